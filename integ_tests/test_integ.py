@@ -2,10 +2,23 @@ import pytest
 import requests
 import numpy as np
 import os
+import json
+import struct
+import subprocess
+import tempfile
+import time
 
 BASE_URL: str = os.getenv("BASE_URL", "http://localhost:8685")
 
-TEST_INDEX_NAMES = ["add_docs", "add_docs_metadata", "search", "search_filters"]
+TEST_INDEX_NAMES = [
+    "add_docs",
+    "add_docs_metadata",
+    "search",
+    "search_filters",
+    "search_batch",
+    "binary_format",
+    "search_plan",
+]
 
 
 @pytest.fixture(scope="session", autouse=True)
@@ -25,6 +38,7 @@ def index_setup():
 
         # Delete if exists
         requests.post(f"{BASE_URL}/delete_index", json=delete_data)
+        requests.post(f"{BASE_URL}/delete_index_from_disk", json=delete_data)
 
         # Create index for testing
         res = requests.post(f"{BASE_URL}/create_index", json=index_data)
@@ -40,6 +54,7 @@ def index_setup():
         res = requests.post(f"{BASE_URL}/delete_index", json=delete_data)
         if res.status_code != 200:
             print(f"Failed to delete index {index_name} during cleanup: {res.text}")
+        requests.post(f"{BASE_URL}/delete_index_from_disk", json=delete_data)
 
 
 def test_add_documents_no_metadata():
@@ -171,3 +186,797 @@ def test_search_index_with_filter():
     # Ensure only doc_1 and doc_2 are returned
     returned_ids = results["hits"]
     assert set(returned_ids).issubset({1, 2}), f"Unexpected result ids: {returned_ids}"
+
+
+def test_search_batch():
+    document_vectors = [
+        [1, 1, 1, 1],
+        [2, 2, 2, 2],
+        [3, 3, 3, 3],
+        [4, 4, 4, 4],
+    ]
+    ids = list(range(len(document_vectors)))
+    metadatas = [{"name": f"doc_{i}"} for i in range(len(document_vectors))]
+
+    add_documents_data = {
+        "indexName": "search_batch",
+        "ids": ids,
+        "vectors": document_vectors,
+        "metadatas": metadatas,
+    }
+
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    search_data = {
+        "indexName": "search_batch",
+        "queries": [
+            {"queryVector": [1, 1, 1, 1]},
+            {"queryVector": [1, 1, 1, 1], "k": 2},
+            {"queryVector": [1, 1, 1, 1], "filter": 'name = "doc_1"'},
+            {"queryVector": [2, 2, 2, 2], "filter": 'name = "doc_1"'},
+        ],
+        "k": 4,
+        "efSearch": 200,
+        "returnMetadata": True,
+    }
+
+    response = requests.post(f"{BASE_URL}/search_batch", json=search_data)
+    assert response.status_code == 200, f"Batch search failed: {response.text}"
+
+    results = response.json()["results"]
+    assert len(results) == 4, f"Expected 4 result sets, got {len(results)}"
+    assert results[0]["hits"] == [3, 2, 1, 0]
+    assert results[1]["hits"] == [3, 2]
+    assert results[2]["hits"] == [1]
+    assert results[3]["hits"] == [1]
+    assert results[2]["metadatas"] == [{"name": "doc_1"}]
+
+
+def test_search_plan_debug():
+    document_vectors = [np.random.rand(4).tolist() for _ in range(200)]
+    ids = list(range(len(document_vectors)))
+    metadatas = [{"group": i % 10, "score": i} for i in ids]
+
+    add_documents_data = {
+        "indexName": "search_plan",
+        "ids": ids,
+        "vectors": document_vectors,
+        "metadatas": metadatas,
+    }
+
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    for search_filter, expected_ids in [
+        ("score = 5", {5}),
+        ("group = 3", {i for i in ids if i % 10 == 3}),
+        ("score >= 0", set(ids)),
+    ]:
+        search_data = {
+            "indexName": "search_plan",
+            "queryVector": [1, 1, 1, 1],
+            "k": 10,
+            "filter": search_filter,
+            "returnMetadata": True,
+            "debug": True,
+        }
+
+        response = requests.post(f"{BASE_URL}/search", json=search_data)
+        assert response.status_code == 200, f"Search failed: {response.text}"
+
+        results = response.json()
+        assert results["debug"]["plan"] in {"exact", "filtered_graph", "predicate_graph"}
+        assert 0 <= results["debug"]["estimatedSelectivity"] <= 1
+        assert len(results["hits"]) == min(10, len(expected_ids))
+        assert set(results["hits"]).issubset(expected_ids)
+
+    search_data = {
+        "indexName": "search_plan",
+        "queryVector": [1, 1, 1, 1],
+        "k": 10,
+    }
+    response = requests.post(f"{BASE_URL}/search", json=search_data)
+    assert response.status_code == 200, f"Search failed: {response.text}"
+    assert "debug" not in response.json()
+
+
+def test_sq8_index_save_and_load():
+    index_name = "sq8_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {
+        "indexName": index_name,
+        "dimension": 16,
+        "spaceType": "L2",
+        "quantization": "SQ8",
+    }
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    vectors = np.random.rand(100, 16).astype(np.float32).tolist()
+    add_documents_data = {
+        "indexName": index_name,
+        "ids": list(range(100)),
+        "vectors": vectors,
+    }
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    def search_for_doc_7():
+        search_data = {"indexName": index_name, "queryVector": vectors[7], "k": 3}
+        response = requests.post(f"{BASE_URL}/search", json=search_data)
+        assert response.status_code == 200, f"Search failed: {response.text}"
+        results = response.json()
+        assert results["hits"][0] == 7
+        assert results["distances"][0] == pytest.approx(0, abs=1e-5)
+
+    search_for_doc_7()
+
+    response = requests.get(f"{BASE_URL}/get_document/{index_name}/7")
+    assert response.status_code == 200
+    assert response.json()["vector"] == pytest.approx(vectors[7], abs=1e-6)
+
+    res = requests.post(f"{BASE_URL}/save_index", json={"indexName": index_name})
+    assert res.status_code == 200, f"Failed to save index: {res.text}"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    res = requests.post(f"{BASE_URL}/load_index", json={"indexName": index_name})
+    assert res.status_code == 200, f"Failed to load index: {res.text}"
+
+    search_for_doc_7()
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+
+def test_create_index_rejects_unknown_quantization():
+    index_data = {"indexName": "bad_quantization", "dimension": 4, "quantization": "PQ"}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 400
+
+
+def test_mmap_index_load_and_prewarm():
+    index_name = "mmap_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 8, "spaceType": "L2"}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    vectors = np.random.rand(200, 8).astype(np.float32).tolist()
+    add_documents_data = {"indexName": index_name, "ids": list(range(200)), "vectors": vectors}
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+    requests.post(f"{BASE_URL}/delete_documents", json={"indexName": index_name, "ids": [3]})
+
+    res = requests.post(f"{BASE_URL}/save_index", json={"indexName": index_name})
+    assert res.status_code == 200, f"Failed to save index: {res.text}"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+
+    load_data = {"indexName": index_name, "mmap": True, "prewarm": True, "warmupQueries": 50}
+    res = requests.post(f"{BASE_URL}/load_index", json=load_data)
+    assert res.status_code == 200, f"Failed to load index: {res.text}"
+
+    status = {}
+    for _ in range(50):
+        status = requests.get(f"{BASE_URL}/index_status/{index_name}").json()
+        if status["ready"]:
+            break
+        time.sleep(0.1)
+    assert status["ready"]
+    assert status["memoryMapped"]
+    assert status["elementCount"] == 199
+
+    search_data = {"indexName": index_name, "queryVector": vectors[7], "k": 3}
+    response = requests.post(f"{BASE_URL}/search", json=search_data)
+    assert response.status_code == 200, f"Search failed: {response.text}"
+    assert response.json()["hits"][0] == 7
+
+    search_data = {"indexName": index_name, "queryVector": vectors[3], "k": 3}
+    response = requests.post(f"{BASE_URL}/search", json=search_data)
+    assert 3 not in response.json()["hits"]
+
+    # Inserts after loading go to the mapping's private copy
+    add_documents_data = {"indexName": index_name, "ids": [1000], "vectors": [[2.0] * 8]}
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+    search_data = {"indexName": index_name, "queryVector": [2.0] * 8, "k": 1}
+    response = requests.post(f"{BASE_URL}/search", json=search_data)
+    assert response.json()["hits"] == [1000]
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+
+def test_load_replays_write_ahead_log():
+    index_name = "wal_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 4, "spaceType": "L2", "efConstruction": 200, "M": 16}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    vectors = np.random.rand(20, 4).astype(np.float32).tolist()
+    metadatas = [{"group": i % 2} for i in range(20)]
+    add_documents_data = {"indexName": index_name, "ids": list(range(20)), "vectors": vectors, "metadatas": metadatas}
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+    requests.post(f"{BASE_URL}/delete_documents", json={"indexName": index_name, "ids": [5]})
+
+    def check_documents():
+        response = requests.get(f"{BASE_URL}/get_document/{index_name}/4")
+        assert response.status_code == 200
+        assert response.json()["vector"] == pytest.approx(vectors[4], abs=1e-6)
+        assert response.json()["metadata"]["group"] == 0
+
+        search_data = {"indexName": index_name, "queryVector": vectors[5], "k": 20}
+        response = requests.post(f"{BASE_URL}/search", json=search_data)
+        assert response.status_code == 200, f"Search failed: {response.text}"
+        assert sorted(response.json()["hits"]) == [i for i in range(20) if i != 5]
+
+    # Never saved, everything comes from the log
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    # Its files are kept, a new index of the same name must not replace them
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 400
+    res = requests.post(f"{BASE_URL}/load_index", json={"indexName": index_name})
+    assert res.status_code == 200, f"Failed to load index: {res.text}"
+    check_documents()
+
+    # Saved, then more mutations logged on top of the snapshot
+    res = requests.post(f"{BASE_URL}/save_index", json={"indexName": index_name})
+    assert res.status_code == 200, f"Failed to save index: {res.text}"
+    add_documents_data = {"indexName": index_name, "ids": [100], "vectors": [[2.0] * 4]}
+    requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    res = requests.post(f"{BASE_URL}/load_index", json={"indexName": index_name})
+    assert res.status_code == 200, f"Failed to load index: {res.text}"
+
+    search_data = {"indexName": index_name, "queryVector": [2.0] * 4, "k": 1}
+    response = requests.post(f"{BASE_URL}/search", json=search_data)
+    assert response.json()["hits"] == [100]
+    response = requests.get(f"{BASE_URL}/get_document/{index_name}/4")
+    assert response.status_code == 200
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+
+def test_async_incremental_snapshot():
+    index_name = "snapshot_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 16, "spaceType": "L2", "efConstruction": 200, "M": 16}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    vectors = np.random.rand(20000, 16).astype(np.float32).tolist()
+    metadatas = [{"group": i % 2} for i in range(20000)]
+    add_documents_data = {"indexName": index_name, "ids": list(range(20000)), "vectors": vectors, "metadatas": metadatas}
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    def wait_for_snapshot():
+        for _ in range(100):
+            status = requests.get(f"{BASE_URL}/index_status/{index_name}").json()["snapshot"]
+            if status["state"] != "running":
+                return status
+            time.sleep(0.1)
+        raise AssertionError("Snapshot did not finish")
+
+    res = requests.post(f"{BASE_URL}/save_index", json={"indexName": index_name, "async": True})
+    assert res.status_code == 202, f"Failed to start snapshot: {res.text}"
+    status = wait_for_snapshot()
+    assert status["state"] == "succeeded", status
+    assert status["bytesWritten"] == status["bytesTotal"]
+
+    # A few changes only rewrite the graph blocks and metadata they touch
+    requests.post(f"{BASE_URL}/add_documents", json={"indexName": index_name, "ids": [5000], "vectors": [[2.0] * 16], "metadatas": [{"group": 7}]})
+    requests.post(f"{BASE_URL}/delete_documents", json={"indexName": index_name, "ids": [3]})
+    res = requests.post(f"{BASE_URL}/save_index", json={"indexName": index_name, "async": True})
+    assert res.status_code == 202, f"Failed to start snapshot: {res.text}"
+    status = wait_for_snapshot()
+    assert status["state"] == "succeeded", status
+    assert status["incremental"] and status["metadataDelta"]
+    assert status["bytesWritten"] < status["bytesTotal"]
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    res = requests.post(f"{BASE_URL}/load_index", json={"indexName": index_name})
+    assert res.status_code == 200, f"Failed to load index: {res.text}"
+    response = requests.get(f"{BASE_URL}/get_document/{index_name}/5000")
+    assert response.status_code == 200
+    assert response.json()["metadata"]["group"] == 7
+    response = requests.post(f"{BASE_URL}/search", json={"indexName": index_name, "queryVector": vectors[3], "k": 1})
+    assert response.json()["hits"] != [3]
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+
+def test_metrics():
+    search_data = {"indexName": "test_index", "queryVector": [0.1, 0.2, 0.3, 0.4], "k": 2, "filter": "some_number > 1"}
+    requests.post(f"{BASE_URL}/search", json=search_data)
+    requests.post(f"{BASE_URL}/search", json=search_data)
+
+    response = requests.get(f"{BASE_URL}/metrics")
+    assert response.status_code == 200
+    assert response.headers["Content-Type"].startswith("text/plain")
+    samples = {}
+    for line in response.text.splitlines():
+        if line and not line.startswith("#"):
+            name, value = line.rsplit(" ", 1)
+            samples[name] = float(value)
+
+    assert samples['hnswlib_server_requests_total{route="/search"}'] >= 2
+    assert samples['hnswlib_server_request_duration_seconds_count{route="/search"}'] >= 2
+    assert samples['hnswlib_server_index_search_duration_seconds_count{index="test_index"}'] >= 2
+    filter_lookups = sum(samples[f'hnswlib_server_index_filter_cache_{outcome}_total{{index="test_index"}}'] for outcome in ("hits", "misses"))
+    assert filter_lookups >= 2
+    plans = [v for k, v in samples.items() if k.startswith('hnswlib_server_index_search_plans_total{index="test_index"')]
+    assert sum(plans) >= 2
+    assert samples['hnswlib_server_index_elements{index="test_index"}'] > 0
+
+
+def test_rebuild_index_drops_deleted_elements():
+    index_name = "rebuild_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 8, "spaceType": "L2", "efConstruction": 200, "M": 16}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    vectors = np.random.rand(1000, 8).astype(np.float32).tolist()
+    add_documents_data = {"indexName": index_name, "ids": list(range(1000)), "vectors": vectors}
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=add_documents_data)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+    requests.post(f"{BASE_URL}/delete_documents", json={"indexName": index_name, "ids": list(range(0, 1000, 2))})
+
+    res = requests.post(f"{BASE_URL}/rebuild_index", json={"indexName": index_name, "M": 8})
+    assert res.status_code == 202, f"Failed to start rebuild: {res.text}"
+    # Served from the old graph while the rebuild runs, and captured for the new one
+    requests.post(f"{BASE_URL}/add_documents", json={"indexName": index_name, "ids": [5000], "vectors": [[2.0] * 8]})
+
+    for _ in range(100):
+        status = requests.get(f"{BASE_URL}/index_status/{index_name}").json()
+        if status["rebuild"]["state"] != "running":
+            break
+        time.sleep(0.1)
+    assert status["rebuild"]["state"] == "succeeded", status
+    assert status["rebuild"]["deletedDropped"] == 500
+    assert status["elementCount"] == 501
+    assert status["maxElements"] < 100000
+
+    response = requests.post(f"{BASE_URL}/search", json={"indexName": index_name, "queryVector": [2.0] * 8, "k": 1})
+    assert response.json()["hits"] == [5000]
+    response = requests.post(f"{BASE_URL}/search", json={"indexName": index_name, "queryVector": vectors[1], "k": 10})
+    hits = response.json()["hits"]
+    assert 1 in hits
+    assert all(hit % 2 == 1 for hit in hits)
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+
+def test_inserts_reuse_deleted_slots():
+    index_name = "rolling_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 8, "spaceType": "L2", "efConstruction": 200, "M": 16}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    def graph_elements():
+        response = requests.get(f"{BASE_URL}/metrics")
+        prefix = f'hnswlib_server_index_elements{{index="{index_name}"}} '
+        return next(float(line[len(prefix):]) for line in response.text.splitlines() if line.startswith(prefix))
+
+    window = 200
+    vectors = {}
+    for day in range(4):
+        ids = list(range(day * window, (day + 1) * window))
+        batch = np.random.rand(window, 8).astype(np.float32).tolist()
+        vectors.update(zip(ids, batch))
+        add_res = requests.post(f"{BASE_URL}/add_documents", json={"indexName": index_name, "ids": ids, "vectors": batch})
+        assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+        if day > 0:
+            oldest = list(range((day - 1) * window, day * window))
+            requests.post(f"{BASE_URL}/delete_documents", json={"indexName": index_name, "ids": oldest})
+
+    # The graph holds one window of live documents and one of deleted slots waiting to be reused
+    assert graph_elements() == 2 * window
+    response = requests.post(f"{BASE_URL}/search", json={"indexName": index_name, "queryVector": vectors[3 * window + 5], "k": 10})
+    hits = response.json()["hits"]
+    assert 3 * window + 5 in hits
+    assert all(hit >= 3 * window for hit in hits)
+
+    # A deleted id can be added again
+    add_res = requests.post(f"{BASE_URL}/add_documents", json={"indexName": index_name, "ids": [0], "vectors": [[5.0] * 8]})
+    assert add_res.status_code == 200, f"Failed to re-add document: {add_res.text}"
+    response = requests.post(f"{BASE_URL}/search", json={"indexName": index_name, "queryVector": [5.0] * 8, "k": 1})
+    assert response.json()["hits"] == [0]
+    assert graph_elements() == 2 * window
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+
+def test_readd_deleted_ids_with_new_ids():
+    index_name = "readd_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 8, "spaceType": "L2", "efConstruction": 200, "M": 16}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    ids = list(range(1000))
+    add_res = requests.post(f"{BASE_URL}/add_documents",
+                            json={"indexName": index_name, "ids": ids, "vectors": np.random.rand(1000, 8).astype(np.float32).tolist()})
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+    res = requests.post(f"{BASE_URL}/delete_documents", json={"indexName": index_name, "ids": list(range(800))})
+    assert res.status_code == 200, f"Failed to delete documents: {res.text}"
+
+    # Deleted ids come back in their own slots while new ids spread over several chunks take the
+    # other deleted slots
+    ids = [id for pair in zip(range(400), range(1000, 1400)) for id in pair]
+    vectors = np.random.rand(len(ids), 8).astype(np.float32).tolist()
+    add_res = requests.post(f"{BASE_URL}/add_documents", json={"indexName": index_name, "ids": ids, "vectors": vectors})
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    status = requests.get(f"{BASE_URL}/index_status/{index_name}").json()
+    assert status["elementCount"] == 1000
+    for position in (0, 1, 401, 798):
+        response = requests.post(f"{BASE_URL}/search", json={"indexName": index_name, "queryVector": vectors[position], "k": 1})
+        assert response.json()["hits"] == [ids[position]]
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+
+def test_filter_strings_with_spaces():
+    index_name = "filter_syntax_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 4, "spaceType": "L2", "efConstruction": 200, "M": 16}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    docs = {
+        "indexName": index_name,
+        "ids": [0, 1, 2],
+        "vectors": np.random.rand(3, 4).astype(np.float32).tolist(),
+        "metadatas": [{"name": "Mary Ann", "delta": -3}, {"name": "Mary", "delta": 2}, {"name": "Ann", "delta": -1}],
+    }
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=docs)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    search = {"indexName": index_name, "queryVector": [0.5] * 4, "k": 3}
+    response = requests.post(f"{BASE_URL}/search", json={**search, "filter": 'name = "Mary Ann"'})
+    assert response.json()["hits"] == [0]
+    response = requests.post(f"{BASE_URL}/search", json={**search, "filter": '(delta<-2)OR name="Mary"'})
+    assert sorted(response.json()["hits"]) == [0, 1]
+
+    response = requests.post(f"{BASE_URL}/search", json={**search, "filter": 'name = "Mary'})
+    assert response.status_code == 400
+    response = requests.post(f"{BASE_URL}/search", json={**search, "filter": "delta > 1 AND"})
+    assert response.status_code == 400
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+def test_malformed_requests_are_rejected():
+    index_name = "malformed_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 2, "spaceType": "L2", "efConstruction": 200, "M": 16}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    headers = {"Content-Type": "application/json"}
+    bodies = {
+        "add_documents": ['{"indexName": "malformed_index", "ids": [1], "vectors": [[1, 2]', '{"indexName": "malformed_index", "ids": ["a"], "vectors": [[1, 2]]}'],
+        "search": ['{"indexName": "malformed_index", "queryVector": [1, 2]}', "not json"],
+        "delete_documents": ['{"indexName": "malformed_index"}'],
+        "save_index": ["{}"],
+        "create_index": ['{"indexName": 1'],
+    }
+    for route, route_bodies in bodies.items():
+        for body in route_bodies:
+            response = requests.post(f"{BASE_URL}/{route}", data=body, headers=headers)
+            assert response.status_code == 400, f"{route} accepted {body}: {response.status_code}"
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+def test_facets():
+    index_name = "facets_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 4, "spaceType": "L2", "efConstruction": 200, "M": 16}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    docs = {
+        "indexName": index_name,
+        "ids": [0, 1, 2, 3],
+        "vectors": np.random.rand(4, 4).astype(np.float32).tolist(),
+        "metadatas": [
+            {"category": "cool", "price": 5},
+            {"category": "cool", "price": 99.5},
+            {"category": "warm", "price": 150},
+            {"category": "warm"},
+        ],
+    }
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=docs)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    response = requests.post(f"{BASE_URL}/facets", json={"indexName": index_name, "filter": "price < 1000.0"})
+    assert response.status_code == 200, response.text
+    assert response.json()["facets"] == {
+        "category": {"values": {"cool": 2, "warm": 1}},
+        "price": {"min": 5, "max": 150, "count": 3},
+    }
+
+    response = requests.post(f"{BASE_URL}/facets", json={"indexName": index_name, "fields": ["category"]})
+    assert response.json()["facets"] == {"category": {"values": {"cool": 2, "warm": 2}}}
+
+    # Facets on a search cover every match of the filter, not only the hits
+    search = {"indexName": index_name, "queryVector": [0.5] * 4, "k": 1, "filter": 'category = "cool"', "facets": ["price"]}
+    response = requests.post(f"{BASE_URL}/search", json=search)
+    assert len(response.json()["hits"]) == 1
+    assert response.json()["facets"] == {"price": {"min": 5, "max": 99.5, "count": 2}}
+
+    response = requests.post(f"{BASE_URL}/facets", json={"indexName": index_name, "filter": "price <"})
+    assert response.status_code == 400
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+def test_sharded_index():
+    index_name = "sharded_index"
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+    index_data = {"indexName": index_name, "dimension": 4, "spaceType": "L2", "efConstruction": 200, "M": 16, "shards": 4}
+    res = requests.post(f"{BASE_URL}/create_index", json=index_data)
+    assert res.status_code == 200, f"Failed to create index: {res.text}"
+
+    res = requests.post(f"{BASE_URL}/create_index", json={**index_data, "indexName": "too_many_shards", "shards": 257})
+    assert res.status_code == 400
+
+    vectors = [[float(i)] * 4 for i in range(100)]
+    docs = {
+        "indexName": index_name,
+        "ids": list(range(100)),
+        "vectors": vectors,
+        "metadatas": [{"parity": "even" if i % 2 == 0 else "odd", "rank": i} for i in range(100)],
+    }
+    add_res = requests.post(f"{BASE_URL}/add_documents", json=docs)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    status = requests.get(f"{BASE_URL}/index_status/{index_name}").json()
+    assert status["elementCount"] == 100
+    assert len(status["shards"]) == 4
+    assert sum(shard["elementCount"] for shard in status["shards"]) == 100
+
+    # The nearest documents come from different shards and are merged in distance order
+    search = {"indexName": index_name, "queryVector": [10.2] * 4, "k": 3, "returnMetadata": True, "debug": True}
+    response = requests.post(f"{BASE_URL}/search", json=search).json()
+    assert response["hits"] == [10, 11, 9]
+    assert response["metadatas"][0]["rank"] == 10
+    assert len(response["debug"]["shards"]) == 4
+
+    search["filter"] = 'parity = "odd"'
+    assert requests.post(f"{BASE_URL}/search", json=search).json()["hits"] == [11, 9, 13]
+
+    batch = {"indexName": index_name, "queries": [{"queryVector": [50.0] * 4, "k": 1}, {"queryVector": [0.0] * 4, "k": 2, "filter": "rank > 0"}]}
+    results = requests.post(f"{BASE_URL}/search_batch", json=batch).json()["results"]
+    assert [result["hits"] for result in results] == [[50], [1, 2]]
+
+    facets = requests.post(f"{BASE_URL}/facets", json={"indexName": index_name, "fields": ["parity", "rank"]}).json()["facets"]
+    assert facets == {"parity": {"values": {"even": 50, "odd": 50}}, "rank": {"min": 0, "max": 99, "count": 100}}
+
+    document = requests.get(f"{BASE_URL}/get_document/{index_name}/42").json()
+    assert document["metadata"]["rank"] == 42
+
+    res = requests.post(f"{BASE_URL}/delete_documents", json={"indexName": index_name, "ids": [10, 11]})
+    assert res.status_code == 200
+    assert requests.post(f"{BASE_URL}/search", json={"indexName": index_name, "queryVector": [10.2] * 4, "k": 2}).json()["hits"] == [9, 12]
+
+    res = requests.post(f"{BASE_URL}/save_index", json={"indexName": index_name})
+    assert res.status_code == 200, res.text
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    res = requests.post(f"{BASE_URL}/load_index", json={"indexName": index_name})
+    assert res.status_code == 200, res.text
+    assert requests.get(f"{BASE_URL}/index_status/{index_name}").json()["elementCount"] == 98
+    assert requests.post(f"{BASE_URL}/search", json={"indexName": index_name, "queryVector": [10.2] * 4, "k": 2}).json()["hits"] == [9, 12]
+
+    requests.post(f"{BASE_URL}/delete_index", json={"indexName": index_name})
+    requests.post(f"{BASE_URL}/delete_index_from_disk", json={"indexName": index_name})
+
+def start_server(binary, port, workdir, env=None):
+    """Start a server process and wait until it answers /health."""
+    process = subprocess.Popen(
+        [binary],
+        cwd=workdir,
+        env={**os.environ, "HNSWLIB_SERVER_PORT": str(port), **(env or {})},
+        stdout=subprocess.DEVNULL,
+    )
+    for _ in range(100):
+        try:
+            if requests.get(f"http://localhost:{port}/health").status_code == 200:
+                return process
+        except requests.ConnectionError:
+            time.sleep(0.1)
+    process.kill()
+    raise RuntimeError(f"Server on port {port} did not start")
+
+
+@pytest.mark.skipif("SERVER_BINARY" not in os.environ, reason="needs SERVER_BINARY to start local servers")
+def test_router_scatter_gather():
+    binary = os.path.abspath(os.environ["SERVER_BINARY"])
+    processes = []
+    try:
+        with tempfile.TemporaryDirectory() as first, tempfile.TemporaryDirectory() as second:
+            processes.append(start_server(binary, 8701, first))
+            processes.append(start_server(binary, 8702, second))
+            processes.append(start_server(binary, 8700, first, {"HNSWLIB_SERVER_ROUTER_SHARDS": "localhost:8701,localhost:8702"}))
+            router = "http://localhost:8700"
+
+            index_data = {"indexName": "routed", "dimension": 4, "spaceType": "L2", "efConstruction": 200, "M": 16}
+            assert requests.post(f"{router}/create_index", json=index_data).status_code == 200
+
+            docs = {
+                "indexName": "routed",
+                "ids": list(range(100)),
+                "vectors": [[float(i)] * 4 for i in range(100)],
+                "metadatas": [{"parity": "even" if i % 2 == 0 else "odd", "rank": i} for i in range(100)],
+            }
+            res = requests.post(f"{router}/add_documents", json=docs)
+            assert res.status_code == 200, res.text
+
+            # Each server holds its part of the documents only
+            counts = [requests.get(f"http://localhost:{port}/index_status/routed").json()["elementCount"] for port in (8701, 8702)]
+            assert sum(counts) == 100 and min(counts) > 0
+
+            search = {"indexName": "routed", "queryVector": [10.2] * 4, "k": 3, "returnMetadata": True, "facets": ["parity"]}
+            response = requests.post(f"{router}/search", json=search).json()
+            assert response["hits"] == [10, 11, 9]
+            assert [metadata["rank"] for metadata in response["metadatas"]] == [10, 11, 9]
+            assert response["facets"] == {"parity": {"values": {"even": 50, "odd": 50}}}
+            assert "failedShards" not in response
+
+            batch = {"indexName": "routed", "queries": [{"queryVector": [50.0] * 4, "k": 1}, {"queryVector": [0.0] * 4, "k": 2, "filter": "rank > 0"}]}
+            results = requests.post(f"{router}/search_batch", json=batch).json()["results"]
+            assert [result["hits"] for result in results] == [[50], [1, 2]]
+
+            assert requests.get(f"{router}/get_document/routed/42").json()["metadata"]["rank"] == 42
+            assert requests.post(f"{router}/delete_documents", json={"indexName": "routed", "ids": [10, 11]}).status_code == 200
+            assert requests.post(f"{router}/search", json={**search, "k": 2}).json()["hits"] == [9, 12]
+
+            # A shard's own errors come back unchanged
+            res = requests.post(f"{router}/search", json={**search, "indexName": "missing"})
+            assert res.status_code == 404
+
+            # Searches still answer, from the remaining shard, once a shard is gone
+            processes[1].kill()
+            processes[1].wait()
+            response = requests.post(f"{router}/search", json={**search, "k": 100}).json()
+            assert response["failedShards"] == [1]
+            assert 0 < len(response["hits"]) < 98
+    finally:
+        for process in processes:
+            process.kill()
+            process.wait()
+
+
+@pytest.mark.skipif("SERVER_BINARY" not in os.environ, reason="needs SERVER_BINARY to start local servers")
+def test_read_replica():
+    binary = os.path.abspath(os.environ["SERVER_BINARY"])
+    processes = []
+    try:
+        with tempfile.TemporaryDirectory() as primary_dir, tempfile.TemporaryDirectory() as replica_dir:
+            processes.append(start_server(binary, 8703, primary_dir, {"HNSWLIB_SERVER_REPLICATION_BUFFER_MB": "16"}))
+            primary = "http://localhost:8703"
+            index_data = {"indexName": "replicated", "dimension": 4, "spaceType": "L2", "efConstruction": 200, "M": 16, "shards": 2}
+            assert requests.post(f"{primary}/create_index", json=index_data).status_code == 200
+            docs = {
+                "indexName": "replicated",
+                "ids": list(range(50)),
+                "vectors": [[float(i)] * 4 for i in range(50)],
+                "metadatas": [{"rank": i} for i in range(50)],
+            }
+            assert requests.post(f"{primary}/add_documents", json=docs).status_code == 200
+
+            # The replica reports healthy once it has loaded the index from the primary
+            processes.append(start_server(binary, 8704, replica_dir, {
+                "HNSWLIB_SERVER_REPLICA_OF": "localhost:8703",
+                "HNSWLIB_SERVER_REPLICA_INDICES": "replicated",
+            }))
+            replica = "http://localhost:8704"
+            search = {"indexName": "replicated", "queryVector": [10.2] * 4, "k": 3}
+            assert requests.post(f"{replica}/search", json=search).json()["hits"] == [10, 11, 9]
+
+            # Later writes reach the replica through the stream
+            more = {"indexName": "replicated", "ids": [100], "vectors": [[10.2] * 4], "metadatas": [{"rank": 100}]}
+            assert requests.post(f"{primary}/add_documents", json=more).status_code == 200
+            assert requests.post(f"{primary}/delete_documents", json={"indexName": "replicated", "ids": [11]}).status_code == 200
+            for _ in range(50):
+                if requests.post(f"{replica}/search", json=search).json()["hits"] == [100, 10, 9]:
+                    break
+                time.sleep(0.1)
+            assert requests.post(f"{replica}/search", json=search).json()["hits"] == [100, 10, 9]
+            assert requests.get(f"{replica}/get_document/replicated/100").json()["metadata"]["rank"] == 100
+
+            status = requests.get(f"{replica}/index_status/replicated").json()["replication"]
+            assert status["loaded"]
+            assert all(shard["sequence"] == shard["primarySequence"] for shard in status["shards"])
+
+            # Writes go to the primary only
+            res = requests.post(f"{replica}/add_documents", json=more)
+            assert res.status_code == 403
+            assert requests.post(f"{replica}/save_index", json={"indexName": "replicated"}).status_code == 403
+    finally:
+        for process in processes:
+            process.kill()
+            process.wait()
+
+
+def encode_binary_vectors(header, vectors):
+    """Pack a request in the application/x-hnswlib-vectors format."""
+    matrix = np.asarray(vectors, dtype="<f4")
+    header_bytes = json.dumps(header).encode("utf-8")
+    padding = b"\0" * (-(20 + len(header_bytes)) % 4)
+    prefix = b"HNSV" + struct.pack(
+        "<IIII", 1, matrix.shape[0], matrix.shape[1], len(header_bytes)
+    )
+    return prefix + header_bytes + padding + matrix.tobytes()
+
+
+def test_binary_format_add_and_search():
+    headers = {"Content-Type": "application/x-hnswlib-vectors"}
+    document_vectors = [
+        [1, 1, 1, 1],
+        [2, 2, 2, 2],
+        [3, 3, 3, 3],
+        [4, 4, 4, 4],
+    ]
+    body = encode_binary_vectors(
+        {
+            "indexName": "binary_format",
+            "ids": [0, 1, 2, 3],
+            "metadatas": [{"name": f"doc_{i}"} for i in range(4)],
+        },
+        document_vectors,
+    )
+
+    add_res = requests.post(f"{BASE_URL}/add_documents", data=body, headers=headers)
+    assert add_res.status_code == 200, f"Failed to add documents: {add_res.text}"
+
+    body = encode_binary_vectors(
+        {"indexName": "binary_format", "k": 4, "returnMetadata": True},
+        [[1, 1, 1, 1]],
+    )
+    response = requests.post(f"{BASE_URL}/search", data=body, headers=headers)
+    assert response.status_code == 200, f"Search failed: {response.text}"
+    results = response.json()
+    assert results["hits"] == [3, 2, 1, 0]
+    assert results["metadatas"][0] == {"name": "doc_3"}
+
+    body = encode_binary_vectors(
+        {"indexName": "binary_format", "queries": [{"k": 1}, {"k": 2}]},
+        [[1, 1, 1, 1], [1, 1, 1, 1]],
+    )
+    response = requests.post(f"{BASE_URL}/search_batch", data=body, headers=headers)
+    assert response.status_code == 200, f"Batch search failed: {response.text}"
+    results = response.json()["results"]
+    assert [r["hits"] for r in results] == [[3], [3, 2]]
+
+
+def test_binary_format_rejects_truncated_body():
+    headers = {"Content-Type": "application/x-hnswlib-vectors"}
+    body = encode_binary_vectors(
+        {"indexName": "binary_format", "ids": [10]}, [[1, 1, 1, 1]]
+    )
+    response = requests.post(
+        f"{BASE_URL}/add_documents", data=body[:-4], headers=headers
+    )
+    assert response.status_code == 400
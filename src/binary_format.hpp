@@ -0,0 +1,120 @@
+// binary_format.hpp
+#ifndef BINARY_FORMAT_HPP
+#define BINARY_FORMAT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Binary request body carrying vectors as raw float32 instead of JSON arrays.
+//
+//   offset  size           field
+//   0       4              magic "HNSV"
+//   4       4              version (uint32, currently 1)
+//   8       4              count, number of vectors (uint32)
+//   12      4              dimension (uint32)
+//   16      4              header length in bytes (uint32)
+//   20      header length  UTF-8 JSON header holding every other request field
+//   ...     0-3            zero padding so the vectors start on a 4 byte boundary
+//   ...     count * dim    little-endian float32 vectors, row major
+//
+// All integers are little-endian.
+#define BINARY_VECTORS_CONTENT_TYPE "application/x-hnswlib-vectors"
+#define BINARY_VECTORS_MAGIC "HNSV"
+#define BINARY_VECTORS_VERSION 1
+
+struct BinaryVectorsPayload {
+    nlohmann::json header;
+    uint32_t count = 0;
+    uint32_t dimension = 0;
+    // Points into the request body when the host is little-endian, otherwise into swapped
+    const float* vectors = nullptr;
+    std::vector<float> swapped;
+};
+
+inline bool host_is_little_endian() {
+    const uint16_t probe = 1;
+    return *reinterpret_cast<const uint8_t*>(&probe) == 1;
+}
+
+inline uint32_t read_le_uint32(const unsigned char* bytes) {
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+           (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+// Parse a binary request body. The returned payload may point into body, so body must outlive it.
+inline BinaryVectorsPayload parse_binary_vectors(const std::string& body) {
+    const size_t fixedHeaderSize = 20;
+    if (body.size() < fixedHeaderSize || body.compare(0, 4, BINARY_VECTORS_MAGIC) != 0) {
+        throw std::invalid_argument("Binary request does not start with the HNSV magic");
+    }
+
+    const auto* bytes = reinterpret_cast<const unsigned char*>(body.data());
+    uint32_t version = read_le_uint32(bytes + 4);
+    if (version != BINARY_VECTORS_VERSION) {
+        throw std::invalid_argument("Unsupported binary request version: " + std::to_string(version));
+    }
+
+    BinaryVectorsPayload payload;
+    payload.count = read_le_uint32(bytes + 8);
+    payload.dimension = read_le_uint32(bytes + 12);
+    uint64_t headerLength = read_le_uint32(bytes + 16);
+
+    uint64_t vectorsOffset = (fixedHeaderSize + headerLength + 3) & ~uint64_t(3);
+    uint64_t vectorsSize = uint64_t(payload.count) * payload.dimension * sizeof(float);
+    if (fixedHeaderSize + headerLength > body.size() || vectorsOffset + vectorsSize != body.size()) {
+        throw std::invalid_argument("Binary request length does not match its header");
+    }
+
+    payload.header = headerLength > 0
+        ? nlohmann::json::parse(body.begin() + fixedHeaderSize, body.begin() + fixedHeaderSize + headerLength)
+        : nlohmann::json::object();
+
+    const char* vectorBytes = body.data() + vectorsOffset;
+    if (host_is_little_endian() && reinterpret_cast<uintptr_t>(vectorBytes) % alignof(float) == 0) {
+        payload.vectors = reinterpret_cast<const float*>(vectorBytes);
+    } else {
+        payload.swapped.resize(size_t(payload.count) * payload.dimension);
+        for (size_t i = 0; i < payload.swapped.size(); i++) {
+            uint32_t bits = read_le_uint32(reinterpret_cast<const unsigned char*>(vectorBytes) + i * sizeof(float));
+            std::memcpy(&payload.swapped[i], &bits, sizeof(float));
+        }
+        payload.vectors = payload.swapped.data();
+    }
+    return payload;
+}
+
+inline void append_le_uint32(std::string& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+}
+
+// Encode count vectors of dimension floats, row major, with header as the JSON header
+inline std::string encode_binary_vectors(const nlohmann::json& header, const float* vectors, uint32_t count, uint32_t dimension) {
+    std::string headerBytes = header.dump();
+    std::string body = BINARY_VECTORS_MAGIC;
+    append_le_uint32(body, BINARY_VECTORS_VERSION);
+    append_le_uint32(body, count);
+    append_le_uint32(body, dimension);
+    append_le_uint32(body, static_cast<uint32_t>(headerBytes.size()));
+    body += headerBytes;
+    body.append((4 - body.size() % 4) % 4, '\0');
+
+    size_t floats = size_t(count) * dimension;
+    if (host_is_little_endian()) {
+        body.append(reinterpret_cast<const char*>(vectors), floats * sizeof(float));
+    } else {
+        for (size_t i = 0; i < floats; i++) {
+            uint32_t bits;
+            std::memcpy(&bits, &vectors[i], sizeof(float));
+            append_le_uint32(body, bits);
+        }
+    }
+    return body;
+}
+
+#endif // BINARY_FORMAT_HPP
@@ -2,187 +2,534 @@
 #include "data_store.hpp"
 #include <fstream>
 #include <algorithm>
-#include <set>
-#include <typeindex>
+#include <cstring>
 #include <climits>
+#include <limits>
+#include <numeric>
 
-bool VariantComparator::operator()(const FieldValue& lhs, const FieldValue& rhs) const {
-    return lhs < rhs;
-}
+namespace {
+    IndexKey toIndexKey(const FieldValue& value) {
+        switch (value.index()) {
+            case 0:
+                return std::get<long>(value);
+            case 1:
+                return std::get<double>(value);
+            default:
+                return std::string_view(std::get<std::string>(value));
+        }
+    }
+
+    bool compareKeys(const IndexKey& recordValue, Comparator comparator, const IndexKey& value) {
+        switch (comparator) {
+            case Comparator::Equal: return recordValue == value;
+            case Comparator::NotEqual: return recordValue != value;
+            case Comparator::Greater: return recordValue > value;
+            case Comparator::Less: return recordValue < value;
+            case Comparator::GreaterEqual: return recordValue >= value;
+            case Comparator::LessEqual: return recordValue <= value;
+        }
+        throw std::runtime_error("Unsupported comparison type");
+    }
 
-template<typename T>
-void DataStore::filterByType(std::unordered_set<int>& result, const std::string& field, const std::string& type, const FieldValue& value) {
-    auto& fieldData = fieldIndex[field];
+    bool isRangeComparator(Comparator comparator) {
+        return comparator != Comparator::Equal && comparator != Comparator::NotEqual;
+    }
 
-    if (fieldData.empty()) return;
+    bool isLowerBound(Comparator comparator) {
+        return comparator == Comparator::Greater || comparator == Comparator::GreaterEqual;
+    }
 
-    if (type == "=") {
-        auto upper_bound = fieldData.upper_bound(value);
-        auto lower_bound = fieldData.lower_bound(value);
-        for (auto it = lower_bound; it != upper_bound; ++it) {
-            result.insert(it->second.begin(), it->second.end());
+    double as_double(const FieldValue& value) {
+        return value.index() == 0 ? static_cast<double>(std::get<long>(value)) : std::get<double>(value);
+    }
+
+    // Numeric order, unlike FieldValue's which puts every long before every double
+    bool numeric_less(const FieldValue& a, const FieldValue& b) {
+        if (a.index() == 0 && b.index() == 0) {
+            return std::get<long>(a) < std::get<long>(b);
         }
-    } else if (type == "!=") {
-        for (const auto& [fieldValue, ids] : fieldData) {
-            if (fieldValue != value) {
-                result.insert(ids.begin(), ids.end());
+        return as_double(a) < as_double(b);
+    }
+
+    void add_to_range(FacetRange& range, const FieldValue& low, const FieldValue& high, size_t count) {
+        if (range.count == 0 || numeric_less(low, range.min)) {
+            range.min = low;
+        }
+        if (range.count == 0 || numeric_less(range.max, high)) {
+            range.max = high;
+        }
+        range.count += count;
+    }
+
+    // Facet values of one column over a run of rows
+    struct ColumnAggregate {
+        long minLong = LONG_MAX;
+        long maxLong = LONG_MIN;
+        size_t longs = 0;
+        double minDouble = std::numeric_limits<double>::infinity();
+        double maxDouble = -std::numeric_limits<double>::infinity();
+        size_t doubles = 0;
+        std::unordered_map<uint32_t, size_t> codes; // documents by dictionary code
+
+        void add(ColumnType type, uint64_t cell) {
+            switch (type) {
+                case ColumnType::Long: {
+                    long value = static_cast<long>(static_cast<int64_t>(cell));
+                    minLong = std::min(minLong, value);
+                    maxLong = std::max(maxLong, value);
+                    longs++;
+                    break;
+                }
+                case ColumnType::Double: {
+                    double value;
+                    std::memcpy(&value, &cell, sizeof(value));
+                    minDouble = std::min(minDouble, value);
+                    maxDouble = std::max(maxDouble, value);
+                    doubles++;
+                    break;
+                }
+                case ColumnType::String:
+                    codes[static_cast<uint32_t>(cell)]++;
+                    break;
+                case ColumnType::Missing:
+                    break;
             }
         }
-    } else if (type == ">") {
-        auto lower_bound = fieldData.lower_bound(value);
-        for (auto it = lower_bound; it != fieldData.end(); ++it) {
-            result.insert(it->second.begin(), it->second.end());
+
+        void merge(const ColumnAggregate& other) {
+            minLong = std::min(minLong, other.minLong);
+            maxLong = std::max(maxLong, other.maxLong);
+            longs += other.longs;
+            minDouble = std::min(minDouble, other.minDouble);
+            maxDouble = std::max(maxDouble, other.maxDouble);
+            doubles += other.doubles;
+            for (const auto& [code, count] : other.codes) {
+                codes[code] += count;
+            }
+        }
+    };
+
+    // value as a bound for the range index, or nothing for strings which it does not hold
+    std::optional<RangeBound> toRangeBound(const FieldValue& value, Comparator comparator) {
+        bool inclusive = comparator == Comparator::GreaterEqual || comparator == Comparator::LessEqual;
+        switch (value.index()) {
+            case 0:
+                return RangeBound{std::get<long>(value), inclusive};
+            case 1:
+                return RangeBound{std::get<double>(value), inclusive};
+            default:
+                return std::nullopt;
+        }
+    }
+}
+
+uint32_t StringDictionary::intern(const std::string& value) {
+    auto it = codes.find(value);
+    if (it != codes.end()) {
+        return it->second;
+    }
+    uint32_t code = static_cast<uint32_t>(strings.size());
+    strings.push_back(value);
+    codes.emplace(strings.back(), code);
+    return code;
+}
+
+uint32_t DataStore::internField(const std::string& field) {
+    auto it = fieldIds.find(field);
+    if (it != fieldIds.end()) {
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(fieldNames.size());
+    fieldNames.push_back(field);
+    fieldIds.emplace(field, id);
+    columns.emplace_back();
+    fieldIndex.emplace_back();
+    rangeIndex.emplace_back();
+    return id;
+}
+
+int DataStore::findField(const std::string& field) const {
+    auto it = fieldIds.find(field);
+    return it == fieldIds.end() ? -1 : static_cast<int>(it->second);
+}
+
+bool DataStore::readCell(uint32_t field, uint32_t row, IndexKey& key) const {
+    const Column& column = columns[field];
+    if (row >= column.types.size()) {
+        return false;
+    }
+
+    uint64_t cell = column.cells[row];
+    switch (column.types[row]) {
+        case ColumnType::Missing:
+            return false;
+        case ColumnType::Long:
+            key = static_cast<long>(static_cast<int64_t>(cell));
+            return true;
+        case ColumnType::Double: {
+            double value;
+            std::memcpy(&value, &cell, sizeof(value));
+            key = value;
+            return true;
+        }
+        case ColumnType::String:
+            key = std::string_view(dictionary.at(static_cast<uint32_t>(cell)));
+            return true;
+    }
+    return false;
+}
+
+FieldValue DataStore::toFieldValue(const IndexKey& key) const {
+    switch (key.index()) {
+        case 0:
+            return std::get<long>(key);
+        case 1:
+            return std::get<double>(key);
+        default:
+            return std::string(std::get<std::string_view>(key));
+    }
+}
+
+std::map<std::string, FieldValue> DataStore::materialize(uint32_t row) const {
+    std::map<std::string, FieldValue> record;
+    IndexKey key;
+    for (uint32_t field = 0; field < columns.size(); field++) {
+        if (readCell(field, row, key)) {
+            record.emplace(fieldNames[field], toFieldValue(key));
         }
-    } else if (type == "<") {
-        auto upper_bound = fieldData.upper_bound(value);
-        for (auto it = fieldData.begin(); it != upper_bound; ++it) {
-            result.insert(it->second.begin(), it->second.end());
+    }
+    return record;
+}
+
+void DataStore::filterByType(IdSet& result, const std::string& field, Comparator comparator, const FieldValue& value) {
+    int fieldId = findField(field);
+    if (fieldId < 0) return;
+    const auto& fieldData = fieldIndex[fieldId];
+
+    IndexKey key = toIndexKey(value);
+
+    // Numeric bounds come from the range index. Every string orders above every number, so
+    // a lower bound also takes all of the string postings.
+    if (auto bound = toRangeBound(value, comparator); bound && isRangeComparator(comparator)) {
+        if (isLowerBound(comparator)) {
+            result |= IdSet::fromIds(rangeIndex[fieldId].collect(bound, std::nullopt));
+            for (auto it = fieldData.lower_bound(std::string_view()); it != fieldData.end(); ++it) {
+                result |= it->second;
+            }
+        } else {
+            result |= IdSet::fromIds(rangeIndex[fieldId].collect(std::nullopt, bound));
         }
-    } else if (type == ">=") {
-        auto lower_bound = fieldData.lower_bound(value);
-        for (auto it = lower_bound; it != fieldData.end(); ++it) {
-            result.insert(it->second.begin(), it->second.end());
+        return;
+    }
+
+    switch (comparator) {
+        case Comparator::Equal: {
+            auto it = fieldData.find(key);
+            if (it != fieldData.end()) {
+                result |= it->second;
+            }
+            break;
         }
-        auto it = fieldData.find(value);
-        if (it != fieldData.end()) {
-            result.insert(it->second.begin(), it->second.end());
+        case Comparator::NotEqual:
+            for (const auto& [fieldValue, ids] : fieldData) {
+                if (fieldValue != key) {
+                    result |= ids;
+                }
+            }
+            break;
+        case Comparator::Greater:
+            for (auto it = fieldData.upper_bound(key); it != fieldData.end(); ++it) {
+                result |= it->second;
+            }
+            break;
+        case Comparator::Less: {
+            auto upper_bound = fieldData.lower_bound(key);
+            for (auto it = fieldData.begin(); it != upper_bound; ++it) {
+                result |= it->second;
+            }
+            break;
+        }
+        case Comparator::GreaterEqual:
+            for (auto it = fieldData.lower_bound(key); it != fieldData.end(); ++it) {
+                result |= it->second;
+            }
+            break;
+        case Comparator::LessEqual: {
+            auto upper_bound = fieldData.upper_bound(key);
+            for (auto it = fieldData.begin(); it != upper_bound; ++it) {
+                result |= it->second;
+            }
+            break;
         }
-    } else if (type == "<=") {
-        auto upper_bound = fieldData.upper_bound(value);
-        for (auto it = fieldData.begin(); it != upper_bound; ++it) {
-            result.insert(it->second.begin(), it->second.end());
+    }
+}
+
+// Drop a row's postings and reset its cells, leaving the row allocated to id
+void DataStore::clearRow(int id, uint32_t row) {
+    IndexKey key;
+    for (uint32_t field = 0; field < columns.size(); field++) {
+        if (!readCell(field, row, key)) continue;
+
+        if (auto number = std::get_if<long>(&key)) {
+            rangeIndex[field].remove(*number, id);
+        } else if (auto number = std::get_if<double>(&key)) {
+            rangeIndex[field].remove(*number, id);
         }
-        auto it = fieldData.find(value);
+
+        auto& fieldData = fieldIndex[field];
+        auto it = fieldData.find(key);
         if (it != fieldData.end()) {
-            result.insert(it->second.begin(), it->second.end());
+            it->second.remove(id);
+            if (it->second.empty()) {
+                fieldData.erase(it);
+            }
         }
+        columns[field].types[row] = ColumnType::Missing;
+        columns[field].cells[row] = 0;
+        columns[field].count--;
+    }
+}
+
+void DataStore::setUnlocked(int id, const std::map<std::string, FieldValue>& record) {
+    uint32_t row;
+    auto existing = rows.find(id);
+    if (existing != rows.end()) {
+        row = existing->second;
+        clearRow(id, row);
+    } else if (!freeRows.empty()) {
+        row = freeRows.back();
+        freeRows.pop_back();
+        rowIds[row] = id;
+        rows.emplace(id, row);
     } else {
-        throw std::runtime_error("Unsupported comparison type");
+        row = static_cast<uint32_t>(rowIds.size());
+        rowIds.push_back(id);
+        rows.emplace(id, row);
+    }
+    ids.add(id);
+    changedIds.add(id);
+
+    for (const auto& [field, value] : record) {
+        uint32_t fieldId = internField(field);
+        Column& column = columns[fieldId];
+        if (column.types.size() <= row) {
+            column.types.resize(row + 1, ColumnType::Missing);
+            column.cells.resize(row + 1, 0);
+        }
+
+        IndexKey key;
+        switch (value.index()) {
+            case 0:
+                column.types[row] = ColumnType::Long;
+                column.cells[row] = static_cast<uint64_t>(static_cast<int64_t>(std::get<long>(value)));
+                key = std::get<long>(value);
+                rangeIndex[fieldId].insert(std::get<long>(value), id);
+                break;
+            case 1: {
+                double number = std::get<double>(value);
+                column.types[row] = ColumnType::Double;
+                std::memcpy(&column.cells[row], &number, sizeof(number));
+                key = number;
+                rangeIndex[fieldId].insert(number, id);
+                break;
+            }
+            default: {
+                uint32_t code = dictionary.intern(std::get<std::string>(value));
+                column.types[row] = ColumnType::String;
+                column.cells[row] = code;
+                key = std::string_view(dictionary.at(code));
+                break;
+            }
+        }
+        column.count++;
+        fieldIndex[fieldId][key].add(id);
     }
 }
 
 void DataStore::set(int id, std::map<std::string, FieldValue> record) {
-    std::lock_guard<std::mutex> lock(mutex);
-    data[id] = std::move(record);
-    ids.insert(id);
-    for (const auto& [field, value] : data[id]) {
-        fieldIndex[field][value].insert(id);
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    setUnlocked(id, record);
+}
+
+void DataStore::setMany(std::vector<std::pair<int, std::map<std::string, FieldValue>>> records) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    for (const auto& [id, record] : records) {
+        setUnlocked(id, record);
     }
 }
 
 std::map<std::string, FieldValue> DataStore::get(int id) {
-    return data.at(id);
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return materialize(rows.at(id));
 }
 
 bool DataStore::contains(int id) {
-    return data.find(id) != data.end();
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return rows.find(id) != rows.end();
+}
+
+size_t DataStore::size() {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return rows.size();
 }
 
 
 std::vector<std::map<std::string, FieldValue>> DataStore::getMany(const std::vector<int>& ids) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
     std::vector<std::map<std::string, FieldValue>> result;
+    result.reserve(ids.size());
     for (int id : ids) {
-        result.push_back(data.at(id));
+        result.push_back(materialize(rows.at(id)));
     }
     return result;
 }
 
 bool DataStore::matchesFilter(int id, std::shared_ptr<FilterASTNode> filters) {
-    if (filters == nullptr) {
-        return true;
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    BoundFilter bound;
+    bindUnlocked(filters, bound);
+    return matchesFilterUnlocked(id, bound);
+}
+
+BoundFilter DataStore::bind(const std::shared_ptr<FilterASTNode>& filters) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    BoundFilter bound;
+    bindUnlocked(filters, bound);
+    return bound;
+}
+
+bool DataStore::matchesFilter(int id, const BoundFilter& filter) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return matchesFilterUnlocked(id, filter);
+}
+
+void DataStore::bindUnlocked(const std::shared_ptr<FilterASTNode>& node, BoundFilter& bound) const {
+    if (node == nullptr) {
+        return;
+    }
+    if (bound.ast == nullptr) {
+        bound.ast = node;
     }
 
-    auto record = data[id];
-    switch (filters->type) {
-        case NodeType::Comparison: {
-            auto filter = filters->filter;
-            auto field = filter.field;
-            auto value = filter.value;
-            auto type = filter.type;
+    size_t index = bound.steps.size();
+    bound.steps.push_back({node->type, BooleanOp::And, Comparator::Equal, -1, 0, IndexKey()});
+    switch (node->type) {
+        case NodeType::Comparison:
+            bound.steps[index].comparator = node->filter.comparator;
+            bound.steps[index].field = findField(node->filter.field);
+            bound.steps[index].value = toIndexKey(node->filter.value);
+            break;
+        case NodeType::BooleanOp:
+            bound.steps[index].booleanOp = node->booleanOp;
+            bindUnlocked(node->left, bound);
+            bindUnlocked(node->right, bound);
+            break;
+        case NodeType::Not:
+            bindUnlocked(node->child, bound);
+            break;
+    }
+    bound.steps[index].end = static_cast<uint32_t>(bound.steps.size());
+}
 
-            if (record.find(field) == record.end()) {
+bool DataStore::matchesRow(const BoundFilter& filter, uint32_t step, uint32_t row) const {
+    const BoundFilter::Step& node = filter.steps[step];
+    switch (node.type) {
+        case NodeType::Comparison: {
+            IndexKey recordValue;
+            if (node.field < 0 || !readCell(node.field, row, recordValue)) {
                 return false;
             }
-
-            auto recordValue = record[field];
-            if (std::holds_alternative<long>(value)) {
-                return std::get<long>(recordValue) == std::get<long>(value);
-            } else if (std::holds_alternative<double>(value)) {
-                return std::get<double>(recordValue) == std::get<double>(value);
-            } else if (std::holds_alternative<std::string>(value)) {
-                return std::get<std::string>(recordValue) == std::get<std::string>(value);
-            }
-            break;
+            return compareKeys(recordValue, node.comparator, node.value);
         }
         case NodeType::BooleanOp: {
-            auto left = matchesFilter(id, filters->left);
-            auto right = matchesFilter(id, filters->right);
-
-            if (filters->booleanOp == BooleanOp::And) {
-                return left && right;
-            } else {
-                return left || right;
+            bool left = matchesRow(filter, step + 1, row);
+            // The right operand starts where the left one's subtree ends
+            if (node.booleanOp == BooleanOp::And) {
+                return left && matchesRow(filter, filter.steps[step + 1].end, row);
             }
-            break;
-        }
-        case NodeType::Not: {
-            return !matchesFilter(id, filters->child);
+            return left || matchesRow(filter, filter.steps[step + 1].end, row);
         }
+        case NodeType::Not:
+            return !matchesRow(filter, step + 1, row);
     }
-
     return false;
 }
 
-void DataStore::remove(int id) {
-    std::lock_guard<std::mutex> lock(mutex);
+bool DataStore::matchesFilterUnlocked(int id, const BoundFilter& filter) const {
+    if (filter.steps.empty()) {
+        return true;
+    }
 
-    if (data.find(id) == data.end()) return;
-    auto record = data[id];
-    for (const auto& [field, value] : record) {
-        fieldIndex[field][value].erase(id);
+    auto rowIt = rows.find(id);
+    if (rowIt == rows.end()) {
+        return false;
     }
-    data.erase(id);
-    ids.erase(id);
+    return matchesRow(filter, 0, rowIt->second);
 }
 
-std::unordered_set<int> DataStore::filter(std::shared_ptr<FilterASTNode> filters) {
-    std::unordered_set<int> result;
+IdSet DataStore::matchingIds(const std::shared_ptr<FilterASTNode>& filters, const std::vector<int>& ids) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    BoundFilter bound;
+    bindUnlocked(filters, bound);
+    IdSet result;
+    for (int id : ids) {
+        if (matchesFilterUnlocked(id, bound)) {
+            result.add(id);
+        }
+    }
+    return result;
+}
+
+void DataStore::remove(int id) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    removeUnlocked(id);
+}
+
+void DataStore::removeUnlocked(int id) {
+    auto existing = rows.find(id);
+    if (existing == rows.end()) return;
+    clearRow(id, existing->second);
+    freeRows.push_back(existing->second);
+    rows.erase(existing);
+    ids.remove(id);
+    changedIds.add(id);
+}
+
+IdSet DataStore::filter(std::shared_ptr<FilterASTNode> filters) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return filterUnlocked(filters);
+}
+
+IdSet DataStore::filterUnlocked(const std::shared_ptr<FilterASTNode>& filters) {
+    IdSet result;
     if (filters == nullptr) {
         return result;
     }
 
     switch (filters->type) {
         case NodeType::Comparison: {
-            auto filter = filters->filter;
-
-            if (std::holds_alternative<long>(filter.value)) {
-                filterByType<long>(result, filter.field, filter.type, filter.value);
-            } else if (std::holds_alternative<double>(filter.value)) {
-                filterByType<double>(result, filter.field, filter.type, filter.value);
-            } else if (std::holds_alternative<std::string>(filter.value)) {
-                filterByType<std::string>(result, filter.field, filter.type, filter.value);
-            }
+            const auto& filter = filters->filter;
+            filterByType(result, filter.field, filter.comparator, filter.value);
             break;
         }
         case NodeType::BooleanOp: {
-            auto left = filter(filters->left);
-            auto right = filter(filters->right);
+            if (filterRange(result, filters)) {
+                break;
+            }
+            result = filterUnlocked(filters->left);
 
             if (filters->booleanOp == BooleanOp::And) {
-                std::set<int> sorted_left(left.begin(), left.end());
-                std::set<int> sorted_right(right.begin(), right.end());
-                std::set_intersection(sorted_left.begin(), sorted_left.end(),
-                                    sorted_right.begin(), sorted_right.end(),
-                                    std::inserter(result, result.begin()));
+                if (!result.empty()) {
+                    result &= filterUnlocked(filters->right);
+                }
             } else {
-                result.insert(left.begin(), left.end());
-                result.insert(right.begin(), right.end());
+                result |= filterUnlocked(filters->right);
             }
             break;
         }
         case NodeType::Not: {
-            auto child = filter(filters->child);
-            std::set_difference(ids.begin(), ids.end(), child.begin(), child.end(), std::inserter(result, result.begin()));
+            result = ids;
+            result -= filterUnlocked(filters->child);
             break;
         }
     }
@@ -190,29 +537,243 @@ std::unordered_set<int> DataStore::filter(std::shared_ptr<FilterASTNode> filters
     return result;
 }
 
-Facets DataStore::get_facets(const std::vector<int>& ids) {
+// Answer an AND of a numeric lower and upper bound on the same field, such as
+// price >= 10 AND price < 100, with a single range index lookup. False for any other node.
+bool DataStore::filterRange(IdSet& result, const std::shared_ptr<FilterASTNode>& filters) const {
+    if (filters->booleanOp != BooleanOp::And
+        || filters->left->type != NodeType::Comparison || filters->right->type != NodeType::Comparison) {
+        return false;
+    }
+    const Filter* lower = &filters->left->filter;
+    const Filter* upper = &filters->right->filter;
+    if (!isRangeComparator(lower->comparator) || !isRangeComparator(upper->comparator)
+        || isLowerBound(lower->comparator) == isLowerBound(upper->comparator) || lower->field != upper->field) {
+        return false;
+    }
+    if (!isLowerBound(lower->comparator)) {
+        std::swap(lower, upper);
+    }
+
+    auto lowerBound = toRangeBound(lower->value, lower->comparator);
+    auto upperBound = toRangeBound(upper->value, upper->comparator);
+    if (!lowerBound || !upperBound) {
+        return false;
+    }
+    int fieldId = findField(lower->field);
+    if (fieldId >= 0) {
+        result = IdSet::fromIds(rangeIndex[fieldId].collect(lowerBound, upperBound));
+    }
+    return true;
+}
+
+double DataStore::estimateSelectivity(const std::shared_ptr<FilterASTNode>& filters) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    if (rows.empty()) {
+        return 0.0;
+    }
+    return std::clamp(estimateUnlocked(filters), 0.0, 1.0);
+}
+
+// Operands of AND/OR are assumed to be independent
+double DataStore::estimateUnlocked(const std::shared_ptr<FilterASTNode>& filters) const {
+    if (filters == nullptr) {
+        return 0.0;
+    }
+
+    switch (filters->type) {
+        case NodeType::Comparison:
+            return estimateComparison(filters->filter);
+        case NodeType::BooleanOp: {
+            double left = estimateUnlocked(filters->left);
+            double right = estimateUnlocked(filters->right);
+            if (filters->booleanOp == BooleanOp::And) {
+                return left * right;
+            }
+            return left + right - left * right;
+        }
+        case NodeType::Not:
+            return 1.0 - estimateUnlocked(filters->child);
+    }
+    return 0.0;
+}
+
+double DataStore::estimateComparison(const Filter& filter) const {
+    int fieldId = findField(filter.field);
+    if (fieldId < 0) return 0.0;
+    const auto& fieldData = fieldIndex[fieldId];
+    const double total = static_cast<double>(rows.size());
+
+    IndexKey key = toIndexKey(filter.value);
+    const Comparator comparator = filter.comparator;
+
+    if (comparator == Comparator::Equal || comparator == Comparator::NotEqual) {
+        auto it = fieldData.find(key);
+        size_t equal = it == fieldData.end() ? 0 : it->second.size();
+        return (comparator == Comparator::Equal ? equal : columns[fieldId].count - equal) / total;
+    }
+
+    if (auto bound = toRangeBound(filter.value, comparator)) {
+        if (!isLowerBound(comparator)) {
+            return rangeIndex[fieldId].estimate(std::nullopt, bound) / total;
+        }
+        // Strings order above every number, so a lower bound matches all of them
+        size_t strings = columns[fieldId].count - rangeIndex[fieldId].size();
+        return (rangeIndex[fieldId].estimate(bound, std::nullopt) + strings) / total;
+    }
+
+    // Sum the postings of the range while it spans only a few distinct values
+    size_t matched = 0;
+    size_t scanned = 0;
+    auto sumRange = [&](auto begin, auto end) {
+        for (auto it = begin; it != end; ++it) {
+            if (++scanned > SELECTIVITY_MAX_SCANNED_KEYS) return false;
+            matched += it->second.size();
+        }
+        return true;
+    };
+
+    bool exact;
+    if (comparator == Comparator::Greater) {
+        exact = sumRange(fieldData.upper_bound(key), fieldData.end());
+    } else if (comparator == Comparator::GreaterEqual) {
+        exact = sumRange(fieldData.lower_bound(key), fieldData.end());
+    } else if (comparator == Comparator::Less) {
+        exact = sumRange(fieldData.begin(), fieldData.lower_bound(key));
+    } else {
+        exact = sumRange(fieldData.begin(), fieldData.upper_bound(key));
+    }
+    if (exact) {
+        return matched / total;
+    }
+
+    // Otherwise check an evenly spaced sample of rows. Freed rows hold no values, so
+    // scale by allocated rows over live rows.
+    size_t step = std::max<size_t>(1, rowIds.size() / SELECTIVITY_SAMPLE_ROWS);
+    size_t sampled = 0;
+    matched = 0;
+    IndexKey recordValue;
+    for (size_t row = 0; row < rowIds.size(); row += step) {
+        sampled++;
+        if (readCell(fieldId, static_cast<uint32_t>(row), recordValue) && compareKeys(recordValue, comparator, key)) {
+            matched++;
+        }
+    }
+    return static_cast<double>(matched) / sampled * rowIds.size() / total;
+}
+
+void Facets::merge(const Facets& other) {
+    for (const auto& [field, otherCounts] : other.counts) {
+        auto& fieldCounts = counts[field];
+        for (const auto& [value, count] : otherCounts) {
+            fieldCounts[value] += count;
+        }
+    }
+    for (const auto& [field, range] : other.ranges) {
+        add_to_range(ranges[field], range.min, range.max, range.count);
+    }
+}
+
+Facets DataStore::get_facets(const std::vector<std::string>& fields, const IdSet* ids, ThreadPool* pool) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
     Facets facets;
 
-    for (int id : ids) {
-        const auto& document = data[id];
+    std::vector<uint32_t> facetFields;
+    if (fields.empty()) {
+        for (uint32_t field = 0; field < columns.size(); field++) {
+            facetFields.push_back(field);
+        }
+    }
+    for (const auto& name : fields) {
+        int field = findField(name);
+        if (field >= 0) {
+            facetFields.push_back(static_cast<uint32_t>(field));
+        }
+    }
+    std::sort(facetFields.begin(), facetFields.end());
+    facetFields.erase(std::unique(facetFields.begin(), facetFields.end()), facetFields.end());
 
-        for (const auto& [field, value] : document) {
-            if (std::holds_alternative<long>(value) ||
-                std::holds_alternative<double>(value))
-            {
-                auto [it, inserted] = facets.ranges.try_emplace(field, INT_MAX, INT_MIN);
-                auto& range = it->second;
+    // Fields with few distinct values are counted with one posting intersection per value
+    std::vector<uint32_t> scannedFields;
+    for (uint32_t field : facetFields) {
+        const auto& fieldData = fieldIndex[field];
+        if (fieldData.size() > FACET_MAX_INDEX_KEYS) {
+            scannedFields.push_back(field);
+            continue;
+        }
+        for (const auto& [key, postings] : fieldData) {
+            size_t count = ids ? (postings & *ids).size() : postings.size();
+            if (count == 0) continue;
+            if (auto text = std::get_if<std::string_view>(&key)) {
+                facets.counts[fieldNames[field]][std::string(*text)] = count;
+            } else {
+                FieldValue value = toFieldValue(key);
+                add_to_range(facets.ranges[fieldNames[field]], value, value, count);
+            }
+        }
+    }
+    if (scannedFields.empty()) {
+        return facets;
+    }
 
-                int v = std::holds_alternative<long>(value)
-                      ? static_cast<int>(std::get<long>(value))
-                      : static_cast<int>(std::get<double>(value));
+    // The others are aggregated from their columns over the matching rows. A large set is
+    // cheaper to check row by row than to look up id by id. Freed rows hold no values.
+    std::vector<uint32_t> matchedRows;
+    if (ids == nullptr || ids->size() * 8 >= rowIds.size()) {
+        matchedRows.reserve(ids ? ids->size() : rows.size());
+        for (uint32_t row = 0; row < rowIds.size(); row++) {
+            if (ids == nullptr || ids->contains(rowIds[row])) {
+                matchedRows.push_back(row);
+            }
+        }
+    } else {
+        matchedRows.reserve(ids->size());
+        for (int id : *ids) {
+            auto it = rows.find(id);
+            if (it != rows.end()) {
+                matchedRows.push_back(it->second);
+            }
+        }
+    }
 
-                std::get<0>(range) = std::min(std::get<0>(range), v); // min
-                std::get<1>(range) = std::max(std::get<1>(range), v); // max
+    size_t chunks = (matchedRows.size() + FACET_CHUNK_ROWS - 1) / FACET_CHUNK_ROWS;
+    std::vector<std::vector<ColumnAggregate>> partials(chunks, std::vector<ColumnAggregate>(scannedFields.size()));
+    auto aggregateChunk = [&](size_t chunk) {
+        size_t begin = chunk * FACET_CHUNK_ROWS;
+        size_t end = std::min(matchedRows.size(), begin + FACET_CHUNK_ROWS);
+        for (size_t f = 0; f < scannedFields.size(); f++) {
+            const Column& column = columns[scannedFields[f]];
+            ColumnAggregate& aggregate = partials[chunk][f];
+            for (size_t i = begin; i < end; i++) {
+                uint32_t row = matchedRows[i];
+                if (row >= column.types.size()) continue;
+                aggregate.add(column.types[row], column.cells[row]);
             }
-            else if (std::holds_alternative<std::string>(value)) {
-                const std::string& s = std::get<std::string>(value);
-                facets.counts[field][s]++;
+        }
+    };
+    if (pool != nullptr && chunks > 1) {
+        pool->parallelFor(chunks, aggregateChunk);
+    } else {
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            aggregateChunk(chunk);
+        }
+    }
+
+    for (size_t f = 0; f < scannedFields.size(); f++) {
+        ColumnAggregate total;
+        for (const auto& partial : partials) {
+            total.merge(partial[f]);
+        }
+        const std::string& name = fieldNames[scannedFields[f]];
+        if (total.longs > 0) {
+            add_to_range(facets.ranges[name], total.minLong, total.maxLong, total.longs);
+        }
+        if (total.doubles > 0) {
+            add_to_range(facets.ranges[name], total.minDouble, total.maxDouble, total.doubles);
+        }
+        if (!total.codes.empty()) {
+            auto& counts = facets.counts[name];
+            for (const auto& [code, count] : total.codes) {
+                counts[dictionary.at(code)] = count;
             }
         }
     }
@@ -222,7 +783,7 @@ Facets DataStore::get_facets(const std::vector<int>& ids) {
 
 
 namespace {
-    void serializeFieldValue(std::ofstream& outFile, const FieldValue& value) {
+    void serializeFieldValue(std::ostream& outFile, const FieldValue& value) {
         int index = value.index();
         outFile.write(reinterpret_cast<const char*>(&index), sizeof(index));
 
@@ -252,7 +813,7 @@ namespace {
         }
     }
 
-    FieldValue deserializeFieldValue(std::ifstream& inFile) {
+    FieldValue deserializeFieldValue(std::istream& inFile) {
         int index;
         inFile.read(reinterpret_cast<char*>(&index), sizeof(index));
 
@@ -288,38 +849,68 @@ void DataStore::serialize(const std::string &filename) {
     if (!outFile) {
         throw std::runtime_error("Failed to open file for serialization.");
     }
+    serialize(outFile);
+}
 
-    size_t recordCount = data.size();
-    outFile.write(reinterpret_cast<const char*>(&recordCount), sizeof(recordCount));
+void DataStore::deserialize(const std::string &filename) {
+    std::ifstream inFile(filename, std::ios::binary);
+    if (!inFile) {
+        throw std::runtime_error("Failed to open file for deserialization.");
+    }
+    deserialize(inFile);
+}
+
+void MetadataSnapshot::serialize(std::ostream& outFile) const {
+    // Fields in name order, as a record materialized into a map lists them
+    std::vector<uint32_t> order(fieldNames.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return fieldNames[a] < fieldNames[b]; });
+    auto hasValue = [this](uint32_t field, uint32_t row) {
+        const Column& column = columns[field];
+        return row < column.types.size() && column.types[row] != ColumnType::Missing;
+    };
 
-    for (const auto& [id, record] : data) {
+    size_t recordCount = records.size();
+    outFile.write(reinterpret_cast<const char*>(&recordCount), sizeof(recordCount));
+    for (const auto& [id, row] : records) {
         outFile.write(reinterpret_cast<const char*>(&id), sizeof(id));
-        size_t fieldCount = record.size();
+        size_t fieldCount = std::count_if(order.begin(), order.end(), [&](uint32_t field) { return hasValue(field, row); });
         outFile.write(reinterpret_cast<const char*>(&fieldCount), sizeof(fieldCount));
 
-        for (const auto& [field, value] : record) {
-            size_t fieldLength = field.size();
+        for (uint32_t field : order) {
+            if (!hasValue(field, row)) continue;
+            const std::string& name = fieldNames[field];
+            size_t fieldLength = name.size();
             outFile.write(reinterpret_cast<const char*>(&fieldLength), sizeof(fieldLength));
-            outFile.write(field.data(), fieldLength);
+            outFile.write(name.data(), fieldLength);
 
-            // Serialize the FieldValue object
-            serializeFieldValue(outFile, value);
+            uint64_t cell = columns[field].cells[row];
+            switch (columns[field].types[row]) {
+                case ColumnType::Long:
+                    serializeFieldValue(outFile, static_cast<long>(static_cast<int64_t>(cell)));
+                    break;
+                case ColumnType::Double: {
+                    double value;
+                    std::memcpy(&value, &cell, sizeof(value));
+                    serializeFieldValue(outFile, value);
+                    break;
+                }
+                default:
+                    serializeFieldValue(outFile, strings[static_cast<uint32_t>(cell)]);
+                    break;
+            }
         }
     }
-}
 
-void DataStore::deserialize(const std::string &filename) {
-    std::lock_guard<std::mutex> lock(mutex);
-
-    std::ifstream inFile(filename, std::ios::binary);
-    if (!inFile) {
-        throw std::runtime_error("Failed to open file for deserialization.");
+    if (delta) {
+        size_t removedCount = removed.size();
+        outFile.write(reinterpret_cast<const char*>(&removedCount), sizeof(removedCount));
+        outFile.write(reinterpret_cast<const char*>(removed.data()), removedCount * sizeof(int));
     }
+}
 
-    size_t recordCount;
-    inFile.read(reinterpret_cast<char*>(&recordCount), sizeof(recordCount));
-
-    for (size_t i = 0; i < recordCount; ++i) {
+namespace {
+    std::pair<int, std::map<std::string, FieldValue>> deserializeRecord(std::istream& inFile) {
         int id;
         inFile.read(reinterpret_cast<char*>(&id), sizeof(id));
 
@@ -338,12 +929,107 @@ void DataStore::deserialize(const std::string &filename) {
             FieldValue value = deserializeFieldValue(inFile);
 
             record[field] = value;
-            
-            // Update the field index
-            fieldIndex[field][value].insert(id);
         }
+        return {id, std::move(record)};
+    }
+}
 
-        data[id] = record;
-        ids.insert(id);
+void DataStore::serialize(std::ostream& outFile) {
+    snapshot().serialize(outFile);
+}
+
+MetadataSnapshot DataStore::snapshot() {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    MetadataSnapshot copy;
+    copy.fieldNames = fieldNames;
+    copy.columns = columns;
+    copy.strings.reserve(dictionary.size());
+    for (uint32_t code = 0; code < dictionary.size(); code++) {
+        copy.strings.push_back(dictionary.at(code));
     }
-}
\ No newline at end of file
+    copy.records.assign(rows.begin(), rows.end());
+    return copy;
+}
+
+void DataStore::deserialize(std::istream& inFile) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    size_t recordCount;
+    inFile.read(reinterpret_cast<char*>(&recordCount), sizeof(recordCount));
+
+    for (size_t i = 0; i < recordCount; ++i) {
+        auto [id, record] = deserializeRecord(inFile);
+        setUnlocked(id, record);
+    }
+    changedIds.clear();
+}
+
+IdSet DataStore::takeChangedIds() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    IdSet taken;
+    std::swap(taken, changedIds);
+    return taken;
+}
+
+void DataStore::serializeDelta(std::ostream& outFile, const IdSet& ids) {
+    snapshotDelta(ids).serialize(outFile);
+}
+
+MetadataSnapshot DataStore::snapshotDelta(const IdSet& ids) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    // Only the rows of ids are copied, with the strings they hold
+    MetadataSnapshot copy;
+    copy.delta = true;
+    copy.fieldNames = fieldNames;
+    copy.columns.resize(columns.size());
+    std::unordered_map<uint32_t, uint32_t> codes; // dictionary code to index in copy.strings
+    for (int id : ids) {
+        auto it = rows.find(id);
+        if (it == rows.end()) {
+            copy.removed.push_back(id);
+            continue;
+        }
+        uint32_t row = it->second;
+        copy.records.emplace_back(id, static_cast<uint32_t>(copy.records.size()));
+        for (uint32_t field = 0; field < columns.size(); field++) {
+            const Column& column = columns[field];
+            Column& target = copy.columns[field];
+            ColumnType type = row < column.types.size() ? column.types[row] : ColumnType::Missing;
+            uint64_t cell = type == ColumnType::Missing ? 0 : column.cells[row];
+            if (type == ColumnType::String) {
+                auto [code, added] = codes.emplace(static_cast<uint32_t>(cell), static_cast<uint32_t>(copy.strings.size()));
+                if (added) {
+                    copy.strings.push_back(dictionary.at(static_cast<uint32_t>(cell)));
+                }
+                cell = code->second;
+            }
+            target.types.push_back(type);
+            target.cells.push_back(cell);
+        }
+    }
+    return copy;
+}
+
+void DataStore::applyDelta(std::istream& inFile) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    size_t recordCount;
+    inFile.read(reinterpret_cast<char*>(&recordCount), sizeof(recordCount));
+    for (size_t i = 0; i < recordCount; ++i) {
+        auto [id, record] = deserializeRecord(inFile);
+        setUnlocked(id, record);
+    }
+
+    size_t removedCount;
+    inFile.read(reinterpret_cast<char*>(&removedCount), sizeof(removedCount));
+    for (size_t i = 0; i < removedCount; ++i) {
+        int id;
+        inFile.read(reinterpret_cast<char*>(&id), sizeof(id));
+        removeUnlocked(id);
+    }
+    if (!inFile) {
+        throw std::runtime_error("Truncated metadata delta.");
+    }
+}
@@ -4,56 +4,196 @@
 
 #include <unordered_map>
 #include <map>
-#include <unordered_set>
+#include <deque>
 #include <string>
+#include <string_view>
+#include <variant>
 #include <vector>
 #include <stdexcept>
 #include <filesystem>
+#include <iostream>
 #include <mutex>
+#include <shared_mutex>
 
 #include "filters.hpp"
 #include "field_value.hpp"
+#include "id_set.hpp"
+#include "range_index.hpp"
+#include "thread_pool.hpp"
 
-// Type for data stores data
-using KeyValueStore = std::unordered_map<int, std::map<std::string, FieldValue>>;
+// Range comparisons walking more distinct values than this are estimated by sampling rows
+#define SELECTIVITY_MAX_SCANNED_KEYS 64
+#define SELECTIVITY_SAMPLE_ROWS 1024
+// Facets of fields with at most this many distinct values are counted from the field index
+#define FACET_MAX_INDEX_KEYS 64
+// Rows aggregated per task when facets are computed from columns
+#define FACET_CHUNK_ROWS 65536
 
-// Comparator for variants
-struct VariantComparator {
-    bool operator()(const FieldValue& lhs, const FieldValue& rhs) const;
+// Every distinct string value is stored once per data store and referred to by its code
+class StringDictionary {
+private:
+    std::deque<std::string> strings; // deque so views into it stay valid as it grows
+    std::unordered_map<std::string_view, uint32_t> codes;
+
+public:
+    uint32_t intern(const std::string& value);
+    const std::string& at(uint32_t code) const { return strings[code]; }
+    size_t size() const { return strings.size(); }
+};
+
+enum class ColumnType : uint8_t {
+    Missing,
+    Long,
+    Double,
+    String
+};
+
+// One metadata field across all rows. A cell holds a long, the bits of a double
+// or a dictionary code depending on its type.
+struct Column {
+    std::vector<ColumnType> types;
+    std::vector<uint64_t> cells;
+    size_t count = 0; // rows holding a value
 };
 
-// Alias for field index structure
-using FieldIndex = std::unordered_map<std::string, std::map<FieldValue, std::unordered_set<int>, VariantComparator>>;
+// Copy of records of a DataStore taken under its lock, serialized later without holding it.
+// Its columns run over the rows of records and its string cells are codes into strings.
+class MetadataSnapshot {
+public:
+    // Write the records as DataStore::serialize does, followed by the removals as
+    // DataStore::serializeDelta does when the copy was taken by snapshotDelta
+    void serialize(std::ostream& out) const;
+
+private:
+    friend class DataStore;
+
+    bool delta = false;
+    std::vector<std::string> fieldNames;
+    std::vector<Column> columns;
+    std::vector<std::string> strings;
+    std::vector<std::pair<int, uint32_t>> records; // id and row
+    std::vector<int> removed;
+};
+
+// Field index key. Strings are views into the dictionary rather than copies, and the
+// variant orders the same way as FieldValue (longs, then doubles, then strings).
+using IndexKey = std::variant<long, double, std::string_view>;
+
+// Alias for field index structure, indexed by field id
+using FieldIndex = std::vector<std::map<IndexKey, IdSet>>;
+
+// A filter flattened for one store: nodes in prefix order with field names resolved to ids
+// and values converted to index keys once, so checking a row is a walk over an array with
+// no lookups. Fields the store did not have when the filter was bound never match.
+struct BoundFilter {
+    struct Step {
+        NodeType type;
+        BooleanOp booleanOp;
+        Comparator comparator;
+        int field;      // -1 when the store has no such field
+        uint32_t end;   // index just past this node's subtree
+        IndexKey value; // strings view into the AST below
+    };
+    std::vector<Step> steps;
+    std::shared_ptr<FilterASTNode> ast;
+};
+
+// Numeric values of a field. min and max keep the type of the value they came from.
+struct FacetRange {
+    FieldValue min;
+    FieldValue max;
+    size_t count = 0;
+};
 
 struct Facets {
-    std::unordered_map<std::string, std::unordered_map<std::string, int>> counts;
-    std::unordered_map<std::string, std::tuple<int, int>> ranges;
+    // Documents holding each string value, by field
+    std::unordered_map<std::string, std::unordered_map<std::string, size_t>> counts;
+    std::unordered_map<std::string, FacetRange> ranges;
+
+    // Add the facets of other, computed over a disjoint set of documents
+    void merge(const Facets& other);
 };
 
+// Columnar metadata store. Field names are interned to ids, each document id maps to a
+// dense row, and each field is a typed column over those rows.
 class DataStore {
 private:
-    std::mutex mutex;
+    // Shared for lookups and filtering, exclusive for writes
+    mutable std::shared_mutex mutex;
 
+    StringDictionary dictionary;
+    std::vector<std::string> fieldNames;
+    std::unordered_map<std::string, uint32_t> fieldIds;
+    std::vector<Column> columns;
     FieldIndex fieldIndex;
+    std::vector<RangeIndex> rangeIndex; // numeric values of each field, parallel to fieldIndex
+
+    std::unordered_map<int, uint32_t> rows;
+    std::vector<int> rowIds;
+    std::vector<uint32_t> freeRows;
+
+    IdSet changedIds; // set or removed since the last takeChangedIds
 
-    template<typename T>
-    void filterByType(std::unordered_set<int>& result, const std::string& field, const std::string& type, const FieldValue& value);
+    uint32_t internField(const std::string& field);
+    int findField(const std::string& field) const;
+    bool readCell(uint32_t field, uint32_t row, IndexKey& key) const;
+    FieldValue toFieldValue(const IndexKey& key) const;
+    std::map<std::string, FieldValue> materialize(uint32_t row) const;
+
+    void filterByType(IdSet& result, const std::string& field, Comparator comparator, const FieldValue& value);
+    bool filterRange(IdSet& result, const std::shared_ptr<FilterASTNode>& filters) const;
+    double estimateComparison(const Filter& filter) const;
+    double estimateUnlocked(const std::shared_ptr<FilterASTNode>& filters) const;
+    void clearRow(int id, uint32_t row);
+    void setUnlocked(int id, const std::map<std::string, FieldValue>& record);
+    void bindUnlocked(const std::shared_ptr<FilterASTNode>& node, BoundFilter& bound) const;
+    bool matchesRow(const BoundFilter& filter, uint32_t step, uint32_t row) const;
+    void removeUnlocked(int id);
+    IdSet filterUnlocked(const std::shared_ptr<FilterASTNode>& filters);
 
 public:
-    KeyValueStore data;
-    std::unordered_set<int> ids;
+    IdSet ids;
 
     DataStore() = default;
     void set(int id, std::map<std::string, FieldValue> record);
+    // Set a batch of records under a single acquisition of the write lock
+    void setMany(std::vector<std::pair<int, std::map<std::string, FieldValue>>> records);
     std::map<std::string, FieldValue> get(int id);
     std::vector<std::map<std::string, FieldValue>> getMany(const std::vector<int>& ids);
     bool contains(int id);
+    size_t size();
     bool matchesFilter(int id, std::shared_ptr<FilterASTNode> filters);
+    // Resolve filters against this store for checking many rows with matchesFilter
+    BoundFilter bind(const std::shared_ptr<FilterASTNode>& filters);
+    bool matchesFilter(int id, const BoundFilter& filter);
+    // Lock the store shared, to check many rows with matchesFilterUnlocked while it is held
+    std::shared_lock<std::shared_mutex> sharedLock() const { return std::shared_lock<std::shared_mutex>(mutex); }
+    bool matchesFilterUnlocked(int id, const BoundFilter& filter) const;
+    // The subset of ids matching filters, checked row by row under a single lock
+    IdSet matchingIds(const std::shared_ptr<FilterASTNode>& filters, const std::vector<int>& ids);
     void remove(int id);
-    std::unordered_set<int> filter(std::shared_ptr<FilterASTNode> filters);
-    Facets get_facets(const std::vector<int>& ids);
+    IdSet filter(std::shared_ptr<FilterASTNode> filters);
+    // Estimated fraction of documents matching filters, from the field index without evaluating it
+    double estimateSelectivity(const std::shared_ptr<FilterASTNode>& filters);
+    // Facets of fields over ids, or over every document when ids is null. An empty fields
+    // takes every field. Large sets are aggregated in parallel on pool when given.
+    Facets get_facets(const std::vector<std::string>& fields, const IdSet* ids = nullptr, ThreadPool* pool = nullptr);
     void serialize(const std::string &filename);
     void deserialize(const std::string &filename);
+    void serialize(std::ostream& out);
+    // Copy of every record, to serialize as serialize does once the store may have changed
+    MetadataSnapshot snapshot();
+    void deserialize(std::istream& in);
+
+    // Ids set or removed since the previous call, or since the store was deserialized
+    IdSet takeChangedIds();
+    // The current state of ids: records for those present, removals for the rest.
+    // applyDelta replays it on top of a store deserialized from an earlier point, and the
+    // ids it touches count as changed.
+    void serializeDelta(std::ostream& out, const IdSet& ids);
+    // Copy of the current state of ids, to serialize as serializeDelta does once the store may have changed
+    MetadataSnapshot snapshotDelta(const IdSet& ids);
+    void applyDelta(std::istream& in);
 };
 
 #endif // DATA_STORE_HPP
@@ -0,0 +1,184 @@
+// filter_cache.cpp
+#include "filter_cache.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+namespace {
+    std::string normalizeValue(const FieldValue& value) {
+        std::ostringstream out;
+        switch (value.index()) {
+            case 0:
+                out << "L:" << std::get<long>(value);
+                break;
+            case 1:
+                out << "D:" << std::setprecision(17) << std::get<double>(value);
+                break;
+            default:
+                out << "S:\"";
+                for (char c : std::get<std::string>(value)) {
+                    if (c == '"' || c == '\\') out << '\\';
+                    out << c;
+                }
+                out << '"';
+                break;
+        }
+        return out.str();
+    }
+
+    void collectOperands(const std::shared_ptr<FilterASTNode>& node, BooleanOp op, std::vector<std::string>& operands) {
+        if (node && node->type == NodeType::BooleanOp && node->booleanOp == op) {
+            collectOperands(node->left, op, operands);
+            collectOperands(node->right, op, operands);
+        } else {
+            operands.push_back(normalizeFilter(node));
+        }
+    }
+}
+
+std::string normalizeFilter(const std::shared_ptr<FilterASTNode>& node) {
+    if (node == nullptr) {
+        return "";
+    }
+
+    switch (node->type) {
+        case NodeType::Comparison:
+            return node->filter.field + node->filter.type + normalizeValue(node->filter.value);
+        case NodeType::Not:
+            return "NOT(" + normalizeFilter(node->child) + ")";
+        case NodeType::BooleanOp: {
+            std::vector<std::string> operands;
+            collectOperands(node, node->booleanOp, operands);
+            std::sort(operands.begin(), operands.end());
+            operands.erase(std::unique(operands.begin(), operands.end()), operands.end());
+            if (operands.size() == 1) {
+                return operands[0];
+            }
+
+            std::string result = node->booleanOp == BooleanOp::And ? "AND(" : "OR(";
+            for (size_t i = 0; i < operands.size(); i++) {
+                if (i > 0) result += ",";
+                result += operands[i];
+            }
+            return result + ")";
+        }
+    }
+    return "";
+}
+
+std::shared_ptr<const IdSet> FilterCache::get(const std::string& key) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    it->second.hits++;
+    return it->second.ids;
+}
+
+void FilterCache::put(const std::string& key, std::shared_ptr<FilterASTNode> ast, std::shared_ptr<const IdSet> ids, uint64_t observedGeneration) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (generation.load() != observedGeneration || entries.find(key) != entries.end()) {
+        return;
+    }
+
+    // Evict the least frequently used entry
+    if (entries.size() >= capacity && !entries.empty()) {
+        auto victim = entries.begin();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->second.hits < victim->second.hits) {
+                victim = it;
+            }
+        }
+        entries.erase(victim);
+    }
+
+    auto& entry = entries[key];
+    entry.ast = std::move(ast);
+    entry.ids = std::move(ids);
+}
+
+void FilterCache::documentsChanged(const std::vector<int>& ids, DataStore& store) {
+    if (ids.empty()) return;
+
+    std::vector<std::tuple<std::string, std::shared_ptr<FilterASTNode>, std::shared_ptr<const IdSet>>> snapshot;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        generation++;
+        snapshot.reserve(entries.size());
+        for (const auto& [key, entry] : entries) {
+            snapshot.emplace_back(key, entry.ast, entry.ids);
+        }
+    }
+
+    // Work out the new results without holding the cache lock so readers are not blocked
+    std::vector<std::pair<std::string, std::shared_ptr<const IdSet>>> updates;
+    for (const auto& [key, ast, cached] : snapshot) {
+        if (ids.size() > FILTER_CACHE_RECOMPUTE_THRESHOLD) {
+            updates.emplace_back(key, std::make_shared<const IdSet>(store.filter(ast)));
+            continue;
+        }
+
+        IdSet matching = store.matchingIds(ast, ids);
+        std::shared_ptr<IdSet> updated;
+        for (int id : ids) {
+            bool matches = matching.contains(id);
+            if (matches == cached->contains(id)) continue;
+            if (!updated) updated = std::make_shared<IdSet>(*cached);
+            if (matches) {
+                updated->add(id);
+            } else {
+                updated->remove(id);
+            }
+        }
+        if (updated) {
+            updates.emplace_back(key, std::move(updated));
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    for (size_t i = 0, u = 0; i < snapshot.size() && u < updates.size(); i++) {
+        if (std::get<0>(snapshot[i]) != updates[u].first) continue;
+
+        auto it = entries.find(updates[u].first);
+        if (it != entries.end()) {
+            if (it->second.ids == std::get<2>(snapshot[i])) {
+                it->second.ids = std::move(updates[u].second);
+            } else {
+                // Another write replaced this entry while we were working, neither result is complete
+                entries.erase(it);
+            }
+        }
+        u++;
+    }
+}
+
+void FilterCache::documentsRemoved(const std::vector<int>& ids) {
+    if (ids.empty()) return;
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    generation++;
+    for (auto& [key, entry] : entries) {
+        std::shared_ptr<IdSet> updated;
+        for (int id : ids) {
+            if (!entry.ids->contains(id)) continue;
+            if (!updated) updated = std::make_shared<IdSet>(*entry.ids);
+            updated->remove(id);
+        }
+        if (updated) {
+            entry.ids = std::move(updated);
+        }
+    }
+}
+
+void FilterCache::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    generation++;
+    entries.clear();
+}
+
+size_t FilterCache::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return entries.size();
+}
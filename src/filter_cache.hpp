@@ -0,0 +1,59 @@
+// filter_cache.hpp
+#ifndef FILTER_CACHE_HPP
+#define FILTER_CACHE_HPP
+
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "data_store.hpp"
+#include "filters.hpp"
+#include "id_set.hpp"
+
+// Batches larger than this refresh cached entries from the field index instead of
+// re-checking every written document against every cached filter
+#define FILTER_CACHE_RECOMPUTE_THRESHOLD 4096
+
+// Canonical form of a filter AST used as the cache key. Operands of AND/OR chains are
+// flattened, sorted and deduplicated, and values keep their type, so "a = 1 AND b = 2"
+// and "b = 2 AND a = 1" share an entry while "a = 1" and "a = 1.0" do not.
+std::string normalizeFilter(const std::shared_ptr<FilterASTNode>& node);
+
+// Cache of filter results for one index. Results are immutable and shared, so a hit costs
+// a reference count rather than a copy. Writes to the index update the cached results in
+// place (copy-on-write) instead of invalidating them.
+class FilterCache {
+private:
+    struct Entry {
+        std::shared_ptr<FilterASTNode> ast;
+        std::shared_ptr<const IdSet> ids;
+        std::atomic<uint64_t> hits{0};
+    };
+
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    size_t capacity;
+    // Bumped by every write so results computed before a write are not cached after it
+    std::atomic<uint64_t> generation{0};
+
+public:
+    explicit FilterCache(size_t capacity) : capacity(capacity) {}
+
+    std::shared_ptr<const IdSet> get(const std::string& key);
+    // Generation to pass to put() for a result about to be computed
+    uint64_t currentGeneration() const { return generation.load(); }
+    // Cache a result unless the index was written to since `observedGeneration`
+    void put(const std::string& key, std::shared_ptr<FilterASTNode> ast, std::shared_ptr<const IdSet> ids, uint64_t observedGeneration);
+
+    // Re-evaluate cached filters for documents that were just added or updated in store
+    void documentsChanged(const std::vector<int>& ids, DataStore& store);
+    // Drop removed documents from every cached result
+    void documentsRemoved(const std::vector<int>& ids);
+
+    void clear();
+    size_t size() const;
+};
+
+#endif // FILTER_CACHE_HPP
@@ -1,10 +1,16 @@
-
-#include <regex>
-#include <sstream>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
 #include "filters.hpp"
 
 
-FilterASTNode::FilterASTNode(Filter filter) : type(NodeType::Comparison), filter(filter) {}
+FilterASTNode::FilterASTNode(Filter filter) : type(NodeType::Comparison), filter(filter) {
+    this->filter.comparator = parseComparator(this->filter.type);
+}
 
 FilterASTNode::FilterASTNode(BooleanOp op, std::shared_ptr<FilterASTNode> left, std::shared_ptr<FilterASTNode> right) : type(NodeType::BooleanOp), booleanOp(op), left(left), right(right) {}
 
@@ -30,72 +36,122 @@ std::string FilterASTNode::toString() {
     return "Invalid node type";
 }
 
-FieldValue convertType(const std::string& value, const std::string& type) {
+Comparator parseComparator(const std::string& type) {
+    if (type == "=") return Comparator::Equal;
+    if (type == "!=") return Comparator::NotEqual;
+    if (type == ">") return Comparator::Greater;
+    if (type == "<") return Comparator::Less;
+    if (type == ">=") return Comparator::GreaterEqual;
+    if (type == "<=") return Comparator::LessEqual;
+    throw std::invalid_argument("Unsupported comparison type: " + type);
+}
+
+FieldValue convertValue(const std::string& value, const std::string& type) {
     if (type == "STRING") {
         return value;
     } else if (type == "LONG") {
-        return std::stol(value);
+        long result;
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+        if (error != std::errc() || end != value.data() + value.size()) {
+            throw std::invalid_argument("Integer out of range in filter string: " + value);
+        }
+        return result;
     } else if (type == "DOUBLE") {
-        return std::stod(value);
+        return std::strtod(value.c_str(), nullptr);
     } else {
-        throw std::runtime_error("Unsupported type: " + type);
-    }   
+        throw std::invalid_argument("Expected a value in filter string, found: " + value);
+    }
 }
 
-const std::regex LPAREN(R"(\()");
-const std::regex RPAREN(R"(\))");
-const std::regex STRING("\"([^\"]*)\"");
-const std::regex LONG(R"(\d+)");
-const std::regex DOUBLE(R"(\d+\.\d+)");
-const std::regex COMPARATOR(R"(!=|>=|<=|=|>|<)");
-const std::regex BOOLEAN_OP(R"(AND|OR|NOT)");
-const std::regex IDENTIFIER(R"(\w+)");
-const std::regex WHITESPACE(R"(\s+)");
-
-std::vector<std::string> splitWhitespace(const std::string &str) {
-    std::vector<std::string> tokens;
-    std::istringstream stream(str);
-    std::string token;
-    while (stream >> token) {
-        std::smatch match;
-        if (std::regex_search(token, match, LPAREN)) {
-            tokens.push_back(match[0]);
-            token.erase(0, 1);
-            tokens.push_back(token);
-        } else if (std::regex_search(token, match, RPAREN)) {
-            tokens.push_back(token.substr(0, token.size() - 1));
-            tokens.push_back(match[0]);
-        } else {
-            tokens.push_back(token);
+namespace {
+    bool is_word_char(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool is_digit(char c) {
+        return std::isdigit(static_cast<unsigned char>(c));
+    }
+
+    // Classify a run of word characters, with an optional leading minus and decimal point
+    Token word_token(std::string word) {
+        if (word == "AND" || word == "OR" || word == "NOT") {
+            return {std::move(word), "BOOLEAN_OP"};
         }
+
+        size_t start = word[0] == '-' ? 1 : 0;
+        size_t digits = start;
+        while (digits < word.size() && is_digit(word[digits])) digits++;
+        if (digits > start && digits == word.size()) {
+            return {std::move(word), "LONG"};
+        }
+        if (digits > start && word[digits] == '.') {
+            size_t fraction = digits + 1;
+            while (fraction < word.size() && is_digit(word[fraction])) fraction++;
+            if (fraction > digits + 1 && fraction == word.size()) {
+                return {std::move(word), "DOUBLE"};
+            }
+        }
+        if (start == 0 && word.find('.') == std::string::npos) {
+            return {std::move(word), "IDENTIFIER"};
+        }
+        throw std::invalid_argument("Invalid token in filter string: " + word);
+    }
+
+    const Token& expect_token(int index, const std::vector<Token>& tokens) {
+        if (index < 0 || index >= static_cast<int>(tokens.size())) {
+            throw std::invalid_argument("Unexpected end of filter string");
+        }
+        return tokens[index];
     }
-    return tokens;
 }
 
+// Single pass over the string. Parentheses and comparators need no surrounding spaces, and
+// string literals may contain spaces and escaped quotes (\" and \\).
 std::vector<Token> tokenize(const std::string &filterString) {
-    auto splitTokens = splitWhitespace(filterString);
     std::vector<Token> tokens;
-
-    for (const auto &word : splitTokens) {
-        std::smatch match;
-        if (std::regex_match(word, match, LPAREN)) {
-            tokens.push_back({word, "LPAREN"});
-        } else if (std::regex_match(word, match, RPAREN)) {
-            tokens.push_back({word, "RPAREN"});
-        } else if (std::regex_match(word, match, COMPARATOR)) {
-            tokens.push_back({word, "COMPARATOR"});
-        } else if (std::regex_match(word, match, BOOLEAN_OP)) {
-            tokens.push_back({word, "BOOLEAN_OP"});
-        } else if (std::regex_match(word, match, DOUBLE)) {
-            tokens.push_back({word, "DOUBLE"});
-        } else if (std::regex_match(word, match, LONG)) {
-            tokens.push_back({word, "LONG"});
-        } else if (std::regex_match(word, match, STRING)) {
-            tokens.push_back({match[1], "STRING"});
-        } else if (std::regex_match(word, match, IDENTIFIER)) {
-            tokens.push_back({word, "IDENTIFIER"});
+    const size_t length = filterString.size();
+    size_t i = 0;
+
+    while (i < length) {
+        char c = filterString[i];
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            i++;
+        } else if (c == '(') {
+            tokens.push_back({"(", "LPAREN"});
+            i++;
+        } else if (c == ')') {
+            tokens.push_back({")", "RPAREN"});
+            i++;
+        } else if (c == '=' || c == '<' || c == '>' || c == '!') {
+            bool orEqual = i + 1 < length && filterString[i + 1] == '=';
+            if (c == '!' && !orEqual) {
+                throw std::invalid_argument("Invalid token in filter string: !");
+            }
+            bool twoChars = orEqual && c != '=';
+            tokens.push_back({filterString.substr(i, twoChars ? 2 : 1), "COMPARATOR"});
+            i += twoChars ? 2 : 1;
+        } else if (c == '"') {
+            std::string value;
+            i++;
+            while (i < length && filterString[i] != '"') {
+                if (filterString[i] == '\\' && i + 1 < length) {
+                    i++;
+                }
+                value.push_back(filterString[i++]);
+            }
+            if (i == length) {
+                throw std::invalid_argument("Unterminated string in filter string");
+            }
+            i++;
+            tokens.push_back({std::move(value), "STRING"});
+        } else if (is_word_char(c) || (c == '-' && i + 1 < length && is_digit(filterString[i + 1]))) {
+            size_t start = i++;
+            while (i < length && (is_word_char(filterString[i]) || filterString[i] == '.')) {
+                i++;
+            }
+            tokens.push_back(word_token(filterString.substr(start, i - start)));
         } else {
-            throw std::runtime_error("Invalid token in filter string: " + word);
+            throw std::invalid_argument("Invalid token in filter string: " + std::string(1, c));
         }
     }
 
@@ -103,72 +159,86 @@ std::vector<Token> tokenize(const std::string &filterString) {
 }
 
 std::shared_ptr<FilterASTNode> parseTerm(int& index, const std::vector<Token>& tokens) {
-    if (index >= tokens.size()) {
-        return nullptr;
-    }
-    
-    std::shared_ptr<FilterASTNode> astNode;
-
-    if (tokens[index].type == "LPAREN") {
+    if (expect_token(index, tokens).type == "LPAREN") {
         index++;
-        astNode = parseExpression(index, tokens);
-        if (tokens[index].type != "RPAREN") {
-            throw std::runtime_error("Expected closing parenthesis at index " + std::to_string(index) + " instead we found: " + tokens[index].value);
+        auto astNode = parseExpression(index, tokens);
+        const Token& closing = expect_token(index, tokens);
+        if (closing.type != "RPAREN") {
+            throw std::invalid_argument("Expected closing parenthesis at index " + std::to_string(index) + " instead we found: " + closing.value);
         }
         index++;
-    } else {
-        astNode = parseFactor(index, tokens); 
+        return astNode;
     }
-    return astNode;
+    return parseFactor(index, tokens);
 }
 
 std::shared_ptr<FilterASTNode> parseFactor(int& index, const std::vector<Token>& tokens) {
-    if (index >= tokens.size()) {
-        return nullptr;
-    }
+    const Token& token = expect_token(index, tokens);
 
-    if (tokens[index].type == "BOOLEAN_OP" && tokens[index].value == "NOT") {
+    if (token.type == "BOOLEAN_OP" && token.value == "NOT") {
         index++;
-        auto child = parseFactor(index, tokens);
+        auto child = parseTerm(index, tokens);
         return std::make_shared<FilterASTNode>(NodeType::Not, child);
-    } 
+    }
 
-    if (tokens[index].type == "IDENTIFIER") {
-        auto field = tokens[index].value;
+    if (token.type == "IDENTIFIER") {
         index++;
-        if (tokens[index].type != "COMPARATOR") {
-            throw std::runtime_error("Expected a comparator after an identifier. After identifier: " + tokens[index-1].value + " found: " + tokens[index].value);
+        const Token& comparator = expect_token(index, tokens);
+        if (comparator.type != "COMPARATOR") {
+            throw std::invalid_argument("Expected a comparator after an identifier. After identifier: " + token.value + " found: " + comparator.value);
         }
-        auto op = tokens[index].value;
         index++;
-        FieldValue convertedValue = convertType(tokens[index].value, tokens[index].type);
+        const Token& value = expect_token(index, tokens);
         index++;
-        return std::make_shared<FilterASTNode>(Filter{field, op, convertedValue});
+        return std::make_shared<FilterASTNode>(Filter{token.value, comparator.value, convertValue(value.value, value.type)});
     }
-    throw std::runtime_error("Syntax error in filter string");
+    throw std::invalid_argument("Syntax error in filter string at: " + token.value);
 }
 
 std::shared_ptr<FilterASTNode> parseExpression(int& index, const std::vector<Token>& tokens) {
     auto astNode = parseTerm(index, tokens);
-    while (index < tokens.size() && tokens[index].type == "BOOLEAN_OP" && tokens[index].value != "NOT") {
+    while (index < static_cast<int>(tokens.size()) && tokens[index].type == "BOOLEAN_OP" && tokens[index].value != "NOT") {
         auto op = tokens[index].value == "AND" ? BooleanOp::And : BooleanOp::Or;
         index++;
         auto right = parseTerm(index, tokens);
         astNode = std::make_shared<FilterASTNode>(op, astNode, right);
     }
-    // index++;
     return astNode;
 }
 
 std::shared_ptr<FilterASTNode> parseFilters(const std::string &filterString) {
     auto tokens = tokenize(filterString);
-    
+    if (tokens.empty()) {
+        return nullptr;
+    }
+
     int index = 0;
     auto astNode = parseExpression(index, tokens);
 
-    if (index < tokens.size()) {
-        throw std::runtime_error("Unexpected token at index " + std::to_string(index) + ": " + tokens[index].value);
+    if (index < static_cast<int>(tokens.size())) {
+        throw std::invalid_argument("Unexpected token at index " + std::to_string(index) + ": " + tokens[index].value);
     }
 
     return astNode;
-}
\ No newline at end of file
+}
+
+std::shared_ptr<FilterASTNode> parseFiltersCached(const std::string &filterString) {
+    static std::shared_mutex mutex;
+    static std::unordered_map<std::string, std::shared_ptr<FilterASTNode>> parsed;
+
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = parsed.find(filterString);
+        if (it != parsed.end()) {
+            return it->second;
+        }
+    }
+
+    auto astNode = parseFilters(filterString);
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (parsed.size() >= FILTER_PARSE_CACHE_CAPACITY) {
+        parsed.clear();
+    }
+    parsed.emplace(filterString, astNode);
+    return astNode;
+}
@@ -1,15 +1,29 @@
 #ifndef FILTERS_HPP
 #define FILTERS_HPP
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
 #include "field_value.hpp"
 
+// Distinct filter strings kept by parseFiltersCached before it starts over
+#define FILTER_PARSE_CACHE_CAPACITY 4096
+
+enum class Comparator : uint8_t {
+    Equal,
+    NotEqual,
+    Greater,
+    Less,
+    GreaterEqual,
+    LessEqual
+};
+
 struct Filter {
     std::string field;
     std::string type; // Comparison type: =, !=, >, <, >=, <=
     FieldValue value;
+    Comparator comparator = Comparator::Equal; // type, set from it by FilterASTNode
 };
 
 enum class NodeType {
@@ -46,7 +60,12 @@ std::vector<Token> tokenize(const std::string &filterString);
 std::shared_ptr<FilterASTNode> parseTerm(int& index, const std::vector<Token>& tokens);
 std::shared_ptr<FilterASTNode> parseFactor(int& index, const std::vector<Token>& tokens);
 std::shared_ptr<FilterASTNode> parseExpression(int& index, const std::vector<Token>& tokens);
+// Parse a filter string. Malformed filters throw std::invalid_argument.
 std::shared_ptr<FilterASTNode> parseFilters(const std::string &filterString);
+// parseFilters, remembering the result by filter string so a repeated filter is only parsed
+// once. The returned AST is shared between callers and must not be modified.
+std::shared_ptr<FilterASTNode> parseFiltersCached(const std::string &filterString);
 FieldValue convertValue(const std::string &value, const std::string &type);
+Comparator parseComparator(const std::string &type);
 
 #endif // FILTERS_HPP
@@ -0,0 +1,418 @@
+// http_client.cpp
+#include "http_client.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#define HTTP_MAX_HEADER_BYTES 65536
+#define HTTP_READ_CHUNK 65536
+
+Endpoint resolve_endpoint(const std::string& hostPort) {
+    size_t colon = hostPort.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == hostPort.size()) {
+        throw std::invalid_argument("Expected host:port, got: " + hostPort);
+    }
+
+    Endpoint endpoint;
+    endpoint.host = hostPort.substr(0, colon);
+    std::string port = hostPort.substr(colon + 1);
+    if (!std::all_of(port.begin(), port.end(), [](unsigned char c) { return std::isdigit(c); }) ||
+        port.size() > 5 || std::stoi(port) == 0 || std::stoi(port) > 65535) {
+        throw std::invalid_argument("Invalid port in: " + hostPort);
+    }
+    endpoint.port = static_cast<uint16_t>(std::stoi(port));
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    int status = getaddrinfo(endpoint.host.c_str(), port.c_str(), &hints, &found);
+    if (status != 0 || found == nullptr) {
+        throw std::invalid_argument("Unable to resolve " + hostPort + ": " + gai_strerror(status));
+    }
+    std::memcpy(&endpoint.address, found->ai_addr, found->ai_addrlen);
+    endpoint.addressLength = found->ai_addrlen;
+    freeaddrinfo(found);
+    return endpoint;
+}
+
+bool HttpResponseParser::feed(const char* data, size_t size) {
+    if (done) {
+        return true;
+    }
+    buffer.append(data, size);
+    if (headerEnd == 0) {
+        size_t end = buffer.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (buffer.size() > HTTP_MAX_HEADER_BYTES) {
+                throw std::runtime_error("Response header too large");
+            }
+            return false;
+        }
+        headerEnd = end + 4;
+        parseHeader();
+    }
+    if (buffer.size() - headerEnd >= contentLength) {
+        result.body = buffer.substr(headerEnd, contentLength);
+        done = true;
+    }
+    return done;
+}
+
+void HttpResponseParser::parseHeader() {
+    if (buffer.compare(0, 7, "HTTP/1.") != 0 || buffer.size() < 12 || buffer[8] != ' ') {
+        throw std::runtime_error("Malformed response status line");
+    }
+    result.keepAlive = buffer[7] == '1';
+    result.status = 0;
+    for (size_t i = 9; i < 12; i++) {
+        if (!std::isdigit(static_cast<unsigned char>(buffer[i]))) {
+            throw std::runtime_error("Malformed response status line");
+        }
+        result.status = result.status * 10 + (buffer[i] - '0');
+    }
+
+    bool hasLength = false;
+    size_t line = buffer.find("\r\n") + 2;
+    while (line < headerEnd - 2) {
+        size_t lineEnd = buffer.find("\r\n", line);
+        size_t colon = buffer.find(':', line);
+        if (colon == std::string::npos || colon > lineEnd) {
+            throw std::runtime_error("Malformed response header");
+        }
+        std::string name = buffer.substr(line, colon - line);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        size_t valueStart = buffer.find_first_not_of(" \t", colon + 1);
+        std::string value = valueStart < lineEnd ? buffer.substr(valueStart, lineEnd - valueStart) : "";
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        if (name == "content-length") {
+            try {
+                contentLength = std::stoul(value);
+            } catch (const std::exception&) {
+                throw std::runtime_error("Malformed Content-Length: " + value);
+            }
+            hasLength = true;
+        } else if (name == "transfer-encoding" && value != "identity") {
+            throw std::runtime_error("Unsupported Transfer-Encoding: " + value);
+        } else if (name == "connection") {
+            result.keepAlive = value.find("close") == std::string::npos;
+        }
+        line = lineEnd + 2;
+    }
+
+    // Only these may omit a length, every other response from the server carries one
+    if (!hasLength && result.status != 204 && result.status != 304 && result.status >= 200) {
+        throw std::runtime_error("Response without a Content-Length");
+    }
+}
+
+std::string url_encode(const std::string& segment) {
+    static const char* hex = "0123456789ABCDEF";
+    std::string encoded;
+    for (unsigned char c : segment) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            encoded.push_back(static_cast<char>(c));
+        } else {
+            encoded.push_back('%');
+            encoded.push_back(hex[c >> 4]);
+            encoded.push_back(hex[c & 15]);
+        }
+    }
+    return encoded;
+}
+
+std::string http_request(const std::string& method, const Endpoint& endpoint, const std::string& target,
+                         const std::string& contentType, const std::string& body) {
+    std::string request = method + " " + target + " HTTP/1.1\r\nHost: " + endpoint.name() + "\r\nConnection: keep-alive\r\n";
+    if (!contentType.empty()) {
+        request += "Content-Type: " + contentType + "\r\n";
+    }
+    request += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    request += body;
+    return request;
+}
+
+ConnectionPool::~ConnectionPool() {
+    for (int fd : idle) {
+        close(fd);
+    }
+}
+
+int ConnectionPool::acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (idle.empty()) {
+        return -1;
+    }
+    int fd = idle.back();
+    idle.pop_back();
+    return fd;
+}
+
+void ConnectionPool::release(int fd) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < maxIdle) {
+            idle.push_back(fd);
+            return;
+        }
+    }
+    close(fd);
+}
+
+HttpClient::HttpClient(std::vector<Endpoint> endpoints, size_t poolSize) : targets(std::move(endpoints)) {
+    for (size_t i = 0; i < targets.size(); i++) {
+        pools.push_back(std::make_unique<ConnectionPool>(poolSize));
+    }
+}
+
+namespace {
+    enum class Stage { Connecting, Writing, Reading, Finished };
+
+    // One send of a call to one endpoint
+    struct Attempt {
+        size_t call;
+        size_t endpoint;
+        int fd = -1;
+        bool reused = false; // fd came from the pool, so the server may have closed it while idle
+        Stage stage = Stage::Connecting;
+        std::string request;
+        size_t written = 0;
+        HttpResponseParser parser;
+    };
+
+    // Start a non-blocking connect, returning false when it failed immediately
+    bool connect_to(const Endpoint& endpoint, Attempt& attempt) {
+        attempt.fd = socket(endpoint.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (attempt.fd < 0) {
+            return false;
+        }
+        int one = 1;
+        setsockopt(attempt.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        attempt.reused = false;
+        attempt.written = 0;
+        if (connect(attempt.fd, reinterpret_cast<const sockaddr*>(&endpoint.address), endpoint.addressLength) == 0) {
+            attempt.stage = Stage::Writing;
+            return true;
+        }
+        if (errno == EINPROGRESS) {
+            attempt.stage = Stage::Connecting;
+            return true;
+        }
+        close(attempt.fd);
+        attempt.fd = -1;
+        return false;
+    }
+}
+
+void HttpClient::run(std::vector<HttpCall>& calls, std::chrono::milliseconds deadline, std::chrono::milliseconds hedgeDelay) {
+    auto started = std::chrono::steady_clock::now();
+    auto deadlineAt = started + deadline;
+    auto hedgeAt = started + hedgeDelay;
+
+    std::vector<std::unique_ptr<Attempt>> attempts;
+    std::vector<size_t> tried(calls.size(), 0);
+    std::vector<size_t> inFlight(calls.size(), 0);
+
+    auto maxAttempts = [&calls](size_t c) {
+        // A hedge of a call with a single endpoint goes to it again over another connection
+        return std::max<size_t>(calls[c].endpoints.size(), calls[c].hedge ? 2 : 1);
+    };
+
+    auto start = [&](size_t c) {
+        HttpCall& call = calls[c];
+        while (tried[c] < maxAttempts(c)) {
+            auto attempt = std::make_unique<Attempt>();
+            attempt->call = c;
+            attempt->endpoint = call.endpoints[tried[c] % call.endpoints.size()];
+            tried[c]++;
+            const Endpoint& endpoint = targets[attempt->endpoint];
+            attempt->request = http_request(call.method, endpoint, call.target, call.contentType, call.body);
+
+            attempt->fd = pools[attempt->endpoint]->acquire();
+            if (attempt->fd >= 0) {
+                attempt->reused = true;
+                attempt->stage = Stage::Writing;
+            } else if (!connect_to(endpoint, *attempt)) {
+                call.error = "Unable to connect to " + endpoint.name() + ": " + std::strerror(errno);
+                continue;
+            }
+            inFlight[c]++;
+            attempts.push_back(std::move(attempt));
+            return;
+        }
+    };
+
+    auto drop = [](Attempt& attempt) {
+        if (attempt.fd >= 0) {
+            close(attempt.fd);
+            attempt.fd = -1;
+        }
+        attempt.stage = Stage::Finished;
+    };
+
+    // The attempt failed: fail over to the next endpoint unless another attempt is still running
+    auto fail = [&](Attempt& attempt, const std::string& error) {
+        drop(attempt);
+        size_t c = attempt.call;
+        inFlight[c]--;
+        if (!calls[c].response) {
+            calls[c].error = targets[attempt.endpoint].name() + ": " + error;
+            if (inFlight[c] == 0) {
+                start(c);
+            }
+        }
+    };
+
+    auto finish = [&](Attempt& attempt) {
+        size_t c = attempt.call;
+        HttpResponse& response = attempt.parser.response();
+        if (response.keepAlive) {
+            pools[attempt.endpoint]->release(attempt.fd);
+        } else {
+            close(attempt.fd);
+        }
+        attempt.fd = -1;
+        attempt.stage = Stage::Finished;
+        inFlight[c]--;
+        calls[c].response = std::move(response);
+        calls[c].error.clear();
+        // A connection with a response still on its way cannot be reused
+        for (auto& other : attempts) {
+            if (other->call == c && other->stage != Stage::Finished) {
+                drop(*other);
+                inFlight[c]--;
+            }
+        }
+    };
+
+    // A pooled connection the server closed while it was idle fails before any response
+    // arrives, and is replaced by a new connection instead of counting as a failure
+    auto reconnectOrFail = [&](Attempt& attempt, const std::string& error) {
+        if (attempt.reused && !attempt.parser.started()) {
+            close(attempt.fd);
+            if (connect_to(targets[attempt.endpoint], attempt)) {
+                return;
+            }
+        }
+        fail(attempt, error);
+    };
+
+    auto advance = [&](Attempt& attempt, short revents) {
+        if (attempt.stage == Stage::Connecting) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(attempt.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                fail(attempt, std::string("connect: ") + std::strerror(error));
+                return;
+            }
+            attempt.stage = Stage::Writing;
+        }
+
+        if (attempt.stage == Stage::Writing) {
+            while (attempt.written < attempt.request.size()) {
+                ssize_t sent = send(attempt.fd, attempt.request.data() + attempt.written,
+                                    attempt.request.size() - attempt.written, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return;
+                    }
+                    reconnectOrFail(attempt, std::string("send: ") + std::strerror(errno));
+                    return;
+                }
+                attempt.written += static_cast<size_t>(sent);
+            }
+            attempt.stage = Stage::Reading;
+            return;
+        }
+
+        if (attempt.stage == Stage::Reading && (revents & (POLLIN | POLLHUP | POLLERR))) {
+            char chunk[HTTP_READ_CHUNK];
+            while (true) {
+                ssize_t received = recv(attempt.fd, chunk, sizeof(chunk), 0);
+                if (received < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return;
+                    }
+                    reconnectOrFail(attempt, std::string("recv: ") + std::strerror(errno));
+                    return;
+                }
+                if (received == 0) {
+                    reconnectOrFail(attempt, "connection closed before the response was complete");
+                    return;
+                }
+                try {
+                    if (attempt.parser.feed(chunk, static_cast<size_t>(received))) {
+                        finish(attempt);
+                        return;
+                    }
+                } catch (const std::runtime_error& e) {
+                    fail(attempt, e.what());
+                    return;
+                }
+            }
+        }
+    };
+
+    for (size_t c = 0; c < calls.size(); c++) {
+        start(c);
+    }
+
+    bool hedged = hedgeDelay.count() <= 0;
+    std::vector<pollfd> polled;
+    std::vector<Attempt*> polledAttempts;
+    while (true) {
+        polled.clear();
+        polledAttempts.clear();
+        for (auto& attempt : attempts) {
+            if (attempt->stage != Stage::Finished) {
+                polled.push_back({attempt->fd, static_cast<short>(attempt->stage == Stage::Reading ? POLLIN : POLLOUT), 0});
+                polledAttempts.push_back(attempt.get());
+            }
+        }
+        if (polled.empty()) {
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadlineAt) {
+            break;
+        }
+        auto wakeAt = hedged ? deadlineAt : std::min(deadlineAt, hedgeAt);
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - now).count() + 1;
+        int ready = poll(polled.data(), polled.size(), static_cast<int>(timeout));
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (!hedged && std::chrono::steady_clock::now() >= hedgeAt) {
+            hedged = true;
+            for (size_t c = 0; c < calls.size(); c++) {
+                if (calls[c].hedge && !calls[c].response && inFlight[c] == 1 && tried[c] == 1) {
+                    start(c);
+                }
+            }
+        }
+
+        for (size_t i = 0; ready > 0 && i < polled.size(); i++) {
+            if (polled[i].revents != 0 && polledAttempts[i]->stage != Stage::Finished) {
+                advance(*polledAttempts[i], polled[i].revents);
+            }
+        }
+    }
+
+    for (auto& attempt : attempts) {
+        if (attempt->stage != Stage::Finished) {
+            calls[attempt->call].error = "No response within " + std::to_string(deadline.count()) + "ms";
+            drop(*attempt);
+        }
+    }
+}
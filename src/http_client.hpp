@@ -0,0 +1,113 @@
+// http_client.hpp
+#ifndef HTTP_CLIENT_HPP
+#define HTTP_CLIENT_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+#define DEFAULT_HTTP_POOL_SIZE 16
+
+// A backend server, resolved once when it is configured
+struct Endpoint {
+    std::string host;
+    uint16_t port = 0;
+    sockaddr_storage address{};
+    socklen_t addressLength = 0;
+
+    std::string name() const { return host + ":" + std::to_string(port); }
+};
+
+// Resolve "host:port". Throws std::invalid_argument when it is malformed or does not resolve.
+Endpoint resolve_endpoint(const std::string& hostPort);
+
+struct HttpResponse {
+    int status = 0;
+    std::string body;
+    bool keepAlive = true; // the server did not ask for the connection to be closed
+};
+
+// Incremental parser for one HTTP/1.1 response with a Content-Length body, the only kind the
+// server sends. Malformed or chunked responses throw std::runtime_error.
+class HttpResponseParser {
+public:
+    // Consume bytes, returning true once the response is complete. Bytes past its end are ignored.
+    bool feed(const char* data, size_t size);
+    bool complete() const { return done; }
+    bool started() const { return !buffer.empty(); }
+    HttpResponse& response() { return result; }
+
+private:
+    std::string buffer;
+    size_t headerEnd = 0;
+    size_t contentLength = 0;
+    bool done = false;
+    HttpResponse result;
+
+    void parseHeader();
+};
+
+// Percent-encode a path segment
+std::string url_encode(const std::string& segment);
+
+// Serialize a request, keeping the connection open for reuse
+std::string http_request(const std::string& method, const Endpoint& endpoint, const std::string& target,
+                         const std::string& contentType = "", const std::string& body = "");
+
+// Idle keep-alive connections to one endpoint. Connections are handed out most recently used
+// first, and ones beyond maxIdle are closed instead of being kept.
+class ConnectionPool {
+public:
+    explicit ConnectionPool(size_t maxIdle) : maxIdle(maxIdle) {}
+    ~ConnectionPool();
+
+    // An idle connection, or -1 when there is none
+    int acquire();
+    void release(int fd);
+
+private:
+    std::mutex mutex;
+    std::vector<int> idle;
+    size_t maxIdle;
+};
+
+// One request to a shard, which any of its endpoints can answer
+struct HttpCall {
+    std::vector<size_t> endpoints; // indices into the client's endpoints, tried in order
+    std::string method;
+    std::string target;
+    std::string contentType;
+    std::string body;
+    bool hedge = false; // send it again to the next endpoint once hedgeDelay passes without an answer
+
+    std::optional<HttpResponse> response; // the first response received
+    std::string error; // why there is no response
+};
+
+// Client for a fixed set of endpoints. Every call of a batch runs from the calling thread on
+// non-blocking sockets, so a fan-out costs one poll loop rather than a thread per backend.
+class HttpClient {
+public:
+    explicit HttpClient(std::vector<Endpoint> endpoints, size_t poolSize = DEFAULT_HTTP_POOL_SIZE);
+
+    // Run the calls concurrently until each has a response or the deadline passes. A call whose
+    // endpoint fails is retried on the next one straight away. Calls left without a response
+    // have their error set. The requests are idempotent, so a hedged call may reach the backends
+    // twice; the slower answer is dropped.
+    void run(std::vector<HttpCall>& calls, std::chrono::milliseconds deadline,
+             std::chrono::milliseconds hedgeDelay = std::chrono::milliseconds(0));
+
+    const std::vector<Endpoint>& endpoints() const { return targets; }
+
+private:
+    std::vector<Endpoint> targets;
+    std::vector<std::unique_ptr<ConnectionPool>> pools; // parallel to targets
+};
+
+#endif // HTTP_CLIENT_HPP
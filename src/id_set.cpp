@@ -0,0 +1,409 @@
+// id_set.cpp
+#include "id_set.hpp"
+#include <algorithm>
+
+namespace {
+    inline int popcount64(uint64_t word) {
+#if defined(_MSC_VER)
+        return static_cast<int>(__popcnt64(word));
+#else
+        return __builtin_popcountll(word);
+#endif
+    }
+
+    inline int countTrailingZeros64(uint64_t word) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctzll(word);
+#endif
+    }
+
+    inline uint16_t highBits(int id) { return static_cast<uint16_t>(static_cast<uint32_t>(id) >> 16); }
+    inline uint16_t lowBits(int id) { return static_cast<uint16_t>(static_cast<uint32_t>(id) & 0xFFFF); }
+    inline int combine(uint16_t high, uint32_t low) { return static_cast<int>((static_cast<uint32_t>(high) << 16) | low); }
+}
+
+bool IdSet::Container::contains(uint16_t low) const {
+    if (isBitmap()) {
+        return (bitmap[low >> 6] >> (low & 63)) & 1;
+    }
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+bool IdSet::Container::add(uint16_t low) {
+    if (isBitmap()) {
+        uint64_t& word = bitmap[low >> 6];
+        uint64_t mask = uint64_t(1) << (low & 63);
+        if (word & mask) return false;
+        word |= mask;
+        cardinality++;
+        return true;
+    }
+
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it != array.end() && *it == low) return false;
+    array.insert(it, low);
+    cardinality++;
+    if (array.size() > ARRAY_MAX_SIZE) {
+        toBitmap();
+    }
+    return true;
+}
+
+bool IdSet::Container::remove(uint16_t low) {
+    if (isBitmap()) {
+        uint64_t& word = bitmap[low >> 6];
+        uint64_t mask = uint64_t(1) << (low & 63);
+        if (!(word & mask)) return false;
+        word &= ~mask;
+        cardinality--;
+        if (cardinality <= ARRAY_MAX_SIZE) {
+            toArray();
+        }
+        return true;
+    }
+
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it == array.end() || *it != low) return false;
+    array.erase(it);
+    cardinality--;
+    return true;
+}
+
+void IdSet::Container::toBitmap() {
+    if (isBitmap()) return;
+    bitmap.assign(BITMAP_WORDS, 0);
+    for (uint16_t low : array) {
+        bitmap[low >> 6] |= uint64_t(1) << (low & 63);
+    }
+    std::vector<uint16_t>().swap(array);
+}
+
+void IdSet::Container::toArray() {
+    if (!isBitmap()) return;
+    array.clear();
+    array.reserve(cardinality);
+    for (size_t i = 0; i < BITMAP_WORDS; i++) {
+        uint64_t word = bitmap[i];
+        while (word) {
+            array.push_back(static_cast<uint16_t>(i * 64 + countTrailingZeros64(word)));
+            word &= word - 1;
+        }
+    }
+    std::vector<uint64_t>().swap(bitmap);
+}
+
+// Recompute the cardinality of a bitmap container and pick the cheaper representation
+void IdSet::Container::normalize() {
+    if (isBitmap()) {
+        uint32_t count = 0;
+        for (uint64_t word : bitmap) {
+            count += popcount64(word);
+        }
+        cardinality = count;
+        if (cardinality <= ARRAY_MAX_SIZE) {
+            toArray();
+        }
+    } else {
+        cardinality = static_cast<uint32_t>(array.size());
+        if (array.size() > ARRAY_MAX_SIZE) {
+            toBitmap();
+        }
+    }
+}
+
+IdSet::Container IdSet::unionOf(const Container& a, const Container& b) {
+    Container result;
+    if (!a.isBitmap() && !b.isBitmap() && a.cardinality + b.cardinality <= ARRAY_MAX_SIZE) {
+        result.array.reserve(a.cardinality + b.cardinality);
+        std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+        result.cardinality = static_cast<uint32_t>(result.array.size());
+        return result;
+    }
+
+    if (a.isBitmap()) {
+        result.bitmap = a.bitmap;
+    } else {
+        result.array = a.array;
+        result.cardinality = a.cardinality;
+        result.toBitmap();
+    }
+
+    if (b.isBitmap()) {
+        for (size_t i = 0; i < BITMAP_WORDS; i++) {
+            result.bitmap[i] |= b.bitmap[i];
+        }
+    } else {
+        for (uint16_t low : b.array) {
+            result.bitmap[low >> 6] |= uint64_t(1) << (low & 63);
+        }
+    }
+    result.normalize();
+    return result;
+}
+
+IdSet::Container IdSet::intersectionOf(const Container& a, const Container& b) {
+    Container result;
+    if (a.isBitmap() && b.isBitmap()) {
+        result.bitmap.resize(BITMAP_WORDS);
+        for (size_t i = 0; i < BITMAP_WORDS; i++) {
+            result.bitmap[i] = a.bitmap[i] & b.bitmap[i];
+        }
+        result.normalize();
+        return result;
+    }
+
+    if (a.isBitmap() || b.isBitmap()) {
+        const Container& arrayContainer = a.isBitmap() ? b : a;
+        const Container& bitmapContainer = a.isBitmap() ? a : b;
+        for (uint16_t low : arrayContainer.array) {
+            if (bitmapContainer.contains(low)) {
+                result.array.push_back(low);
+            }
+        }
+    } else {
+        std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+    }
+    result.cardinality = static_cast<uint32_t>(result.array.size());
+    return result;
+}
+
+IdSet::Container IdSet::differenceOf(const Container& a, const Container& b) {
+    Container result;
+    if (a.isBitmap()) {
+        result.bitmap = a.bitmap;
+        if (b.isBitmap()) {
+            for (size_t i = 0; i < BITMAP_WORDS; i++) {
+                result.bitmap[i] &= ~b.bitmap[i];
+            }
+        } else {
+            for (uint16_t low : b.array) {
+                result.bitmap[low >> 6] &= ~(uint64_t(1) << (low & 63));
+            }
+        }
+        result.normalize();
+        return result;
+    }
+
+    if (b.isBitmap()) {
+        for (uint16_t low : a.array) {
+            if (!b.contains(low)) {
+                result.array.push_back(low);
+            }
+        }
+    } else {
+        std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+    }
+    result.cardinality = static_cast<uint32_t>(result.array.size());
+    return result;
+}
+
+IdSet::IdSet(std::initializer_list<int> ids) {
+    for (int id : ids) {
+        add(id);
+    }
+}
+
+IdSet IdSet::fromIds(std::vector<int> ids) {
+    std::sort(ids.begin(), ids.end(), [](int a, int b) { return static_cast<uint32_t>(a) < static_cast<uint32_t>(b); });
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    IdSet result;
+    for (int id : ids) {
+        uint16_t high = highBits(id);
+        if (result.keys.empty() || result.keys.back() != high) {
+            result.keys.push_back(high);
+            result.containers.emplace_back();
+        }
+        result.containers.back().array.push_back(lowBits(id));
+    }
+    for (auto& container : result.containers) {
+        container.normalize();
+    }
+    result.cardinality = ids.size();
+    return result;
+}
+
+void IdSet::add(int id) {
+    uint16_t high = highBits(id);
+    auto it = std::lower_bound(keys.begin(), keys.end(), high);
+    size_t index = it - keys.begin();
+    if (it == keys.end() || *it != high) {
+        keys.insert(it, high);
+        containers.insert(containers.begin() + index, Container());
+    }
+    if (containers[index].add(lowBits(id))) {
+        cardinality++;
+    }
+}
+
+void IdSet::remove(int id) {
+    uint16_t high = highBits(id);
+    auto it = std::lower_bound(keys.begin(), keys.end(), high);
+    if (it == keys.end() || *it != high) return;
+    size_t index = it - keys.begin();
+    if (containers[index].remove(lowBits(id))) {
+        cardinality--;
+        if (containers[index].cardinality == 0) {
+            keys.erase(it);
+            containers.erase(containers.begin() + index);
+        }
+    }
+}
+
+bool IdSet::contains(int id) const {
+    uint16_t high = highBits(id);
+    auto it = std::lower_bound(keys.begin(), keys.end(), high);
+    if (it == keys.end() || *it != high) return false;
+    return containers[it - keys.begin()].contains(lowBits(id));
+}
+
+void IdSet::clear() {
+    keys.clear();
+    containers.clear();
+    cardinality = 0;
+}
+
+IdSet& IdSet::operator|=(const IdSet& other) {
+    std::vector<uint16_t> mergedKeys;
+    std::vector<Container> mergedContainers;
+    mergedKeys.reserve(keys.size() + other.keys.size());
+    mergedContainers.reserve(keys.size() + other.keys.size());
+
+    size_t i = 0, j = 0;
+    cardinality = 0;
+    while (i < keys.size() || j < other.keys.size()) {
+        if (j == other.keys.size() || (i < keys.size() && keys[i] < other.keys[j])) {
+            mergedKeys.push_back(keys[i]);
+            mergedContainers.push_back(std::move(containers[i]));
+            i++;
+        } else if (i == keys.size() || other.keys[j] < keys[i]) {
+            mergedKeys.push_back(other.keys[j]);
+            mergedContainers.push_back(other.containers[j]);
+            j++;
+        } else {
+            mergedKeys.push_back(keys[i]);
+            mergedContainers.push_back(unionOf(containers[i], other.containers[j]));
+            i++;
+            j++;
+        }
+        cardinality += mergedContainers.back().cardinality;
+    }
+
+    keys = std::move(mergedKeys);
+    containers = std::move(mergedContainers);
+    return *this;
+}
+
+IdSet& IdSet::operator&=(const IdSet& other) {
+    size_t out = 0;
+    size_t j = 0;
+    cardinality = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        while (j < other.keys.size() && other.keys[j] < keys[i]) j++;
+        if (j == other.keys.size()) break;
+        if (other.keys[j] != keys[i]) continue;
+
+        Container intersection = intersectionOf(containers[i], other.containers[j]);
+        if (intersection.cardinality == 0) continue;
+        cardinality += intersection.cardinality;
+        keys[out] = keys[i];
+        containers[out] = std::move(intersection);
+        out++;
+    }
+    keys.resize(out);
+    containers.resize(out);
+    return *this;
+}
+
+IdSet& IdSet::operator-=(const IdSet& other) {
+    size_t out = 0;
+    size_t j = 0;
+    cardinality = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        while (j < other.keys.size() && other.keys[j] < keys[i]) j++;
+
+        if (j < other.keys.size() && other.keys[j] == keys[i]) {
+            Container difference = differenceOf(containers[i], other.containers[j]);
+            if (difference.cardinality == 0) continue;
+            containers[out] = std::move(difference);
+        } else if (out != i) {
+            containers[out] = std::move(containers[i]);
+        }
+        keys[out] = keys[i];
+        cardinality += containers[out].cardinality;
+        out++;
+    }
+    keys.resize(out);
+    containers.resize(out);
+    return *this;
+}
+
+bool IdSet::operator==(const IdSet& other) const {
+    if (cardinality != other.cardinality || keys != other.keys) return false;
+    for (size_t i = 0; i < containers.size(); i++) {
+        const Container& a = containers[i];
+        const Container& b = other.containers[i];
+        if (a.cardinality != b.cardinality) return false;
+        if (a.isBitmap() != b.isBitmap()) return false;
+        if (a.isBitmap() ? a.bitmap != b.bitmap : a.array != b.array) return false;
+    }
+    return true;
+}
+
+std::vector<int> IdSet::toVector() const {
+    std::vector<int> result;
+    result.reserve(cardinality);
+    for (int id : *this) {
+        result.push_back(id);
+    }
+    return result;
+}
+
+size_t IdSet::memoryUsage() const {
+    size_t bytes = sizeof(IdSet) + keys.capacity() * sizeof(uint16_t) + containers.capacity() * sizeof(Container);
+    for (const auto& container : containers) {
+        bytes += container.array.capacity() * sizeof(uint16_t) + container.bitmap.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+IdSet::const_iterator::const_iterator(const IdSet* set, size_t containerIndex) : set(set), containerIndex(containerIndex), position(0) {
+    settle();
+}
+
+// Advance from (containerIndex, position) to the next id present in the set, or to end()
+void IdSet::const_iterator::settle() {
+    while (containerIndex < set->containers.size()) {
+        const Container& container = set->containers[containerIndex];
+        uint16_t high = set->keys[containerIndex];
+        if (container.isBitmap()) {
+            size_t wordIndex = position >> 6;
+            if (wordIndex < BITMAP_WORDS) {
+                uint64_t word = container.bitmap[wordIndex] & (~uint64_t(0) << (position & 63));
+                while (word == 0 && ++wordIndex < BITMAP_WORDS) {
+                    word = container.bitmap[wordIndex];
+                }
+                if (wordIndex < BITMAP_WORDS) {
+                    position = wordIndex * 64 + countTrailingZeros64(word);
+                    current = combine(high, static_cast<uint32_t>(position));
+                    return;
+                }
+            }
+        } else if (position < container.array.size()) {
+            current = combine(high, container.array[position]);
+            return;
+        }
+        containerIndex++;
+        position = 0;
+    }
+}
+
+IdSet::const_iterator& IdSet::const_iterator::operator++() {
+    position++;
+    settle();
+    return *this;
+}
@@ -0,0 +1,99 @@
+// id_set.hpp
+#ifndef ID_SET_HPP
+#define ID_SET_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <initializer_list>
+#include <iterator>
+
+// Compressed set of document ids (roaring-style).
+// Ids are split into a 16 bit high part selecting a container and a 16 bit low part stored
+// in that container. Sparse containers are sorted arrays, dense ones are 65536 bit bitmaps,
+// so set algebra on large filter results runs word-at-a-time instead of node-at-a-time.
+class IdSet {
+private:
+    static constexpr size_t ARRAY_MAX_SIZE = 4096;
+    static constexpr size_t BITMAP_WORDS = 1024;
+
+    struct Container {
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bitmap;
+        uint32_t cardinality = 0;
+
+        bool isBitmap() const { return !bitmap.empty(); }
+        bool contains(uint16_t low) const;
+        bool add(uint16_t low);
+        bool remove(uint16_t low);
+        void toBitmap();
+        void toArray();
+        void normalize();
+    };
+
+    std::vector<uint16_t> keys;
+    std::vector<Container> containers;
+    size_t cardinality = 0;
+
+    static Container unionOf(const Container& a, const Container& b);
+    static Container intersectionOf(const Container& a, const Container& b);
+    static Container differenceOf(const Container& a, const Container& b);
+
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int*;
+        using reference = int;
+
+        const_iterator() = default;
+        int operator*() const { return current; }
+        const_iterator& operator++();
+        const_iterator operator++(int) { auto copy = *this; ++(*this); return copy; }
+        bool operator==(const const_iterator& other) const { return set == other.set && containerIndex == other.containerIndex && position == other.position; }
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        friend class IdSet;
+        const_iterator(const IdSet* set, size_t containerIndex);
+        void settle();
+
+        const IdSet* set = nullptr;
+        size_t containerIndex = 0;
+        size_t position = 0; // array position, or bit position within a bitmap container
+        int current = 0;
+    };
+
+    IdSet() = default;
+    IdSet(std::initializer_list<int> ids);
+    // Build from ids in any order with one sort, instead of a search per add
+    static IdSet fromIds(std::vector<int> ids);
+
+    void add(int id);
+    void remove(int id);
+    bool contains(int id) const;
+    size_t size() const { return cardinality; }
+    bool empty() const { return cardinality == 0; }
+    void clear();
+
+    IdSet& operator|=(const IdSet& other);
+    IdSet& operator&=(const IdSet& other);
+    IdSet& operator-=(const IdSet& other);
+
+    friend IdSet operator|(IdSet lhs, const IdSet& rhs) { lhs |= rhs; return lhs; }
+    friend IdSet operator&(IdSet lhs, const IdSet& rhs) { lhs &= rhs; return lhs; }
+    friend IdSet operator-(IdSet lhs, const IdSet& rhs) { lhs -= rhs; return lhs; }
+
+    bool operator==(const IdSet& other) const;
+    bool operator!=(const IdSet& other) const { return !(*this == other); }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, containers.size()); }
+
+    std::vector<int> toVector() const;
+    size_t memoryUsage() const;
+};
+
+#endif // ID_SET_HPP
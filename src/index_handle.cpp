@@ -0,0 +1,1246 @@
+// index_handle.cpp
+#include "index_handle.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <numeric>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+    hnswlib::SpaceInterface<float>* make_space(const std::string& spaceType, int dimension) {
+        return (spaceType == "IP")
+            ? static_cast<hnswlib::SpaceInterface<float>*>(new hnswlib::InnerProductSpace(dimension))
+            : static_cast<hnswlib::SpaceInterface<float>*>(new hnswlib::L2Space(dimension));
+    }
+
+    // Files of an index besides the log segments retired by its snapshots
+    const std::vector<std::string> INDEX_FILE_SUFFIXES = {".bin", ".json", ".data", ".sq8", ".labels", ".wal", ".data.delta"};
+
+    // Positions of the ids to insert, in order, leaving out all but the last of a repeated id
+    std::vector<size_t> last_occurrences(const std::vector<int>& ids) {
+        std::unordered_map<int, size_t> last;
+        last.reserve(ids.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            last[ids[i]] = i;
+        }
+        std::vector<size_t> positions;
+        positions.reserve(last.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (last[ids[i]] == i) {
+                positions.push_back(i);
+            }
+        }
+        return positions;
+    }
+
+    // Log files retired by snapshots, as (last sequence they hold, path), oldest first
+    std::vector<std::pair<uint64_t, std::string>> log_segments(const std::string& indexName) {
+        std::vector<std::pair<uint64_t, std::string>> segments;
+        if (!std::filesystem::is_directory("indices")) {
+            return segments;
+        }
+        const std::string prefix = indexName + ".wal.";
+        for (const auto& entry : std::filesystem::directory_iterator("indices")) {
+            std::string filename = entry.path().filename().string();
+            if (filename.size() <= prefix.size() || filename.compare(0, prefix.size(), prefix) != 0) continue;
+            std::string suffix = filename.substr(prefix.size());
+            if (!std::all_of(suffix.begin(), suffix.end(), [](char c) { return c >= '0' && c <= '9'; })) continue;
+            segments.emplace_back(std::stoull(suffix), entry.path().string());
+        }
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    // Patch of a body of count records of recordLength bytes: the first prefixLength bytes of each
+    // and the whole of those in ids, which are ascending
+    RecordPatch record_patch(const char* body, size_t count, size_t recordLength, size_t prefixLength,
+                             const std::vector<hnswlib::tableint>& ids) {
+        RecordPatch patch;
+        patch.recordCount = count;
+        patch.recordLength = recordLength;
+        patch.prefixLength = prefixLength;
+        patch.prefixes.resize(count * prefixLength);
+        for (size_t i = 0; prefixLength > 0 && i < count; i++) {
+            std::memcpy(&patch.prefixes[i * prefixLength], body + i * recordLength, prefixLength);
+        }
+        for (hnswlib::tableint id : ids) {
+            if (id >= count) break;
+            patch.ids.push_back(id);
+            patch.records.insert(patch.records.end(), body + size_t(id) * recordLength, body + (size_t(id) + 1) * recordLength);
+        }
+        return patch;
+    }
+
+    // Shards are named <index>.shard<i>
+    bool is_shard_name(const std::string& name) {
+        size_t dot = name.rfind(".shard");
+        if (dot == std::string::npos || dot + 6 == name.size()) {
+            return false;
+        }
+        return std::all_of(name.begin() + dot + 6, name.end(), [](char c) { return c >= '0' && c <= '9'; });
+    }
+
+    // hnswlib's base layer search, skipping the deleted and filter checks when neither applies
+    template <bool collectMetrics>
+    auto search_base_layer(const hnswlib::HierarchicalNSW<float>& index, hnswlib::tableint entry, const void* traversal,
+                           size_t ef, hnswlib::BaseFilterFunctor* isIdAllowed) {
+        return (index.num_deleted_ || isIdAllowed)
+            ? index.searchBaseLayerST<false, collectMetrics>(entry, traversal, ef, isIdAllowed)
+            : index.searchBaseLayerST<true, collectMetrics>(entry, traversal, ef);
+    }
+}
+
+void keep_nearest(SearchResult& result, size_t k, float distance, hnswlib::labeltype label) {
+    if (result.size() < k) {
+        result.emplace(distance, label);
+    } else if (distance < result.top().first) {
+        result.pop();
+        result.emplace(distance, label);
+    }
+}
+
+IndexHandle::IndexHandle(const std::string& name, const nlohmann::json& settings)
+    : name(name), settings(settings), filterCache(MAX_FILTER_CACHE_SIZE) {}
+
+IndexHandle::~IndexHandle() {
+    delete index;
+    delete space;
+    delete rerankSpace;
+}
+
+void IndexHandle::initSpace(const std::string& spaceType, const std::string& quantization, bool rerank) {
+    if (quantization == "SQ8") {
+        quantizer = new SQ8Space(dimension, spaceType == "IP");
+        space = quantizer;
+        if (rerank) {
+            rerankSpace = make_space(spaceType, dimension);
+        }
+    } else {
+        space = make_space(spaceType, dimension);
+    }
+}
+
+std::shared_ptr<IndexHandle> IndexHandle::create(const IndexRequest& request, const nlohmann::json& settings, const WalOptions& wal) {
+    auto handle = std::make_shared<IndexHandle>(request.indexName, settings);
+    handle->dimension = request.dimension;
+    handle->initSpace(request.spaceType, request.quantization, request.rerank);
+    handle->index = new hnswlib::HierarchicalNSW<float>(
+        handle->space,
+        DEFAULT_INDEX_SIZE,
+        request.M,
+        request.efConstruction,
+        42,
+        true
+    );
+    handle->numThreads = request.numThreads;
+    if (handle->rerankSpace != nullptr) {
+        handle->fullVectors.resize(handle->index->max_elements_ * handle->dimension);
+    }
+
+    // The settings are written now so the log can be replayed even if the index is never saved.
+    // /create_index refuses a name with files on disk, so nothing saved is overwritten.
+    if (wal.enabled) {
+        std::filesystem::create_directories("indices");
+        SnapshotProgress progress;
+        write_file_atomically("indices/" + request.indexName + ".json", handle->manifest(0, 0, 0).dump(), progress);
+        handle->writeAheadLog = std::make_unique<WriteAheadLog>("indices/" + request.indexName + ".wal", wal, 0);
+    }
+    return handle;
+}
+
+std::shared_ptr<IndexHandle> IndexHandle::load(const LoadIndexRequest& request, ThreadPool& pool, const WalOptions& wal) {
+    const std::string& name = request.indexName;
+    std::ifstream settings_file("indices/" + name + ".json");
+    if (!settings_file) {
+        throw std::runtime_error("Unable to open settings file for index: " + name);
+    }
+    nlohmann::json indexState;
+    settings_file >> indexState;
+
+    int dim = indexState["dimension"];
+    std::string spaceType = indexState["spaceType"];
+    int ef_construction = indexState["efConstruction"];
+    int M = indexState["M"];
+
+    auto handle = std::make_shared<IndexHandle>(name, indexState);
+    handle->dimension = dim;
+    handle->numThreads = indexState.value("numThreads", 0);
+    handle->initSpace(spaceType, indexState.value("quantization", "None"), indexState.value("rerank", true));
+
+    // An index that was logged but never saved has settings and a log but no snapshot
+    bool hasSnapshot = std::filesystem::exists("indices/" + name + ".bin");
+    handle->snapshotId = indexState.value("snapshotId", uint64_t(0));
+    handle->metadataBaseSnapshot = indexState.value("metadataBaseSnapshot", uint64_t(0));
+    handle->lastSnapshotId = handle->snapshotId;
+    handle->lastSnapshotSequence = indexState.value("walSequence", uint64_t(0));
+
+    // The graph and the metadata are independent, so they are read at the same time
+    pool.parallelFor(2, [&](size_t part) {
+        if (part == 0) {
+            handle->loadGraph(request.memoryMap, hasSnapshot, M, ef_construction);
+        } else if (hasSnapshot) {
+            handle->loadMetadata();
+        }
+    });
+    if (handle->rerankSpace != nullptr) {
+        handle->fullVectors.resize(handle->index->max_elements_ * handle->dimension);
+    }
+
+    // Mutations logged after the snapshot was taken, including segments retired by a snapshot
+    // that did not finish. A record that failed when it was first applied fails the same way
+    // here, it is reported and skipped.
+    auto apply = [&](const WalRecord& record) {
+        try {
+            handle->applyLogRecord(record, pool);
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping write-ahead log record " << record.sequence << " of index " << name << ": " << e.what() << std::endl;
+        }
+    };
+    std::string logPath = "indices/" + name + ".wal";
+    uint64_t lastSequence = indexState.value("walSequence", uint64_t(0));
+    for (const auto& [segmentSequence, segmentPath] : log_segments(name)) {
+        lastSequence = WriteAheadLog::replay(segmentPath, lastSequence, apply);
+    }
+    lastSequence = WriteAheadLog::replay(logPath, lastSequence, apply);
+    handle->replayedSequence = lastSequence;
+    if (wal.enabled) {
+        handle->writeAheadLog = std::make_unique<WriteAheadLog>(logPath, wal, lastSequence);
+    }
+
+    handle->ready = !request.prewarm;
+    return handle;
+}
+
+void IndexHandle::loadGraph(bool memoryMap, bool hasSnapshot, int M, int efConstruction) {
+    if (memoryMap && hasSnapshot) {
+        mappedIndex = new MappedHierarchicalNSW(
+            space,
+            "indices/" + name + ".bin",
+            "indices/" + name + ".labels",
+            true
+        );
+        index = mappedIndex;
+    } else {
+        index = new hnswlib::HierarchicalNSW<float>(
+            space,
+            DEFAULT_INDEX_SIZE,
+            M,
+            efConstruction,
+            42,
+            true
+        );
+        if (hasSnapshot) {
+            index->loadIndex("indices/" + name + ".bin", space, 10000);
+        }
+    }
+
+    if (quantizer != nullptr && hasSnapshot) {
+        std::ifstream quantization_file("indices/" + name + ".sq8", std::ios::binary);
+        if (!quantization_file) {
+            throw std::runtime_error("Unable to open quantization file for index: " + name);
+        }
+        quantizer->load(quantization_file);
+
+        uint64_t count = 0;
+        quantization_file.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if (rerankSpace != nullptr) {
+            fullVectors.resize(index->max_elements_ * dimension);
+            quantization_file.read(reinterpret_cast<char*>(fullVectors.data()), count * dimension * sizeof(float));
+        }
+        if (!quantization_file) {
+            throw std::runtime_error("Truncated quantization file for index: " + name);
+        }
+    }
+}
+
+void IndexHandle::loadMetadata() {
+    dataStore.deserialize("indices/" + name + ".data");
+    hasMetadataBase = true;
+
+    // Changes since the full metadata file, unless the delta belongs to a different one
+    std::ifstream delta_file("indices/" + name + ".data.delta", std::ios::binary);
+    uint64_t baseSnapshot = 0;
+    if (delta_file.read(reinterpret_cast<char*>(&baseSnapshot), sizeof(baseSnapshot)) && baseSnapshot == metadataBaseSnapshot) {
+        dataStore.applyDelta(delta_file);
+    }
+}
+
+void IndexHandle::applyLogRecord(const WalRecord& record, ThreadPool& pool) {
+    // A snapshot written after the record may already hold some of its deletes
+    if (record.type == WalRecord::Type::DeleteDocuments) {
+        for (int id : record.ids) {
+            try {
+                deleteDocuments({id});
+            } catch (const std::invalid_argument&) {
+            }
+        }
+        return;
+    }
+    if (record.dimension != dimension) {
+        throw std::runtime_error("Vector dimension does not match index dimension");
+    }
+
+    AddDocumentsRequest request;
+    request.indexName = name;
+    request.ids = record.ids;
+    request.metadatas = record.metadatas;
+    request.packedVectors = record.vectors.data();
+    request.packedCount = record.ids.size();
+    request.packedDimension = record.dimension;
+    reserve(request.ids.size());
+    addDocuments(request, pool);
+}
+
+nlohmann::json IndexHandle::manifest(uint64_t walSequence, uint64_t snapshot, uint64_t metadataBase) const {
+    nlohmann::json state = settings;
+    state["walSequence"] = walSequence;
+    state["snapshotId"] = snapshot;
+    state["metadataBaseSnapshot"] = metadataBase;
+    return state;
+}
+
+void IndexHandle::save() {
+    auto snapshot = captureSnapshot();
+    if (snapshot == nullptr) {
+        throw std::runtime_error("A snapshot of index " + name + " is already running");
+    }
+    writeSnapshot(*snapshot);
+}
+
+std::shared_ptr<IndexSnapshot> IndexHandle::captureSnapshot() {
+    bool idle = false;
+    if (!snapshotRunning.compare_exchange_strong(idle, true)) {
+        return nullptr;
+    }
+
+    const std::string prefix = "indices/" + name;
+    auto snapshot = std::make_shared<IndexSnapshot>();
+    try {
+        // Writes change the index only while holding writeOrderMutex, and everything else that
+        // does holds mutex exclusively, so searches carry on while it is copied
+        std::lock_guard<std::mutex> writeOrderLock(writeOrderMutex);
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        snapshot->id = snapshotId + 1;
+
+        // Every logged mutation up to this sequence is applied. Later ones go to a new log file,
+        // the old one is deleted once the snapshot is written.
+        snapshot->walSequence = writeAheadLog != nullptr ? writeAheadLog->lastSequence() : replayedSequence;
+        if (writeAheadLog != nullptr) {
+            writeAheadLog->rotate("indices/" + name + ".wal." + std::to_string(snapshot->walSequence));
+        }
+
+        // Files holding the previous snapshot are patched. Inserts rewire links throughout the
+        // graph and deletes are flagged beside them, so the links of every element are copied,
+        // the rest of a record only when the element was inserted or updated since.
+        std::vector<hnswlib::tableint> dirty;
+        dirty.swap(snapshotDirtyElements);
+        bool dirtyAll = snapshotDirtyAll.exchange(false);
+        std::sort(dirty.begin(), dirty.end());
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+        size_t count = index->cur_element_count;
+        copy_index_head(*index, snapshot->graphHead, snapshot->graphLinkLists);
+        snapshot->graphPatched = !dirtyAll && can_patch_snapshot_file(prefix + ".bin", snapshot->graphHead, graphFileState);
+        if (snapshot->graphPatched) {
+            snapshot->graphPatch = record_patch(index->data_level0_memory_, count, index->size_data_per_element_,
+                                                index->offsetData_, dirty);
+        } else {
+            snapshot->graphLevel0.assign(index->data_level0_memory_, index->data_level0_memory_ + count * index->size_data_per_element_);
+        }
+        snapshot->labels = encode_labels(*index);
+
+        // SQ8 parameters, followed by the float vectors kept for reranking
+        if (quantizer != nullptr) {
+            std::ostringstream head;
+            quantizer->save(head);
+            uint64_t vectorCount = rerankSpace != nullptr ? count : 0;
+            head.write(reinterpret_cast<const char*>(&vectorCount), sizeof(vectorCount));
+            snapshot->quantized = true;
+            snapshot->quantizationHead = head.str();
+            snapshot->vectorsPatched = !dirtyAll && can_patch_snapshot_file(prefix + ".sq8", snapshot->quantizationHead, vectorsFileState);
+            if (snapshot->vectorsPatched) {
+                snapshot->vectorsPatch = record_patch(reinterpret_cast<const char*>(fullVectors.data()), vectorCount,
+                                                      dimension * sizeof(float), 0, dirty);
+            } else {
+                snapshot->vectors.assign(fullVectors.begin(), fullVectors.begin() + vectorCount * dimension);
+            }
+        }
+
+        // Metadata is written in full once the changes since the last full copy grow large,
+        // otherwise only those changes are. Its columns are copied here and serialized by writeSnapshot.
+        metadataChangedSinceBase |= dataStore.takeChangedIds();
+        snapshot->fullMetadata = !hasMetadataBase
+            || metadataChangedSinceBase.size() > dataStore.size() * SNAPSHOT_METADATA_DELTA_MAX_FRACTION;
+        snapshot->metadata = snapshot->fullMetadata ? dataStore.snapshot() : dataStore.snapshotDelta(metadataChangedSinceBase);
+        snapshot->manifest = manifest(snapshot->walSequence, snapshot->id,
+                                      snapshot->fullMetadata ? snapshot->id : metadataBaseSnapshot).dump();
+    } catch (const std::exception& e) {
+        snapshotDirtyAll = true;
+        finishSnapshot(e.what());
+        throw;
+    }
+
+    std::lock_guard<std::mutex> statusLock(snapshotStatusMutex);
+    snapshotState = "running";
+    snapshotError.clear();
+    snapshotIncremental = !graphFileState.blockHashes.empty();
+    snapshotMetadataDelta = !snapshot->fullMetadata;
+    snapshotProgress.reset(snapshot->size());
+    return snapshot;
+}
+
+void IndexHandle::writeSnapshot(IndexSnapshot& snapshot) {
+    const std::string prefix = "indices/" + name;
+    try {
+        std::filesystem::create_directories("indices");
+
+        // Written beside the old files and renamed over them, a memory mapped index may still be reading the old graph
+        if (snapshot.graphPatched) {
+            patch_snapshot_file(prefix + ".bin", snapshot.graphHead, snapshot.graphPatch, snapshot.graphLinkLists,
+                                graphFileState, snapshotProgress);
+        } else {
+            write_snapshot_file(prefix + ".bin", snapshot.graphHead, snapshot.graphLevel0.data(), snapshot.graphLevel0.size(),
+                                snapshot.graphLinkLists, graphFileState, snapshotProgress);
+        }
+        write_file_atomically(prefix + ".labels", snapshot.labels, snapshotProgress);
+        if (snapshot.vectorsPatched) {
+            patch_snapshot_file(prefix + ".sq8", snapshot.quantizationHead, snapshot.vectorsPatch, "", vectorsFileState,
+                                snapshotProgress);
+        } else if (snapshot.quantized) {
+            write_snapshot_file(prefix + ".sq8", snapshot.quantizationHead, reinterpret_cast<const char*>(snapshot.vectors.data()),
+                                snapshot.vectors.size() * sizeof(float), "", vectorsFileState, snapshotProgress);
+        }
+
+        std::ostringstream metadata;
+        if (!snapshot.fullMetadata) {
+            metadata.write(reinterpret_cast<const char*>(&metadataBaseSnapshot), sizeof(metadataBaseSnapshot));
+        }
+        snapshot.metadata.serialize(metadata);
+        std::string contents = metadata.str();
+        snapshotProgress.bytesTotal += contents.size();
+        if (snapshot.fullMetadata) {
+            write_file_atomically(prefix + ".data", contents, snapshotProgress);
+            std::filesystem::remove(prefix + ".data.delta");
+        } else {
+            write_file_atomically(prefix + ".data.delta", contents, snapshotProgress);
+        }
+
+        // The manifest is written last, until then a load uses the previous snapshot and replays the log from there
+        write_file_atomically(prefix + ".json", snapshot.manifest, snapshotProgress);
+        for (const auto& [segmentSequence, segmentPath] : log_segments(name)) {
+            if (segmentSequence <= snapshot.walSequence) {
+                std::filesystem::remove(segmentPath);
+            }
+        }
+        if (writeAheadLog == nullptr) {
+            std::filesystem::remove(prefix + ".wal");
+        }
+    } catch (const std::exception& e) {
+        // The elements this snapshot would have written are no longer tracked
+        snapshotDirtyAll = true;
+        finishSnapshot(e.what());
+        throw;
+    }
+
+    snapshotId = snapshot.id;
+    if (snapshot.fullMetadata) {
+        metadataBaseSnapshot = snapshot.id;
+        hasMetadataBase = true;
+        metadataChangedSinceBase.clear();
+    }
+    lastSnapshotSequence = snapshot.walSequence;
+    lastSnapshotId = snapshot.id;
+    finishSnapshot("");
+}
+
+void IndexHandle::finishSnapshot(const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(snapshotStatusMutex);
+        snapshotState = error.empty() ? "succeeded" : "failed";
+        snapshotError = error;
+    }
+    snapshotRunning = false;
+}
+
+nlohmann::json IndexHandle::snapshotStatus() const {
+    std::lock_guard<std::mutex> lock(snapshotStatusMutex);
+    nlohmann::json status;
+    status["state"] = snapshotState;
+    status["incremental"] = snapshotIncremental;
+    status["metadataDelta"] = snapshotMetadataDelta;
+    status["bytesTotal"] = snapshotProgress.bytesTotal.load();
+    status["bytesProcessed"] = snapshotProgress.bytesProcessed.load();
+    status["bytesWritten"] = snapshotProgress.bytesWritten.load();
+    status["bytesCopied"] = snapshotProgress.bytesCopied.load();
+    status["id"] = lastSnapshotId.load();
+    status["walSequence"] = lastSnapshotSequence.load();
+    if (!snapshotError.empty()) {
+        status["error"] = snapshotError;
+    }
+    return status;
+}
+
+bool IndexHandle::beginRebuild() {
+    bool idle = false;
+    if (!rebuildRunning.compare_exchange_strong(idle, true)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(rebuildStatusMutex);
+    rebuildState = "running";
+    rebuildError.clear();
+    rebuildElementsTotal = 0;
+    rebuildElementsInserted = 0;
+    rebuildDeletedDropped = 0;
+    rebuildWritesReplayed = 0;
+    return true;
+}
+
+void IndexHandle::rebuild(const RebuildIndexRequest& request, ThreadPool& pool) {
+    hnswlib::HierarchicalNSW<float>* rebuilt = nullptr;
+    try {
+        // The live elements as the graph stores them, with their float vectors when rerank is on
+        std::vector<int> labels;
+        std::vector<char> data;
+        std::vector<float> vectors;
+        size_t dataSize;
+        int M;
+        int efConstruction;
+        {
+            // Writes wait while the graph is copied and searches carry on, as for a snapshot
+            std::lock_guard<std::mutex> writeOrderLock(writeOrderMutex);
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            dataSize = index->data_size_;
+            M = request.M > 0 ? request.M : static_cast<int>(index->M_);
+            efConstruction = request.efConstruction > 0 ? request.efConstruction : static_cast<int>(index->ef_construction_);
+
+            size_t count = index->cur_element_count;
+            size_t live = count - index->num_deleted_;
+            labels.reserve(live);
+            data.reserve(live * dataSize);
+            vectors.reserve(rerankSpace != nullptr ? live * dimension : 0);
+            for (hnswlib::tableint internalId = 0; internalId < count; internalId++) {
+                if (index->isMarkedDeleted(internalId)) continue;
+                labels.push_back(static_cast<int>(index->getExternalLabel(internalId)));
+                const char* element = index->getDataByInternalId(internalId);
+                data.insert(data.end(), element, element + dataSize);
+                if (rerankSpace != nullptr) {
+                    const float* vector = &fullVectors[size_t(internalId) * dimension];
+                    vectors.insert(vectors.end(), vector, vector + dimension);
+                }
+            }
+            rebuildDeletedDropped = count - labels.size();
+
+            // Every write from here on is also applied to the new graph
+            capturingWrites = true;
+        }
+        rebuildElementsTotal = labels.size();
+
+        rebuilt = new hnswlib::HierarchicalNSW<float>(space, labels.size() + DEFAULT_INDEX_RESIZE_HEADROOM, M, efConstruction, 42, true);
+        std::vector<float> rebuiltVectors(rerankSpace != nullptr ? rebuilt->max_elements_ * dimension : 0);
+        size_t numChunks = (labels.size() + ADD_DOCUMENTS_CHUNK_SIZE - 1) / ADD_DOCUMENTS_CHUNK_SIZE;
+        pool.parallelFor(numChunks, [&](size_t chunk) {
+            size_t begin = chunk * ADD_DOCUMENTS_CHUNK_SIZE;
+            size_t end = std::min(begin + ADD_DOCUMENTS_CHUNK_SIZE, labels.size());
+            for (size_t i = begin; i < end; i++) {
+                hnswlib::tableint internalId = rebuilt->addPoint(&data[i * dataSize], labels[i], 0);
+                if (rerankSpace != nullptr) {
+                    std::memcpy(&rebuiltVectors[size_t(internalId) * dimension], &vectors[i * dimension], dimension * sizeof(float));
+                }
+            }
+            rebuildElementsInserted += end - begin;
+        }, numThreads);
+
+        // Catch up with the captured writes while writers carry on, then apply the remainder and
+        // swap while they wait
+        std::vector<char> code;
+        auto applyCaptured = [&]() {
+            std::vector<WalRecord> records;
+            {
+                std::lock_guard<std::mutex> captureLock(capturedWritesMutex);
+                records.swap(capturedWrites);
+            }
+            for (const auto& record : records) {
+                applyToRebuilt(record, *rebuilt, rebuiltVectors, code);
+            }
+            rebuildWritesReplayed += records.size();
+            return records.size();
+        };
+        for (int round = 0; round < REBUILD_CATCH_UP_ROUNDS && applyCaptured() > 0; round++) {
+        }
+
+        hnswlib::HierarchicalNSW<float>* retired;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            applyCaptured();
+            capturingWrites = false;
+            retired = index;
+            index = rebuilt;
+            rebuilt = nullptr;
+            mappedIndex = nullptr;
+            fullVectors.swap(rebuiltVectors);
+            std::vector<float>().swap(provisionalVectors);
+            snapshotDirtyAll = true;
+            settings["M"] = M;
+            settings["efConstruction"] = efConstruction;
+        }
+        delete retired;
+    } catch (const std::exception& e) {
+        {
+            std::lock_guard<std::mutex> writeOrderLock(writeOrderMutex);
+            capturingWrites = false;
+        }
+        {
+            std::lock_guard<std::mutex> captureLock(capturedWritesMutex);
+            capturedWrites.clear();
+        }
+        delete rebuilt;
+        finishRebuild(e.what());
+        throw;
+    }
+    finishRebuild("");
+}
+
+void IndexHandle::applyToRebuilt(const WalRecord& record, hnswlib::HierarchicalNSW<float>& rebuilt,
+                                 std::vector<float>& rebuiltVectors, std::vector<char>& code) const {
+    if (record.type == WalRecord::Type::DeleteDocuments) {
+        for (int id : record.ids) {
+            try {
+                rebuilt.markDelete(id);
+            } catch (const std::runtime_error&) {
+            }
+        }
+        return;
+    }
+
+    // Keep the headroom reserve() keeps, writers reserve against whichever graph is current
+    if (rebuilt.cur_element_count + record.ids.size() + DEFAULT_INDEX_RESIZE_HEADROOM > rebuilt.max_elements_) {
+        rebuilt.resizeIndex(rebuilt.cur_element_count + record.ids.size() + DEFAULT_INDEX_RESIZE_HEADROOM);
+        if (rerankSpace != nullptr) {
+            rebuiltVectors.resize(rebuilt.max_elements_ * dimension);
+        }
+    }
+    for (size_t i = 0; i < record.ids.size(); i++) {
+        insertVector(rebuilt, rebuiltVectors, &record.vectors[i * dimension], record.ids[i], code);
+    }
+}
+
+void IndexHandle::finishRebuild(const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(rebuildStatusMutex);
+        rebuildState = error.empty() ? "succeeded" : "failed";
+        rebuildError = error;
+    }
+    rebuildRunning = false;
+}
+
+nlohmann::json IndexHandle::rebuildStatus() const {
+    std::lock_guard<std::mutex> lock(rebuildStatusMutex);
+    nlohmann::json status;
+    status["state"] = rebuildState;
+    status["elementsTotal"] = rebuildElementsTotal.load();
+    status["elementsInserted"] = rebuildElementsInserted.load();
+    status["deletedDropped"] = rebuildDeletedDropped.load();
+    status["writesReplayed"] = rebuildWritesReplayed.load();
+    if (!rebuildError.empty()) {
+        status["error"] = rebuildError;
+    }
+    return status;
+}
+
+uint64_t IndexSnapshot::size() const {
+    return graphHead.size() + (graphPatched ? graphPatch.bodyLength() : graphLevel0.size()) + graphLinkLists.size()
+        + labels.size() + quantizationHead.size() + (vectorsPatched ? vectorsPatch.bodyLength() : vectors.size() * sizeof(float))
+        + manifest.size();
+}
+
+// Grow the index ahead of an insert of `incoming` elements. Resizing reallocates the
+// whole graph so it waits for in-flight searches and inserts on this index only.
+// Slots of deleted elements are reused by inserts, so only live elements count against capacity.
+void IndexHandle::reserve(size_t incoming) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (liveElements() + incoming + DEFAULT_INDEX_RESIZE_HEADROOM <= index->max_elements_) {
+            return;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (liveElements() + incoming + DEFAULT_INDEX_RESIZE_HEADROOM > index->max_elements_) {
+        if (mappedIndex != nullptr) {
+            mappedIndex->materialize();
+        }
+        index->resizeIndex((int)((float)index->max_elements_ + (float)index->max_elements_ * INDEX_GROWTH_FACTOR + (float)incoming));
+        if (rerankSpace != nullptr) {
+            fullVectors.resize(index->max_elements_ * dimension);
+        }
+    }
+}
+
+size_t IndexHandle::liveElements() const {
+    return index->cur_element_count - index->num_deleted_;
+}
+
+void IndexHandle::addDocuments(AddDocumentsRequest& request, ThreadPool& pool) {
+    size_t threads = request.numThreads > 0 ? request.numThreads : numThreads;
+    size_t count = request.ids.size();
+    // A repeated id ends up as its last occurrence, as if the batch were applied in turn, and no
+    // two workers insert the same id. Writes are ordered by writeOrderMutex, so neither does
+    // another request.
+    std::vector<size_t> positions = last_occurrences(request.ids);
+
+    std::lock_guard<std::mutex> writeOrderLock(writeOrderMutex);
+    // An SQ8 index learns its quantization range from the vectors it receives, each batch training
+    // it again until it has seen enough for the range to be final. A rebuild copying the graph
+    // keeps the parameters its copy was encoded with.
+    if (quantizer != nullptr && (!quantizer->trained() || quantizer->provisional()) && count > 0) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (!quantizer->trained() || (quantizer->provisional() && !capturingWrites)) {
+            trainQuantizer(request);
+        }
+    }
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    // A rebuild may have swapped in a smaller graph since the caller reserved room
+    while (liveElements() + count > index->max_elements_) {
+        lock.unlock();
+        reserve(count);
+        lock.lock();
+    }
+    if (writeAheadLog != nullptr) {
+        std::vector<const float*> vectors(count);
+        for (size_t i = 0; i < count; i++) {
+            vectors[i] = request.vectorAt(i);
+        }
+        writeAheadLog->appendAdd(request.ids, dimension, vectors, request.metadatas);
+    }
+    // Writers are ordered by writeOrderMutex and searches never read it, so it can grow here.
+    // Elements it does not hold yet, after a load or a rebuild, start out decoded.
+    bool keepProvisional = quantizer != nullptr && quantizer->provisional() && rerankSpace == nullptr;
+    if (keepProvisional) {
+        size_t known = provisionalVectors.size() / dimension;
+        provisionalVectors.resize((index->cur_element_count + count) * dimension);
+        for (hnswlib::tableint internalId = known; internalId < index->cur_element_count; internalId++) {
+            quantizer->decode(index->getDataByInternalId(internalId), &provisionalVectors[size_t(internalId) * dimension]);
+        }
+    }
+
+    // A deleted id is revived in its own slot, which an insert of a new id on another worker could
+    // claim meanwhile, so those are inserted one by one before the rest are spread over the workers
+    std::vector<size_t> revived;
+    std::vector<size_t> others;
+    {
+        std::lock_guard<std::mutex> lookupLock(index->label_lookup_lock);
+        for (size_t i : positions) {
+            auto it = index->label_lookup_.find(request.ids[i]);
+            bool deleted = it != index->label_lookup_.end() && index->isMarkedDeleted(it->second);
+            (deleted ? revived : others).push_back(i);
+        }
+    }
+    size_t numChunks = (others.size() + ADD_DOCUMENTS_CHUNK_SIZE - 1) / ADD_DOCUMENTS_CHUNK_SIZE;
+
+    auto insertPositions = [&](const size_t* first, const size_t* last, std::vector<hnswlib::tableint>& inserted) {
+        std::vector<std::pair<int, std::map<std::string, FieldValue>>> records;
+        records.reserve(last - first);
+        std::vector<char> code;
+        for (; first != last; ++first) {
+            size_t i = *first;
+            hnswlib::tableint internalId = insertVector(*index, fullVectors, request.vectorAt(i), request.ids[i], code);
+            inserted.push_back(internalId);
+            if (keepProvisional) {
+                std::memcpy(&provisionalVectors[size_t(internalId) * dimension], request.vectorAt(i), dimension * sizeof(float));
+            }
+            if (request.metadatas.size()) {
+                records.emplace_back(request.ids[i], std::move(request.metadatas[i]));
+            } else {
+                records.emplace_back(request.ids[i], std::map<std::string, FieldValue>());
+            }
+        }
+        dataStore.setMany(std::move(records));
+    };
+
+    // Elements the next snapshot writes whole. Past as many as there are elements, it writes level 0
+    // in full, as it also does if an insert fails part way.
+    std::vector<std::vector<hnswlib::tableint>> inserted(numChunks + 1);
+    try {
+        insertPositions(revived.data(), revived.data() + revived.size(), inserted[numChunks]);
+        pool.parallelFor(numChunks, [&](size_t chunk) {
+            size_t begin = chunk * ADD_DOCUMENTS_CHUNK_SIZE;
+            size_t end = std::min(begin + ADD_DOCUMENTS_CHUNK_SIZE, others.size());
+            insertPositions(others.data() + begin, others.data() + end, inserted[chunk]);
+        }, threads);
+    } catch (...) {
+        snapshotDirtyAll = true;
+        throw;
+    }
+    for (const auto& ids : inserted) {
+        snapshotDirtyElements.insert(snapshotDirtyElements.end(), ids.begin(), ids.end());
+    }
+    if (snapshotDirtyElements.size() > index->cur_element_count) {
+        snapshotDirtyAll = true;
+        std::vector<hnswlib::tableint>().swap(snapshotDirtyElements);
+    }
+
+    filterCache.documentsChanged(request.ids, dataStore);
+    metrics.documentsAdded.add(request.ids.size());
+
+    if (capturingWrites) {
+        WalRecord record;
+        record.type = WalRecord::Type::AddDocuments;
+        record.ids = request.ids;
+        record.dimension = dimension;
+        record.vectors.reserve(count * dimension);
+        for (size_t i = 0; i < count; i++) {
+            record.vectors.insert(record.vectors.end(), request.vectorAt(i), request.vectorAt(i) + dimension);
+        }
+        std::lock_guard<std::mutex> captureLock(capturedWritesMutex);
+        capturedWrites.push_back(std::move(record));
+    }
+}
+
+void IndexHandle::trainQuantizer(const AddDocumentsRequest& request) {
+    // Elements take their floats from the rerank vectors, or those kept while provisional. Ones
+    // the kept vectors do not hold yet are decoded.
+    size_t elements = index->cur_element_count;
+    size_t count = request.ids.size();
+    std::vector<float> vectors((elements + count) * dimension);
+    for (hnswlib::tableint internalId = 0; internalId < elements; internalId++) {
+        float* vector = &vectors[size_t(internalId) * dimension];
+        if (rerankSpace != nullptr) {
+            std::memcpy(vector, &fullVectors[size_t(internalId) * dimension], dimension * sizeof(float));
+        } else if ((size_t(internalId) + 1) * dimension <= provisionalVectors.size()) {
+            std::memcpy(vector, &provisionalVectors[size_t(internalId) * dimension], dimension * sizeof(float));
+        } else {
+            quantizer->decode(index->getDataByInternalId(internalId), vector);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        std::memcpy(&vectors[(elements + i) * dimension], request.vectorAt(i), dimension * sizeof(float));
+    }
+
+    // The links between existing elements stay as they were built, only their codes change
+    quantizer->train(vectors.data(), elements + count);
+    for (hnswlib::tableint internalId = 0; internalId < elements; internalId++) {
+        quantizer->encode(&vectors[size_t(internalId) * dimension], index->getDataByInternalId(internalId));
+    }
+    snapshotDirtyAll = true;
+    if (!quantizer->provisional()) {
+        std::vector<float>().swap(provisionalVectors);
+    }
+}
+
+hnswlib::tableint IndexHandle::insertVector(hnswlib::HierarchicalNSW<float>& target, std::vector<float>& targetVectors,
+                                            const float* vector, int label, std::vector<char>& code) const {
+    const void* data = traversalQuery(vector, code);
+    bool present = false;
+    bool deleted = false;
+    {
+        std::lock_guard<std::mutex> lock(target.label_lookup_lock);
+        auto it = target.label_lookup_.find(label);
+        if (it != target.label_lookup_.end()) {
+            present = true;
+            deleted = target.isMarkedDeleted(it->second);
+        }
+    }
+
+    // hnswlib's replacing insert is only safe for new labels. It would leave a live element with
+    // the same label behind, and a deleted one is revived in its own slot instead, so the slot
+    // is not later reused with the label still pointing at it.
+    hnswlib::tableint internalId;
+    if (present) {
+        if (deleted) {
+            target.unmarkDelete(label);
+        }
+        internalId = target.addPoint(data, label, 0);
+    } else {
+        // Takes the slot of a deleted element when there is one, relinking its neighbours
+        target.addPoint(data, label, true);
+        std::lock_guard<std::mutex> lock(target.label_lookup_lock);
+        internalId = target.label_lookup_.at(label);
+    }
+    if (rerankSpace != nullptr) {
+        std::memcpy(&targetVectors[size_t(internalId) * dimension], vector, dimension * sizeof(float));
+    }
+    return internalId;
+}
+
+void IndexHandle::deleteDocuments(const std::vector<int>& ids) {
+    std::lock_guard<std::mutex> writeOrderLock(writeOrderMutex);
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    // Every id is checked before anything is logged, so the batch is applied and logged whole
+    {
+        std::unordered_set<int> seen;
+        std::lock_guard<std::mutex> lookupLock(index->label_lookup_lock);
+        for (int id : ids) {
+            auto it = index->label_lookup_.find(id);
+            if (it == index->label_lookup_.end() || index->isMarkedDeleted(it->second)) {
+                throw std::invalid_argument("Document " + std::to_string(id) + " not found");
+            }
+            if (!seen.insert(id).second) {
+                throw std::invalid_argument("Document " + std::to_string(id) + " is listed more than once");
+            }
+        }
+    }
+    if (writeAheadLog != nullptr) {
+        writeAheadLog->appendDelete(ids);
+    }
+    for (int id : ids) {
+        index->markDelete(id);
+        dataStore.remove(id);
+    }
+    filterCache.documentsRemoved(ids);
+    metrics.documentsDeleted.add(ids.size());
+
+    if (capturingWrites) {
+        WalRecord record;
+        record.type = WalRecord::Type::DeleteDocuments;
+        record.ids = ids;
+        std::lock_guard<std::mutex> captureLock(capturedWritesMutex);
+        capturedWrites.push_back(std::move(record));
+    }
+}
+
+std::shared_ptr<const IdSet> IndexHandle::filterIds(const std::shared_ptr<FilterASTNode>& ast, const std::string& key) {
+    auto cachedIds = filterCache.get(key);
+    if (cachedIds != nullptr) {
+        return cachedIds;
+    }
+
+    uint64_t generation = filterCache.currentGeneration();
+    auto filteredIds = std::make_shared<const IdSet>(dataStore.filter(ast));
+    filterCache.put(key, ast, filteredIds, generation);
+    return filteredIds;
+}
+
+SearchPlan IndexHandle::planFor(size_t k, size_t ef, const PreparedFilter* filter) const {
+    SearchPlanInputs inputs;
+    inputs.elementCount = liveElements();
+    inputs.dimension = dimension;
+    inputs.maxM0 = index->maxM0_;
+    inputs.k = k;
+    inputs.ef = ef;
+    if (filter != nullptr) {
+        inputs.filtered = true;
+        inputs.selectivity = filter->selectivity;
+        inputs.filterCached = filter->cached;
+    }
+    return planSearch(inputs);
+}
+
+SearchResult IndexHandle::search(const float* query, size_t k, size_t ef, PreparedFilter* filter, SearchPlan* plan) {
+    SearchPlan chosen = planFor(k, ef, filter);
+    metrics.searchPlans[static_cast<size_t>(chosen.type)].add();
+    if (plan != nullptr) {
+        *plan = chosen;
+    }
+
+    std::vector<char> buffer;
+    const void* traversal = traversalQuery(query, buffer);
+    if (chosen.type == SearchPlanType::Exact) {
+        return exactSearch(query, traversal, k, filter->ids());
+    }
+    return graphSearch(query, traversal, k, chosen, filter, descend(traversal));
+}
+
+void IndexHandle::searchGroup(std::vector<SearchTask*>& tasks, ThreadPool& pool) {
+    std::map<std::string, std::vector<SearchTask*>> exactGroups;
+    std::vector<SearchTask*> graphTasks;
+    for (SearchTask* task : tasks) {
+        traversalQuery(task->query, task->encodedQuery);
+        task->plan = planFor(task->k, task->ef, task->filter);
+        metrics.searchPlans[static_cast<size_t>(task->plan.type)].add();
+        if (task->plan.type == SearchPlanType::Exact) {
+            exactGroups[task->filter->key].push_back(task);
+        } else {
+            graphTasks.push_back(task);
+        }
+    }
+
+    for (auto& [key, group] : exactGroups) {
+        exactSearchGroup(group, group.front()->filter->ids(), pool);
+    }
+
+    // Order graph searches by the base layer node their descent ends at, so searches
+    // starting in the same region of the graph run back to back on the same thread
+    std::vector<hnswlib::tableint> entries(graphTasks.size());
+    pool.parallelFor(graphTasks.size(), [&](size_t i) {
+        entries[i] = descend(taskTraversal(*graphTasks[i]));
+    });
+    std::vector<size_t> order(graphTasks.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&entries](size_t a, size_t b) { return entries[a] < entries[b]; });
+
+    size_t slices = std::min(graphTasks.size(), pool.size() + 1);
+    pool.parallelFor(slices, [&](size_t slice) {
+        size_t begin = slice * graphTasks.size() / slices;
+        size_t end = (slice + 1) * graphTasks.size() / slices;
+        for (size_t i = begin; i < end; i++) {
+            SearchTask* task = graphTasks[order[i]];
+            task->result = graphSearch(task->query, taskTraversal(*task), task->k, task->plan, task->filter, entries[order[i]]);
+        }
+    });
+}
+
+const void* IndexHandle::traversalQuery(const float* query, std::vector<char>& buffer) const {
+    if (quantizer == nullptr) {
+        return query;
+    }
+    buffer.resize(quantizer->get_data_size());
+    quantizer->encode(query, buffer.data());
+    return buffer.data();
+}
+
+const void* IndexHandle::taskTraversal(const SearchTask& task) const {
+    return quantizer != nullptr ? static_cast<const void*>(task.encodedQuery.data()) : static_cast<const void*>(task.query);
+}
+
+float IndexHandle::exactDistance(const float* query, const void* traversal, hnswlib::tableint internalId) const {
+    if (rerankSpace != nullptr) {
+        return rerankSpace->get_dist_func()(query, &fullVectors[size_t(internalId) * dimension], rerankSpace->get_dist_func_param());
+    }
+    return index->fstdistfunc_(traversal, index->getDataByInternalId(internalId), index->dist_func_param_);
+}
+
+std::vector<float> IndexHandle::getVector(int id) const {
+    if (quantizer == nullptr) {
+        return index->getDataByLabel<float>(id);
+    }
+
+    hnswlib::tableint internalId;
+    {
+        std::lock_guard<std::mutex> lock(index->label_lookup_lock);
+        auto it = index->label_lookup_.find(id);
+        if (it == index->label_lookup_.end() || index->isMarkedDeleted(it->second)) {
+            throw std::runtime_error("Label not found");
+        }
+        internalId = it->second;
+    }
+
+    std::vector<float> vector(dimension);
+    if (rerankSpace != nullptr) {
+        std::memcpy(vector.data(), &fullVectors[size_t(internalId) * dimension], dimension * sizeof(float));
+    } else {
+        quantizer->decode(index->getDataByInternalId(internalId), vector.data());
+    }
+    return vector;
+}
+
+void IndexHandle::prewarm(size_t warmupQueries) {
+    size_t count;
+    std::vector<char> traversal;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (mappedIndex != nullptr) {
+            mappedIndex->prewarm();
+        }
+        count = index->cur_element_count;
+        traversal.resize(index->data_size_);
+    }
+
+    // Stored vectors spread over the index stand in for queries, in the form the graph keeps them.
+    // A rebuild may swap in a smaller graph between queries, so each is bounded by the current one.
+    size_t queries = std::min(warmupQueries, count);
+    for (size_t i = 0; i < queries; i++) {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        size_t current = index->cur_element_count;
+        if (current == 0) {
+            break;
+        }
+        hnswlib::tableint internalId = static_cast<hnswlib::tableint>(std::min(i * count / queries, current - 1));
+        std::memcpy(traversal.data(), index->getDataByInternalId(internalId), traversal.size());
+        index->searchBaseLayerST<false>(descend(traversal.data()), traversal.data(), PREWARM_SEARCH_EF);
+    }
+    ready = true;
+}
+
+hnswlib::tableint IndexHandle::descend(const void* traversal) const {
+    hnswlib::tableint currObj = index->enterpoint_node_;
+    if (index->cur_element_count == 0) {
+        return currObj;
+    }
+
+    // Greedy descent through the upper layers to an entry point on the base layer
+    float curdist = index->fstdistfunc_(traversal, index->getDataByInternalId(currObj), index->dist_func_param_);
+    long hops = 0;
+    long distanceComputations = 0;
+    for (int level = index->maxlevel_; level > 0; level--) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            hnswlib::linklistsizeint* data = index->get_linklist(currObj, level);
+            int size = index->getListCount(data);
+            hops++;
+            distanceComputations += size;
+            auto* neighbours = reinterpret_cast<hnswlib::tableint*>(data + 1);
+            for (int i = 0; i < size; i++) {
+                float d = index->fstdistfunc_(traversal, index->getDataByInternalId(neighbours[i]), index->dist_func_param_);
+                if (d < curdist) {
+                    curdist = d;
+                    currObj = neighbours[i];
+                    changed = true;
+                }
+            }
+        }
+    }
+    if (collectGraphMetrics) {
+        index->metric_hops += hops;
+        index->metric_distance_computations += distanceComputations;
+    }
+    return currObj;
+}
+
+SearchResult IndexHandle::graphSearch(const float* query, const void* traversal, size_t k, const SearchPlan& plan, PreparedFilter* filter, hnswlib::tableint entry) {
+    switch (plan.type) {
+        case SearchPlanType::FilteredGraph: {
+            FilterIdsInSet isIdAllowed(filter->ids());
+            return baseLayerSearch(query, traversal, k, plan.ef, &isIdAllowed, entry);
+        }
+        case SearchPlanType::PredicateGraph: {
+            FilterMatchesPredicate isIdAllowed(dataStore, filter->ast);
+            return baseLayerSearch(query, traversal, k, plan.ef, &isIdAllowed, entry);
+        }
+        default:
+            return baseLayerSearch(query, traversal, k, plan.ef, nullptr, entry);
+    }
+}
+
+SearchResult IndexHandle::baseLayerSearch(const float* query, const void* traversal, size_t k, size_t ef, hnswlib::BaseFilterFunctor* isIdAllowed, hnswlib::tableint entry) const {
+    SearchResult result;
+    if (index->cur_element_count == 0) {
+        return result;
+    }
+
+    size_t candidates = rerankSpace != nullptr ? k * SQ8_RERANK_CANDIDATE_FACTOR : k;
+    size_t searchEf = std::max(ef, candidates);
+    auto topCandidates = collectGraphMetrics
+        ? search_base_layer<true>(*index, entry, traversal, searchEf, isIdAllowed)
+        : search_base_layer<false>(*index, entry, traversal, searchEf, isIdAllowed);
+    while (topCandidates.size() > candidates) {
+        topCandidates.pop();
+    }
+    while (!topCandidates.empty()) {
+        auto [distance, internalId] = topCandidates.top();
+        if (rerankSpace != nullptr) {
+            distance = exactDistance(query, traversal, internalId);
+        }
+        keep_nearest(result, k, distance, index->getExternalLabel(internalId));
+        topCandidates.pop();
+    }
+    return result;
+}
+
+std::vector<std::pair<hnswlib::tableint, int>> IndexHandle::resolveElements(const IdSet& ids) const {
+    std::vector<std::pair<hnswlib::tableint, int>> elements;
+    elements.reserve(ids.size());
+    std::lock_guard<std::mutex> lock(index->label_lookup_lock);
+    for (int id : ids) {
+        auto it = index->label_lookup_.find(id);
+        if (it != index->label_lookup_.end()) {
+            elements.emplace_back(it->second, id);
+        }
+    }
+    return elements;
+}
+
+SearchResult IndexHandle::exactSearch(const float* query, const void* traversal, size_t k, const IdSet& ids) const {
+    SearchResult result;
+    for (const auto& [internalId, id] : resolveElements(ids)) {
+        if (index->isMarkedDeleted(internalId)) continue;
+        keep_nearest(result, k, exactDistance(query, traversal, internalId), id);
+    }
+    return result;
+}
+
+// Every query of the group is scored against a block of vectors before moving to the next
+// block, so each vector is read from memory once per group rather than once per query
+void IndexHandle::exactSearchGroup(const std::vector<SearchTask*>& tasks, const IdSet& ids, ThreadPool& pool) const {
+    auto elements = resolveElements(ids);
+    size_t numChunks = (elements.size() + EXACT_SEARCH_CHUNK_SIZE - 1) / EXACT_SEARCH_CHUNK_SIZE;
+    std::vector<std::vector<SearchResult>> partial(numChunks, std::vector<SearchResult>(tasks.size()));
+
+    pool.parallelFor(numChunks, [&](size_t chunk) {
+        size_t chunkEnd = std::min((chunk + 1) * EXACT_SEARCH_CHUNK_SIZE, elements.size());
+        auto& results = partial[chunk];
+        for (size_t block = chunk * EXACT_SEARCH_CHUNK_SIZE; block < chunkEnd; block += EXACT_SEARCH_BLOCK_SIZE) {
+            size_t blockEnd = std::min(block + EXACT_SEARCH_BLOCK_SIZE, chunkEnd);
+            for (size_t t = 0; t < tasks.size(); t++) {
+                const float* query = tasks[t]->query;
+                const void* traversal = taskTraversal(*tasks[t]);
+                for (size_t e = block; e < blockEnd; e++) {
+                    const auto& [internalId, id] = elements[e];
+                    if (index->isMarkedDeleted(internalId)) continue;
+                    keep_nearest(results[t], tasks[t]->k, exactDistance(query, traversal, internalId), id);
+                }
+            }
+        }
+    });
+
+    for (size_t t = 0; t < tasks.size(); t++) {
+        SearchResult& result = tasks[t]->result;
+        result = SearchResult();
+        for (auto& chunkResults : partial) {
+            auto& chunkResult = chunkResults[t];
+            while (!chunkResult.empty()) {
+                keep_nearest(result, tasks[t]->k, chunkResult.top().first, chunkResult.top().second);
+                chunkResult.pop();
+            }
+        }
+    }
+}
+
+PreparedFilter::PreparedFilter(IndexHandle& handle, const std::string& filter)
+    : ast(parseFiltersCached(filter)), key(normalizeFilter(ast)), handle(handle) {
+    materialized = handle.filterCache.get(key);
+    cached = materialized != nullptr;
+    (cached ? handle.metrics.filterCacheHits : handle.metrics.filterCacheMisses).add();
+    if (cached) {
+        selectivity = static_cast<double>(materialized->size()) / std::max<size_t>(1, handle.dataStore.size());
+    } else {
+        selectivity = handle.dataStore.estimateSelectivity(ast);
+    }
+}
+
+const IdSet& PreparedFilter::ids() {
+    std::call_once(materializeOnce, [this]() {
+        if (materialized == nullptr) {
+            materialized = handle.filterIds(ast, key);
+        }
+    });
+    return *materialized;
+}
+
+std::vector<std::string> saved_index_names() {
+    std::vector<std::string> names;
+    if (!std::filesystem::is_directory("indices")) {
+        return names;
+    }
+    for (const auto& entry : std::filesystem::directory_iterator("indices")) {
+        if (entry.is_regular_file() && entry.path().extension() == ".json" && !is_shard_name(entry.path().stem().string())) {
+            names.push_back(entry.path().stem().string());
+        }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+bool index_on_disk(const std::string &indexName) {
+    for (const auto& suffix : INDEX_FILE_SUFFIXES) {
+        if (std::filesystem::exists("indices/" + indexName + suffix)) {
+            return true;
+        }
+    }
+    return !log_segments(indexName).empty();
+}
+
+void remove_index_from_disk(const std::string &indexName) {
+    for (const auto& suffix : INDEX_FILE_SUFFIXES) {
+        std::filesystem::remove("indices/" + indexName + suffix);
+    }
+    for (const auto& [segmentSequence, segmentPath] : log_segments(indexName)) {
+        std::filesystem::remove(segmentPath);
+    }
+}
@@ -0,0 +1,323 @@
+// index_handle.hpp
+#ifndef INDEX_HANDLE_HPP
+#define INDEX_HANDLE_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hnswlib/hnswlib.h"
+#include "nlohmann/json.hpp"
+#include "data_store.hpp"
+#include "id_set.hpp"
+#include "models.hpp"
+#include "query_planner.hpp"
+#include "request_coalescer.hpp"
+#include "sq8_space.hpp"
+#include "filter_cache.hpp"
+#include "mapped_index.hpp"
+#include "metrics.hpp"
+#include "snapshot_writer.hpp"
+#include "thread_pool.hpp"
+#include "write_ahead_log.hpp"
+
+#define DEFAULT_INDEX_SIZE 100000
+#define DEFAULT_INDEX_RESIZE_HEADROOM 10000
+#define INDEX_GROWTH_FACTOR 2.0
+#define MAX_FILTER_CACHE_SIZE 1000
+#define ADD_DOCUMENTS_CHUNK_SIZE 256
+// Vectors per parallel chunk, and per block scored against every query of a group, in exact search
+#define EXACT_SEARCH_CHUNK_SIZE 4096
+#define EXACT_SEARCH_BLOCK_SIZE 64
+// SQ8 graph searches collect this many times k candidates to rerank with float vectors
+#define SQ8_RERANK_CANDIDATE_FACTOR 4
+// ef of the searches run to warm up an index after it is loaded
+#define PREWARM_SEARCH_EF 64
+// Snapshots write metadata in full once more than this fraction of documents changed since the last full copy
+#define SNAPSHOT_METADATA_DELTA_MAX_FRACTION 0.25
+// Rounds of applying writes captured during a rebuild before the final round, which blocks writers
+#define REBUILD_CATCH_UP_ROUNDS 8
+
+using SearchResult = std::priority_queue<std::pair<float, hnswlib::labeltype>>;
+
+// Add a candidate to a max-heap holding the k nearest seen so far
+void keep_nearest(SearchResult& result, size_t k, float distance, hnswlib::labeltype label);
+
+// Functor to filter results with a set of IDs
+class FilterIdsInSet : public hnswlib::BaseFilterFunctor {
+    public:
+    const IdSet& ids;
+    FilterIdsInSet(const IdSet& ids) : ids(ids) {}
+    bool operator()(hnswlib::labeltype label_id) {
+        return ids.contains(static_cast<int>(label_id));
+    }
+};
+
+// Functor to filter results by evaluating a filter against each candidate's metadata.
+// The filter is bound to the store and the store locked once per search rather than once per
+// candidate, so the store must not be locked again while the functor lives.
+class FilterMatchesPredicate : public hnswlib::BaseFilterFunctor {
+    public:
+    DataStore& dataStore;
+    BoundFilter filter;
+    std::shared_lock<std::shared_mutex> lock;
+    FilterMatchesPredicate(DataStore& dataStore, const std::shared_ptr<FilterASTNode>& filters)
+        : dataStore(dataStore), filter(dataStore.bind(filters)), lock(dataStore.sharedLock()) {}
+    bool operator()(hnswlib::labeltype label_id) {
+        return dataStore.matchesFilterUnlocked(static_cast<int>(label_id), filter);
+    }
+};
+
+class PreparedFilter;
+
+// One search of a group executed together by IndexHandle::searchGroup
+struct SearchTask {
+    const float* query = nullptr;
+    size_t k = 0;
+    size_t ef = 0;
+    PreparedFilter* filter = nullptr;
+    SearchResult result;
+    SearchPlan plan;
+    std::vector<char> encodedQuery; // query as SQ8 codes, filled by searchGroup
+};
+
+// Point in time copy of everything a snapshot writes, taken while writes to the index wait
+// and written to disk once they carry on
+struct IndexSnapshot {
+    uint64_t id = 0;
+    uint64_t walSequence = 0; // last logged mutation the snapshot contains
+    std::string manifest;     // settings file contents
+    std::string graphHead;
+    // Level 0 in full, or as a patch of the previous snapshot's: the links of every element and
+    // whole records of the elements inserted or updated since
+    bool graphPatched = false;
+    std::vector<char> graphLevel0;
+    RecordPatch graphPatch;
+    std::string graphLinkLists;
+    std::string labels;
+    bool quantized = false;
+    std::string quantizationHead; // SQ8 parameters and the number of float vectors
+    bool vectorsPatched = false;  // as graphPatched, for the float vectors
+    std::vector<float> vectors;   // float vectors kept for reranking
+    RecordPatch vectorsPatch;
+    bool fullMetadata = true;     // metadata holds the whole data store, otherwise the changes since the last full copy
+    MetadataSnapshot metadata;
+
+    // Bytes to write, but for the metadata, which is only serialized when it is written
+    uint64_t size() const;
+};
+
+// Everything that belongs to a single index. Handles are reference counted so a request
+// that looked one up keeps it alive even if /delete_index drops it from the registry.
+class IndexHandle {
+public:
+    IndexHandle(const std::string& name, const nlohmann::json& settings);
+    ~IndexHandle();
+
+    // With the log enabled, a created index is logged from its first insert and a loaded index
+    // replays its log on top of the snapshot. pool reads the graph and the metadata in parallel
+    // and runs the replayed inserts.
+    static std::shared_ptr<IndexHandle> create(const IndexRequest& request, const nlohmann::json& settings, const WalOptions& wal);
+    static std::shared_ptr<IndexHandle> load(const LoadIndexRequest& request, ThreadPool& pool, const WalOptions& wal);
+
+    // Capture and write a snapshot on the calling thread. Throws if one is already running.
+    void save();
+    // Copy the index while writes wait, searches carry on, and move the log aside. Returns null if a
+    // snapshot is already running, otherwise one is running until writeSnapshot is called with the result.
+    std::shared_ptr<IndexSnapshot> captureSnapshot();
+    // Write a captured snapshot without holding the index lock. Files are written beside the old
+    // ones and renamed over them, graph and vector files only rewrite blocks that changed since
+    // the last snapshot. Log files the snapshot covers are deleted once it is complete.
+    void writeSnapshot(IndexSnapshot& snapshot);
+    // State and progress of the last snapshot, for /index_status
+    nlohmann::json snapshotStatus() const;
+
+    // Mark a rebuild as running. Returns false if one already is, otherwise rebuild must be called next.
+    bool beginRebuild();
+    // Build a new graph from the live elements, with a new M and efConstruction when given, while
+    // the current graph keeps serving. Writes made meanwhile are captured and applied to the new
+    // graph, which then replaces the current one under a brief exclusive lock.
+    void rebuild(const RebuildIndexRequest& request, ThreadPool& pool);
+    // State and progress of the last rebuild, for /index_status
+    nlohmann::json rebuildStatus() const;
+    void reserve(size_t incoming);
+    // Elements in the graph that are not marked deleted. Callers hold mutex.
+    size_t liveElements() const;
+    // Insert a batch of documents, split into chunks across up to numThreads workers of pool
+    void addDocuments(AddDocumentsRequest& request, ThreadPool& pool);
+    // Mark ids deleted. Throws std::invalid_argument, before logging or deleting any of them, if an
+    // id is not in the index or is listed twice.
+    void deleteDocuments(const std::vector<int>& ids);
+    // Apply a logged mutation, replayed from the log or streamed from a primary
+    void applyLogRecord(const WalRecord& record, ThreadPool& pool);
+
+    // Evaluate a parsed filter against the data store, going through the filter cache.
+    // The result is shared with the cache and must not be modified.
+    std::shared_ptr<const IdSet> filterIds(const std::shared_ptr<FilterASTNode>& ast, const std::string& key);
+    // Nearest neighbours of query, restricted to filter when given. The way the filter is applied
+    // is chosen by planSearch and written to plan when given. Callers hold mutex shared.
+    SearchResult search(const float* query, size_t k, size_t ef, PreparedFilter* filter, SearchPlan* plan = nullptr);
+    // Run a group of searches together. Exact searches sharing a filter share one pass over the
+    // vectors and graph searches are ordered by where they enter the base layer. Callers hold mutex shared.
+    void searchGroup(std::vector<SearchTask*>& tasks, ThreadPool& pool);
+    // Vector stored for a label, decoded from its codes for SQ8 indices without rerank vectors
+    std::vector<float> getVector(int id) const;
+    // Fault in a memory mapped graph and search with warmupQueries of the stored vectors, then mark
+    // the index ready. Runs in the background after a load, searches are served while it runs.
+    void prewarm(size_t warmupQueries);
+
+    const std::string name;
+    nlohmann::json settings;
+    hnswlib::SpaceInterface<float>* space = nullptr;
+    hnswlib::HierarchicalNSW<float>* index = nullptr;
+    // Same object as index when it was loaded with mmap
+    MappedHierarchicalNSW* mappedIndex = nullptr;
+    // Set for SQ8 indices, where it is also space and the graph holds int8 codes
+    SQ8Space* quantizer = nullptr;
+    // Float space and vectors, by internal id, used to rerank SQ8 candidates. Null when rerank is off.
+    hnswlib::SpaceInterface<float>* rerankSpace = nullptr;
+    std::vector<float> fullVectors;
+    // Float vectors, by internal id, of the elements added while the quantizer is provisional and
+    // rerank is off, to train it again on. Cleared once it is final, or by a rebuild.
+    std::vector<float> provisionalVectors;
+    DataStore dataStore;
+    size_t dimension = 0;
+    size_t numThreads = 0; // threads used to insert a batch, 0 uses every worker
+    std::atomic<bool> ready{true}; // false until a requested prewarm has finished
+
+    IndexMetrics metrics;
+    // Graph searches add their hops and distance computations to hnswlib's metric_hops and
+    // metric_distance_computations. Off by default as hnswlib counts every hop with a shared atomic.
+    bool collectGraphMetrics = false;
+
+    FilterCache filterCache;
+
+    // Shared for searches and inserts (hnswlib supports concurrent addPoint),
+    // exclusive for operations that touch the whole index such as resize and rebuild
+    std::shared_mutex mutex;
+
+    // Groups concurrent /search calls on this index when coalescing is enabled
+    RequestCoalescer<SearchTask> searchCoalescer;
+
+    // Null when the log is disabled. Appended under writeOrderMutex, so holding that means every
+    // logged mutation has been applied.
+    std::unique_ptr<WriteAheadLog> writeAheadLog;
+    // Held by a write from its log append until it is applied, so writes to the same ids take
+    // effect in the order they are logged and replayed. Taken before mutex.
+    std::mutex writeOrderMutex;
+
+private:
+    // Parts of load run in parallel. loadGraph also reads the SQ8 file, which is sized by the graph.
+    void loadGraph(bool memoryMap, bool hasSnapshot, int M, int efConstruction);
+    void loadMetadata();
+    // Train the quantizer on every element and the batch, and encode the elements again with the
+    // new parameters. Callers hold mutex exclusively.
+    void trainQuantizer(const AddDocumentsRequest& request);
+    // Add vector to target under label, keeping its float copy in targetVectors when rerank is on.
+    // A new label fills the slot of a deleted element when there is one, an existing label is
+    // updated in place. Whether the label is present is checked before inserting, so a label must
+    // not be inserted by two threads at once. Nor may a deleted label be revived while another
+    // thread inserts a new label, which may claim the slot being revived.
+    hnswlib::tableint insertVector(hnswlib::HierarchicalNSW<float>& target, std::vector<float>& targetVectors,
+                                   const float* vector, int label, std::vector<char>& code) const;
+    // Apply a write captured during a rebuild to the graph being built
+    void applyToRebuilt(const WalRecord& record, hnswlib::HierarchicalNSW<float>& rebuilt, std::vector<float>& rebuiltVectors,
+                        std::vector<char>& code) const;
+    void finishRebuild(const std::string& error);
+    nlohmann::json manifest(uint64_t walSequence, uint64_t snapshot, uint64_t metadataBase) const;
+    void finishSnapshot(const std::string& error);
+    // Last sequence replayed on load, recorded in snapshots taken while the log is disabled
+    uint64_t replayedSequence = 0;
+
+    // Internal ids of the elements inserted or updated since a snapshot was last captured, possibly
+    // repeated, guarded by writeOrderMutex. The next snapshot writes level 0 in full instead while
+    // snapshotDirtyAll is set: after a load, once the elements were encoded again or the graph
+    // replaced, and after a snapshot failed.
+    std::vector<hnswlib::tableint> snapshotDirtyElements;
+    std::atomic<bool> snapshotDirtyAll{true};
+
+    // Only one snapshot runs at a time, so the fields below are only touched by its capture and write
+    std::atomic<bool> snapshotRunning{false};
+    uint64_t snapshotId = 0;
+    uint64_t metadataBaseSnapshot = 0; // snapshot whose metadata file is a full copy
+    bool hasMetadataBase = false;
+    IdSet metadataChangedSinceBase;
+    SnapshotFileState graphFileState;
+    SnapshotFileState vectorsFileState;
+
+    mutable std::mutex snapshotStatusMutex;
+    std::string snapshotState = "idle"; // idle, running, succeeded or failed
+    std::string snapshotError;
+    bool snapshotIncremental = false;
+    bool snapshotMetadataDelta = false;
+    std::atomic<uint64_t> lastSnapshotSequence{0};
+    std::atomic<uint64_t> lastSnapshotId{0};
+    SnapshotProgress snapshotProgress;
+
+    // Set by a rebuild once it has copied the graph, under writeOrderMutex, and cleared when it swaps
+    // the new one in under an exclusive lock, so a write sees it unchanged from its log append until
+    // it is applied
+    std::atomic<bool> capturingWrites{false};
+    std::mutex capturedWritesMutex;
+    std::vector<WalRecord> capturedWrites;
+
+    std::atomic<bool> rebuildRunning{false};
+    mutable std::mutex rebuildStatusMutex;
+    std::string rebuildState = "idle"; // idle, running, succeeded or failed
+    std::string rebuildError;
+    std::atomic<uint64_t> rebuildElementsTotal{0};
+    std::atomic<uint64_t> rebuildElementsInserted{0};
+    std::atomic<uint64_t> rebuildDeletedDropped{0};
+    std::atomic<uint64_t> rebuildWritesReplayed{0};
+
+    void initSpace(const std::string& spaceType, const std::string& quantization, bool rerank);
+    // The query in the form the graph stores vectors, encoded into buffer for SQ8 indices
+    const void* traversalQuery(const float* query, std::vector<char>& buffer) const;
+    // Traversal query of a task whose encodedQuery has been filled
+    const void* taskTraversal(const SearchTask& task) const;
+    // Full precision distance when float vectors are kept, otherwise the distance the graph uses
+    float exactDistance(const float* query, const void* traversal, hnswlib::tableint internalId) const;
+
+    SearchPlan planFor(size_t k, size_t ef, const PreparedFilter* filter) const;
+    // Greedy descent through the upper layers, returns the base layer entry point for query
+    hnswlib::tableint descend(const void* traversal) const;
+    // hnswlib's searchKnn split at the base layer, with a per query ef instead of the index wide one
+    SearchResult graphSearch(const float* query, const void* traversal, size_t k, const SearchPlan& plan, PreparedFilter* filter, hnswlib::tableint entry);
+    SearchResult baseLayerSearch(const float* query, const void* traversal, size_t k, size_t ef, hnswlib::BaseFilterFunctor* isIdAllowed, hnswlib::tableint entry) const;
+    // Internal ids of the labels in ids that are present in the index
+    std::vector<std::pair<hnswlib::tableint, int>> resolveElements(const IdSet& ids) const;
+    // Brute force over the vectors of ids
+    SearchResult exactSearch(const float* query, const void* traversal, size_t k, const IdSet& ids) const;
+    void exactSearchGroup(const std::vector<SearchTask*>& tasks, const IdSet& ids, ThreadPool& pool) const;
+};
+
+// A parsed filter with its estimated selectivity. The matching ids are only built if a plan
+// needs them, and then only once, so the queries of a batch that share a filter share the work.
+class PreparedFilter {
+public:
+    PreparedFilter(IndexHandle& handle, const std::string& filter);
+
+    const IdSet& ids();
+
+    std::shared_ptr<FilterASTNode> ast;
+    std::string key;
+    double selectivity = 1.0;
+    bool cached = false; // the result was already in the filter cache
+
+private:
+    IndexHandle& handle;
+    std::once_flag materializeOnce;
+    std::shared_ptr<const IdSet> materialized;
+};
+
+// Names of the indices with settings in the indices directory, which /load_index can load.
+// Shards of a sharded index are loaded with it and are not listed.
+std::vector<std::string> saved_index_names();
+// True if any file of the index, saved or logged, is in the indices directory
+bool index_on_disk(const std::string &indexName);
+void remove_index_from_disk(const std::string &indexName);
+
+#endif // INDEX_HANDLE_HPP
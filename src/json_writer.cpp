@@ -0,0 +1,129 @@
+// json_writer.cpp
+#include "json_writer.hpp"
+#include <cmath>
+
+void JsonWriter::separate() {
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (!hasItems.empty()) {
+        if (hasItems.back()) {
+            out += ',';
+        }
+        hasItems.back() = true;
+    }
+}
+
+JsonWriter& JsonWriter::beginObject() {
+    separate();
+    out += '{';
+    hasItems.push_back(false);
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+    out += '}';
+    hasItems.pop_back();
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+    separate();
+    out += '[';
+    hasItems.push_back(false);
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+    out += ']';
+    hasItems.pop_back();
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(std::string_view name) {
+    value(name);
+    out += ':';
+    afterKey = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(std::string_view value) {
+    static const char HEX[] = "0123456789abcdef";
+    separate();
+    out += '"';
+    size_t plain = 0; // start of the run of characters that need no escaping
+    for (size_t i = 0; i < value.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(value[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(value.data() + plain, i - plain);
+        plain = i + 1;
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default:
+                out += "\\u00";
+                out += HEX[c >> 4];
+                out += HEX[c & 0xF];
+        }
+    }
+    out.append(value.data() + plain, value.size() - plain);
+    out += '"';
+    return *this;
+}
+
+template <typename T>
+void JsonWriter::writeFloat(T value) {
+    separate();
+    if (!std::isfinite(value)) {
+        out += "null";
+        return;
+    }
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    std::string_view digits(buffer, result.ptr - buffer);
+    out += digits;
+    if (digits.find_first_of(".e") == std::string_view::npos) {
+        out += ".0";
+    }
+}
+
+JsonWriter& JsonWriter::value(double value) {
+    writeFloat(value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(float value) {
+    writeFloat(value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(bool value) {
+    separate();
+    out += value ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const FieldValue& value) {
+    std::visit([this](const auto& v) { this->value(v); }, value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::null() {
+    separate();
+    out += "null";
+    return *this;
+}
+
+std::string& json_response_buffer() {
+    thread_local std::string buffer;
+    buffer.clear();
+    return buffer;
+}
@@ -0,0 +1,69 @@
+// json_writer.hpp
+#ifndef JSON_WRITER_HPP
+#define JSON_WRITER_HPP
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "field_value.hpp"
+
+// Writes JSON straight into a string without building a document first. Commas and colons
+// are placed by the writer, so callers only open and close containers, write keys and write
+// values. Nothing checks that the calls form valid JSON.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out) : out(out) {}
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+    JsonWriter& key(std::string_view name);
+
+    JsonWriter& value(std::string_view value);
+    JsonWriter& value(const char* value) { return this->value(std::string_view(value)); }
+    JsonWriter& value(const std::string& value) { return this->value(std::string_view(value)); }
+    // Shortest form that reads back as the same number, always with a decimal point or
+    // exponent so it stays a float. NaN and infinities are written as null.
+    JsonWriter& value(double value);
+    JsonWriter& value(float value);
+    JsonWriter& value(bool value);
+    JsonWriter& value(const FieldValue& value);
+    JsonWriter& null();
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+    JsonWriter& value(T value) {
+        separate();
+        char buffer[24];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter& array(const std::vector<T>& values) {
+        beginArray();
+        for (const auto& v : values) {
+            value(v);
+        }
+        return endArray();
+    }
+
+private:
+    void separate();
+    template <typename T>
+    void writeFloat(T value);
+
+    std::string& out;
+    std::vector<bool> hasItems; // one per open container
+    bool afterKey = false;
+};
+
+// Per thread output buffer for responses. Cleared on each call and keeps its capacity, so a
+// thread serving similar responses stops allocating while it writes them.
+std::string& json_response_buffer();
+
+#endif // JSON_WRITER_HPP
@@ -0,0 +1,322 @@
+// mapped_index.cpp
+#include "mapped_index.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Labels of this many elements, spread over the index, are compared with the mapping
+// before a labels sidecar is trusted
+#define LABELS_SIDECAR_SPOT_CHECKS 16
+
+namespace {
+    // Reads the labels sidecar into labels and deleted, returns false if it is missing or
+    // was written for a different index file
+    bool read_labels(const std::string& location, size_t elementCount, size_t indexFileLength,
+                     std::vector<uint64_t>& labels, std::vector<uint32_t>& deleted) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input) {
+            return false;
+        }
+        uint64_t count = 0, fileLength = 0, deletedCount = 0;
+        input.read(reinterpret_cast<char*>(&count), sizeof(count));
+        input.read(reinterpret_cast<char*>(&fileLength), sizeof(fileLength));
+        if (!input || count != elementCount || fileLength != indexFileLength) {
+            return false;
+        }
+        labels.resize(count);
+        input.read(reinterpret_cast<char*>(labels.data()), count * sizeof(uint64_t));
+        input.read(reinterpret_cast<char*>(&deletedCount), sizeof(deletedCount));
+        if (!input || deletedCount > count) {
+            return false;
+        }
+        deleted.resize(deletedCount);
+        input.read(reinterpret_cast<char*>(deleted.data()), deletedCount * sizeof(uint32_t));
+        return static_cast<bool>(input);
+    }
+}
+
+MappedHierarchicalNSW::MappedHierarchicalNSW(hnswlib::SpaceInterface<float>* s, const std::string& location,
+                                             const std::string& labelsLocation, bool allowReplaceDeleted)
+    : hnswlib::HierarchicalNSW<float>(s) {
+#ifdef _WIN32
+    throw std::runtime_error("Memory mapped indices are not supported on this platform");
+#else
+    // Same header as HierarchicalNSW::loadIndex
+    std::ifstream input(location, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Unable to open index file: " + location);
+    }
+    size_t elementCount = 0;
+    hnswlib::readBinaryPOD(input, offsetLevel0_);
+    hnswlib::readBinaryPOD(input, max_elements_);
+    hnswlib::readBinaryPOD(input, elementCount);
+    hnswlib::readBinaryPOD(input, size_data_per_element_);
+    hnswlib::readBinaryPOD(input, label_offset_);
+    hnswlib::readBinaryPOD(input, offsetData_);
+    hnswlib::readBinaryPOD(input, maxlevel_);
+    hnswlib::readBinaryPOD(input, enterpoint_node_);
+    hnswlib::readBinaryPOD(input, maxM_);
+    hnswlib::readBinaryPOD(input, maxM0_);
+    hnswlib::readBinaryPOD(input, M_);
+    hnswlib::readBinaryPOD(input, mult_);
+    hnswlib::readBinaryPOD(input, ef_construction_);
+    if (!input) {
+        throw std::runtime_error("Truncated index file: " + location);
+    }
+    level0HeaderLength = static_cast<size_t>(input.tellg());
+    input.close();
+
+    max_elements_ = std::max(max_elements_, elementCount);
+    data_size_ = s->get_data_size();
+    fstdistfunc_ = s->get_dist_func();
+    dist_func_param_ = s->get_dist_func_param();
+    size_links_per_element_ = maxM_ * sizeof(hnswlib::tableint) + sizeof(hnswlib::linklistsizeint);
+    size_links_level0_ = maxM0_ * sizeof(hnswlib::tableint) + sizeof(hnswlib::linklistsizeint);
+    revSize_ = 1.0 / mult_;
+    ef_ = 10;
+    allow_replace_deleted_ = allowReplaceDeleted;
+
+    int fd = open(location.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0) {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error("Unable to open index file: " + location);
+    }
+    const size_t fileLength = static_cast<size_t>(status.st_size);
+    level0FileLength = level0HeaderLength + elementCount * size_data_per_element_;
+    if (fileLength < level0FileLength) {
+        close(fd);
+        throw std::runtime_error("Truncated index file: " + location);
+    }
+
+    // Reserve room for max_elements_ so inserts can use the slots after the saved elements,
+    // then map the header and the saved elements over the start of the reservation
+    level0MappingLength = level0HeaderLength + max_elements_ * size_data_per_element_;
+    void* reservation = mmap(nullptr, level0MappingLength, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Unable to reserve memory for index: " + location);
+    }
+    level0Mapping = static_cast<char*>(reservation);
+    if (mmap(level0Mapping, level0FileLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        close(fd);
+        unmap();
+        throw std::runtime_error("Unable to map index file: " + location);
+    }
+
+    // Link lists of the upper levels follow level 0, mapped from the page holding their start
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    const size_t listsOffset = level0FileLength - level0FileLength % pageSize;
+    listsMappingLength = fileLength - listsOffset;
+    void* lists = listsMappingLength > 0
+        ? mmap(nullptr, listsMappingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, listsOffset)
+        : nullptr;
+    close(fd);
+    if (lists == MAP_FAILED) {
+        unmap();
+        throw std::runtime_error("Unable to map index file: " + location);
+    }
+    listsMapping = static_cast<char*>(lists);
+    try {
+        data_level0_memory_ = level0Mapping + level0HeaderLength;
+
+        std::vector<std::mutex>(max_elements_).swap(link_list_locks_);
+        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+        visited_list_pool_.reset(new hnswlib::VisitedListPool(1, max_elements_));
+        element_levels_ = std::vector<int>(max_elements_);
+        linkLists_ = static_cast<char**>(malloc(sizeof(void*) * max_elements_));
+        if (linkLists_ == nullptr) {
+            throw std::runtime_error("Not enough memory: MappedHierarchicalNSW failed to allocate linklists");
+        }
+
+        size_t position = level0FileLength;
+        for (size_t i = 0; i < elementCount; i++) {
+            hnswlib::linklistsizeint linkListSize = 0;
+            if (position + sizeof(linkListSize) > fileLength) {
+                throw std::runtime_error("Truncated index file: " + location);
+            }
+            std::memcpy(&linkListSize, listsMapping + (position - listsOffset), sizeof(linkListSize));
+            position += sizeof(linkListSize);
+            if (linkListSize == 0) {
+                element_levels_[i] = 0;
+                linkLists_[i] = nullptr;
+            } else {
+                if (position + linkListSize > fileLength) {
+                    throw std::runtime_error("Truncated index file: " + location);
+                }
+                element_levels_[i] = linkListSize / size_links_per_element_;
+                linkLists_[i] = listsMapping + (position - listsOffset);
+                position += linkListSize;
+            }
+            mappedElements = i + 1;
+        }
+        if (position != fileLength) {
+            throw std::runtime_error("Index file size does not match its header: " + location);
+        }
+
+        std::vector<uint64_t> labels;
+        std::vector<uint32_t> deleted;
+        bool sidecar = read_labels(labelsLocation, elementCount, fileLength, labels, deleted);
+        size_t stride = std::max<size_t>(1, elementCount / LABELS_SIDECAR_SPOT_CHECKS);
+        for (size_t i = 0; sidecar && i < elementCount; i += stride) {
+            sidecar = labels[i] == getExternalLabel(i);
+        }
+
+        if (sidecar) {
+            label_lookup_.reserve(elementCount);
+            for (size_t i = 0; i < elementCount; i++) {
+                label_lookup_[labels[i]] = i;
+            }
+            for (uint32_t internalId : deleted) {
+                num_deleted_ += 1;
+                if (allow_replace_deleted_) deleted_elements.insert(internalId);
+            }
+        } else {
+            for (size_t i = 0; i < elementCount; i++) {
+                label_lookup_[getExternalLabel(i)] = i;
+                if (isMarkedDeleted(i)) {
+                    num_deleted_ += 1;
+                    if (allow_replace_deleted_) deleted_elements.insert(i);
+                }
+            }
+        }
+    } catch (...) {
+        unmap();
+        throw;
+    }
+    cur_element_count = elementCount;
+#endif
+}
+
+MappedHierarchicalNSW::~MappedHierarchicalNSW() {
+    unmap();
+}
+
+void MappedHierarchicalNSW::unmap() {
+#ifndef _WIN32
+    // The base destructor frees level 0 and every upper level link list, so leave it
+    // only the memory that was allocated after loading
+    if (level0Mapping != nullptr) {
+        munmap(level0Mapping, level0MappingLength);
+        level0Mapping = nullptr;
+        data_level0_memory_ = nullptr;
+    }
+    if (listsMapping != nullptr) {
+        for (size_t i = 0; i < mappedElements; i++) {
+            if (linkLists_[i] >= listsMapping && linkLists_[i] < listsMapping + listsMappingLength) {
+                linkLists_[i] = nullptr;
+            }
+        }
+        munmap(listsMapping, listsMappingLength);
+        listsMapping = nullptr;
+    }
+#endif
+}
+
+void MappedHierarchicalNSW::materialize() {
+#ifndef _WIN32
+    if (level0Mapping == nullptr) {
+        return;
+    }
+    char* memory = static_cast<char*>(malloc(max_elements_ * size_data_per_element_));
+    if (memory == nullptr) {
+        throw std::runtime_error("Not enough memory: materialize failed to allocate level 0");
+    }
+    std::memcpy(memory, data_level0_memory_, cur_element_count * size_data_per_element_);
+    munmap(level0Mapping, level0MappingLength);
+    level0Mapping = nullptr;
+    data_level0_memory_ = memory;
+#endif
+}
+
+void MappedHierarchicalNSW::prewarm() const {
+#ifndef _WIN32
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+    if (level0Mapping != nullptr) {
+        madvise(level0Mapping, level0FileLength, MADV_WILLNEED);
+        for (size_t offset = 0; offset < level0FileLength; offset += pageSize) {
+            sink = sink + level0Mapping[offset];
+        }
+    }
+    if (listsMapping != nullptr) {
+        madvise(listsMapping, listsMappingLength, MADV_WILLNEED);
+        for (size_t offset = 0; offset < listsMappingLength; offset += pageSize) {
+            sink = sink + listsMapping[offset];
+        }
+    }
+#endif
+}
+
+void copy_index_file(const hnswlib::HierarchicalNSW<float>& index, std::string& head, std::vector<char>& level0,
+                     std::string& linkLists) {
+    copy_index_head(index, head, linkLists);
+    level0.resize(index.cur_element_count * index.size_data_per_element_);
+    std::memcpy(level0.data(), index.data_level0_memory_, level0.size());
+}
+
+void copy_index_head(const hnswlib::HierarchicalNSW<float>& index, std::string& head, std::string& linkLists) {
+    // Same layout as HierarchicalNSW::saveIndex
+    std::ostringstream header;
+    size_t elementCount = index.cur_element_count;
+    hnswlib::writeBinaryPOD(header, index.offsetLevel0_);
+    hnswlib::writeBinaryPOD(header, index.max_elements_);
+    hnswlib::writeBinaryPOD(header, elementCount);
+    hnswlib::writeBinaryPOD(header, index.size_data_per_element_);
+    hnswlib::writeBinaryPOD(header, index.label_offset_);
+    hnswlib::writeBinaryPOD(header, index.offsetData_);
+    hnswlib::writeBinaryPOD(header, index.maxlevel_);
+    hnswlib::writeBinaryPOD(header, index.enterpoint_node_);
+    hnswlib::writeBinaryPOD(header, index.maxM_);
+    hnswlib::writeBinaryPOD(header, index.maxM0_);
+    hnswlib::writeBinaryPOD(header, index.M_);
+    hnswlib::writeBinaryPOD(header, index.mult_);
+    hnswlib::writeBinaryPOD(header, index.ef_construction_);
+    head = header.str();
+
+    linkLists.clear();
+    for (size_t i = 0; i < elementCount; i++) {
+        hnswlib::linklistsizeint linkListSize = index.element_levels_[i] > 0
+            ? index.size_links_per_element_ * index.element_levels_[i]
+            : 0;
+        linkLists.append(reinterpret_cast<const char*>(&linkListSize), sizeof(linkListSize));
+        if (linkListSize) {
+            linkLists.append(index.linkLists_[i], linkListSize);
+        }
+    }
+}
+
+std::string encode_labels(const hnswlib::HierarchicalNSW<float>& index) {
+    uint64_t count = index.cur_element_count;
+    uint64_t fileLength = index.indexFileSize();
+    std::vector<uint64_t> labels(count);
+    std::vector<uint32_t> deleted;
+    for (size_t i = 0; i < count; i++) {
+        labels[i] = index.getExternalLabel(i);
+        if (index.isMarkedDeleted(i)) {
+            deleted.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    uint64_t deletedCount = deleted.size();
+
+    std::string contents;
+    contents.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    contents.append(reinterpret_cast<const char*>(&fileLength), sizeof(fileLength));
+    contents.append(reinterpret_cast<const char*>(labels.data()), count * sizeof(uint64_t));
+    contents.append(reinterpret_cast<const char*>(&deletedCount), sizeof(deletedCount));
+    contents.append(reinterpret_cast<const char*>(deleted.data()), deletedCount * sizeof(uint32_t));
+    return contents;
+}
@@ -0,0 +1,60 @@
+// mapped_index.hpp
+#ifndef MAPPED_INDEX_HPP
+#define MAPPED_INDEX_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "hnswlib/hnswlib.h"
+
+// HierarchicalNSW whose level 0 data and link lists are memory mapped from a file written by
+// saveIndex instead of read into the heap, so loading only reads the header and the per
+// element link list sizes. Pages fault in as searches touch them.
+//
+// Both mappings are private: writes from inserts and updates stay in memory and never reach
+// the file. Level 0 is mapped into a reservation sized for max_elements_, so new elements can
+// be added up to the saved capacity without copying. Anything that reallocates level 0
+// (resizeIndex) must call materialize() first.
+class MappedHierarchicalNSW : public hnswlib::HierarchicalNSW<float> {
+public:
+    // labelsLocation is the sidecar holding encode_labels. When it is missing or stale the
+    // labels are read from the mapping instead, which faults in all of level 0.
+    MappedHierarchicalNSW(hnswlib::SpaceInterface<float>* s, const std::string& location,
+                          const std::string& labelsLocation, bool allowReplaceDeleted);
+    ~MappedHierarchicalNSW();
+
+    MappedHierarchicalNSW(const MappedHierarchicalNSW&) = delete;
+    MappedHierarchicalNSW& operator=(const MappedHierarchicalNSW&) = delete;
+
+    // Copy level 0 into the heap and drop its mapping
+    void materialize();
+    bool mapped() const { return level0Mapping != nullptr; }
+
+    // Ask the kernel to read the mappings ahead and touch every page so it is resident
+    void prewarm() const;
+
+private:
+    void unmap();
+
+    char* level0Mapping = nullptr;
+    size_t level0MappingLength = 0;
+    size_t level0FileLength = 0;
+    size_t level0HeaderLength = 0;
+    char* listsMapping = nullptr;
+    size_t listsMappingLength = 0;
+    size_t mappedElements = 0;
+};
+
+// The file saveIndex would write, split into its header, level 0 and the upper level link lists.
+// Callers must keep the index from being modified while it is copied.
+void copy_index_file(const hnswlib::HierarchicalNSW<float>& index, std::string& head, std::vector<char>& level0,
+                     std::string& linkLists);
+// The header and upper level link lists of copy_index_file, without level 0
+void copy_index_head(const hnswlib::HierarchicalNSW<float>& index, std::string& head, std::string& linkLists);
+
+// Contents of the labels sidecar for an index saved as copy_index_file describes it: the label
+// of every element and the ids of deleted elements, letting MappedHierarchicalNSW build its
+// lookup without touching level 0
+std::string encode_labels(const hnswlib::HierarchicalNSW<float>& index);
+
+#endif // MAPPED_INDEX_HPP
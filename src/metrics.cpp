@@ -0,0 +1,69 @@
+// metrics.cpp
+#include "metrics.hpp"
+#include <charconv>
+
+namespace {
+    constexpr uint64_t LATENCY_BOUNDS_US[LATENCY_BUCKET_COUNT] = LATENCY_BUCKET_BOUNDS_US;
+
+    // Shortest decimal form that reads back as the same double
+    std::string format_value(double value) {
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed);
+        return std::string(buffer, result.ptr);
+    }
+}
+
+void LatencyHistogram::observe(std::chrono::nanoseconds duration) {
+    uint64_t nanoseconds = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+    size_t bucket = 0;
+    while (bucket < LATENCY_BUCKET_COUNT && nanoseconds > LATENCY_BOUNDS_US[bucket] * 1000) {
+        bucket++;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    sumNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::write(std::string& out, const std::string& name, const std::string& labels) const {
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    uint64_t cumulative = 0;
+    for (size_t bucket = 0; bucket <= LATENCY_BUCKET_COUNT; bucket++) {
+        cumulative += buckets[bucket].load(std::memory_order_relaxed);
+        std::string bound = bucket < LATENCY_BUCKET_COUNT ? format_value(LATENCY_BOUNDS_US[bucket] / 1e6) : "+Inf";
+        out += name + "_bucket{" + prefix + "le=\"" + bound + "\"} " + std::to_string(cumulative) + "\n";
+    }
+    std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+    out += name + "_sum" + suffix + " " + format_value(sumNanoseconds.load(std::memory_order_relaxed) / 1e9) + "\n";
+    out += name + "_count" + suffix + " " + std::to_string(cumulative) + "\n";
+}
+
+void MetricsWriter::header(const std::string& name, const std::string& type, const std::string& help) {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+void MetricsWriter::sample(const std::string& name, const std::string& labels, double value) {
+    out += name;
+    if (!labels.empty()) {
+        out += "{" + labels + "}";
+    }
+    out += " " + format_value(value) + "\n";
+}
+
+void MetricsWriter::histogram(const std::string& name, const std::string& labels, const LatencyHistogram& histogram) {
+    histogram.write(out, name, labels);
+}
+
+std::string metric_label(const std::string& name, const std::string& value) {
+    std::string label = name + "=\"";
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            label += '\\';
+            label += c;
+        } else if (c == '\n') {
+            label += "\\n";
+        } else {
+            label += c;
+        }
+    }
+    return label + "\"";
+}
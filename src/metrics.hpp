@@ -0,0 +1,74 @@
+// metrics.hpp
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "query_planner.hpp"
+
+// Latency histogram buckets, upper bounds in microseconds
+#define LATENCY_BUCKET_COUNT 16
+#define LATENCY_BUCKET_BOUNDS_US {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000}
+
+// Monotonic counter. Updates are relaxed atomic adds and every counter has its own cache line,
+// so counters bumped by different threads do not contend.
+class alignas(64) Counter {
+public:
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+// Latency histogram with fixed buckets. Recording is a scan of the bounds and two relaxed adds.
+class alignas(64) LatencyHistogram {
+public:
+    void observe(std::chrono::nanoseconds duration);
+    // Append the cumulative buckets, sum and count of the histogram called name
+    void write(std::string& out, const std::string& name, const std::string& labels) const;
+
+private:
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKET_COUNT + 1> buckets{}; // the last one is +Inf
+    std::atomic<uint64_t> sumNanoseconds{0};
+};
+
+// Requests served by one route
+struct RouteMetrics {
+    Counter requests;
+    Counter errors; // responses with a 4xx or 5xx status
+    LatencyHistogram latency;
+};
+
+// Work done by one index, kept on its IndexHandle
+struct IndexMetrics {
+    LatencyHistogram searchLatency; // /search requests
+    Counter documentsAdded;
+    Counter documentsDeleted;
+    Counter filterCacheHits;
+    Counter filterCacheMisses;
+    std::array<Counter, SEARCH_PLAN_TYPE_COUNT> searchPlans; // queries by the SearchPlanType chosen for them
+};
+
+// Builds a response in the Prometheus text exposition format. Samples of a metric must be
+// written right after its header.
+class MetricsWriter {
+public:
+    void header(const std::string& name, const std::string& type, const std::string& help);
+    void sample(const std::string& name, const std::string& labels, double value);
+    void histogram(const std::string& name, const std::string& labels, const LatencyHistogram& histogram);
+
+    const std::string& str() const { return out; }
+
+private:
+    std::string out;
+};
+
+// name="value" with the value escaped for the text format
+std::string metric_label(const std::string& name, const std::string& value);
+
+#endif // METRICS_HPP
@@ -6,6 +6,9 @@
 #include <vector>
 #include <nlohmann/json.hpp>
 #include "data_store.hpp"
+#include "binary_format.hpp"
+
+#define MAX_INDEX_SHARDS 256
 
 struct IndexRequest {
     std::string indexName;
@@ -14,6 +17,10 @@ struct IndexRequest {
     std::string spaceType = "IP"; // default is Inner Product space
     int efConstruction = 512; // default value for efConstruction
     int M = 16; // default value for M
+    int numThreads = 0; // threads used to insert a batch, 0 uses every worker
+    std::string quantization = "None"; // "SQ8" stores int8 codes in the graph
+    bool rerank = true; // for SQ8, keep float vectors to rerank the top candidates
+    int shards = 1; // graphs the documents are split between by id
 };
 
 inline void from_json(const nlohmann::json& j, IndexRequest& req) {
@@ -24,39 +31,81 @@ inline void from_json(const nlohmann::json& j, IndexRequest& req) {
     req.spaceType = j.value("spaceType", req.spaceType);
     req.efConstruction = j.value("efConstruction", req.efConstruction);
     req.M = j.value("M", req.M);
+    req.numThreads = j.value("numThreads", req.numThreads);
+    req.quantization = j.value("quantization", req.quantization);
+    req.rerank = j.value("rerank", req.rerank);
+    req.shards = j.value("shards", req.shards);
+    if (req.shards < 1 || req.shards > MAX_INDEX_SHARDS) {
+        throw std::invalid_argument("shards must be between 1 and " + std::to_string(MAX_INDEX_SHARDS));
+    }
+    if (req.quantization != "None" && req.quantization != "SQ8") {
+        throw std::invalid_argument("Unsupported quantization: " + req.quantization);
+    }
 }
 
-struct AddDocumentsRequest {
+struct LoadIndexRequest {
     std::string indexName;
-    std::vector<int> ids;
-    std::vector<std::vector<float>> vectors;
-    std::vector<std::map<std::string, FieldValue>> metadatas = {}; // default is empty metadata
+    bool memoryMap = false; // map the graph from disk instead of reading it into memory
+    bool prewarm = false; // fault in the index and run warmup queries in the background
+    int warmupQueries = 1000;
 };
 
-inline void to_json(nlohmann::json& j, const AddDocumentsRequest& req) {
-    j["indexName"] = req.indexName;
-    j["ids"] = req.ids;
-    j["vectors"] = req.vectors;
+inline void from_json(const nlohmann::json& j, LoadIndexRequest& req) {
+    j.at("indexName").get_to(req.indexName);
+    req.memoryMap = j.value("mmap", req.memoryMap);
+    req.prewarm = j.value("prewarm", req.prewarm);
+    req.warmupQueries = j.value("warmupQueries", req.warmupQueries);
+    if (req.warmupQueries < 0) {
+        throw std::invalid_argument("warmupQueries must not be negative");
+    }
+}
+
+struct RebuildIndexRequest {
+    std::string indexName;
+    int M = 0; // 0 keeps the current value
+    int efConstruction = 0; // 0 keeps the current value
+};
 
-    // Convert metadatas manually
-    j["metadatas"] = nlohmann::json::array();
-    for (const auto& metadata_map : req.metadatas) {
-        nlohmann::json json_metadata_map;
-        for (const auto& [key, value] : metadata_map) {
-            // Visit the variant to assign the appropriate type to JSON
-            std::visit([&json_metadata_map, &key](auto&& arg) {
-                json_metadata_map[key] = arg;
-            }, value);
-        }
-        j["metadatas"].push_back(json_metadata_map);
+inline void from_json(const nlohmann::json& j, RebuildIndexRequest& req) {
+    j.at("indexName").get_to(req.indexName);
+    req.M = j.value("M", req.M);
+    req.efConstruction = j.value("efConstruction", req.efConstruction);
+    if (req.M < 0 || req.efConstruction < 0) {
+        throw std::invalid_argument("M and efConstruction must not be negative");
     }
 }
 
-inline void from_json(const nlohmann::json& j, AddDocumentsRequest& req) {
+struct FacetsRequest {
+    std::string indexName;
+    std::string filter = ""; // facets over every document when empty
+    std::vector<std::string> fields = {}; // every field when empty
+};
+
+inline void from_json(const nlohmann::json& j, FacetsRequest& req) {
     j.at("indexName").get_to(req.indexName);
-    j.at("ids").get_to(req.ids);
-    j.at("vectors").get_to(req.vectors);
+    req.filter = j.value("filter", req.filter);
+    req.fields = j.value("fields", req.fields);
+}
+
+struct AddDocumentsRequest {
+    std::string indexName;
+    std::vector<int> ids;
+    std::vector<std::vector<float>> vectors;
+    std::vector<std::map<std::string, FieldValue>> metadatas = {}; // default is empty metadata
+    int numThreads = 0; // overrides the index's numThreads for this request when set
+
+    // Parsed requests carry their vectors packed instead of in vectors: count * dimension floats, row major
+    const float* packedVectors = nullptr;
+    size_t packedCount = 0;
+    size_t packedDimension = 0;
+    std::vector<float> packedStorage; // owns packedVectors when they could not be used in place
 
+    size_t numVectors() const { return packedVectors ? packedCount : vectors.size(); }
+    size_t dimensionAt(size_t i) const { return packedVectors ? packedDimension : vectors[i].size(); }
+    const float* vectorAt(size_t i) const { return packedVectors ? packedVectors + i * packedDimension : vectors[i].data(); }
+};
+
+inline void metadatas_from_json(const nlohmann::json& j, AddDocumentsRequest& req) {
     // Convert metadatas manually
     if (!j.contains("metadatas")) {
         return; // No metadata provided
@@ -82,6 +131,19 @@ inline void from_json(const nlohmann::json& j, AddDocumentsRequest& req) {
     }
 }
 
+inline void from_binary(BinaryVectorsPayload payload, AddDocumentsRequest& req) {
+    const auto& j = payload.header;
+    j.at("indexName").get_to(req.indexName);
+    j.at("ids").get_to(req.ids);
+    req.numThreads = j.value("numThreads", req.numThreads);
+    metadatas_from_json(j, req);
+
+    req.packedCount = payload.count;
+    req.packedDimension = payload.dimension;
+    req.packedStorage = std::move(payload.swapped);
+    req.packedVectors = req.packedStorage.empty() ? payload.vectors : req.packedStorage.data();
+}
+
 // JSON Serialization helpers for FieldValue
 inline void to_json(nlohmann::json& j, const FieldValue& value) {
     std::visit([&j](auto&& arg) { j = arg; }, value);
@@ -112,18 +174,74 @@ struct SearchRequest {
     int efSearch = 512; // default value
     std::string filter = ""; // filter string, default is empty (no filter)
     bool returnMetadata = false; // whether to return metadata or not, default is false
+    bool debug = false; // whether to return the chosen search plan, default is false
+    std::vector<std::string> facets = {}; // fields to aggregate over every document matching filter
 };
 
-inline void from_json(const nlohmann::json& j, SearchRequest& req) {
+inline void search_options_from_json(const nlohmann::json& j, SearchRequest& req) {
     j.at("indexName").get_to(req.indexName);
-    j.at("queryVector").get_to(req.queryVector);
     j.at("k").get_to(req.k);
     // defaults
     req.efSearch = j.value("efSearch", req.efSearch);
     req.filter = j.value("filter", req.filter);
     req.returnMetadata = j.value("returnMetadata", req.returnMetadata);
+    req.debug = j.value("debug", req.debug);
+    req.facets = j.value("facets", req.facets);
+}
+
+inline void from_binary(BinaryVectorsPayload payload, SearchRequest& req) {
+    if (payload.count != 1) {
+        throw std::invalid_argument("Binary search requests must carry exactly one query vector");
+    }
+    req.queryVector.assign(payload.vectors, payload.vectors + payload.dimension);
+    search_options_from_json(payload.header, req);
 }
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(DeleteDocumentsRequest, indexName, ids)
+struct BatchQuery {
+    std::vector<float> queryVector;
+    int k;
+    std::string filter;
+};
+
+struct SearchBatchRequest {
+    std::string indexName;
+    std::vector<BatchQuery> queries;
+    int k = 10; // default k for queries that do not set their own
+    int efSearch = 512; // default value
+    std::string filter = ""; // default filter for queries that do not set their own
+    bool returnMetadata = false; // whether to return metadata or not, default is false
+    bool debug = false; // whether to return the chosen search plans, default is false
+};
+
+inline void search_batch_options_from_json(const nlohmann::json& j, SearchBatchRequest& req) {
+    j.at("indexName").get_to(req.indexName);
+    // defaults
+    req.k = j.value("k", req.k);
+    req.efSearch = j.value("efSearch", req.efSearch);
+    req.filter = j.value("filter", req.filter);
+    req.returnMetadata = j.value("returnMetadata", req.returnMetadata);
+    req.debug = j.value("debug", req.debug);
+}
+
+// Query vectors come from the packed matrix; the optional "queries" array in the header
+// carries per-query k and filter in the same order.
+inline void from_binary(BinaryVectorsPayload payload, SearchBatchRequest& req) {
+    const auto& j = payload.header;
+    search_batch_options_from_json(j, req);
+
+    bool hasQueryOptions = j.contains("queries");
+    if (hasQueryOptions && j.at("queries").size() != payload.count) {
+        throw std::invalid_argument("Number of queries does not match number of vectors");
+    }
+
+    for (uint32_t i = 0; i < payload.count; i++) {
+        BatchQuery query;
+        const float* vector = payload.vectors + size_t(i) * payload.dimension;
+        query.queryVector.assign(vector, vector + payload.dimension);
+        query.k = hasQueryOptions ? j.at("queries").at(i).value("k", req.k) : req.k;
+        query.filter = hasQueryOptions ? j.at("queries").at(i).value("filter", req.filter) : req.filter;
+        req.queries.push_back(std::move(query));
+    }
+}
 
 #endif // MODELS_HPP
\ No newline at end of file
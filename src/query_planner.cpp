@@ -0,0 +1,61 @@
+// query_planner.cpp
+#include "query_planner.hpp"
+#include <algorithm>
+#include <cmath>
+
+SearchPlan planSearch(const SearchPlanInputs& inputs) {
+    const double dimension = static_cast<double>(inputs.dimension);
+    const size_t baseEf = std::max(inputs.ef, inputs.k);
+
+    SearchPlan plan;
+    plan.ef = baseEf;
+    if (!inputs.filtered) {
+        plan.cost = static_cast<double>(baseEf) * inputs.maxM0 * dimension;
+        return plan;
+    }
+
+    const double elements = static_cast<double>(std::max<size_t>(inputs.elementCount, 1));
+    const double selectivity = std::clamp(inputs.selectivity, 0.0, 1.0);
+    const double matches = selectivity * elements;
+    plan.selectivity = selectivity;
+
+    // A graph search visits about ef nodes and computes a distance to each of their neighbours
+    double raised = std::ceil(baseEf / std::max(selectivity, PLANNER_MIN_SELECTIVITY));
+    size_t raisedEf = std::max(baseEf, static_cast<size_t>(std::min(raised, elements)));
+    double candidates = static_cast<double>(raisedEf) * inputs.maxM0;
+
+    double materialize = inputs.filterCached ? 0.0 : matches * PLANNER_ID_SET_BUILD_COST;
+    double exactCost = materialize + matches * (dimension + PLANNER_LABEL_LOOKUP_COST);
+    double filteredCost = materialize + candidates * (dimension + PLANNER_ID_SET_CHECK_COST);
+    double predicateCost = candidates * (dimension + PLANNER_PREDICATE_COST);
+
+    // Prefer the exact plan on ties since its results are exact
+    plan.type = SearchPlanType::Exact;
+    plan.cost = exactCost;
+    if (filteredCost < plan.cost) {
+        plan.type = SearchPlanType::FilteredGraph;
+        plan.cost = filteredCost;
+    }
+    if (predicateCost < plan.cost) {
+        plan.type = SearchPlanType::PredicateGraph;
+        plan.cost = predicateCost;
+    }
+    if (plan.type != SearchPlanType::Exact) {
+        plan.ef = raisedEf;
+    }
+    return plan;
+}
+
+std::string searchPlanName(SearchPlanType type) {
+    switch (type) {
+        case SearchPlanType::Graph:
+            return "graph";
+        case SearchPlanType::Exact:
+            return "exact";
+        case SearchPlanType::FilteredGraph:
+            return "filtered_graph";
+        case SearchPlanType::PredicateGraph:
+            return "predicate_graph";
+    }
+    return "unknown";
+}
@@ -0,0 +1,49 @@
+// query_planner.hpp
+#ifndef QUERY_PLANNER_HPP
+#define QUERY_PLANNER_HPP
+
+#include <cstddef>
+#include <string>
+
+// Relative costs used by the planner, in units of one float operation of a distance computation
+#define PLANNER_ID_SET_BUILD_COST 4.0   // adding one matching id to a materialized filter result
+#define PLANNER_LABEL_LOOKUP_COST 20.0  // mapping a label to its vector for an exact scan
+#define PLANNER_ID_SET_CHECK_COST 2.0   // checking a graph candidate against a materialized result
+#define PLANNER_PREDICATE_COST 40.0     // evaluating the filter against a graph candidate's metadata
+// Lower bound on selectivity when raising ef, so an estimate of zero still gives a finite plan
+#define PLANNER_MIN_SELECTIVITY 1e-6
+// Number of SearchPlanType values, for tables indexed by plan type
+#define SEARCH_PLAN_TYPE_COUNT 4
+
+enum class SearchPlanType {
+    Graph,          // no filter, plain HNSW search
+    Exact,          // materialize the filter and brute force over the matching vectors
+    FilteredGraph,  // materialize the filter and restrict HNSW candidates to it, with a raised ef
+    PredicateGraph  // HNSW with a raised ef, checking each candidate's metadata as it is visited
+};
+
+struct SearchPlan {
+    SearchPlanType type = SearchPlanType::Graph;
+    size_t ef = 0;             // ef the graph search runs with
+    double selectivity = 1.0;  // estimated fraction of documents passing the filter
+    double cost = 0.0;         // estimated cost of the chosen plan
+};
+
+struct SearchPlanInputs {
+    size_t elementCount = 0;  // live vectors in the index
+    size_t dimension = 0;
+    size_t maxM0 = 0;         // neighbours per node on the base layer
+    size_t k = 0;
+    size_t ef = 0;            // requested ef, before any raise for the filter
+    double selectivity = 1.0;
+    bool filtered = false;
+    bool filterCached = false; // the filter result is already materialized
+};
+
+// Pick the cheapest way to run a search. The graph plans raise ef to ef / selectivity
+// so that enough candidates survive the filter to fill k results.
+SearchPlan planSearch(const SearchPlanInputs& inputs);
+
+std::string searchPlanName(SearchPlanType type);
+
+#endif // QUERY_PLANNER_HPP
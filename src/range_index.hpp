@@ -0,0 +1,203 @@
+// range_index.hpp
+#ifndef RANGE_INDEX_HPP
+#define RANGE_INDEX_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Buffered changes are merged into the sorted run once they exceed this many, or
+// 1 / RANGE_INDEX_MERGE_FRACTION of the run, whichever is larger
+#define RANGE_INDEX_MIN_PENDING 1024
+#define RANGE_INDEX_MERGE_FRACTION 8
+
+// A numeric range endpoint. Longs and doubles order the same way as in IndexKey:
+// every long before every double.
+struct RangeBound {
+    std::variant<long, double> value;
+    bool inclusive;
+};
+
+// (value, id) pairs of one type sorted by value. Inserts go to an unsorted buffer and
+// removals of sorted entries to a set of ids, both of which queries check alongside the
+// sorted entries, and they are merged into it in one pass once there are enough of them.
+// A document holds one value per field, so an id is in the sorted entries and in the
+// buffer at most once each.
+template <typename T>
+class SortedRun {
+public:
+    void insert(T value, int id) {
+        pendingPositions[id] = pending.size();
+        pending.emplace_back(value, id);
+        mergeIfDue();
+    }
+
+    void remove(int id) {
+        auto it = pendingPositions.find(id);
+        if (it != pendingPositions.end()) {
+            size_t position = it->second;
+            pendingPositions.erase(it);
+            if (position + 1 != pending.size()) {
+                pending[position] = pending.back();
+                pendingPositions[pending[position].second] = position;
+            }
+            pending.pop_back();
+            return;
+        }
+        removed.insert(id);
+        mergeIfDue();
+    }
+
+    // Append the ids of entries within the bounds. A null bound is unbounded.
+    void collect(const T* lower, bool lowerInclusive, const T* upper, bool upperInclusive, std::vector<int>& out) const {
+        auto [begin, end] = positions(lower, lowerInclusive, upper, upperInclusive);
+        if (removed.empty()) {
+            out.insert(out.end(), ids.begin() + begin, ids.begin() + end);
+        } else {
+            for (size_t i = begin; i < end; i++) {
+                if (removed.find(ids[i]) == removed.end()) {
+                    out.push_back(ids[i]);
+                }
+            }
+        }
+        for (const auto& [value, id] : pending) {
+            if (within(value, lower, lowerInclusive, upper, upperInclusive)) {
+                out.push_back(id);
+            }
+        }
+    }
+
+    size_t size() const { return values.size() - removed.size() + pending.size(); }
+
+    // Entries within the bounds, counting sorted entries that were removed since the last merge
+    size_t estimate(const T* lower, bool lowerInclusive, const T* upper, bool upperInclusive) const {
+        auto [begin, end] = positions(lower, lowerInclusive, upper, upperInclusive);
+        size_t count = end - begin;
+        for (const auto& entry : pending) {
+            count += within(entry.first, lower, lowerInclusive, upper, upperInclusive);
+        }
+        return count;
+    }
+
+private:
+    std::vector<T> values;
+    std::vector<int> ids; // parallel to values
+    std::vector<std::pair<T, int>> pending;
+    std::unordered_map<int, size_t> pendingPositions; // id to its position in pending
+    std::unordered_set<int> removed;
+
+    static bool within(T value, const T* lower, bool lowerInclusive, const T* upper, bool upperInclusive) {
+        if (lower && (lowerInclusive ? value < *lower : value <= *lower)) return false;
+        if (upper && (upperInclusive ? value > *upper : value >= *upper)) return false;
+        return true;
+    }
+
+    std::pair<size_t, size_t> positions(const T* lower, bool lowerInclusive, const T* upper, bool upperInclusive) const {
+        size_t begin = 0;
+        size_t end = values.size();
+        if (lower) {
+            begin = (lowerInclusive ? std::lower_bound(values.begin(), values.end(), *lower)
+                                    : std::upper_bound(values.begin(), values.end(), *lower)) - values.begin();
+        }
+        if (upper) {
+            end = (upperInclusive ? std::upper_bound(values.begin(), values.end(), *upper)
+                                  : std::lower_bound(values.begin(), values.end(), *upper)) - values.begin();
+        }
+        return {begin, std::max(begin, end)};
+    }
+
+    void mergeIfDue() {
+        size_t buffered = pending.size() + removed.size();
+        if (buffered > std::max<size_t>(RANGE_INDEX_MIN_PENDING, values.size() / RANGE_INDEX_MERGE_FRACTION)) {
+            merge();
+        }
+    }
+
+    void merge() {
+        std::sort(pending.begin(), pending.end());
+        std::vector<T> mergedValues;
+        std::vector<int> mergedIds;
+        mergedValues.reserve(values.size() + pending.size());
+        mergedIds.reserve(values.size() + pending.size());
+
+        size_t p = 0;
+        for (size_t i = 0; i < values.size(); i++) {
+            if (removed.find(ids[i]) != removed.end()) continue;
+            for (; p < pending.size() && pending[p].first < values[i]; p++) {
+                mergedValues.push_back(pending[p].first);
+                mergedIds.push_back(pending[p].second);
+            }
+            mergedValues.push_back(values[i]);
+            mergedIds.push_back(ids[i]);
+        }
+        for (; p < pending.size(); p++) {
+            mergedValues.push_back(pending[p].first);
+            mergedIds.push_back(pending[p].second);
+        }
+
+        values.swap(mergedValues);
+        ids.swap(mergedIds);
+        pending.clear();
+        pendingPositions.clear();
+        removed.clear();
+    }
+};
+
+// Range index over the numeric values of one field, answering <, <=, > and >= and
+// ranges bounded on both sides with a binary search instead of a walk over every distinct
+// value in between. String values are not indexed.
+class RangeIndex {
+public:
+    void insert(long value, int id) { longs.insert(value, id); }
+    void insert(double value, int id) { doubles.insert(value, id); }
+    void remove(long, int id) { longs.remove(id); }
+    void remove(double, int id) { doubles.remove(id); }
+    size_t size() const { return longs.size() + doubles.size(); }
+
+    // Ids of the numeric values between lower and upper, unbounded where a bound is empty
+    std::vector<int> collect(const std::optional<RangeBound>& lower, const std::optional<RangeBound>& upper) const {
+        std::vector<int> out;
+        forEachRun(lower, upper, [&out](const auto& run, const auto* low, bool lowInclusive, const auto* high, bool highInclusive) {
+            run.collect(low, lowInclusive, high, highInclusive, out);
+        });
+        return out;
+    }
+
+    size_t estimate(const std::optional<RangeBound>& lower, const std::optional<RangeBound>& upper) const {
+        size_t count = 0;
+        forEachRun(lower, upper, [&count](const auto& run, const auto* low, bool lowInclusive, const auto* high, bool highInclusive) {
+            count += run.estimate(low, lowInclusive, high, highInclusive);
+        });
+        return count;
+    }
+
+private:
+    SortedRun<long> longs;
+    SortedRun<double> doubles;
+
+    // Call fn with each run the bounds reach and the bounds expressed in its type. A double
+    // lower bound is above every long and a long upper bound below every double.
+    template <typename Fn>
+    void forEachRun(const std::optional<RangeBound>& lower, const std::optional<RangeBound>& upper, Fn&& fn) const {
+        const long* lowerLong = lower ? std::get_if<long>(&lower->value) : nullptr;
+        const double* lowerDouble = lower ? std::get_if<double>(&lower->value) : nullptr;
+        const long* upperLong = upper ? std::get_if<long>(&upper->value) : nullptr;
+        const double* upperDouble = upper ? std::get_if<double>(&upper->value) : nullptr;
+        bool lowerInclusive = lower && lower->inclusive;
+        bool upperInclusive = upper && upper->inclusive;
+
+        if (lowerDouble == nullptr) {
+            fn(longs, lowerLong, lowerInclusive, upperLong, upperInclusive);
+        }
+        if (upperLong == nullptr) {
+            fn(doubles, lowerDouble, lowerInclusive, upperDouble, upperInclusive);
+        }
+    }
+};
+
+#endif // RANGE_INDEX_HPP
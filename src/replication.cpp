@@ -0,0 +1,301 @@
+// replication.cpp
+#include "replication.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include "snapshot_writer.hpp"
+#include "write_ahead_log.hpp"
+
+namespace {
+    // Files a snapshot of one index handle can consist of, the settings file first
+    const std::vector<std::string> SNAPSHOT_FILE_SUFFIXES = {".json", ".bin", ".labels", ".sq8", ".data", ".data.delta"};
+
+    bool ends_with(const std::string& value, const std::string& suffix) {
+        return value.size() > suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // Both manifests describe the same finished snapshot of every shard
+    bool same_snapshots(const nlohmann::json& before, const nlohmann::json& after) {
+        const nlohmann::json& shardsBefore = before.at("shards");
+        const nlohmann::json& shardsAfter = after.at("shards");
+        if (shardsBefore.size() != shardsAfter.size()) {
+            return false;
+        }
+        for (size_t shard = 0; shard < shardsBefore.size(); shard++) {
+            const nlohmann::json& a = shardsBefore.at(shard).at("snapshot");
+            const nlohmann::json& b = shardsAfter.at(shard).at("snapshot");
+            if (a.at("state").get<std::string>() == "running" || b.at("state").get<std::string>() == "running"
+                || a.at("id").get<uint64_t>() != b.at("id").get<uint64_t>()
+                || a.at("walSequence").get<uint64_t>() != b.at("walSequence").get<uint64_t>()) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+nlohmann::json snapshot_manifest(const ShardedIndex& index) {
+    nlohmann::json manifest;
+    manifest["indexName"] = index.name;
+    manifest["files"] = nlohmann::json::array();
+    if (index.sharded()) {
+        manifest["files"].push_back(index.name + ".json");
+    }
+
+    manifest["shards"] = nlohmann::json::array();
+    for (const auto& handle : index.shards) {
+        nlohmann::json shard;
+        shard["name"] = handle->name;
+        shard["snapshot"] = handle->snapshotStatus();
+        shard["files"] = nlohmann::json::array();
+        for (const auto& suffix : SNAPSHOT_FILE_SUFFIXES) {
+            if (std::filesystem::exists("indices/" + handle->name + suffix)) {
+                shard["files"].push_back(handle->name + suffix);
+            }
+        }
+        manifest["shards"].push_back(std::move(shard));
+    }
+    return manifest;
+}
+
+bool is_snapshot_file_name(const std::string& fileName) {
+    if (fileName.empty() || fileName[0] == '.' || fileName.find_first_of("/\\") != std::string::npos) {
+        return false;
+    }
+    return std::any_of(SNAPSHOT_FILE_SUFFIXES.begin(), SNAPSHOT_FILE_SUFFIXES.end(),
+                       [&fileName](const std::string& suffix) { return ends_with(fileName, suffix); });
+}
+
+Replica::Replica(const ServerConfig& config, IndexRegistry& indices, ThreadPool& pool)
+    : config(config), indices(indices), pool(pool),
+      client(std::make_unique<HttpClient>(std::vector<Endpoint>{resolve_endpoint(config.replicaOf)})) {
+    for (const auto& name : config.replicaIndices) {
+        auto state = std::make_unique<IndexState>();
+        state->name = name;
+        states.push_back(std::move(state));
+    }
+}
+
+void Replica::start() {
+    for (const auto& state : states) {
+        std::thread([this, &state = *state]() { follow(state); }).detach();
+    }
+}
+
+std::string Replica::unhealthyReason() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    for (const auto& state : states) {
+        if (!state->loaded) {
+            return "Loading index " + state->name + " from the primary";
+        }
+        for (const auto& shard : state->shards) {
+            if (now - shard.caughtUpAt > config.replicaMaxLag) {
+                return "Index " + state->name + " is behind the primary";
+            }
+        }
+    }
+    return "";
+}
+
+nlohmann::json Replica::status(const std::string& indexName) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find_if(states.begin(), states.end(), [&indexName](const auto& state) { return state->name == indexName; });
+    if (it == states.end()) {
+        return nullptr;
+    }
+
+    const IndexState& state = **it;
+    auto now = std::chrono::steady_clock::now();
+    nlohmann::json status;
+    status["primary"] = config.replicaOf;
+    status["loaded"] = state.loaded;
+    status["shards"] = nlohmann::json::array();
+    for (const auto& shard : state.shards) {
+        nlohmann::json progress;
+        progress["sequence"] = shard.sequence;
+        progress["primarySequence"] = shard.primarySequence;
+        progress["lagMs"] = std::chrono::duration_cast<std::chrono::milliseconds>(now - shard.caughtUpAt).count();
+        status["shards"].push_back(std::move(progress));
+    }
+    if (!state.error.empty()) {
+        status["error"] = state.error;
+    }
+    return status;
+}
+
+void Replica::follow(IndexState& state) {
+    while (true) {
+        try {
+            std::vector<uint64_t> sequences;
+            auto index = bootstrap(state, sequences);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                state.loaded = true;
+                state.error.clear();
+                state.shards.assign(sequences.size(), ShardProgress{});
+                for (size_t shard = 0; shard < sequences.size(); shard++) {
+                    state.shards[shard].sequence = sequences[shard];
+                    state.shards[shard].primarySequence = sequences[shard];
+                    state.shards[shard].caughtUpAt = std::chrono::steady_clock::now();
+                }
+            }
+            stream(state, *index, sequences);
+        } catch (const std::exception& e) {
+            std::cerr << "Replicating index " << state.name << " failed: " << e.what() << std::endl;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                state.error = e.what();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(REPLICATION_RETRY_MS));
+        }
+    }
+}
+
+std::shared_ptr<ShardedIndex> Replica::bootstrap(IndexState& state, std::vector<uint64_t>& sequences) {
+    nlohmann::json body;
+    body["indexName"] = state.name;
+    nlohmann::json manifest = nlohmann::json::parse(
+        request("POST", "/replication/snapshot", body.dump(), config.replicaTimeout).body);
+
+    std::vector<std::string> files = manifest.at("files").get<std::vector<std::string>>();
+    const nlohmann::json& shards = manifest.at("shards");
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        for (const auto& file : shards.at(shard).at("files")) {
+            files.push_back(file.get<std::string>());
+        }
+    }
+
+    // The index being replaced keeps serving from memory while the new copy is written and loaded
+    remove_sharded_index_from_disk(state.name);
+    std::filesystem::create_directories("indices");
+    for (const auto& file : files) {
+        if (!is_snapshot_file_name(file)) {
+            throw std::runtime_error("The primary listed an unexpected file: " + file);
+        }
+        HttpResponse response = request("GET", "/replication/file/" + url_encode(file), "", config.replicaTimeout);
+        SnapshotProgress progress;
+        write_file_atomically("indices/" + file, response.body, progress);
+    }
+
+    // Each file is replaced whole by a snapshot, but one that ran during the download may have
+    // replaced some of them
+    nlohmann::json current = nlohmann::json::parse(
+        request("GET", "/replication/snapshot/" + url_encode(state.name), "", config.replicaTimeout).body);
+    if (!same_snapshots(manifest, current)) {
+        throw std::runtime_error("The primary took another snapshot during the download");
+    }
+
+    // Streamed records are the primary's log, the replica keeps none of its own
+    WalOptions wal = config.wal;
+    wal.enabled = false;
+    LoadIndexRequest loadRequest;
+    loadRequest.indexName = state.name;
+    auto index = ShardedIndex::load(loadRequest, pool, wal);
+    if (index->shards.size() != shards.size()) {
+        throw std::runtime_error("Downloaded snapshot has " + std::to_string(index->shards.size()) + " shards, expected "
+                                 + std::to_string(shards.size()));
+    }
+    sequences.clear();
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        index->shards[shard]->collectGraphMetrics = config.graphMetrics;
+        sequences.push_back(shards.at(shard).at("snapshot").at("walSequence").get<uint64_t>());
+    }
+    indices.replace(index);
+    return index;
+}
+
+void Replica::stream(IndexState& state, ShardedIndex& index, std::vector<uint64_t>& sequences) {
+    while (true) {
+        std::vector<HttpCall> calls(index.shards.size());
+        for (size_t shard = 0; shard < calls.size(); shard++) {
+            calls[shard].endpoints = {0};
+            calls[shard].method = "GET";
+            calls[shard].target = "/replication/stream/" + url_encode(state.name) + "/" + std::to_string(shard)
+                + "?after=" + std::to_string(sequences[shard]);
+        }
+        client->run(calls, config.replicaTimeout);
+
+        bool behind = false;
+        bool failed = false;
+        for (size_t shard = 0; shard < calls.size(); shard++) {
+            // A shard the primary does not answer for falls behind until it does
+            const std::optional<HttpResponse>& response = calls[shard].response;
+            if (!response || response->status != 200) {
+                if (response && response->status == 410) {
+                    throw std::runtime_error("The primary no longer holds the mutations of shard " + std::to_string(shard)
+                                             + " after " + std::to_string(sequences[shard]));
+                }
+                std::string error = response ? std::to_string(response->status) + ": " + response->body : calls[shard].error;
+                std::lock_guard<std::mutex> lock(mutex);
+                state.error = "Streaming shard " + std::to_string(shard) + " failed: " + error;
+                failed = true;
+                continue;
+            }
+
+            uint64_t primarySequence = 0;
+            if (response->body.size() < sizeof(primarySequence)) {
+                throw std::runtime_error("Truncated replication stream response");
+            }
+            std::memcpy(&primarySequence, response->body.data(), sizeof(primarySequence));
+
+            // A record that failed on the primary fails the same way here, as on a replay
+            uint64_t& sequence = sequences[shard];
+            IndexHandle& handle = *index.shards[shard];
+            WriteAheadLog::decodeStream(response->body.substr(sizeof(primarySequence)), [&](const WalRecord& record) {
+                if (record.sequence != sequence + 1) {
+                    throw std::runtime_error("Replication stream of shard " + std::to_string(shard) + " skipped from "
+                                             + std::to_string(sequence) + " to " + std::to_string(record.sequence));
+                }
+                try {
+                    handle.applyLogRecord(record, pool);
+                } catch (const std::exception& e) {
+                    std::cerr << "Skipping replicated record " << record.sequence << " of index " << handle.name << ": " << e.what() << std::endl;
+                }
+                sequence = record.sequence;
+            });
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ShardProgress& progress = state.shards[shard];
+            progress.sequence = sequence;
+            progress.primarySequence = primarySequence;
+            if (sequence >= primarySequence) {
+                progress.caughtUpAt = std::chrono::steady_clock::now();
+            } else {
+                behind = true;
+            }
+        }
+
+        if (!failed) {
+            std::lock_guard<std::mutex> lock(mutex);
+            state.error.clear();
+        }
+        if (!behind) {
+            std::this_thread::sleep_for(config.replicaPoll);
+        }
+    }
+}
+
+HttpResponse Replica::request(const std::string& method, const std::string& target, const std::string& body,
+                              std::chrono::milliseconds timeout) {
+    std::vector<HttpCall> calls(1);
+    calls[0].endpoints = {0};
+    calls[0].method = method;
+    calls[0].target = target;
+    calls[0].contentType = body.empty() ? "" : "application/json";
+    calls[0].body = body;
+    client->run(calls, timeout);
+
+    if (!calls[0].response) {
+        throw std::runtime_error(calls[0].error);
+    }
+    if (calls[0].response->status != 200) {
+        throw std::runtime_error("The primary answered " + method + " " + target + " with " +
+                                 std::to_string(calls[0].response->status) + ": " + calls[0].response->body);
+    }
+    return std::move(*calls[0].response);
+}
@@ -0,0 +1,88 @@
+// replication.hpp
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "http_client.hpp"
+#include "server_config.hpp"
+#include "sharded_index.hpp"
+#include "thread_pool.hpp"
+
+// Bytes of records returned by one request for the stream
+#define REPLICATION_STREAM_CHUNK_BYTES (4 * 1024 * 1024)
+// Pause before a replica retries after the primary failed to answer
+#define REPLICATION_RETRY_MS 1000
+
+// Primaries and replicas talk over these routes of the primary:
+//
+//   POST /replication/snapshot            save {"indexName"} and return its snapshot manifest
+//   GET  /replication/snapshot/<index>    the manifest of the last snapshot, without saving
+//   GET  /replication/file/<file>         a file of the indices directory named in a manifest
+//   GET  /replication/stream/<index>/<shard>?after=<sequence>
+//
+// A manifest lists each shard's files with the id and log sequence of its snapshot. The stream
+// answers with the primary's last logged sequence, 8 bytes in host order, followed by the
+// shard's records after the requested sequence, framed as in its log file. It answers 410 once
+// the records are no longer buffered, the replica then starts again from a new snapshot.
+
+// Manifest of the last snapshot of every shard of index, listing the files it is made of
+nlohmann::json snapshot_manifest(const ShardedIndex& index);
+// True for a file name a manifest can list, so /replication/file serves nothing else
+bool is_snapshot_file_name(const std::string& fileName);
+
+// Keeps copies of indices of a primary server up to date. Each index is loaded from a snapshot
+// the primary takes for it, then its shards apply the primary's stream of mutations from the
+// sequence their snapshot holds. Every shard is asked for new records at once, again straight
+// away while any is behind and after the poll interval once all are caught up. Records are
+// applied like a replayed log, under the shard's own locks, so searches are served throughout.
+// An index whose stream is no longer available, or breaks, is loaded from a new snapshot and
+// swapped in once it is ready.
+class Replica {
+public:
+    Replica(const ServerConfig& config, IndexRegistry& indices, ThreadPool& pool);
+
+    // Start following every index, each on a thread of its own
+    void start();
+    // Empty when every index is loaded and was caught up with the primary within the max lag,
+    // otherwise why not
+    std::string unhealthyReason() const;
+    // Replication state of an index for /index_status, null if it is not replicated
+    nlohmann::json status(const std::string& indexName) const;
+
+private:
+    struct ShardProgress {
+        uint64_t sequence = 0;        // last record applied
+        uint64_t primarySequence = 0; // last record logged on the primary when it was last asked
+        std::chrono::steady_clock::time_point caughtUpAt;
+    };
+    struct IndexState {
+        std::string name;
+        bool loaded = false;
+        std::string error; // why the last attempt to load or follow it failed
+        std::vector<ShardProgress> shards;
+    };
+
+    const ServerConfig& config;
+    IndexRegistry& indices;
+    ThreadPool& pool;
+    std::unique_ptr<HttpClient> client;
+    std::vector<std::unique_ptr<IndexState>> states;
+    mutable std::mutex mutex; // guards the progress and errors in states
+
+    void follow(IndexState& state);
+    // Download a fresh snapshot of the index and load it, returning the log sequence of each shard
+    std::shared_ptr<ShardedIndex> bootstrap(IndexState& state, std::vector<uint64_t>& sequences);
+    // Apply the stream of every shard until it breaks, which throws
+    void stream(IndexState& state, ShardedIndex& index, std::vector<uint64_t>& sequences);
+    // The primary's answer to a request, throwing std::runtime_error if there is none or it is an error
+    HttpResponse request(const std::string& method, const std::string& target, const std::string& body,
+                         std::chrono::milliseconds timeout);
+};
+
+#endif // REPLICATION_HPP
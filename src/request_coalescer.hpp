@@ -0,0 +1,83 @@
+// request_coalescer.hpp
+#ifndef REQUEST_COALESCER_HPP
+#define REQUEST_COALESCER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Groups tasks submitted by concurrent callers so they can be executed together. The first
+// caller to arrive becomes the leader of a group: it waits up to `window` for others to join
+// (or until the group holds maxBatch tasks), then executes the whole group while the rest
+// wait for their results. The next group starts collecting as soon as the leader takes this one.
+template <typename Task>
+class RequestCoalescer {
+public:
+    using Executor = std::function<void(std::vector<Task*>&)>;
+
+    // Execute task, possibly together with tasks from other threads, and block until it is done.
+    // If execute throws, the exception is rethrown to every caller in the group.
+    void run(Task& task, std::chrono::microseconds window, size_t maxBatch, const Executor& execute) {
+        Slot slot{&task};
+
+        std::unique_lock<std::mutex> lock(mutex);
+        pending.push_back(&slot);
+
+        if (collecting) {
+            if (pending.size() >= maxBatch) {
+                groupFull.notify_one();
+            }
+            finished.wait(lock, [&slot] { return slot.done; });
+        } else {
+            collecting = true;
+            groupFull.wait_for(lock, window, [this, maxBatch] { return pending.size() >= maxBatch; });
+            std::vector<Slot*> group;
+            group.swap(pending);
+            collecting = false;
+            lock.unlock();
+
+            std::vector<Task*> tasks;
+            tasks.reserve(group.size());
+            for (Slot* member : group) {
+                tasks.push_back(member->task);
+            }
+
+            std::exception_ptr error;
+            try {
+                execute(tasks);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            for (Slot* member : group) {
+                member->error = error;
+                member->done = true;
+            }
+            finished.notify_all();
+        }
+
+        if (slot.error) {
+            std::rethrow_exception(slot.error);
+        }
+    }
+
+private:
+    struct Slot {
+        Task* task = nullptr;
+        bool done = false;
+        std::exception_ptr error = nullptr;
+    };
+
+    std::mutex mutex;
+    std::condition_variable groupFull;
+    std::condition_variable finished;
+    std::vector<Slot*> pending;
+    bool collecting = false;
+};
+
+#endif // REQUEST_COALESCER_HPP
@@ -0,0 +1,457 @@
+// request_parser.cpp
+#include "request_parser.hpp"
+#include <climits>
+#include <cstdint>
+#include <optional>
+#include <variant>
+#include <vector>
+
+namespace {
+    // A scalar as the SAX parser reports it. Strings point at the parser's buffer and may be moved from.
+    using JsonScalar = std::variant<std::nullptr_t, bool, int64_t, uint64_t, double, std::string*>;
+
+    std::invalid_argument field_error(const std::string& field, const char* expected) {
+        return std::invalid_argument(field + " must be " + expected);
+    }
+
+    int64_t to_integer(const JsonScalar& value, const std::string& field) {
+        if (const int64_t* v = std::get_if<int64_t>(&value)) {
+            return *v;
+        }
+        if (const uint64_t* v = std::get_if<uint64_t>(&value); v != nullptr && *v <= INT64_MAX) {
+            return static_cast<int64_t>(*v);
+        }
+        throw field_error(field, "an integer");
+    }
+
+    int to_int(const JsonScalar& value, const std::string& field) {
+        int64_t v = to_integer(value, field);
+        if (v < INT_MIN || v > INT_MAX) {
+            throw std::invalid_argument(field + " is out of range");
+        }
+        return static_cast<int>(v);
+    }
+
+    float to_float(const JsonScalar& value, const std::string& field) {
+        if (const double* v = std::get_if<double>(&value)) return static_cast<float>(*v);
+        if (const int64_t* v = std::get_if<int64_t>(&value)) return static_cast<float>(*v);
+        if (const uint64_t* v = std::get_if<uint64_t>(&value)) return static_cast<float>(*v);
+        throw field_error(field, "numbers");
+    }
+
+    bool to_bool(const JsonScalar& value, const std::string& field) {
+        if (const bool* v = std::get_if<bool>(&value)) {
+            return *v;
+        }
+        throw field_error(field, "a boolean");
+    }
+
+    std::string to_string(const JsonScalar& value, const std::string& field) {
+        if (std::string* const* v = std::get_if<std::string*>(&value)) {
+            return std::move(**v);
+        }
+        throw field_error(field, "a string");
+    }
+
+    FieldValue to_field_value(const JsonScalar& value) {
+        if (std::holds_alternative<int64_t>(value) || std::holds_alternative<uint64_t>(value)) {
+            return static_cast<long>(to_integer(value, "Integer metadata values"));
+        }
+        if (const double* v = std::get_if<double>(&value)) {
+            return *v;
+        }
+        if (std::string* const* v = std::get_if<std::string*>(&value)) {
+            return std::move(**v);
+        }
+        throw std::invalid_argument("Unsupported type in metadatas");
+    }
+
+    // Tracks the containers enclosing the current value and hands every scalar and every
+    // container to the request specific reader, which looks at that path to decide what the
+    // value is. Values at paths a reader does not know are skipped.
+    class RequestReader : public nlohmann::json_sax<nlohmann::json> {
+    public:
+        bool null() override { return scalar(nullptr); }
+        bool boolean(bool val) override { return scalar(val); }
+        bool number_integer(number_integer_t val) override { return scalar(static_cast<int64_t>(val)); }
+        bool number_unsigned(number_unsigned_t val) override { return scalar(static_cast<uint64_t>(val)); }
+        bool number_float(number_float_t val, const string_t&) override { return scalar(static_cast<double>(val)); }
+        bool string(string_t& val) override { return scalar(&val); }
+        bool binary(binary_t&) override { throw std::invalid_argument("Unsupported binary value in request"); }
+
+        bool start_object(std::size_t) override { return open(false); }
+        bool start_array(std::size_t) override { return open(true); }
+        bool end_object() override { return close(); }
+        bool end_array() override { return close(); }
+
+        bool key(string_t& val) override {
+            frames.back().key = val;
+            return true;
+        }
+
+        bool parse_error(std::size_t, const std::string&, const nlohmann::json::exception& ex) override {
+            throw std::invalid_argument(std::string("Invalid JSON: ") + ex.what());
+        }
+
+        void parse(const std::string& body) {
+            nlohmann::json::sax_parse(body, this);
+            finish();
+        }
+
+    protected:
+        struct Frame {
+            bool array;
+            std::string key;  // member being read, for objects
+            size_t index = 0; // elements completed so far, for arrays
+        };
+        // Enclosing containers, the root object first
+        std::vector<Frame> frames;
+
+        // Called with frames holding the enclosing containers of the value
+        virtual void onScalar(const JsonScalar& value) = 0;
+        virtual void onOpen(bool array) = 0;
+        // Called once the container has been popped off frames
+        virtual void onClose(bool array) {}
+        // Called after the whole body has been read
+        virtual void finish() {}
+
+        size_t depth() const { return frames.size(); }
+        const std::string& rootKey() const { return frames[0].key; }
+
+        void require(bool present, const char* field) const {
+            if (!present) {
+                throw std::invalid_argument(std::string("Missing field: ") + field);
+            }
+        }
+
+    private:
+        bool scalar(const JsonScalar& value) {
+            if (frames.empty()) {
+                throw std::invalid_argument("Request body must be a JSON object");
+            }
+            onScalar(value);
+            if (frames.back().array) {
+                frames.back().index++;
+            }
+            return true;
+        }
+
+        bool open(bool array) {
+            if (frames.empty() && array) {
+                throw std::invalid_argument("Request body must be a JSON object");
+            }
+            onOpen(array);
+            frames.push_back({array, std::string()});
+            return true;
+        }
+
+        bool close() {
+            bool array = frames.back().array;
+            frames.pop_back();
+            onClose(array);
+            if (!frames.empty() && frames.back().array) {
+                frames.back().index++;
+            }
+            return true;
+        }
+    };
+
+    class AddDocumentsReader : public RequestReader {
+    public:
+        explicit AddDocumentsReader(AddDocumentsRequest& request) : request(request) {}
+
+    private:
+        AddDocumentsRequest& request;
+        bool hasIndexName = false;
+        bool hasIds = false;
+        bool hasVectors = false;
+        size_t rowLength = 0;
+
+        void onScalar(const JsonScalar& value) override {
+            if (depth() == 1) {
+                if (rootKey() == "indexName") {
+                    request.indexName = to_string(value, "indexName");
+                    hasIndexName = true;
+                } else if (rootKey() == "numThreads") {
+                    request.numThreads = to_int(value, "numThreads");
+                } else if (rootKey() == "ids" || rootKey() == "vectors") {
+                    throw field_error(rootKey(), "an array");
+                } else if (rootKey() == "metadatas" && !std::holds_alternative<std::nullptr_t>(value)) {
+                    throw field_error("metadatas", "an array");
+                }
+            } else if (depth() == 2) {
+                if (rootKey() == "ids") {
+                    request.ids.push_back(to_int(value, "ids"));
+                } else if (rootKey() == "vectors") {
+                    throw field_error("vectors", "arrays of numbers");
+                } else if (rootKey() == "metadatas") {
+                    if (!std::holds_alternative<std::nullptr_t>(value)) {
+                        throw field_error("metadatas", "objects");
+                    }
+                    request.metadatas.emplace_back();
+                }
+            } else if (depth() == 3) {
+                if (rootKey() == "vectors") {
+                    request.packedStorage.push_back(to_float(value, "vectors"));
+                    rowLength++;
+                } else if (rootKey() == "metadatas") {
+                    request.metadatas.back()[frames[2].key] = to_field_value(value);
+                }
+            }
+        }
+
+        void onOpen(bool array) override {
+            if (depth() == 0) {
+                return;
+            }
+            const std::string& key = rootKey();
+            if (key != "ids" && key != "vectors" && key != "metadatas") {
+                return;
+            }
+            if (depth() == 1) {
+                if (!array) {
+                    throw field_error(key, "an array");
+                }
+                hasIds |= key == "ids";
+                hasVectors |= key == "vectors";
+            } else if (depth() == 2 && key == "vectors" && array) {
+                rowLength = 0;
+            } else if (depth() == 2 && key == "metadatas" && !array) {
+                request.metadatas.emplace_back();
+            } else if (key == "metadatas") {
+                throw std::invalid_argument("Unsupported type in metadatas");
+            } else {
+                throw field_error(key, key == "ids" ? "integers" : "arrays of numbers");
+            }
+        }
+
+        void onClose(bool array) override {
+            if (depth() == 2 && rootKey() == "vectors") {
+                if (request.packedCount == 0) {
+                    request.packedDimension = rowLength;
+                } else if (rowLength != request.packedDimension) {
+                    throw std::invalid_argument("Vector dimension does not match index dimension");
+                }
+                request.packedCount++;
+            }
+        }
+
+        void finish() override {
+            require(hasIndexName, "indexName");
+            require(hasIds, "ids");
+            require(hasVectors, "vectors");
+            request.packedVectors = request.packedStorage.data();
+        }
+    };
+
+    // Reads the options shared by /search and /search_batch from the root object
+    template <typename Request>
+    bool read_search_option(Request& request, const std::string& key, const JsonScalar& value) {
+        if (key == "efSearch") {
+            request.efSearch = to_int(value, key);
+        } else if (key == "returnMetadata") {
+            request.returnMetadata = to_bool(value, key);
+        } else if (key == "debug") {
+            request.debug = to_bool(value, key);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    class SearchReader : public RequestReader {
+    public:
+        explicit SearchReader(SearchRequest& request) : request(request) {}
+
+    private:
+        SearchRequest& request;
+        bool hasIndexName = false;
+        bool hasK = false;
+        bool hasQueryVector = false;
+
+        void onScalar(const JsonScalar& value) override {
+            if (depth() == 1) {
+                const std::string& key = rootKey();
+                if (key == "indexName") {
+                    request.indexName = to_string(value, key);
+                    hasIndexName = true;
+                } else if (key == "k") {
+                    request.k = to_int(value, key);
+                    hasK = true;
+                } else if (key == "filter") {
+                    request.filter = to_string(value, key);
+                } else if (key == "queryVector" || key == "facets") {
+                    throw field_error(key, "an array");
+                } else {
+                    read_search_option(request, key, value);
+                }
+            } else if (depth() == 2 && rootKey() == "queryVector") {
+                request.queryVector.push_back(to_float(value, "queryVector"));
+            } else if (depth() == 2 && rootKey() == "facets") {
+                request.facets.push_back(to_string(value, "facets"));
+            }
+        }
+
+        void onOpen(bool array) override {
+            if (depth() == 0) {
+                return;
+            }
+            if (rootKey() == "queryVector") {
+                if (depth() > 1 || !array) {
+                    throw field_error("queryVector", "an array of numbers");
+                }
+                hasQueryVector = true;
+            } else if (rootKey() == "facets" && (depth() > 1 || !array)) {
+                throw field_error("facets", "an array of strings");
+            }
+        }
+
+        void finish() override {
+            require(hasIndexName, "indexName");
+            require(hasK, "k");
+            require(hasQueryVector, "queryVector");
+        }
+    };
+
+    class SearchBatchReader : public RequestReader {
+    public:
+        explicit SearchBatchReader(SearchBatchRequest& request) : request(request) {}
+
+    private:
+        SearchBatchRequest& request;
+        bool hasIndexName = false;
+        bool hasQueries = false;
+        // Per query k and filter, which fall back to the top level ones once those are known
+        std::vector<std::optional<int>> ks;
+        std::vector<std::optional<std::string>> filters;
+        std::vector<bool> hasQueryVector;
+
+        bool inQuery() const { return depth() >= 3 && rootKey() == "queries"; }
+
+        void onScalar(const JsonScalar& value) override {
+            if (depth() == 1) {
+                const std::string& key = rootKey();
+                if (key == "indexName") {
+                    request.indexName = to_string(value, key);
+                    hasIndexName = true;
+                } else if (key == "k") {
+                    request.k = to_int(value, key);
+                } else if (key == "filter") {
+                    request.filter = to_string(value, key);
+                } else if (key == "queries") {
+                    throw field_error(key, "an array");
+                } else {
+                    read_search_option(request, key, value);
+                }
+            } else if (depth() == 2 && rootKey() == "queries") {
+                throw field_error("queries", "objects");
+            } else if (depth() == 3 && inQuery()) {
+                const std::string& key = frames[2].key;
+                if (key == "k") {
+                    ks.back() = to_int(value, key);
+                } else if (key == "filter") {
+                    filters.back() = to_string(value, key);
+                } else if (key == "queryVector") {
+                    throw field_error(key, "an array");
+                }
+            } else if (depth() == 4 && inQuery() && frames[2].key == "queryVector") {
+                request.queries.back().queryVector.push_back(to_float(value, "queryVector"));
+            }
+        }
+
+        void onOpen(bool array) override {
+            if (depth() == 0 || rootKey() != "queries") {
+                return;
+            }
+            if (depth() == 1) {
+                if (!array) {
+                    throw field_error("queries", "an array");
+                }
+                hasQueries = true;
+            } else if (depth() == 2) {
+                if (array) {
+                    throw field_error("queries", "objects");
+                }
+                request.queries.emplace_back();
+                ks.emplace_back();
+                filters.emplace_back();
+                hasQueryVector.push_back(false);
+            } else if (frames[2].key == "queryVector") {
+                if (depth() > 3 || !array) {
+                    throw field_error("queryVector", "an array of numbers");
+                }
+                hasQueryVector.back() = true;
+            }
+        }
+
+        void finish() override {
+            require(hasIndexName, "indexName");
+            require(hasQueries, "queries");
+            for (size_t i = 0; i < request.queries.size(); i++) {
+                require(hasQueryVector[i], "queryVector");
+                request.queries[i].k = ks[i].value_or(request.k);
+                request.queries[i].filter = filters[i] ? std::move(*filters[i]) : request.filter;
+            }
+        }
+    };
+
+    class DeleteDocumentsReader : public RequestReader {
+    public:
+        explicit DeleteDocumentsReader(DeleteDocumentsRequest& request) : request(request) {}
+
+    private:
+        DeleteDocumentsRequest& request;
+        bool hasIndexName = false;
+        bool hasIds = false;
+
+        void onScalar(const JsonScalar& value) override {
+            if (depth() == 1 && rootKey() == "indexName") {
+                request.indexName = to_string(value, "indexName");
+                hasIndexName = true;
+            } else if (depth() == 1 && rootKey() == "ids") {
+                throw field_error("ids", "an array");
+            } else if (depth() == 2 && rootKey() == "ids") {
+                request.ids.push_back(to_int(value, "ids"));
+            }
+        }
+
+        void onOpen(bool array) override {
+            if (depth() == 0 || rootKey() != "ids") {
+                return;
+            }
+            if (depth() > 1 || !array) {
+                throw field_error("ids", "an array of integers");
+            }
+            hasIds = true;
+        }
+
+        void finish() override {
+            require(hasIndexName, "indexName");
+            require(hasIds, "ids");
+        }
+    };
+}
+
+void parse_json_request(const std::string& body, AddDocumentsRequest& request) {
+    AddDocumentsReader(request).parse(body);
+}
+
+void parse_json_request(const std::string& body, SearchRequest& request) {
+    SearchReader(request).parse(body);
+}
+
+void parse_json_request(const std::string& body, SearchBatchRequest& request) {
+    SearchBatchReader(request).parse(body);
+}
+
+void parse_json_request(const std::string& body, DeleteDocumentsRequest& request) {
+    DeleteDocumentsReader(request).parse(body);
+}
+
+nlohmann::json parse_json_body(const std::string& body) {
+    try {
+        return nlohmann::json::parse(body);
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument(std::string("Invalid JSON: ") + e.what());
+    }
+}
@@ -0,0 +1,59 @@
+// request_parser.hpp
+#ifndef REQUEST_PARSER_HPP
+#define REQUEST_PARSER_HPP
+
+#include <stdexcept>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "binary_format.hpp"
+#include "models.hpp"
+
+// Fill a request straight from its JSON body through nlohmann's SAX interface, without
+// building a document first. Numbers are converted once, as they are read: vectors into
+// their final buffers (packed and row major for AddDocumentsRequest) and metadata values
+// into FieldValues. Malformed JSON and missing or mistyped fields throw std::invalid_argument.
+void parse_json_request(const std::string& body, AddDocumentsRequest& request);
+void parse_json_request(const std::string& body, SearchRequest& request);
+void parse_json_request(const std::string& body, SearchBatchRequest& request);
+void parse_json_request(const std::string& body, DeleteDocumentsRequest& request);
+
+// Parse a request body in either the JSON or the binary vector format, depending on its content type
+template<typename T>
+T parse_request(const std::string& body, const std::string& contentType) {
+    T request;
+    if (contentType.rfind(BINARY_VECTORS_CONTENT_TYPE, 0) == 0) {
+        try {
+            from_binary(parse_binary_vectors(body), request);
+        } catch (const nlohmann::json::exception& e) {
+            throw std::invalid_argument(e.what());
+        }
+    } else {
+        parse_json_request(body, request);
+    }
+    return request;
+}
+
+// The body as a document, for the requests that keep one. Malformed JSON throws std::invalid_argument.
+nlohmann::json parse_json_body(const std::string& body);
+
+// j converted to T, with missing or mistyped fields reported as std::invalid_argument
+template<typename T>
+T json_get(const nlohmann::json& j) {
+    try {
+        return j.get<T>();
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument(e.what());
+    }
+}
+
+// The member key of j converted to T. A missing or mistyped member throws std::invalid_argument.
+template<typename T>
+T json_get(const nlohmann::json& j, const std::string& key) {
+    try {
+        return j.at(key).get<T>();
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument(e.what());
+    }
+}
+
+#endif // REQUEST_PARSER_HPP
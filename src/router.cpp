@@ -0,0 +1,407 @@
+// router.cpp
+#include "router.hpp"
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include "binary_format.hpp"
+#include "models.hpp"
+#include "request_parser.hpp"
+#include "sharded_index.hpp"
+
+std::vector<std::vector<std::string>> parse_shard_map(const std::string& shardMap) {
+    std::vector<std::vector<std::string>> shards;
+    std::stringstream shardList(shardMap);
+    std::string shard;
+    while (std::getline(shardList, shard, ',')) {
+        std::vector<std::string> servers;
+        std::stringstream serverList(shard);
+        std::string server;
+        while (std::getline(serverList, server, '|')) {
+            server.erase(std::remove_if(server.begin(), server.end(), [](unsigned char c) { return std::isspace(c); }), server.end());
+            if (!server.empty()) {
+                servers.push_back(server);
+            }
+        }
+        if (servers.empty()) {
+            throw std::invalid_argument("Shard " + std::to_string(shards.size()) + " of the shard map has no servers");
+        }
+        shards.push_back(std::move(servers));
+    }
+    if (shards.empty()) {
+        throw std::invalid_argument("The shard map is empty");
+    }
+    return shards;
+}
+
+namespace {
+    HttpResponse json_response(const nlohmann::json& body) {
+        HttpResponse response;
+        response.status = 200;
+        response.body = body.dump();
+        return response;
+    }
+
+    // The k nearest hits over the answers, with their metadata when every answer carries it
+    void merge_hits(const std::vector<const nlohmann::json*>& answers, size_t k, nlohmann::json& out) {
+        struct Hit {
+            double distance;
+            int id;
+            size_t answer;
+            size_t position;
+        };
+        std::vector<Hit> hits;
+        bool withMetadata = !answers.empty();
+        for (size_t a = 0; a < answers.size(); a++) {
+            const auto& ids = answers[a]->at("hits");
+            const auto& distances = answers[a]->at("distances");
+            for (size_t i = 0; i < ids.size(); i++) {
+                hits.push_back({distances.at(i).get<double>(), ids.at(i).get<int>(), a, i});
+            }
+            withMetadata = withMetadata && answers[a]->contains("metadatas");
+        }
+
+        size_t count = std::min(k, hits.size());
+        std::partial_sort(hits.begin(), hits.begin() + count, hits.end(), [](const Hit& a, const Hit& b) {
+            return a.distance != b.distance ? a.distance < b.distance : a.id < b.id;
+        });
+
+        out["hits"] = nlohmann::json::array();
+        out["distances"] = nlohmann::json::array();
+        if (withMetadata) {
+            out["metadatas"] = nlohmann::json::array();
+        }
+        for (size_t i = 0; i < count; i++) {
+            const Hit& hit = hits[i];
+            out["hits"].push_back(hit.id);
+            out["distances"].push_back(answers[hit.answer]->at("distances").at(hit.position));
+            if (withMetadata) {
+                out["metadatas"].push_back(answers[hit.answer]->at("metadatas").at(hit.position));
+            }
+        }
+    }
+
+    // Add one shard's facets to the merged ones: value counts are summed and numeric ranges widened
+    void merge_facets(nlohmann::json& merged, const nlohmann::json& facets) {
+        for (const auto& [field, summary] : facets.items()) {
+            nlohmann::json& target = merged[field];
+            if (summary.contains("values")) {
+                nlohmann::json& values = target["values"];
+                for (const auto& [value, count] : summary.at("values").items()) {
+                    size_t previous = values.contains(value) ? values[value].get<size_t>() : 0;
+                    values[value] = previous + count.get<size_t>();
+                }
+            }
+            if (summary.contains("count")) {
+                if (!target.contains("count")) {
+                    target["min"] = summary.at("min");
+                    target["max"] = summary.at("max");
+                    target["count"] = summary.at("count");
+                    continue;
+                }
+                if (summary.at("min") < target["min"]) {
+                    target["min"] = summary.at("min");
+                }
+                if (target["max"] < summary.at("max")) {
+                    target["max"] = summary.at("max");
+                }
+                target["count"] = target["count"].get<size_t>() + summary.at("count").get<size_t>();
+            }
+        }
+    }
+
+    nlohmann::json metadata_json(const std::map<std::string, FieldValue>& metadata) {
+        nlohmann::json object = nlohmann::json::object();
+        for (const auto& [key, value] : metadata) {
+            std::visit([&object, &key = key](const auto& v) { object[key] = v; }, value);
+        }
+        return object;
+    }
+}
+
+Router::Router(const ServerConfig& config)
+    : deadline(config.routerDeadline), hedgeDelay(config.routerHedgeDelay), writeTimeout(config.routerWriteTimeout) {
+    // A server listed under several shards, or as a replica of more than one, shares its pool
+    std::vector<Endpoint> endpoints;
+    std::map<std::string, size_t> positions;
+    for (const auto& servers : parse_shard_map(config.routerShards)) {
+        std::vector<size_t> shard;
+        for (const auto& server : servers) {
+            auto [it, inserted] = positions.emplace(server, endpoints.size());
+            if (inserted) {
+                endpoints.push_back(resolve_endpoint(server));
+            }
+            shard.push_back(it->second);
+        }
+        shards.push_back(std::move(shard));
+    }
+    client = std::make_unique<HttpClient>(std::move(endpoints), config.routerPoolSize);
+}
+
+std::vector<HttpCall> Router::scatter(const std::string& target, const std::string& contentType, const std::string& body) {
+    std::vector<HttpCall> calls(shards.size());
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        calls[shard].endpoints = shards[shard];
+        calls[shard].method = "POST";
+        calls[shard].target = target;
+        calls[shard].contentType = contentType;
+        calls[shard].body = body;
+        calls[shard].hedge = hedgeDelay.count() > 0;
+    }
+    client->run(calls, deadline, hedgeDelay);
+    return calls;
+}
+
+std::vector<nlohmann::json> Router::gather(const std::vector<HttpCall>& calls, std::vector<size_t>& failedShards,
+                                           std::optional<HttpResponse>& failure) const {
+    std::vector<nlohmann::json> answers(calls.size());
+    std::string errors;
+    for (size_t shard = 0; shard < calls.size(); shard++) {
+        const HttpCall& call = calls[shard];
+        if (!call.response) {
+            failedShards.push_back(shard);
+            errors += "\nshard " + std::to_string(shard) + ": " + call.error;
+            continue;
+        }
+        if (call.response->status != 200) {
+            failure = call.response;
+            return answers;
+        }
+        try {
+            answers[shard] = nlohmann::json::parse(call.response->body);
+        } catch (const nlohmann::json::exception& e) {
+            failure = HttpResponse{502, "Shard " + std::to_string(shard) + " returned malformed JSON: " + e.what()};
+            return answers;
+        }
+    }
+    if (failedShards.size() == calls.size()) {
+        failure = HttpResponse{503, "No shard answered" + errors};
+    }
+    return answers;
+}
+
+HttpResponse Router::search(const std::string& body, const std::string& contentType) {
+    SearchRequest request = parse_request<SearchRequest>(body, contentType);
+    auto calls = scatter("/search", contentType, body);
+    std::vector<size_t> failedShards;
+    std::optional<HttpResponse> failure;
+    auto answers = gather(calls, failedShards, failure);
+    if (failure) {
+        return *failure;
+    }
+
+    std::vector<const nlohmann::json*> answered;
+    for (const auto& answer : answers) {
+        if (!answer.is_null()) {
+            answered.push_back(&answer);
+        }
+    }
+
+    nlohmann::json response;
+    merge_hits(answered, static_cast<size_t>(std::max(request.k, 0)), response);
+    if (!request.facets.empty()) {
+        response["facets"] = nlohmann::json::object();
+        for (const auto* answer : answered) {
+            merge_facets(response["facets"], answer->at("facets"));
+        }
+    }
+    if (request.debug) {
+        response["debug"]["shards"] = nlohmann::json::array();
+        for (const auto& answer : answers) {
+            response["debug"]["shards"].push_back(answer.is_null() ? nlohmann::json() : answer.value("debug", nlohmann::json()));
+        }
+    }
+    if (!failedShards.empty()) {
+        response["failedShards"] = failedShards;
+    }
+    return json_response(response);
+}
+
+HttpResponse Router::searchBatch(const std::string& body, const std::string& contentType) {
+    SearchBatchRequest request = parse_request<SearchBatchRequest>(body, contentType);
+    auto calls = scatter("/search_batch", contentType, body);
+    std::vector<size_t> failedShards;
+    std::optional<HttpResponse> failure;
+    auto answers = gather(calls, failedShards, failure);
+    if (failure) {
+        return *failure;
+    }
+
+    nlohmann::json response;
+    response["results"] = nlohmann::json::array();
+    for (size_t q = 0; q < request.queries.size(); q++) {
+        std::vector<const nlohmann::json*> answered;
+        for (const auto& answer : answers) {
+            if (!answer.is_null()) {
+                answered.push_back(&answer.at("results").at(q));
+            }
+        }
+        nlohmann::json result;
+        merge_hits(answered, static_cast<size_t>(std::max(request.queries[q].k, 0)), result);
+        if (request.debug) {
+            result["debug"]["shards"] = nlohmann::json::array();
+            for (const auto& answer : answers) {
+                result["debug"]["shards"].push_back(answer.is_null() ? nlohmann::json() : answer.at("results").at(q).value("debug", nlohmann::json()));
+            }
+        }
+        response["results"].push_back(std::move(result));
+    }
+    if (!failedShards.empty()) {
+        response["failedShards"] = failedShards;
+    }
+    return json_response(response);
+}
+
+HttpResponse Router::facets(const std::string& body) {
+    parse_json_body(body);
+    auto calls = scatter("/facets", "application/json", body);
+    std::vector<size_t> failedShards;
+    std::optional<HttpResponse> failure;
+    auto answers = gather(calls, failedShards, failure);
+    if (failure) {
+        return *failure;
+    }
+
+    nlohmann::json response;
+    response["facets"] = nlohmann::json::object();
+    for (const auto& answer : answers) {
+        if (!answer.is_null()) {
+            merge_facets(response["facets"], answer.at("facets"));
+        }
+    }
+    if (!failedShards.empty()) {
+        response["failedShards"] = failedShards;
+    }
+    return json_response(response);
+}
+
+HttpResponse Router::getDocument(const std::string& indexName, int id) {
+    std::vector<HttpCall> calls(1);
+    calls[0].endpoints = shards[shard_of(id, shards.size())];
+    calls[0].method = "GET";
+    calls[0].target = "/get_document/" + url_encode(indexName) + "/" + std::to_string(id);
+    calls[0].hedge = hedgeDelay.count() > 0;
+    client->run(calls, deadline, hedgeDelay);
+    if (!calls[0].response) {
+        return HttpResponse{504, calls[0].error};
+    }
+    return *calls[0].response;
+}
+
+HttpResponse Router::addDocuments(const std::string& body, const std::string& contentType) {
+    AddDocumentsRequest request = parse_request<AddDocumentsRequest>(body, contentType);
+    if (request.numVectors() != request.ids.size()) {
+        throw std::invalid_argument("Number of IDs does not match number of vectors");
+    }
+    if (!request.metadatas.empty() && request.metadatas.size() != request.ids.size()) {
+        throw std::invalid_argument("Number of metadatas does not match number of IDs");
+    }
+    size_t dimension = request.ids.empty() ? 0 : request.dimensionAt(0);
+    for (size_t i = 0; i < request.ids.size(); i++) {
+        if (request.dimensionAt(i) != dimension) {
+            throw std::invalid_argument("Vector dimension does not match index dimension");
+        }
+    }
+
+    std::vector<std::vector<size_t>> rows(shards.size());
+    for (size_t i = 0; i < request.ids.size(); i++) {
+        rows[shard_of(request.ids[i], shards.size())].push_back(i);
+    }
+
+    // Each shard's part travels in the binary format whatever the request used, so vectors
+    // are not printed and parsed again as JSON
+    std::vector<HttpCall> calls;
+    std::vector<size_t> callShards;
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        if (rows[shard].empty()) continue;
+        nlohmann::json header;
+        header["indexName"] = request.indexName;
+        header["ids"] = nlohmann::json::array();
+        if (request.numThreads != 0) {
+            header["numThreads"] = request.numThreads;
+        }
+        std::vector<float> vectors;
+        vectors.reserve(rows[shard].size() * dimension);
+        for (size_t row : rows[shard]) {
+            header["ids"].push_back(request.ids[row]);
+            if (!request.metadatas.empty()) {
+                header["metadatas"].push_back(metadata_json(request.metadatas[row]));
+            }
+            vectors.insert(vectors.end(), request.vectorAt(row), request.vectorAt(row) + dimension);
+        }
+
+        HttpCall call;
+        call.endpoints = {shards[shard].front()};
+        call.method = "POST";
+        call.target = "/add_documents";
+        call.contentType = BINARY_VECTORS_CONTENT_TYPE;
+        call.body = encode_binary_vectors(header, vectors.data(), static_cast<uint32_t>(rows[shard].size()), static_cast<uint32_t>(dimension));
+        calls.push_back(std::move(call));
+        callShards.push_back(shard);
+    }
+    if (calls.empty()) {
+        return HttpResponse{200, "Documents added"};
+    }
+    return write(calls, callShards);
+}
+
+HttpResponse Router::deleteDocuments(const std::string& body) {
+    DeleteDocumentsRequest request;
+    parse_json_request(body, request);
+
+    std::vector<std::vector<int>> ids(shards.size());
+    for (int id : request.ids) {
+        ids[shard_of(id, shards.size())].push_back(id);
+    }
+
+    std::vector<HttpCall> calls;
+    std::vector<size_t> callShards;
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        if (ids[shard].empty()) continue;
+        HttpCall call;
+        call.endpoints = {shards[shard].front()};
+        call.method = "POST";
+        call.target = "/delete_documents";
+        call.contentType = "application/json";
+        call.body = nlohmann::json{{"indexName", request.indexName}, {"ids", ids[shard]}}.dump();
+        calls.push_back(std::move(call));
+        callShards.push_back(shard);
+    }
+    if (calls.empty()) {
+        return HttpResponse{200, "Documents deleted"};
+    }
+    return write(calls, callShards);
+}
+
+HttpResponse Router::broadcast(const std::string& target, const std::string& body) {
+    std::vector<HttpCall> calls(shards.size());
+    std::vector<size_t> callShards(shards.size());
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        calls[shard].endpoints = {shards[shard].front()};
+        calls[shard].method = "POST";
+        calls[shard].target = target;
+        calls[shard].contentType = "application/json";
+        calls[shard].body = body;
+        callShards[shard] = shard;
+    }
+    return write(calls, callShards);
+}
+
+HttpResponse Router::write(std::vector<HttpCall>& calls, const std::vector<size_t>& callShards) {
+    client->run(calls, writeTimeout);
+
+    // Shards that did answer keep the write, so a client retrying after a 502 may repeat it on them
+    std::string errors;
+    for (size_t i = 0; i < calls.size(); i++) {
+        if (!calls[i].response) {
+            errors += "\nshard " + std::to_string(callShards[i]) + ": " + calls[i].error;
+        } else if (calls[i].response->status >= 300) {
+            return *calls[i].response;
+        }
+    }
+    if (!errors.empty()) {
+        return HttpResponse{502, "Write failed on some shards" + errors};
+    }
+    return *calls.front().response;
+}
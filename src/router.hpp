@@ -0,0 +1,63 @@
+// router.hpp
+#ifndef ROUTER_HPP
+#define ROUTER_HPP
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "http_client.hpp"
+#include "server_config.hpp"
+
+// Servers of each shard from a shard map such as "a:8686|b:8686,c:8686": shards are separated
+// by commas and the servers holding the same shard by '|', the one taking writes first.
+// Throws std::invalid_argument when a shard is empty.
+std::vector<std::vector<std::string>> parse_shard_map(const std::string& shardMap);
+
+// Scatter-gather front end over servers that each hold one shard of every index. It owns no
+// data. Documents are placed with the same id hash as shards within one server, so shard i of
+// the map holds the ids shard_of assigns to i.
+//
+// Reads go to every shard, each with its own deadline, and are hedged onto the shard's next
+// server when it is slow to answer. A shard that misses the deadline is left out and listed
+// under "failedShards" in the response. Writes go to the first server of each shard they
+// touch and wait for all of them. A backend's own error response is returned as is.
+//
+// Every method returns the response for the client. Malformed requests throw std::invalid_argument.
+class Router {
+public:
+    explicit Router(const ServerConfig& config);
+
+    size_t shardCount() const { return shards.size(); }
+
+    HttpResponse search(const std::string& body, const std::string& contentType);
+    HttpResponse searchBatch(const std::string& body, const std::string& contentType);
+    HttpResponse facets(const std::string& body);
+    HttpResponse getDocument(const std::string& indexName, int id);
+
+    // Split the batch by shard and send each shard its part
+    HttpResponse addDocuments(const std::string& body, const std::string& contentType);
+    HttpResponse deleteDocuments(const std::string& body);
+    // Send an index level request unchanged to every shard
+    HttpResponse broadcast(const std::string& target, const std::string& body);
+
+private:
+    std::vector<std::vector<size_t>> shards; // endpoint indices of each shard, writes to the first
+    std::unique_ptr<HttpClient> client;
+    std::chrono::milliseconds deadline;
+    std::chrono::milliseconds hedgeDelay;
+    std::chrono::milliseconds writeTimeout;
+
+    // The same request to every shard, run to the read deadline
+    std::vector<HttpCall> scatter(const std::string& target, const std::string& contentType, const std::string& body);
+    // Run writes, callShards holding the shard each call goes to, and answer for all of them
+    HttpResponse write(std::vector<HttpCall>& calls, const std::vector<size_t>& callShards);
+    // The JSON answers of the shards that responded in time, null for those that did not.
+    // Sets failure instead when a shard answered with an error or none answered at all.
+    std::vector<nlohmann::json> gather(const std::vector<HttpCall>& calls, std::vector<size_t>& failedShards,
+                                       std::optional<HttpResponse>& failure) const;
+};
+
+#endif // ROUTER_HPP
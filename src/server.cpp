@@ -1,236 +1,761 @@
 #include "crow.h"
 #include "hnswlib/hnswlib.h"
 #include "nlohmann/json.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
 #include <unordered_map>
 #include <vector>
 #include <string>
 #include <filesystem>
 #include <mutex>
 #include <shared_mutex>
+#include <thread>
 #include <unordered_set>
 #include "data_store.hpp"
 #include "models.hpp"
 #include "filters.hpp"
-#include "lfu_cache.hpp"
+#include "id_set.hpp"
+#include "index_handle.hpp"
+#include "json_writer.hpp"
+#include "metrics.hpp"
+#include "replication.hpp"
+#include "request_parser.hpp"
+#include "router.hpp"
+#include "server_config.hpp"
+#include "sharded_index.hpp"
+#include "thread_pool.hpp"
+
+ServerConfig config;
+IndexRegistry indices;
+ThreadPool workerPool;
+// False while saved indices are loaded at startup
+std::atomic<bool> serverReady{true};
+// Set when the server replicates the indices of a primary
+std::unique_ptr<Replica> replica;
+
+// Request metrics by route, keyed by the first segment of the path. Filled before the server
+// starts and only read afterwards, so lookups take no lock.
+std::map<std::string, RouteMetrics> routeMetrics;
+const std::vector<std::string> METRICS_ROUTES = {
+    "/health", "/metrics", "/create_index", "/load_index", "/index_status", "/save_index", "/rebuild_index", "/delete_index",
+    "/delete_index_from_disk", "/list_indices", "/add_documents", "/delete_documents", "/get_document",
+    "/search", "/search_batch", "/facets", "/replication", "other"
+};
 
-#define DEFAULT_INDEX_SIZE 100000
-#define DEFAULT_INDEX_RESIZE_HEADROOM 10000
-#define INDEX_GROWTH_FACTOR 2.0
-#define EXACT_KNN_FILTER_PCT_MATCH_THRESHOLD 0.1
-#define MAX_FILTER_CACHE_SIZE 1000
+// Routes a replica rejects: writes, and replication, which only a primary serves
+const std::unordered_set<std::string> WRITE_ROUTES = {
+    "/create_index", "/load_index", "/save_index", "/rebuild_index", "/delete_index", "/delete_index_from_disk",
+    "/add_documents", "/delete_documents", "/replication"
+};
 
-std::unordered_map<std::string, hnswlib::HierarchicalNSW<float>*> indices;
-std::unordered_map<std::string, nlohmann::json> indexSettings;
-std::unordered_map<std::string, DataStore*> dataStores;
+// Times every request and counts it against its route
+struct RequestMetrics {
+    struct context {
+        std::chrono::steady_clock::time_point start;
+    };
 
-std::unordered_map<std::string, LFUCache<std::string, std::unordered_set<int>>*> indexFilterCache;
+    void before_handle(crow::request &, crow::response &, context &ctx) {
+        ctx.start = std::chrono::steady_clock::now();
+    }
 
-std::shared_mutex indexMutex;
-std::mutex dataStoreMutex;
+    void after_handle(crow::request &req, crow::response &res, context &ctx) {
+        auto it = routeMetrics.find(req.url.substr(0, req.url.find('/', 1)));
+        RouteMetrics& route = it != routeMetrics.end() ? it->second : routeMetrics.at("other");
+        route.requests.add();
+        if (res.code >= 400) {
+            route.errors.add();
+        }
+        route.latency.observe(std::chrono::steady_clock::now() - ctx.start);
+    }
+};
+
+// Rejects writes on a replica, its indices only change through the primary's stream
+struct ReadOnlyReplica {
+    struct context {};
 
-// Functor to filter results with a set of IDs
-class FilterIdsInSet : public hnswlib::BaseFilterFunctor {
-    public:
-    std::unordered_set<int>& ids;
-    FilterIdsInSet(std::unordered_set<int>& ids) : ids(ids) {}
-    bool operator()(hnswlib::labeltype label_id) {
-        return ids.find(label_id) != ids.end();
+    void before_handle(crow::request &req, crow::response &res, context &) {
+        if (replica && WRITE_ROUTES.count(req.url.substr(0, req.url.find('/', 1)))) {
+            res.code = 403;
+            res.body = "This server is a read-only replica of " + config.replicaOf + ", send writes to the primary";
+            res.end();
+        }
     }
+
+    void after_handle(crow::request &, crow::response &, context &) {}
 };
 
+std::string render_metrics() {
+    MetricsWriter writer;
+    writer.header("hnswlib_server_ready", "gauge", "1 once indices loaded at startup are ready.");
+    writer.sample("hnswlib_server_ready", "", serverReady ? 1 : 0);
+
+    writer.header("hnswlib_server_requests_total", "counter", "Requests served, by route.");
+    for (const auto& [name, route] : routeMetrics) {
+        writer.sample("hnswlib_server_requests_total", metric_label("route", name), route.requests.get());
+    }
+    writer.header("hnswlib_server_request_errors_total", "counter", "Requests answered with a 4xx or 5xx status, by route.");
+    for (const auto& [name, route] : routeMetrics) {
+        writer.sample("hnswlib_server_request_errors_total", metric_label("route", name), route.errors.get());
+    }
+    writer.header("hnswlib_server_request_duration_seconds", "histogram", "Request latency, by route.");
+    for (const auto& [name, route] : routeMetrics) {
+        writer.histogram("hnswlib_server_request_duration_seconds", metric_label("route", name), route.latency);
+    }
+
+    // Shards of a sharded index are reported under their own names
+    std::vector<std::shared_ptr<IndexHandle>> handles;
+    for (const auto& name : indices.names()) {
+        if (auto index = indices.get(name)) {
+            handles.insert(handles.end(), index->shards.begin(), index->shards.end());
+        }
+    }
+
+    using IndexValue = std::function<double(IndexHandle&)>;
+    auto perIndex = [&](const std::string& name, const std::string& type, const std::string& help, const IndexValue& value) {
+        writer.header(name, type, help);
+        for (const auto& handle : handles) {
+            writer.sample(name, metric_label("index", handle->name), value(*handle));
+        }
+    };
+    perIndex("hnswlib_server_index_documents_added_total", "counter", "Documents added or updated.",
+             [](IndexHandle& h) { return h.metrics.documentsAdded.get(); });
+    perIndex("hnswlib_server_index_documents_deleted_total", "counter", "Documents deleted.",
+             [](IndexHandle& h) { return h.metrics.documentsDeleted.get(); });
+    perIndex("hnswlib_server_index_filter_cache_hits_total", "counter", "Search filters found in the filter cache.",
+             [](IndexHandle& h) { return h.metrics.filterCacheHits.get(); });
+    perIndex("hnswlib_server_index_filter_cache_misses_total", "counter", "Search filters not found in the filter cache.",
+             [](IndexHandle& h) { return h.metrics.filterCacheMisses.get(); });
+
+    writer.header("hnswlib_server_index_search_plans_total", "counter", "Queries by the way the search was executed.");
+    for (const auto& handle : handles) {
+        for (size_t type = 0; type < SEARCH_PLAN_TYPE_COUNT; type++) {
+            std::string labels = metric_label("index", handle->name) + "," + metric_label("plan", searchPlanName(static_cast<SearchPlanType>(type)));
+            writer.sample("hnswlib_server_index_search_plans_total", labels, handle->metrics.searchPlans[type].get());
+        }
+    }
+    writer.header("hnswlib_server_index_search_duration_seconds", "histogram", "Latency of /search requests.");
+    for (const auto& handle : handles) {
+        writer.histogram("hnswlib_server_index_search_duration_seconds", metric_label("index", handle->name), handle->metrics.searchLatency);
+    }
+
+    // Graph values are read under the index lock, a resize may be changing them and a rebuild
+    // may be freeing the graph
+    struct GraphValues {
+        double distanceComputations;
+        double hops;
+        double elements;
+        double maxElements;
+        double deleted;
+    };
+    std::vector<GraphValues> graphs;
+    for (const auto& handle : handles) {
+        std::shared_lock<std::shared_mutex> lock(handle->mutex);
+        const auto& graph = *handle->index;
+        graphs.push_back({static_cast<double>(graph.metric_distance_computations.load()), static_cast<double>(graph.metric_hops.load()),
+                          static_cast<double>(graph.cur_element_count), static_cast<double>(graph.max_elements_),
+                          static_cast<double>(graph.num_deleted_)});
+    }
+    auto perGraph = [&](const std::string& name, const std::string& type, const std::string& help, double GraphValues::*field) {
+        writer.header(name, type, help);
+        for (size_t i = 0; i < handles.size(); i++) {
+            writer.sample(name, metric_label("index", handles[i]->name), graphs[i].*field);
+        }
+    };
+    perGraph("hnswlib_server_index_distance_computations_total", "counter", "hnswlib metric_distance_computations, when graph metrics are enabled.",
+             &GraphValues::distanceComputations);
+    perGraph("hnswlib_server_index_hops_total", "counter", "hnswlib metric_hops, when graph metrics are enabled.", &GraphValues::hops);
+    perGraph("hnswlib_server_index_elements", "gauge", "Elements in the graph, including deleted ones.", &GraphValues::elements);
+    perGraph("hnswlib_server_index_max_elements", "gauge", "Capacity of the graph before it is resized.", &GraphValues::maxElements);
+    perGraph("hnswlib_server_index_deleted_elements", "gauge", "Elements marked deleted.", &GraphValues::deleted);
+    return writer.str();
+}
+
+// Load every saved index, several at once on the worker pool. An index that fails to load is
+// reported and skipped.
+void load_saved_indices() {
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::string> names = saved_index_names();
+    std::atomic<size_t> loaded{0};
+    workerPool.parallelFor(names.size(), [&names, &loaded](size_t i) {
+        LoadIndexRequest request;
+        request.indexName = names[i];
+        request.memoryMap = config.autoLoadMemoryMap;
+        try {
+            auto index = ShardedIndex::load(request, workerPool, config.wal);
+            for (const auto& shard : index->shards) {
+                shard->collectGraphMetrics = config.graphMetrics;
+            }
+            if (indices.insert(index)) {
+                loaded++;
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Loading index " << names[i] << " failed: " << e.what() << std::endl;
+        }
+    });
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    std::cout << "Loaded " << loaded << " of " << names.size() << " indices in " << elapsed.count() << "ms" << std::endl;
+    serverReady = true;
+}
+
+void write_metadata(JsonWriter& writer, const std::map<std::string, FieldValue>& metadata) {
+    writer.beginObject();
+    for (const auto& [key, value] : metadata) {
+        writer.key(key).value(value);
+    }
+    writer.endObject();
+}
+
+void write_search_plan(JsonWriter& writer, const SearchPlan& plan) {
+    writer.beginObject();
+    writer.key("plan").value(searchPlanName(plan.type));
+    writer.key("ef").value(plan.ef);
+    writer.key("estimatedSelectivity").value(plan.selectivity);
+    writer.key("estimatedCost").value(plan.cost);
+    writer.endObject();
+}
+
+// Writes the members of a search response into the object the writer is in
+void write_search_result(JsonWriter& writer, const ShardedIndex& index, SearchResult& result, bool returnMetadata) {
+    std::vector<int> ids(result.size());
+    std::vector<float> distances(result.size());
+    for (size_t i = ids.size(); i-- > 0; result.pop()) {
+        ids[i] = static_cast<int>(result.top().second);
+        distances[i] = result.top().first;
+    }
+
+    writer.key("hits").array(ids);
+    writer.key("distances").array(distances);
+
+    if (returnMetadata) {
+        auto metadatas = index.getMany(ids);
+        writer.key("metadatas").beginArray();
+        for (const auto& metadata : metadatas) {
+            write_metadata(writer, metadata);
+        }
+        writer.endArray();
+    }
+}
+
+// Each field's string value counts under "values" and its numeric range as "min", "max" and "count"
+void write_facets(JsonWriter& writer, const Facets& facets) {
+    std::set<std::string> fields;
+    for (const auto& [field, counts] : facets.counts) {
+        fields.insert(field);
+    }
+    for (const auto& [field, range] : facets.ranges) {
+        fields.insert(field);
+    }
+
+    writer.beginObject();
+    for (const auto& field : fields) {
+        writer.key(field).beginObject();
+        auto counts = facets.counts.find(field);
+        if (counts != facets.counts.end()) {
+            writer.key("values").beginObject();
+            for (const auto& [value, count] : counts->second) {
+                writer.key(value).value(count);
+            }
+            writer.endObject();
+        }
+        auto range = facets.ranges.find(field);
+        if (range != facets.ranges.end()) {
+            writer.key("min").value(range->second.min);
+            writer.key("max").value(range->second.max);
+            writer.key("count").value(range->second.count);
+        }
+        writer.endObject();
+    }
+    writer.endObject();
+}
+
+// Status of one shard, or of a whole single-shard index
+nlohmann::json shard_status(IndexHandle& handle) {
+    nlohmann::json status;
+    status["ready"] = handle.ready.load();
+    {
+        std::shared_lock<std::shared_mutex> lock(handle.mutex);
+        status["memoryMapped"] = handle.mappedIndex != nullptr && handle.mappedIndex->mapped();
+        status["elementCount"] = handle.liveElements();
+        status["maxElements"] = handle.index->max_elements_;
+    }
+    status["snapshot"] = handle.snapshotStatus();
+    status["rebuild"] = handle.rebuildStatus();
+    return status;
+}
 
-void remove_index_from_disk(const std::string &indexName) {
-    std::filesystem::remove("indices/" + indexName + ".bin");
-    std::filesystem::remove("indices/" + indexName + ".json");
-    std::filesystem::remove("indices/" + indexName + ".data");
+using ShardSnapshots = std::vector<std::pair<std::shared_ptr<IndexHandle>, std::shared_ptr<IndexSnapshot>>>;
+
+// Capture the shards one after another. A shard whose snapshot is already running is skipped,
+// the others are still captured since capturing one leaves it running.
+ShardSnapshots capture_shards(ShardedIndex& index) {
+    ShardSnapshots snapshots;
+    for (const auto& shard : index.shards) {
+        if (auto snapshot = shard->captureSnapshot()) {
+            snapshots.emplace_back(shard, snapshot);
+        }
+    }
+    if (!snapshots.empty()) {
+        index.writeManifest();
+    }
+    return snapshots;
 }
 
+void write_shard_plans(JsonWriter& writer, const std::vector<SearchPlan>& plans) {
+    writer.beginObject();
+    writer.key("shards").beginArray();
+    for (const auto& plan : plans) {
+        write_search_plan(writer, plan);
+    }
+    writer.endArray();
+    writer.endObject();
+}
+
+// /search against a sharded index. Searches of a single shard go through its coalescer instead.
+crow::response search_shards(ShardedIndex& index, const SearchRequest& searchReq, std::chrono::steady_clock::time_point started) {
+    std::vector<std::vector<SearchPlan>> plans;
+    std::vector<SearchResult> results;
+    Facets facets;
+    try {
+        results = index.search({ShardQuery{searchReq.queryVector.data(), static_cast<size_t>(searchReq.k), static_cast<size_t>(searchReq.efSearch), searchReq.filter}}, workerPool, &plans);
+        // Facets cover every match of the filter, not only the hits
+        if (!searchReq.facets.empty()) {
+            facets = index.facets(searchReq.facets, searchReq.filter, workerPool);
+        }
+    } catch (const std::invalid_argument &e) {
+        return crow::response(400, e.what());
+    }
 
-void write_index_to_disk(const std::string &indexName) {
-    std::filesystem::create_directories("indices");
+    std::string& body = json_response_buffer();
+    JsonWriter writer(body);
+    writer.beginObject();
+    write_search_result(writer, index, results.front(), searchReq.returnMetadata);
+    if (!searchReq.facets.empty()) {
+        write_facets(writer.key("facets"), facets);
+    }
+    if (searchReq.debug) {
+        write_shard_plans(writer.key("debug"), plans.front());
+    }
+    writer.endObject();
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    for (const auto& shard : index.shards) {
+        shard->metrics.searchLatency.observe(elapsed);
+    }
+    return crow::response(body);
+}
 
-    auto *index = indices[indexName];
-    if (!index) {
-        std::cerr << "Error: Index not found: " << indexName << std::endl;
-        return;
+crow::response search_batch_shards(ShardedIndex& index, const SearchBatchRequest& batchReq) {
+    std::vector<ShardQuery> queries;
+    queries.reserve(batchReq.queries.size());
+    for (const auto& query : batchReq.queries) {
+        queries.push_back(ShardQuery{query.queryVector.data(), static_cast<size_t>(query.k), static_cast<size_t>(batchReq.efSearch), query.filter});
     }
 
+    std::vector<std::vector<SearchPlan>> plans;
+    std::vector<SearchResult> results;
     try {
-        index->saveIndex("indices/" + indexName + ".bin");
-    } catch (const std::exception &e) {
-        std::cerr << "Error saving index: " << e.what() << std::endl;
-        return;
+        results = index.search(queries, workerPool, batchReq.debug ? &plans : nullptr);
+    } catch (const std::invalid_argument &e) {
+        return crow::response(400, e.what());
     }
 
-    std::ofstream settings_file("indices/" + indexName + ".json");
-    if (!settings_file) {
-        std::cerr << "Error: Unable to open settings file for writing: " << indexName << std::endl;
-        return;
+    std::string& body = json_response_buffer();
+    JsonWriter writer(body);
+    writer.beginObject();
+    writer.key("results").beginArray();
+    for (size_t i = 0; i < results.size(); i++) {
+        writer.beginObject();
+        write_search_result(writer, index, results[i], batchReq.returnMetadata);
+        if (batchReq.debug) {
+            write_shard_plans(writer.key("debug"), plans[i]);
+        }
+        writer.endObject();
     }
-    settings_file << indexSettings[indexName].dump();
+    writer.endArray();
+    writer.endObject();
+    return crow::response(body);
 }
 
-void read_index_from_disk(const std::string &indexName) {
-    std::ifstream settings_file("indices/" + indexName + ".json");
-    nlohmann::json indexState;
-    settings_file >> indexState;
-
-    int dim = indexState["dimension"];
-    std::string space = indexState["spaceType"];
-    int ef_construction = indexState["efConstruction"];
-    int M = indexState["M"];
-
-    hnswlib::SpaceInterface<float>* metricSpace = (space == "IP")
-        ? static_cast<hnswlib::SpaceInterface<float>*>(new hnswlib::InnerProductSpace(dim))
-        : static_cast<hnswlib::SpaceInterface<float>*>(new hnswlib::L2Space(dim));
-
-    auto *index = new hnswlib::HierarchicalNSW<float>(
-        metricSpace,
-        DEFAULT_INDEX_SIZE,
-        M,
-        ef_construction,
-        42,
-        true
-    );
-    std::string index_path = "indices/" + indexName + ".bin";
-    index->loadIndex(index_path, metricSpace, 10000);
-
-    indices[indexName] = index;
-    indexSettings[indexName] = indexState;
+// The router's answer, or 400 when the request is malformed
+template <typename Fn>
+crow::response routed(Fn&& forward) {
+    try {
+        HttpResponse response = forward();
+        return crow::response(response.status, response.body);
+    } catch (const std::invalid_argument &e) {
+        return crow::response(400, e.what());
+    }
 }
 
-int main() {
-    crow::SimpleApp app;
+// Serve as a router over the servers of HNSWLIB_SERVER_ROUTER_SHARDS instead of holding indices
+void run_router() {
+    Router router(config);
+    crow::App<RequestMetrics> app;
     app.loglevel(crow::LogLevel::Warning);
 
     CROW_ROUTE(app, "/health").methods(crow::HTTPMethod::GET)
     ([]() {
-        return "OK";
+        return crow::response(200, "OK");
+    });
+
+    CROW_ROUTE(app, "/metrics").methods(crow::HTTPMethod::GET)
+    ([]() {
+        crow::response response(render_metrics());
+        response.set_header("Content-Type", "text/plain; version=0.0.4");
+        return response;
+    });
+
+    CROW_ROUTE(app, "/search").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.search(req.body, req.get_header_value("Content-Type")); });
+    });
+
+    CROW_ROUTE(app, "/search_batch").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.searchBatch(req.body, req.get_header_value("Content-Type")); });
+    });
+
+    CROW_ROUTE(app, "/facets").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.facets(req.body); });
+    });
+
+    CROW_ROUTE(app, "/get_document/<string>/<int>").methods(crow::HTTPMethod::GET)
+    ([&router](const crow::request &, std::string indexName, int id) {
+        return routed([&]() { return router.getDocument(indexName, id); });
+    });
+
+    CROW_ROUTE(app, "/add_documents").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.addDocuments(req.body, req.get_header_value("Content-Type")); });
     });
 
+    CROW_ROUTE(app, "/delete_documents").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.deleteDocuments(req.body); });
+    });
+
+    // Index level requests apply to the index's part on every shard
     CROW_ROUTE(app, "/create_index").methods(crow::HTTPMethod::POST)
-    ([](const crow::request &req) {
-        auto data = nlohmann::json::parse(req.body);
-        IndexRequest indexRequest = data.get<IndexRequest>();
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.broadcast("/create_index", req.body); });
+    });
+
+    CROW_ROUTE(app, "/load_index").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.broadcast("/load_index", req.body); });
+    });
+
+    CROW_ROUTE(app, "/save_index").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.broadcast("/save_index", req.body); });
+    });
+
+    CROW_ROUTE(app, "/rebuild_index").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.broadcast("/rebuild_index", req.body); });
+    });
+
+    CROW_ROUTE(app, "/delete_index").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.broadcast("/delete_index", req.body); });
+    });
+
+    CROW_ROUTE(app, "/delete_index_from_disk").methods(crow::HTTPMethod::POST)
+    ([&router](const crow::request &req) {
+        return routed([&]() { return router.broadcast("/delete_index_from_disk", req.body); });
+    });
+
+    std::cout << "Router for " << router.shardCount() << " shards started on port " << config.port << "!" << std::endl;
+    app.port(static_cast<uint16_t>(config.port)).multithreaded().run();
+}
 
-        {
-            std::unique_lock<std::shared_mutex> indexLock(indexMutex);
-            std::lock_guard<std::mutex> datastoreLock(dataStoreMutex);
+int main() {
+    config = load_server_config();
+
+    for (const auto& route : METRICS_ROUTES) {
+        routeMetrics.try_emplace(route);
+    }
+
+    if (!config.routerShards.empty()) {
+        run_router();
+        return 0;
+    }
+    if (!config.replicaOf.empty()) {
+        replica = std::make_unique<Replica>(config, indices, workerPool);
+    }
+
+    crow::App<RequestMetrics, ReadOnlyReplica> app;
+    app.loglevel(crow::LogLevel::Warning);
 
-            if (indices.find(indexRequest.indexName) != indices.end()) {
-                return crow::response(400, "Index already exists");
+    CROW_ROUTE(app, "/health").methods(crow::HTTPMethod::GET)
+    ([]() {
+        if (!serverReady) {
+            return crow::response(503, "Loading indices");
+        }
+        if (replica) {
+            std::string reason = replica->unhealthyReason();
+            if (!reason.empty()) {
+                return crow::response(503, reason);
             }
+        }
+        return crow::response(200, "OK");
+    });
 
-            hnswlib::SpaceInterface<float>* space = (indexRequest.spaceType == "IP")
-                ? static_cast<hnswlib::SpaceInterface<float>*>(new hnswlib::InnerProductSpace(indexRequest.dimension))
-                : static_cast<hnswlib::SpaceInterface<float>*>(new hnswlib::L2Space(indexRequest.dimension));
+    CROW_ROUTE(app, "/metrics").methods(crow::HTTPMethod::GET)
+    ([]() {
+        crow::response response(render_metrics());
+        response.set_header("Content-Type", "text/plain; version=0.0.4");
+        return response;
+    });
 
-            auto *index = new hnswlib::HierarchicalNSW<float>(
-                space,
-                DEFAULT_INDEX_SIZE,
-                indexRequest.M,
-                indexRequest.efConstruction,
-                42,
-                true
-            );
+    CROW_ROUTE(app, "/create_index").methods(crow::HTTPMethod::POST)
+    ([](const crow::request &req) {
+        nlohmann::json data;
+        IndexRequest indexRequest;
+        try {
+            data = parse_json_body(req.body);
+            indexRequest = json_get<IndexRequest>(data);
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        if (!indices.reserve(indexRequest.indexName)) {
+            return crow::response(400, "Index already exists");
+        }
+        if (sharded_index_on_disk(indexRequest.indexName, static_cast<size_t>(indexRequest.shards))) {
+            indices.release(indexRequest.indexName);
+            return crow::response(400, "Index is saved on disk. Please load it or delete it from disk first");
+        }
 
-            indices[indexRequest.indexName] = index;
-            indexSettings[indexRequest.indexName] = data;
-            dataStores[indexRequest.indexName] = new DataStore();
-            indexFilterCache[indexRequest.indexName] = new LFUCache<std::string, std::unordered_set<int>>(MAX_FILTER_CACHE_SIZE);
+        std::shared_ptr<ShardedIndex> index;
+        try {
+            index = ShardedIndex::create(indexRequest, data, config.wal);
+        } catch (...) {
+            indices.release(indexRequest.indexName);
+            throw;
         }
+        for (const auto& shard : index->shards) {
+            shard->collectGraphMetrics = config.graphMetrics;
+        }
+        indices.replace(index);
         return crow::response(200, "Index created");
     });
 
     CROW_ROUTE(app, "/load_index").methods(crow::HTTPMethod::POST)
     ([](const crow::request &req) {
-        auto data = nlohmann::json::parse(req.body);
-        std::string indexName = data["indexName"];
-        {
-            std::unique_lock<std::shared_mutex> indexLock(indexMutex);
-            std::lock_guard<std::mutex> datastoreLock(dataStoreMutex);
-        
-            if (indices.find(indexName) != indices.end()) {
-                return crow::response(400, "Index already exists");
-            }
-
-            read_index_from_disk(indexName);
+        LoadIndexRequest loadRequest;
+        try {
+            loadRequest = json_get<LoadIndexRequest>(parse_json_body(req.body));
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
 
-            dataStores[indexName] = new DataStore();
-            dataStores[indexName]->deserialize("indices/" + indexName + ".data");
-            indexFilterCache[indexName] = new LFUCache<std::string, std::unordered_set<int>>(MAX_FILTER_CACHE_SIZE);
+        if (!indices.reserve(loadRequest.indexName)) {
+            return crow::response(400, "Index already exists");
         }
 
+        std::shared_ptr<ShardedIndex> index;
+        try {
+            index = ShardedIndex::load(loadRequest, workerPool, config.wal);
+        } catch (...) {
+            indices.release(loadRequest.indexName);
+            throw;
+        }
+        for (const auto& shard : index->shards) {
+            shard->collectGraphMetrics = config.graphMetrics;
+        }
+        indices.replace(index);
+
+        if (loadRequest.prewarm) {
+            // The thread keeps the shards alive if the index is deleted while they warm up
+            std::thread([index, warmupQueries = loadRequest.warmupQueries]() {
+                for (const auto& handle : index->shards) {
+                    try {
+                        handle->prewarm(warmupQueries);
+                    } catch (const std::exception &e) {
+                        std::cerr << "Prewarming index " << handle->name << " failed: " << e.what() << std::endl;
+                        handle->ready = true;
+                    }
+                }
+            }).detach();
+        }
         return crow::response(200, "Index loaded");
     });
 
+    CROW_ROUTE(app, "/index_status/<string>").methods(crow::HTTPMethod::GET)
+    ([](const std::string &indexName) {
+        auto index = indices.get(indexName);
+        if (!index) {
+            return crow::response(404, "Index not found");
+        }
+
+        if (!index->sharded()) {
+            nlohmann::json response = shard_status(*index->shards.front());
+            response["indexName"] = indexName;
+            if (replica) {
+                response["replication"] = replica->status(indexName);
+            }
+            return crow::response(response.dump());
+        }
+
+        nlohmann::json response;
+        response["indexName"] = indexName;
+
+        // A sharded index sums its shards, which are listed with their own status
+        bool ready = true;
+        bool memoryMapped = true;
+        size_t elementCount = 0;
+        size_t maxElements = 0;
+        response["shards"] = nlohmann::json::array();
+        for (const auto& shard : index->shards) {
+            nlohmann::json status = shard_status(*shard);
+            ready = ready && status["ready"].get<bool>();
+            memoryMapped = memoryMapped && status["memoryMapped"].get<bool>();
+            elementCount += status["elementCount"].get<size_t>();
+            maxElements += status["maxElements"].get<size_t>();
+            status["name"] = shard->name;
+            response["shards"].push_back(std::move(status));
+        }
+        response["ready"] = ready;
+        response["memoryMapped"] = memoryMapped;
+        response["elementCount"] = elementCount;
+        response["maxElements"] = maxElements;
+        if (replica) {
+            response["replication"] = replica->status(indexName);
+        }
+        return crow::response(response.dump());
+    });
+
     CROW_ROUTE(app, "/save_index").methods(crow::HTTPMethod::POST)
     ([](const crow::request &req) {
-        auto data = nlohmann::json::parse(req.body);
-        std::string indexName = data["indexName"];
-
-        {
-            std::unique_lock<std::shared_mutex> indexLock(indexMutex);
-            std::lock_guard<std::mutex> datastoreLock(dataStoreMutex);
-            
-            if (indices.find(indexName) == indices.end()) {
-                return crow::response(404, "Index not found");
-            }
+        std::string indexName;
+        bool async = false;
+        try {
+            auto data = parse_json_body(req.body);
+            indexName = json_get<std::string>(data, "indexName");
+            async = data.contains("async") && json_get<bool>(data, "async");
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        auto index = indices.get(indexName);
+        if (!index) {
+            return crow::response(404, "Index not found");
+        }
+
+        ShardSnapshots snapshots = capture_shards(*index);
+        if (snapshots.empty()) {
+            return crow::response(409, "A snapshot of this index is already running");
+        }
+
+        // Requests are served again as soon as the index has been copied, an async save also
+        // returns then and leaves the writing to a thread polled through /index_status
+        if (async) {
+            std::thread([snapshots]() {
+                for (const auto& [shard, snapshot] : snapshots) {
+                    try {
+                        shard->writeSnapshot(*snapshot);
+                    } catch (const std::exception &e) {
+                        std::cerr << "Saving index " << shard->name << " failed: " << e.what() << std::endl;
+                    }
+                }
+            }).detach();
+            return crow::response(202, "Index snapshot started");
+        }
 
-            write_index_to_disk(indexName);
-            dataStores[indexName]->serialize("indices/" + indexName + ".data");
+        for (const auto& [shard, snapshot] : snapshots) {
+            shard->writeSnapshot(*snapshot);
+        }
+        if (snapshots.size() < index->shards.size()) {
+            return crow::response(409, "A snapshot of some shards of this index is already running");
         }
         return crow::response(200, "Index saved");
     });
 
-    CROW_ROUTE(app, "/delete_index").methods(crow::HTTPMethod::POST)
+    CROW_ROUTE(app, "/rebuild_index").methods(crow::HTTPMethod::POST)
     ([](const crow::request &req) {
-        auto data = nlohmann::json::parse(req.body);
-        std::string indexName = data["indexName"];
-
-        {
-            std::unique_lock<std::shared_mutex> indexLock(indexMutex);
-            std::lock_guard<std::mutex> datastoreLock(dataStoreMutex);
-            
-            if (indices.find(indexName) == indices.end()) {
-                return crow::response(404, "Index not found");
+        RebuildIndexRequest rebuildRequest;
+        try {
+            rebuildRequest = json_get<RebuildIndexRequest>(parse_json_body(req.body));
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        auto index = indices.get(rebuildRequest.indexName);
+        if (!index) {
+            return crow::response(404, "Index not found");
+        }
+        std::vector<std::shared_ptr<IndexHandle>> started;
+        for (const auto& shard : index->shards) {
+            if (shard->beginRebuild()) {
+                started.push_back(shard);
+            }
+        }
+        if (started.empty()) {
+            return crow::response(409, "A rebuild of this index is already running");
+        }
+
+        // Each shard keeps serving from its current graph until its rebuilt one is swapped in.
+        // Shards are rebuilt one at a time so only one extra graph is in memory.
+        std::thread([started, rebuildRequest]() {
+            for (const auto& handle : started) {
+                try {
+                    handle->rebuild(rebuildRequest, workerPool);
+                } catch (const std::exception &e) {
+                    std::cerr << "Rebuilding index " << handle->name << " failed: " << e.what() << std::endl;
+                }
             }
+        }).detach();
+        return crow::response(202, "Index rebuild started");
+    });
 
-            delete indices[indexName];
-            indices.erase(indexName);
-            indexSettings.erase(indexName);
-            delete dataStores[indexName];
-            dataStores.erase(indexName);
-            delete indexFilterCache[indexName];
-            indexFilterCache.erase(indexName);
+    CROW_ROUTE(app, "/delete_index").methods(crow::HTTPMethod::POST)
+    ([](const crow::request &req) {
+        std::string indexName;
+        try {
+            indexName = json_get<std::string>(parse_json_body(req.body), "indexName");
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        // In-flight requests keep their own reference, the index is freed when the last one finishes
+        if (!indices.remove(indexName)) {
+            return crow::response(404, "Index not found");
         }
         return crow::response(200, "Index deleted");
     });
 
     CROW_ROUTE(app, "/delete_index_from_disk").methods(crow::HTTPMethod::POST)
     ([](const crow::request &req) {
-        auto data = nlohmann::json::parse(req.body);
-        std::string indexName = data["indexName"];
-
-        {
-            std::unique_lock<std::shared_mutex> indexLock(indexMutex);
-            std::lock_guard<std::mutex> datastoreLock(dataStoreMutex);
-            
-            if (indices.find(indexName) != indices.end()) {
-                return crow::response(400, "Index is loaded. Please delete it first");
-            }
+        std::string indexName;
+        try {
+            indexName = json_get<std::string>(parse_json_body(req.body), "indexName");
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
 
-            remove_index_from_disk(indexName);
+        if (indices.contains(indexName)) {
+            return crow::response(400, "Index is loaded. Please delete it first");
         }
+
+        remove_sharded_index_from_disk(indexName);
         return crow::response(200, "Index deleted from disk");
     });
 
     CROW_ROUTE(app, "/list_indices").methods(crow::HTTPMethod::GET)
     ([]() {
-        nlohmann::json response;
-        for (auto const& [indexName, _] : indices) {
+        nlohmann::json response = nlohmann::json::array();
+        for (const auto& indexName : indices.names()) {
             response.push_back(indexName);
         }
 
@@ -239,10 +764,14 @@ int main() {
 
     CROW_ROUTE(app, "/add_documents").methods(crow::HTTPMethod::POST)
     ([](const crow::request &req) {
-        auto data = nlohmann::json::parse(req.body);
-        AddDocumentsRequest addReq = data.get<AddDocumentsRequest>();
+        AddDocumentsRequest addReq;
+        try {
+            addReq = parse_request<AddDocumentsRequest>(req.body, req.get_header_value("Content-Type"));
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
 
-        if (addReq.ids.size() != addReq.vectors.size()) {
+        if (addReq.ids.size() != addReq.numVectors()) {
             return crow::response(400, "Number of IDs does not match number of vectors");
         }
 
@@ -250,56 +779,40 @@ int main() {
             return crow::response(400, "Number of metadatas does not match number of IDs");
         }
 
-        if (indices.find(addReq.indexName) == indices.end()) {
+        auto index = indices.get(addReq.indexName);
+        if (!index) {
             return crow::response(404, "Index not found");
         }
 
-        auto* index = indices[addReq.indexName];
-
-        
-        if (index->cur_element_count + addReq.ids.size() + DEFAULT_INDEX_RESIZE_HEADROOM > index->max_elements_) {
-    
-            std::unique_lock<std::shared_mutex> uniqueLock(indexMutex);
-
-            if (index->cur_element_count + addReq.ids.size() + DEFAULT_INDEX_RESIZE_HEADROOM > index->max_elements_) {
-                index->resizeIndex((int)((float)index->max_elements_ + (float)index->max_elements_ * INDEX_GROWTH_FACTOR + (float)addReq.ids.size()));
+        for (size_t i = 0; i < addReq.numVectors(); i++) {
+            if (addReq.dimensionAt(i) != index->dimension()) {
+                return crow::response(400, "Vector dimension does not match index dimension");
             }
         }
 
-        if (indexFilterCache[addReq.indexName]->getStats()["size"] > 0) {
-            indexFilterCache[addReq.indexName]->clear();
-        }
-        
-        {
-            std::shared_lock<std::shared_mutex> lock(indexMutex);
-            for (int i = 0; i < addReq.ids.size(); i++) {
-                std::vector<float>& vec_data = addReq.vectors[i];
-                indices[addReq.indexName]->addPoint(vec_data.data(), addReq.ids[i], 0);
-                if (addReq.metadatas.size()) {
-                    dataStores[addReq.indexName]->set(addReq.ids[i], addReq.metadatas[i]);
-                } else {
-                    dataStores[addReq.indexName]->set(addReq.ids[i], std::map<std::string, FieldValue>());
-                }
-            }
-        }        
+        index->addDocuments(addReq, workerPool);
 
         return crow::response(200, "Documents added");
     });
 
     CROW_ROUTE(app, "/delete_documents").methods(crow::HTTPMethod::POST)
     ([](const crow::request &req) {
-        auto data = nlohmann::json::parse(req.body);
-        DeleteDocumentsRequest deleteReq = data.get<DeleteDocumentsRequest>();
+        DeleteDocumentsRequest deleteReq;
+        try {
+            parse_json_request(req.body, deleteReq);
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
 
-        if (indices.find(deleteReq.indexName) == indices.end()) {
+        auto index = indices.get(deleteReq.indexName);
+        if (!index) {
             return crow::response(404, "Index not found");
         }
 
-        auto *index = indices[deleteReq.indexName];
-
-        for (int id : deleteReq.ids) {
-            index->markDelete(id);
-            dataStores[deleteReq.indexName]->remove(id);
+        try {
+            index->deleteDocuments(deleteReq.ids, workerPool);
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
         }
 
         return crow::response(200, "Documents deleted");
@@ -307,107 +820,318 @@ int main() {
 
     CROW_ROUTE(app, "/get_document/<string>/<int>").methods(crow::HTTPMethod::GET)
     ([](const crow::request &req, std::string indexName, int id) {
-        if (indices.find(indexName) == indices.end()) {
+        auto index = indices.get(indexName);
+        if (!index) {
             return crow::response(404, "Index not found");
         }
 
-        auto *index = indices[indexName];
-        auto hasDoc = dataStores[indexName]->contains(id);
+        IndexHandle& handle = index->shardFor(id);
+        std::shared_lock<std::shared_mutex> lock(handle.mutex);
+        auto hasDoc = handle.dataStore.contains(id);
 
         if (!hasDoc) {
             return crow::response(404, "Document not found");
         }
 
-        auto metadata = dataStores[indexName]->get(id);
-        auto vectorData = index->getDataByLabel<float>(id);
-        nlohmann::json response;
-        
-        response["id"] = id;
-        response["vector"] = vectorData;
-        response["metadata"] = nlohmann::json();
-        for (const auto& [key, value] : metadata) {
-            std::visit([&response, &key](auto&& arg) {
-                response["metadata"][key] = arg;
-            }, value);
+        auto metadata = handle.dataStore.get(id);
+        auto vectorData = handle.getVector(id);
+
+        std::string& body = json_response_buffer();
+        JsonWriter writer(body);
+        writer.beginObject();
+        writer.key("id").value(id);
+        writer.key("vector").array(vectorData);
+        writer.key("metadata");
+        if (metadata.empty()) {
+            writer.null();
+        } else {
+            write_metadata(writer, metadata);
         }
+        writer.endObject();
 
-        return crow::response(response.dump());
+        return crow::response(body);
     });
 
     CROW_ROUTE(app, "/search").methods(crow::HTTPMethod::POST)
     ([](const crow::request &req) {
-        auto data = nlohmann::json::parse(req.body);
-        SearchRequest searchReq = data.get<SearchRequest>();
+        SearchRequest searchReq;
+        try {
+            searchReq = parse_request<SearchRequest>(req.body, req.get_header_value("Content-Type"));
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
 
-        if (indices.find(searchReq.indexName) == indices.end()) {
+        auto index = indices.get(searchReq.indexName);
+        if (!index) {
             return crow::response(404, "Index not found");
         }
 
-        auto *index = indices[searchReq.indexName];
-        std::vector<float>& query_vec = searchReq.queryVector;
-        index->setEf(searchReq.efSearch);
+        if (searchReq.queryVector.size() != index->dimension()) {
+            return crow::response(400, "Query vector dimension does not match index dimension");
+        }
 
+        auto started = std::chrono::steady_clock::now();
+        if (index->sharded()) {
+            return search_shards(*index, searchReq, started);
+        }
 
-        std::priority_queue<std::pair<float, hnswlib::labeltype>> result;
+        auto handle = index->shards.front();
+        std::shared_lock<std::shared_mutex> lock(handle->mutex);
 
+        std::unique_ptr<PreparedFilter> filter;
         if (searchReq.filter.size() > 0) {
-            std::shared_ptr<FilterASTNode> filters = parseFilters(searchReq.filter);
-            std::unordered_set<int> filteredIds;
-            auto &filterCache = indexFilterCache[searchReq.indexName];
-            if (filterCache->get(searchReq.filter) != nullptr) {
-                filteredIds = *filterCache->get(searchReq.filter);
-            } else {
-                filteredIds = dataStores[searchReq.indexName]->filter(filters);
-                filterCache->put(searchReq.filter, filteredIds);
+            try {
+                filter = std::make_unique<PreparedFilter>(*handle, searchReq.filter);
+            } catch (const std::invalid_argument &e) {
+                return crow::response(400, e.what());
             }
-            
-            FilterIdsInSet filter(filteredIds);
+        }
 
-            if (filteredIds.size() < index->cur_element_count * EXACT_KNN_FILTER_PCT_MATCH_THRESHOLD) {
-                result = index->searchExactKnn(query_vec.data(), searchReq.k, &filter);
-            } else {
-                result = index->searchKnn(query_vec.data(), searchReq.k, &filter);
-            }
+        SearchTask task;
+        task.query = searchReq.queryVector.data();
+        task.k = searchReq.k;
+        task.ef = searchReq.efSearch;
+        task.filter = filter.get();
+        if (config.searchCoalesceWindow.count() > 0) {
+            handle->searchCoalescer.run(task, config.searchCoalesceWindow, config.searchCoalesceMaxBatch,
+                [&handle](std::vector<SearchTask*>& group) { handle->searchGroup(group, workerPool); });
         } else {
-            result = index->searchKnn(query_vec.data(), searchReq.k);
+            task.result = handle->search(task.query, task.k, task.ef, task.filter, &task.plan);
         }
-         
-        nlohmann::json response;
-        std::vector<int> ids;
-        std::vector<float> distances;
-        while (!result.empty()) {
-            ids.push_back(result.top().second);
-            distances.push_back(result.top().first);
-            result.pop();
-        }
-        
-        std::reverse(ids.begin(), ids.end());
-        std::reverse(distances.begin(), distances.end());
-
-        response["hits"] = ids;
-        response["distances"] = distances;
-
-        if (searchReq.returnMetadata) {
-            auto metadatas = dataStores[searchReq.indexName]->getMany(ids);
-            response["metadatas"] = nlohmann::json::array();
-            for (const auto& metadata : metadatas) {
-                nlohmann::json json_metadata;
-                for (const auto& [key, value] : metadata) {
-                    std::visit([&json_metadata, &key](auto&& arg) {
-                        json_metadata[key] = arg;
-                    }, value);
-                }
-                response["metadatas"].push_back(json_metadata);
+
+        // Facets cover every match of the filter, not only the hits
+        Facets facets;
+        if (!searchReq.facets.empty()) {
+            facets = handle->dataStore.get_facets(searchReq.facets, filter ? &filter->ids() : nullptr, &workerPool);
+        }
+
+        std::string& body = json_response_buffer();
+        JsonWriter writer(body);
+        writer.beginObject();
+        write_search_result(writer, *index, task.result, searchReq.returnMetadata);
+        if (!searchReq.facets.empty()) {
+            write_facets(writer.key("facets"), facets);
+        }
+        if (searchReq.debug) {
+            write_search_plan(writer.key("debug"), task.plan);
+        }
+        writer.endObject();
+        handle->metrics.searchLatency.observe(std::chrono::steady_clock::now() - started);
+        return crow::response(body);
+    });
+
+    CROW_ROUTE(app, "/search_batch").methods(crow::HTTPMethod::POST)
+    ([](const crow::request &req) {
+        SearchBatchRequest batchReq;
+        try {
+            batchReq = parse_request<SearchBatchRequest>(req.body, req.get_header_value("Content-Type"));
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        auto index = indices.get(batchReq.indexName);
+        if (!index) {
+            return crow::response(404, "Index not found");
+        }
+
+        for (const auto& query : batchReq.queries) {
+            if (query.queryVector.size() != index->dimension()) {
+                return crow::response(400, "Query vector dimension does not match index dimension");
             }
         }
 
-        return crow::response(response.dump());
+        if (index->sharded()) {
+            return search_batch_shards(*index, batchReq);
+        }
+
+        auto handle = index->shards.front();
+        std::shared_lock<std::shared_mutex> lock(handle->mutex);
+
+        // Prepare each distinct filter once and share it between the queries using it
+        std::vector<std::string> filterStrings;
+        std::unordered_map<std::string, size_t> filterSlots;
+        for (const auto& query : batchReq.queries) {
+            if (!query.filter.empty() && filterSlots.find(query.filter) == filterSlots.end()) {
+                filterSlots[query.filter] = filterStrings.size();
+                filterStrings.push_back(query.filter);
+            }
+        }
+
+        std::vector<std::unique_ptr<PreparedFilter>> filters(filterStrings.size());
+        try {
+            workerPool.parallelFor(filterStrings.size(), [&](size_t i) {
+                filters[i] = std::make_unique<PreparedFilter>(*handle, filterStrings[i]);
+            });
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        std::vector<SearchTask> tasks(batchReq.queries.size());
+        std::vector<SearchTask*> group;
+        for (size_t i = 0; i < tasks.size(); i++) {
+            const auto& query = batchReq.queries[i];
+            tasks[i].query = query.queryVector.data();
+            tasks[i].k = query.k;
+            tasks[i].ef = batchReq.efSearch;
+            tasks[i].filter = query.filter.empty() ? nullptr : filters[filterSlots.at(query.filter)].get();
+            group.push_back(&tasks[i]);
+        }
+        handle->searchGroup(group, workerPool);
+
+        std::string& body = json_response_buffer();
+        JsonWriter writer(body);
+        writer.beginObject();
+        writer.key("results").beginArray();
+        for (auto& task : tasks) {
+            writer.beginObject();
+            write_search_result(writer, *index, task.result, batchReq.returnMetadata);
+            if (batchReq.debug) {
+                write_search_plan(writer.key("debug"), task.plan);
+            }
+            writer.endObject();
+        }
+        writer.endArray();
+        writer.endObject();
+
+        return crow::response(body);
+    });
+
+    CROW_ROUTE(app, "/facets").methods(crow::HTTPMethod::POST)
+    ([](const crow::request &req) {
+        FacetsRequest facetsReq;
+        try {
+            facetsReq = json_get<FacetsRequest>(parse_json_body(req.body));
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        auto index = indices.get(facetsReq.indexName);
+        if (!index) {
+            return crow::response(404, "Index not found");
+        }
+
+        Facets facets;
+        try {
+            facets = index->facets(facetsReq.fields, facetsReq.filter, workerPool);
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        std::string& body = json_response_buffer();
+        JsonWriter writer(body);
+        writer.beginObject();
+        write_facets(writer.key("facets"), facets);
+        writer.endObject();
+        return crow::response(body);
+    });
+
+    CROW_ROUTE(app, "/replication/snapshot").methods(crow::HTTPMethod::POST)
+    ([](const crow::request &req) {
+        std::string indexName;
+        try {
+            indexName = json_get<std::string>(parse_json_body(req.body), "indexName");
+        } catch (const std::invalid_argument &e) {
+            return crow::response(400, e.what());
+        }
+
+        auto index = indices.get(indexName);
+        if (!index) {
+            return crow::response(404, "Index not found");
+        }
+        for (const auto& shard : index->shards) {
+            if (shard->writeAheadLog == nullptr || !shard->writeAheadLog->streams()) {
+                return crow::response(409, "Replication needs the write-ahead log and HNSWLIB_SERVER_REPLICATION_BUFFER_MB");
+            }
+        }
+
+        // A fresh snapshot holds everything the stream buffer may already have dropped
+        ShardSnapshots snapshots = capture_shards(*index);
+        for (const auto& [shard, snapshot] : snapshots) {
+            shard->writeSnapshot(*snapshot);
+        }
+        if (snapshots.size() < index->shards.size()) {
+            return crow::response(409, "A snapshot of this index is already running");
+        }
+        return crow::response(snapshot_manifest(*index).dump());
+    });
+
+    CROW_ROUTE(app, "/replication/snapshot/<string>").methods(crow::HTTPMethod::GET)
+    ([](const std::string &indexName) {
+        auto index = indices.get(indexName);
+        if (!index) {
+            return crow::response(404, "Index not found");
+        }
+        return crow::response(snapshot_manifest(*index).dump());
+    });
+
+    CROW_ROUTE(app, "/replication/file/<string>").methods(crow::HTTPMethod::GET)
+    ([](const std::string &fileName) {
+        if (!is_snapshot_file_name(fileName)) {
+            return crow::response(400, "Not a snapshot file");
+        }
+        std::ifstream file("indices/" + fileName, std::ios::binary);
+        if (!file) {
+            return crow::response(404, "File not found");
+        }
+        std::string contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        crow::response response(std::move(contents));
+        response.set_header("Content-Type", "application/octet-stream");
+        return response;
     });
 
-    std::cout << "Server started on port 8685!" << std::endl;
+    CROW_ROUTE(app, "/replication/stream/<string>/<int>").methods(crow::HTTPMethod::GET)
+    ([](const crow::request &req, const std::string &indexName, int shard) {
+        const char* afterParam = req.url_params.get("after");
+        std::string afterText = afterParam == nullptr ? "" : afterParam;
+        uint64_t after = 0;
+        try {
+            if (afterText.empty() || !std::all_of(afterText.begin(), afterText.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+                throw std::invalid_argument(afterText);
+            }
+            after = std::stoull(afterText);
+        } catch (const std::exception &) {
+            return crow::response(400, "after must be a sequence number");
+        }
+
+        auto index = indices.get(indexName);
+        if (!index) {
+            return crow::response(404, "Index not found");
+        }
+        if (shard < 0 || static_cast<size_t>(shard) >= index->shards.size()) {
+            return crow::response(404, "Shard not found");
+        }
+        WriteAheadLog* log = index->shards[shard]->writeAheadLog.get();
+        if (log == nullptr || !log->streams()) {
+            return crow::response(409, "Replication needs the write-ahead log and HNSWLIB_SERVER_REPLICATION_BUFFER_MB");
+        }
+
+        // The primary's last sequence goes first, the records after it
+        std::string body(sizeof(uint64_t), '\0');
+        uint64_t logSequence = 0;
+        if (!log->readStream(after, REPLICATION_STREAM_CHUNK_BYTES, body, logSequence)) {
+            return crow::response(410, "Mutations after this sequence are no longer buffered, start from a new snapshot");
+        }
+        std::memcpy(body.data(), &logSequence, sizeof(logSequence));
+        crow::response response(std::move(body));
+        response.set_header("Content-Type", "application/octet-stream");
+        return response;
+    });
+
+    // A replica serves its indices once they have been loaded from the primary
+    if (replica) {
+        replica->start();
+    }
+
+    // Requests are served while the indices load, /health reports 503 until they have
+    if (config.autoLoad) {
+        serverReady = false;
+        std::thread(load_saved_indices).detach();
+    }
+
+    std::cout << "Server started on port " << config.port << "!" << std::endl;
     std::cout << "Press Ctrl+C to quit" << std::endl;
     std::cout << "All other stdout is suppressed as an optimisation" << std::endl;
 
     // Start the server
-    app.port(8685).multithreaded().run();
+    app.port(static_cast<uint16_t>(config.port)).multithreaded().run();
 }
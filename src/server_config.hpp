@@ -0,0 +1,169 @@
+// server_config.hpp
+#ifndef SERVER_CONFIG_HPP
+#define SERVER_CONFIG_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "write_ahead_log.hpp"
+
+#define DEFAULT_SERVER_PORT 8685
+#define DEFAULT_SEARCH_COALESCE_WINDOW_US 0
+#define DEFAULT_SEARCH_COALESCE_MAX_BATCH 64
+#define DEFAULT_ROUTER_DEADLINE_MS 1000
+#define DEFAULT_ROUTER_HEDGE_MS 100
+#define DEFAULT_ROUTER_WRITE_TIMEOUT_MS 30000
+#define DEFAULT_ROUTER_POOL_SIZE 16
+#define DEFAULT_REPLICA_POLL_MS 100
+#define DEFAULT_REPLICA_MAX_LAG_MS 5000
+#define DEFAULT_REPLICA_TIMEOUT_MS 60000
+
+// Server wide settings, read once at startup from HNSWLIB_SERVER_* environment variables
+struct ServerConfig {
+    long port = DEFAULT_SERVER_PORT;
+    // Concurrent /search calls on one index arriving within this window are executed as a
+    // group. Adds up to the window to each search's latency; 0 disables coalescing.
+    std::chrono::microseconds searchCoalesceWindow{DEFAULT_SEARCH_COALESCE_WINDOW_US};
+    // A group is executed early once it holds this many searches
+    size_t searchCoalesceMaxBatch = DEFAULT_SEARCH_COALESCE_MAX_BATCH;
+    // Document mutations are logged per index and replayed on load
+    WalOptions wal;
+    // Load every index saved in the indices directory at startup, memory mapped if requested
+    bool autoLoad = false;
+    bool autoLoadMemoryMap = false;
+    // Count hnswlib hops and distance computations for /metrics. Adds a contended atomic update
+    // per hop to every graph search.
+    bool graphMetrics = false;
+
+    // Shard map of a router, see Router. A router holds no data and forwards every request to
+    // the servers listed here; empty runs the server normally.
+    std::string routerShards;
+    // How long a read waits for each shard before answering without it
+    std::chrono::milliseconds routerDeadline{DEFAULT_ROUTER_DEADLINE_MS};
+    // A read still unanswered after this long is sent again to the shard's next server;
+    // 0 disables hedging
+    std::chrono::milliseconds routerHedgeDelay{DEFAULT_ROUTER_HEDGE_MS};
+    // Writes are not dropped at the read deadline, they fail after this long
+    std::chrono::milliseconds routerWriteTimeout{DEFAULT_ROUTER_WRITE_TIMEOUT_MS};
+    // Idle connections kept open to each backend server
+    size_t routerPoolSize = DEFAULT_ROUTER_POOL_SIZE;
+
+    // Primary of a replica, as "host:port"; empty runs the server normally. A replica loads
+    // replicaIndices from snapshots of the primary, applies the primary's stream of mutations
+    // to them and rejects writes. A primary needs wal.streamBufferBytes set.
+    std::string replicaOf;
+    std::vector<std::string> replicaIndices;
+    // How often a replica that has caught up asks the primary for new mutations
+    std::chrono::milliseconds replicaPoll{DEFAULT_REPLICA_POLL_MS};
+    // A replica reports 503 on /health once it has not been caught up with the primary for this long
+    std::chrono::milliseconds replicaMaxLag{DEFAULT_REPLICA_MAX_LAG_MS};
+    // Snapshots and file downloads from the primary fail after this long
+    std::chrono::milliseconds replicaTimeout{DEFAULT_REPLICA_TIMEOUT_MS};
+};
+
+inline long env_long(const char* name, long fallback) {
+    const char* value = std::getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return fallback;
+    }
+    try {
+        long parsed = std::stol(value);
+        if (parsed < 0) {
+            throw std::invalid_argument(name);
+        }
+        return parsed;
+    } catch (const std::exception&) {
+        throw std::runtime_error(std::string("Invalid value for ") + name + ": " + value);
+    }
+}
+
+inline std::string env_string(const char* name) {
+    const char* value = std::getenv(name);
+    return value == nullptr ? "" : value;
+}
+
+// Non-empty items of a comma separated list, with surrounding spaces removed
+inline std::vector<std::string> env_list(const char* name) {
+    std::vector<std::string> items;
+    std::stringstream stream(env_string(name));
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        item.erase(0, item.find_first_not_of(' '));
+        item.erase(item.find_last_not_of(' ') + 1);
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+inline WalSyncPolicy env_wal_sync_policy(const char* name) {
+    const char* value = std::getenv(name);
+    std::string policy = value == nullptr ? "" : value;
+    if (policy.empty() || policy == "always") {
+        return WalSyncPolicy::Always;
+    } else if (policy == "interval") {
+        return WalSyncPolicy::Interval;
+    } else if (policy == "never") {
+        return WalSyncPolicy::Never;
+    }
+    throw std::runtime_error(std::string("Invalid value for ") + name + ": " + policy);
+}
+
+inline ServerConfig load_server_config() {
+    ServerConfig config;
+    config.port = env_long("HNSWLIB_SERVER_PORT", DEFAULT_SERVER_PORT);
+    if (config.port == 0 || config.port > 65535) {
+        throw std::runtime_error("Invalid value for HNSWLIB_SERVER_PORT: " + std::to_string(config.port));
+    }
+    config.searchCoalesceWindow = std::chrono::microseconds(
+        env_long("HNSWLIB_SERVER_SEARCH_COALESCE_WINDOW_US", DEFAULT_SEARCH_COALESCE_WINDOW_US));
+    config.searchCoalesceMaxBatch = std::max<long>(1,
+        env_long("HNSWLIB_SERVER_SEARCH_COALESCE_MAX_BATCH", DEFAULT_SEARCH_COALESCE_MAX_BATCH));
+    config.wal.enabled = env_long("HNSWLIB_SERVER_WAL", 1) != 0;
+    config.wal.sync = env_wal_sync_policy("HNSWLIB_SERVER_WAL_SYNC");
+    config.wal.syncInterval = std::chrono::milliseconds(
+        env_long("HNSWLIB_SERVER_WAL_SYNC_INTERVAL_MS", DEFAULT_WAL_SYNC_INTERVAL_MS));
+    config.wal.streamBufferBytes = static_cast<size_t>(env_long("HNSWLIB_SERVER_REPLICATION_BUFFER_MB", 0)) << 20;
+    config.autoLoad = env_long("HNSWLIB_SERVER_AUTO_LOAD", 0) != 0;
+    config.autoLoadMemoryMap = env_long("HNSWLIB_SERVER_AUTO_LOAD_MMAP", 0) != 0;
+    config.graphMetrics = env_long("HNSWLIB_SERVER_GRAPH_METRICS", 0) != 0;
+    config.routerShards = env_string("HNSWLIB_SERVER_ROUTER_SHARDS");
+    config.routerDeadline = std::chrono::milliseconds(
+        env_long("HNSWLIB_SERVER_ROUTER_DEADLINE_MS", DEFAULT_ROUTER_DEADLINE_MS));
+    config.routerHedgeDelay = std::chrono::milliseconds(
+        env_long("HNSWLIB_SERVER_ROUTER_HEDGE_MS", DEFAULT_ROUTER_HEDGE_MS));
+    config.routerWriteTimeout = std::chrono::milliseconds(
+        env_long("HNSWLIB_SERVER_ROUTER_WRITE_TIMEOUT_MS", DEFAULT_ROUTER_WRITE_TIMEOUT_MS));
+    config.routerPoolSize = env_long("HNSWLIB_SERVER_ROUTER_POOL_SIZE", DEFAULT_ROUTER_POOL_SIZE);
+
+    config.replicaOf = env_string("HNSWLIB_SERVER_REPLICA_OF");
+    config.replicaIndices = env_list("HNSWLIB_SERVER_REPLICA_INDICES");
+    config.replicaPoll = std::chrono::milliseconds(env_long("HNSWLIB_SERVER_REPLICA_POLL_MS", DEFAULT_REPLICA_POLL_MS));
+    config.replicaMaxLag = std::chrono::milliseconds(
+        env_long("HNSWLIB_SERVER_REPLICA_MAX_LAG_MS", DEFAULT_REPLICA_MAX_LAG_MS));
+    config.replicaTimeout = std::chrono::milliseconds(
+        env_long("HNSWLIB_SERVER_REPLICA_TIMEOUT_MS", DEFAULT_REPLICA_TIMEOUT_MS));
+    if (!config.replicaOf.empty()) {
+        if (config.replicaIndices.empty()) {
+            throw std::runtime_error("HNSWLIB_SERVER_REPLICA_INDICES must list the indices to replicate");
+        }
+        if (!config.routerShards.empty()) {
+            throw std::runtime_error("A server cannot be both a router and a replica");
+        }
+        if (config.replicaMaxLag <= config.replicaPoll) {
+            throw std::runtime_error("HNSWLIB_SERVER_REPLICA_MAX_LAG_MS must be longer than HNSWLIB_SERVER_REPLICA_POLL_MS");
+        }
+        // Everything a replica holds comes from its primary, it neither logs nor loads on its own
+        config.wal.enabled = false;
+        config.autoLoad = false;
+    }
+    return config;
+}
+
+#endif // SERVER_CONFIG_HPP
@@ -0,0 +1,305 @@
+// sharded_index.cpp
+#include "sharded_index.hpp"
+#include <filesystem>
+#include <fstream>
+#include "snapshot_writer.hpp"
+
+size_t shard_of(int id, size_t shardCount) {
+    // murmur3 finalizer
+    uint32_t h = static_cast<uint32_t>(id);
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h % shardCount;
+}
+
+std::string shard_name(const std::string& indexName, size_t shard, size_t shardCount) {
+    return shardCount == 1 ? indexName : indexName + ".shard" + std::to_string(shard);
+}
+
+ShardedIndex::ShardedIndex(const std::string& name, const nlohmann::json& settings, std::vector<std::shared_ptr<IndexHandle>> shards)
+    : name(name), shards(std::move(shards)), settings(settings) {}
+
+std::shared_ptr<ShardedIndex> ShardedIndex::create(const IndexRequest& request, const nlohmann::json& settings, const WalOptions& wal) {
+    size_t shardCount = static_cast<size_t>(request.shards);
+    std::vector<std::shared_ptr<IndexHandle>> shards;
+    for (size_t shard = 0; shard < shardCount; shard++) {
+        IndexRequest shardRequest = request;
+        shardRequest.indexName = shard_name(request.indexName, shard, shardCount);
+        nlohmann::json shardSettings = settings;
+        shardSettings["indexName"] = shardRequest.indexName;
+        shardSettings.erase("shards");
+        shards.push_back(IndexHandle::create(shardRequest, shardSettings, wal));
+    }
+
+    auto index = std::make_shared<ShardedIndex>(request.indexName, settings, std::move(shards));
+    if (wal.enabled) {
+        index->writeManifest();
+    }
+    return index;
+}
+
+std::shared_ptr<ShardedIndex> ShardedIndex::load(const LoadIndexRequest& request, ThreadPool& pool, const WalOptions& wal) {
+    std::ifstream settings_file("indices/" + request.indexName + ".json");
+    if (!settings_file) {
+        throw std::runtime_error("Unable to open settings file for index: " + request.indexName);
+    }
+    nlohmann::json settings;
+    settings_file >> settings;
+    size_t shardCount = settings.value("shards", size_t(1));
+
+    // Shards are independent, so they load at the same time
+    std::vector<std::shared_ptr<IndexHandle>> shards(shardCount);
+    pool.parallelFor(shardCount, [&](size_t shard) {
+        LoadIndexRequest shardRequest = request;
+        shardRequest.indexName = shard_name(request.indexName, shard, shardCount);
+        shards[shard] = IndexHandle::load(shardRequest, pool, wal);
+    });
+    return std::make_shared<ShardedIndex>(request.indexName, settings, std::move(shards));
+}
+
+void ShardedIndex::writeManifest() const {
+    if (!sharded()) {
+        return;
+    }
+    nlohmann::json manifest = settings;
+    manifest["shards"] = shards.size();
+    std::filesystem::create_directories("indices");
+    SnapshotProgress progress;
+    write_file_atomically("indices/" + name + ".json", manifest.dump(), progress);
+}
+
+void ShardedIndex::addDocuments(AddDocumentsRequest& request, ThreadPool& pool) {
+    if (!sharded()) {
+        shards.front()->reserve(request.ids.size());
+        shards.front()->addDocuments(request, pool);
+        return;
+    }
+
+    size_t dim = dimension();
+    std::vector<AddDocumentsRequest> parts(shards.size());
+    for (size_t i = 0; i < request.ids.size(); i++) {
+        AddDocumentsRequest& part = parts[shard_of(request.ids[i], shards.size())];
+        part.ids.push_back(request.ids[i]);
+        part.packedStorage.insert(part.packedStorage.end(), request.vectorAt(i), request.vectorAt(i) + dim);
+        if (!request.metadatas.empty()) {
+            part.metadatas.push_back(std::move(request.metadatas[i]));
+        }
+    }
+
+    pool.parallelFor(shards.size(), [&](size_t shard) {
+        AddDocumentsRequest& part = parts[shard];
+        if (part.ids.empty()) return;
+        part.indexName = shards[shard]->name;
+        part.numThreads = request.numThreads;
+        part.packedVectors = part.packedStorage.data();
+        part.packedCount = part.ids.size();
+        part.packedDimension = dim;
+        shards[shard]->reserve(part.ids.size());
+        shards[shard]->addDocuments(part, pool);
+    });
+}
+
+void ShardedIndex::deleteDocuments(const std::vector<int>& ids, ThreadPool& pool) {
+    if (!sharded()) {
+        shards.front()->deleteDocuments(ids);
+        return;
+    }
+
+    std::vector<std::vector<int>> parts(shards.size());
+    for (int id : ids) {
+        parts[shard_of(id, shards.size())].push_back(id);
+    }
+    pool.parallelFor(shards.size(), [&](size_t shard) {
+        if (!parts[shard].empty()) {
+            shards[shard]->deleteDocuments(parts[shard]);
+        }
+    });
+}
+
+std::vector<SearchResult> ShardedIndex::search(const std::vector<ShardQuery>& queries, ThreadPool& pool,
+                                               std::vector<std::vector<SearchPlan>>* plans) {
+    std::vector<std::vector<SearchResult>> shardResults(shards.size(), std::vector<SearchResult>(queries.size()));
+    if (plans != nullptr) {
+        plans->assign(queries.size(), std::vector<SearchPlan>(shards.size()));
+    }
+
+    pool.parallelFor(shards.size(), [&](size_t shard) {
+        IndexHandle& handle = *shards[shard];
+        std::shared_lock<std::shared_mutex> lock(handle.mutex);
+
+        // Each distinct filter is prepared once per shard, against that shard's metadata
+        std::unordered_map<std::string, std::unique_ptr<PreparedFilter>> filters;
+        std::vector<SearchTask> tasks(queries.size());
+        std::vector<SearchTask*> group;
+        for (size_t q = 0; q < queries.size(); q++) {
+            tasks[q].query = queries[q].query;
+            tasks[q].k = queries[q].k;
+            tasks[q].ef = queries[q].ef;
+            if (!queries[q].filter.empty()) {
+                auto& filter = filters[queries[q].filter];
+                if (filter == nullptr) {
+                    filter = std::make_unique<PreparedFilter>(handle, queries[q].filter);
+                }
+                tasks[q].filter = filter.get();
+            }
+            group.push_back(&tasks[q]);
+        }
+        handle.searchGroup(group, pool);
+
+        for (size_t q = 0; q < queries.size(); q++) {
+            shardResults[shard][q] = std::move(tasks[q].result);
+            if (plans != nullptr) {
+                (*plans)[q][shard] = tasks[q].plan;
+            }
+        }
+    });
+
+    std::vector<SearchResult> results(queries.size());
+    for (size_t q = 0; q < queries.size(); q++) {
+        for (auto& shardResult : shardResults) {
+            SearchResult& partial = shardResult[q];
+            for (; !partial.empty(); partial.pop()) {
+                keep_nearest(results[q], queries[q].k, partial.top().first, partial.top().second);
+            }
+        }
+    }
+    return results;
+}
+
+std::vector<std::map<std::string, FieldValue>> ShardedIndex::getMany(const std::vector<int>& ids) const {
+    if (!sharded()) {
+        return shards.front()->dataStore.getMany(ids);
+    }
+
+    std::vector<std::vector<int>> shardIds(shards.size());
+    std::vector<std::vector<size_t>> positions(shards.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        size_t shard = shard_of(ids[i], shards.size());
+        shardIds[shard].push_back(ids[i]);
+        positions[shard].push_back(i);
+    }
+
+    std::vector<std::map<std::string, FieldValue>> result(ids.size());
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        if (shardIds[shard].empty()) continue;
+        auto metadatas = shards[shard]->dataStore.getMany(shardIds[shard]);
+        for (size_t i = 0; i < metadatas.size(); i++) {
+            result[positions[shard][i]] = std::move(metadatas[i]);
+        }
+    }
+    return result;
+}
+
+Facets ShardedIndex::facets(const std::vector<std::string>& fields, const std::string& filter, ThreadPool& pool) {
+    std::vector<Facets> partials(shards.size());
+    pool.parallelFor(shards.size(), [&](size_t shard) {
+        IndexHandle& handle = *shards[shard];
+        std::shared_lock<std::shared_mutex> lock(handle.mutex);
+        std::unique_ptr<PreparedFilter> prepared;
+        if (!filter.empty()) {
+            prepared = std::make_unique<PreparedFilter>(handle, filter);
+        }
+        partials[shard] = handle.dataStore.get_facets(fields, prepared ? &prepared->ids() : nullptr, &pool);
+    });
+
+    Facets result = std::move(partials.front());
+    for (size_t shard = 1; shard < partials.size(); shard++) {
+        result.merge(partials[shard]);
+    }
+    return result;
+}
+
+std::shared_ptr<ShardedIndex> IndexRegistry::get(const std::string& name) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = indices.find(name);
+    if (it == indices.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+bool IndexRegistry::contains(const std::string& name) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return indices.find(name) != indices.end();
+}
+
+bool IndexRegistry::reserve(const std::string& name) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return indices.emplace(name, nullptr).second;
+}
+
+void IndexRegistry::release(const std::string& name) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = indices.find(name);
+    if (it != indices.end() && it->second == nullptr) {
+        indices.erase(it);
+    }
+}
+
+bool IndexRegistry::insert(std::shared_ptr<ShardedIndex> index) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    return indices.emplace(index->name, std::move(index)).second;
+}
+
+void IndexRegistry::replace(std::shared_ptr<ShardedIndex> index) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto& slot = indices[index->name];
+    slot = std::move(index);
+}
+
+std::shared_ptr<ShardedIndex> IndexRegistry::remove(const std::string& name) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = indices.find(name);
+    if (it == indices.end() || it->second == nullptr) {
+        return nullptr;
+    }
+    auto index = std::move(it->second);
+    indices.erase(it);
+    return index;
+}
+
+std::vector<std::string> IndexRegistry::names() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    std::vector<std::string> result;
+    result.reserve(indices.size());
+    for (const auto& [name, index] : indices) {
+        if (index != nullptr) {
+            result.push_back(name);
+        }
+    }
+    return result;
+}
+
+bool sharded_index_on_disk(const std::string& indexName, size_t shardCount) {
+    if (index_on_disk(indexName)) {
+        return true;
+    }
+    for (size_t shard = 0; shardCount > 1 && shard < shardCount; shard++) {
+        if (index_on_disk(shard_name(indexName, shard, shardCount))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void remove_sharded_index_from_disk(const std::string& indexName) {
+    size_t shardCount = 1;
+    {
+        std::ifstream settings_file("indices/" + indexName + ".json");
+        nlohmann::json settings;
+        if (settings_file) {
+            try {
+                settings_file >> settings;
+                shardCount = settings.value("shards", size_t(1));
+            } catch (const nlohmann::json::exception&) {
+            }
+        }
+    }
+    for (size_t shard = 0; shardCount > 1 && shard < shardCount; shard++) {
+        remove_index_from_disk(shard_name(indexName, shard, shardCount));
+    }
+    remove_index_from_disk(indexName);
+}
@@ -0,0 +1,101 @@
+// sharded_index.hpp
+#ifndef SHARDED_INDEX_HPP
+#define SHARDED_INDEX_HPP
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "data_store.hpp"
+#include "index_handle.hpp"
+#include "models.hpp"
+#include "query_planner.hpp"
+#include "thread_pool.hpp"
+#include "write_ahead_log.hpp"
+
+// Shard holding id. Ids are mixed first so ids with a common stride still spread evenly.
+size_t shard_of(int id, size_t shardCount);
+// Name of a shard's IndexHandle and of its files
+std::string shard_name(const std::string& indexName, size_t shard, size_t shardCount);
+
+// One query of a search fanned out to every shard
+struct ShardQuery {
+    const float* query = nullptr;
+    size_t k = 0;
+    size_t ef = 0;
+    std::string filter;
+};
+
+// An index split into shards by document id. Each shard is a complete IndexHandle with its
+// own graph, metadata, log and snapshot files, so shards are inserted into, resized, saved
+// and rebuilt independently. An index created with one shard is a single handle named after
+// the index, with the same files as before sharding existed. Shards of a larger index are
+// named <index>.shard<i>, and indices/<index>.json records how many there are.
+class ShardedIndex {
+public:
+    ShardedIndex(const std::string& name, const nlohmann::json& settings, std::vector<std::shared_ptr<IndexHandle>> shards);
+
+    static std::shared_ptr<ShardedIndex> create(const IndexRequest& request, const nlohmann::json& settings, const WalOptions& wal);
+    static std::shared_ptr<ShardedIndex> load(const LoadIndexRequest& request, ThreadPool& pool, const WalOptions& wal);
+
+    const std::string name;
+    const std::vector<std::shared_ptr<IndexHandle>> shards;
+
+    size_t dimension() const { return shards.front()->dimension; }
+    bool sharded() const { return shards.size() > 1; }
+    IndexHandle& shardFor(int id) const { return *shards[shard_of(id, shards.size())]; }
+
+    // Split the batch by shard and insert into every shard at once, each growing as needed
+    void addDocuments(AddDocumentsRequest& request, ThreadPool& pool);
+    // Each shard checks its own ids before deleting any, a shard that throws leaves the rest applied
+    void deleteDocuments(const std::vector<int>& ids, ThreadPool& pool);
+
+    // Run the queries against every shard in parallel, each shard under its own shared lock, and
+    // merge the k nearest of each query. plans receives each shard's plan per query when given.
+    // An invalid filter throws std::invalid_argument.
+    std::vector<SearchResult> search(const std::vector<ShardQuery>& queries, ThreadPool& pool,
+                                     std::vector<std::vector<SearchPlan>>* plans = nullptr);
+    // Metadata of ids, looked up in the shard each belongs to
+    std::vector<std::map<std::string, FieldValue>> getMany(const std::vector<int>& ids) const;
+    // Facets of fields over the documents of every shard matching filter, or all when it is empty
+    Facets facets(const std::vector<std::string>& fields, const std::string& filter, ThreadPool& pool);
+
+    // Write indices/<name>.json with the shard count. Only sharded indices have one of their own,
+    // a single shard writes its settings file itself.
+    void writeManifest() const;
+
+private:
+    nlohmann::json settings;
+};
+
+// Name -> index lookup. The registry lock is only held for the map access itself,
+// never while an index is being built, loaded, saved or searched. A name is reserved while
+// its index is being built or loaded, so no other request can take it or touch its files:
+// get, names and remove pass over it until replace puts the index in or release frees it.
+class IndexRegistry {
+private:
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<ShardedIndex>> indices;
+
+public:
+    std::shared_ptr<ShardedIndex> get(const std::string& name) const;
+    bool contains(const std::string& name) const;
+    // Reserve name for an index about to be created or loaded, false if it is taken
+    bool reserve(const std::string& name);
+    // Free a reserved name whose index could not be made
+    void release(const std::string& name);
+    bool insert(std::shared_ptr<ShardedIndex> index);
+    // Insert index, or swap it in for the loaded one or the reservation of the same name
+    void replace(std::shared_ptr<ShardedIndex> index);
+    std::shared_ptr<ShardedIndex> remove(const std::string& name);
+    std::vector<std::string> names() const;
+};
+
+// True if files of an index with this name, or of any of its shardCount shards, are on disk
+bool sharded_index_on_disk(const std::string& indexName, size_t shardCount);
+// Remove the files of an index and of all of its shards
+void remove_sharded_index_from_disk(const std::string& indexName);
+
+#endif // SHARDED_INDEX_HPP
@@ -0,0 +1,222 @@
+// snapshot_writer.cpp
+#include "snapshot_writer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace {
+    // Owns the descriptor of a temporary file, removing the file unless it was committed
+    class TemporaryFile {
+    public:
+        TemporaryFile(const std::string& path, bool truncate) : path(path) {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+            if (fd < 0) {
+                throw std::runtime_error("Unable to open " + path + ": " + std::strerror(errno));
+            }
+        }
+
+        ~TemporaryFile() {
+            if (fd >= 0) {
+                ::close(fd);
+                std::filesystem::remove(path);
+            }
+        }
+
+        void writeAt(const char* data, size_t length, size_t offset) {
+            while (length > 0) {
+                ssize_t result = ::pwrite(fd, data, length, static_cast<off_t>(offset));
+                if (result < 0) {
+                    if (errno == EINTR) continue;
+                    throw std::runtime_error("Unable to write " + path + ": " + std::strerror(errno));
+                }
+                data += result;
+                length -= static_cast<size_t>(result);
+                offset += static_cast<size_t>(result);
+            }
+        }
+
+        // Read length bytes at offset, zero filling whatever lies past the end of the file
+        void readAt(char* data, size_t length, size_t offset) {
+            while (length > 0) {
+                ssize_t result = ::pread(fd, data, length, static_cast<off_t>(offset));
+                if (result < 0) {
+                    if (errno == EINTR) continue;
+                    throw std::runtime_error("Unable to read " + path + ": " + std::strerror(errno));
+                }
+                if (result == 0) {
+                    std::memset(data, 0, length);
+                    return;
+                }
+                data += result;
+                length -= static_cast<size_t>(result);
+                offset += static_cast<size_t>(result);
+            }
+        }
+
+        // Give the file the contents of source, sharing its extents where the filesystem supports
+        // it. Returns the bytes that had to be copied instead, 0 for a clone.
+        uint64_t copyFrom(const std::string& source) {
+            int sourceFd = ::open(source.c_str(), O_RDONLY);
+            if (sourceFd < 0) {
+                throw std::runtime_error("Unable to open " + source + ": " + std::strerror(errno));
+            }
+#ifdef FICLONE
+            if (::ioctl(fd, FICLONE, sourceFd) == 0) {
+                ::close(sourceFd);
+                return 0;
+            }
+#endif
+            std::vector<char> buffer(16 * SNAPSHOT_BLOCK_SIZE);
+            uint64_t copied = 0;
+            while (true) {
+                ssize_t result = ::read(sourceFd, buffer.data(), buffer.size());
+                if (result < 0 && errno == EINTR) continue;
+                if (result < 0) {
+                    int error = errno;
+                    ::close(sourceFd);
+                    throw std::runtime_error("Unable to read " + source + ": " + std::strerror(error));
+                }
+                if (result == 0) break;
+                try {
+                    writeAt(buffer.data(), static_cast<size_t>(result), copied);
+                } catch (...) {
+                    ::close(sourceFd);
+                    throw;
+                }
+                copied += static_cast<uint64_t>(result);
+            }
+            ::close(sourceFd);
+            return copied;
+        }
+
+        // Sync, close and rename over target, then sync the directory so the rename is durable
+        void commit(size_t length, const std::string& target) {
+            if (::ftruncate(fd, static_cast<off_t>(length)) != 0 || ::fsync(fd) != 0) {
+                throw std::runtime_error("Unable to sync " + path + ": " + std::strerror(errno));
+            }
+            ::close(fd);
+            fd = -1;
+            std::filesystem::rename(path, target);
+
+            std::string directory = std::filesystem::path(target).parent_path().string();
+            int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+            if (dirFd >= 0) {
+                ::fsync(dirFd);
+                ::close(dirFd);
+            }
+        }
+
+    private:
+        std::string path;
+        int fd = -1;
+    };
+
+    // Write the file of write_snapshot_file. The body is body when given, otherwise the previous
+    // file's with patch applied, which needs an incremental write.
+    void write_blocks(const std::string& path, const std::string& head, const char* body, const RecordPatch* patch,
+                      size_t bodyLength, const std::string& tail, bool incremental, SnapshotFileState& state,
+                      SnapshotProgress& progress) {
+        TemporaryFile file(path + ".tmp", true);
+        if (incremental) {
+            uint64_t copied = file.copyFrom(path);
+            progress.bytesTotal += copied;
+            progress.bytesProcessed += copied;
+            progress.bytesWritten += copied;
+            progress.bytesCopied += copied;
+        }
+
+        file.writeAt(head.data(), head.size(), 0);
+        progress.bytesProcessed += head.size();
+        progress.bytesWritten += head.size();
+
+        std::vector<uint64_t> hashes((bodyLength + SNAPSHOT_BLOCK_SIZE - 1) / SNAPSHOT_BLOCK_SIZE);
+        std::vector<char> patched(patch != nullptr ? SNAPSHOT_BLOCK_SIZE : 0);
+        std::hash<std::string_view> hasher;
+        for (size_t block = 0; block < hashes.size(); block++) {
+            size_t offset = block * SNAPSHOT_BLOCK_SIZE;
+            size_t length = std::min<size_t>(SNAPSHOT_BLOCK_SIZE, bodyLength - offset);
+            const char* data = body + offset;
+            if (patch != nullptr) {
+                file.readAt(patched.data(), length, head.size() + offset);
+                patch->apply(offset, patched.data(), length);
+                data = patched.data();
+            }
+            hashes[block] = hasher(std::string_view(data, length));
+            bool unchanged = incremental && block < state.blockHashes.size() && state.blockHashes[block] == hashes[block];
+            if (!unchanged) {
+                file.writeAt(data, length, head.size() + offset);
+                progress.bytesWritten += length;
+            }
+            progress.bytesProcessed += length;
+        }
+
+        file.writeAt(tail.data(), tail.size(), head.size() + bodyLength);
+        progress.bytesProcessed += tail.size();
+        progress.bytesWritten += tail.size();
+
+        file.commit(head.size() + bodyLength + tail.size(), path);
+        state.headLength = head.size();
+        state.blockHashes = std::move(hashes);
+    }
+}
+
+void RecordPatch::apply(size_t offset, char* block, size_t length) const {
+    if (recordLength == 0 || length == 0) {
+        return;
+    }
+    size_t end = offset + length;
+    size_t first = offset / recordLength;
+    size_t last = std::min(recordCount, (end + recordLength - 1) / recordLength);
+
+    // The part of [from, to) of the body that falls in the block
+    auto copy = [&](const char* source, size_t from, size_t to) {
+        size_t begin = std::max(from, offset);
+        size_t finish = std::min(to, end);
+        if (begin < finish) {
+            std::memcpy(block + (begin - offset), source + (begin - from), finish - begin);
+        }
+    };
+    for (size_t record = first; prefixLength > 0 && record < last; record++) {
+        copy(&prefixes[record * prefixLength], record * recordLength, record * recordLength + prefixLength);
+    }
+    auto it = std::lower_bound(ids.begin(), ids.end(), static_cast<uint32_t>(first));
+    for (; it != ids.end() && *it < last; ++it) {
+        size_t index = static_cast<size_t>(it - ids.begin());
+        copy(&records[index * recordLength], size_t(*it) * recordLength, (size_t(*it) + 1) * recordLength);
+    }
+}
+
+bool can_patch_snapshot_file(const std::string& path, const std::string& head, const SnapshotFileState& state) {
+    return !state.blockHashes.empty() && state.headLength == head.size() && std::filesystem::exists(path);
+}
+
+void write_snapshot_file(const std::string& path, const std::string& head, const char* body, size_t bodyLength,
+                         const std::string& tail, SnapshotFileState& state, SnapshotProgress& progress) {
+    write_blocks(path, head, body, nullptr, bodyLength, tail, can_patch_snapshot_file(path, head, state), state, progress);
+}
+
+void patch_snapshot_file(const std::string& path, const std::string& head, const RecordPatch& patch,
+                         const std::string& tail, SnapshotFileState& state, SnapshotProgress& progress) {
+    if (!can_patch_snapshot_file(path, head, state)) {
+        throw std::runtime_error("No previous snapshot file to patch: " + path);
+    }
+    write_blocks(path, head, nullptr, &patch, patch.bodyLength(), tail, true, state, progress);
+}
+
+void write_file_atomically(const std::string& path, const std::string& contents, SnapshotProgress& progress) {
+    TemporaryFile file(path + ".tmp", true);
+    file.writeAt(contents.data(), contents.size(), 0);
+    file.commit(contents.size(), path);
+    progress.bytesProcessed += contents.size();
+    progress.bytesWritten += contents.size();
+}
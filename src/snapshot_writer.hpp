@@ -0,0 +1,72 @@
+// snapshot_writer.hpp
+#ifndef SNAPSHOT_WRITER_HPP
+#define SNAPSHOT_WRITER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Granularity at which snapshot files are compared with the previous snapshot
+#define SNAPSHOT_BLOCK_SIZE (64 * 1024)
+
+// Describes a snapshot file as it is on disk: the length of its head and a hash of each
+// block of its body. Empty until the file has been written once by this process.
+struct SnapshotFileState {
+    size_t headLength = 0;
+    std::vector<uint64_t> blockHashes;
+};
+
+// Progress of the snapshot being written, polled by /index_status
+struct SnapshotProgress {
+    std::atomic<uint64_t> bytesTotal{0};
+    std::atomic<uint64_t> bytesProcessed{0}; // compared or written so far
+    std::atomic<uint64_t> bytesWritten{0};   // actually written, less than processed when incremental
+    // Bytes of previous files copied to start incremental writes, on filesystems that cannot share
+    // their extents. They count in every total above.
+    std::atomic<uint64_t> bytesCopied{0};
+
+    void reset(uint64_t total) {
+        bytesTotal = total;
+        bytesProcessed = 0;
+        bytesWritten = 0;
+        bytesCopied = 0;
+    }
+};
+
+// Changes to a body of fixed length records since the file was last written: the first
+// prefixLength bytes of every record, and all of the records listed in ids
+struct RecordPatch {
+    size_t recordCount = 0;
+    size_t recordLength = 0;
+    size_t prefixLength = 0;
+    std::vector<char> prefixes;   // prefixLength bytes of each record, in order
+    std::vector<uint32_t> ids;    // records given whole, ascending
+    std::vector<char> records;    // recordLength bytes of each record in ids
+
+    size_t bodyLength() const { return recordCount * recordLength; }
+    uint64_t size() const { return prefixes.size() + records.size(); }
+    // Overwrite block, the length bytes of the body from offset, with the parts of the patch in it
+    void apply(size_t offset, char* block, size_t length) const;
+};
+
+// Write head, body and tail to path through a temporary file that is synced and renamed over
+// it. When state describes the file at path and its head has the same length, the temporary
+// file starts as a clone of it, sharing its extents where the filesystem can and copying it
+// otherwise, and only body blocks whose hash changed are written; head and tail are always
+// written. On success state describes the new file.
+void write_snapshot_file(const std::string& path, const std::string& head, const char* body, size_t bodyLength,
+                         const std::string& tail, SnapshotFileState& state, SnapshotProgress& progress);
+// True when state describes the file at path and its head has the same length as head, so
+// write_snapshot_file writes it incrementally and patch_snapshot_file can patch it
+bool can_patch_snapshot_file(const std::string& path, const std::string& head, const SnapshotFileState& state);
+// Like write_snapshot_file, with the body made of the file at path with patch applied. Throws
+// std::runtime_error, leaving the file as it is, unless can_patch_snapshot_file.
+void patch_snapshot_file(const std::string& path, const std::string& head, const RecordPatch& patch,
+                         const std::string& tail, SnapshotFileState& state, SnapshotProgress& progress);
+
+// Write contents to path through a temporary file that is synced and renamed over it
+void write_file_atomically(const std::string& path, const std::string& contents, SnapshotProgress& progress);
+
+#endif // SNAPSHOT_WRITER_HPP
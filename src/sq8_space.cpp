@@ -0,0 +1,178 @@
+// sq8_space.cpp
+#include "sq8_space.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+#if defined(__AVX2__)
+    inline int32_t horizontal_sum(__m256i acc) {
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sum = _mm_hadd_epi32(sum, sum);
+        sum = _mm_hadd_epi32(sum, sum);
+        return _mm_cvtsi128_si32(sum);
+    }
+#endif
+
+    float sq8_l2_distance(const void* a, const void* b, const void* param) {
+        const auto* params = static_cast<const SQ8Params*>(param);
+        int32_t squared = sq8_l2(static_cast<const int8_t*>(a), static_cast<const int8_t*>(b), params->dimension);
+        return params->scale * params->scale * static_cast<float>(squared);
+    }
+
+    // x . y = centerNorm + scale * (termX + termY) + scale^2 * (codesX . codesY)
+    float sq8_ip_distance(const void* a, const void* b, const void* param) {
+        const auto* params = static_cast<const SQ8Params*>(param);
+        float termA, termB;
+        std::memcpy(&termA, static_cast<const char*>(a) + params->dimension, sizeof(float));
+        std::memcpy(&termB, static_cast<const char*>(b) + params->dimension, sizeof(float));
+        int32_t dot = sq8_dot(static_cast<const int8_t*>(a), static_cast<const int8_t*>(b), params->dimension);
+        float product = params->centerNorm + params->scale * (termA + termB) + params->scale * params->scale * static_cast<float>(dot);
+        return 1.0f - product;
+    }
+}
+
+int32_t sq8_dot(const int8_t* a, const int8_t* b, size_t dimension) {
+    int32_t sum = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 16 <= dimension; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    sum = horizontal_sum(acc);
+#endif
+    for (; i < dimension; i++) {
+        sum += static_cast<int32_t>(a[i]) * static_cast<int32_t>(b[i]);
+    }
+    return sum;
+}
+
+int32_t sq8_l2(const int8_t* a, const int8_t* b, size_t dimension) {
+    int32_t sum = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 16 <= dimension; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m256i diff = _mm256_sub_epi16(va, vb);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(diff, diff));
+    }
+    sum = horizontal_sum(acc);
+#endif
+    for (; i < dimension; i++) {
+        int32_t diff = static_cast<int32_t>(a[i]) - static_cast<int32_t>(b[i]);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+SQ8Space::SQ8Space(size_t dimension, bool innerProduct) {
+    parameters.dimension = dimension;
+    parameters.innerProduct = innerProduct;
+    parameters.centers.assign(dimension, 0.0f);
+}
+
+size_t SQ8Space::get_data_size() {
+    return parameters.dimension + sizeof(float);
+}
+
+hnswlib::DISTFUNC<float> SQ8Space::get_dist_func() {
+    return parameters.innerProduct ? sq8_ip_distance : sq8_l2_distance;
+}
+
+void* SQ8Space::get_dist_func_param() {
+    return &parameters;
+}
+
+void SQ8Space::train(const float* vectors, size_t count) {
+    const size_t dimension = parameters.dimension;
+    std::vector<float> lows(dimension, std::numeric_limits<float>::max());
+    std::vector<float> highs(dimension, std::numeric_limits<float>::lowest());
+    for (size_t i = 0; i < count; i++) {
+        for (size_t d = 0; d < dimension; d++) {
+            float value = vectors[i * dimension + d];
+            lows[d] = std::min(lows[d], value);
+            highs[d] = std::max(highs[d], value);
+        }
+    }
+
+    float halfRange = 0.0f;
+    parameters.centerNorm = 0.0f;
+    for (size_t d = 0; d < dimension; d++) {
+        if (count == 0) {
+            lows[d] = highs[d] = 0.0f;
+        }
+        parameters.centers[d] = (lows[d] + highs[d]) / 2.0f;
+        parameters.centerNorm += parameters.centers[d] * parameters.centers[d];
+        halfRange = std::max(halfRange, (highs[d] - lows[d]) / 2.0f);
+    }
+
+    // A batch with no spread still needs a usable scale
+    if (halfRange <= 0.0f) {
+        halfRange = 1.0f;
+    }
+    parameters.scale = halfRange * (1.0f + SQ8_TRAINING_MARGIN) / SQ8_MAX_CODE;
+    isProvisional = count < SQ8_MIN_TRAINING_VECTORS;
+    isTrained = true;
+}
+
+void SQ8Space::encode(const float* vector, void* code) const {
+    auto* codes = static_cast<int8_t*>(code);
+    float term = 0.0f;
+    for (size_t d = 0; d < parameters.dimension; d++) {
+        float scaled = std::round((vector[d] - parameters.centers[d]) / parameters.scale);
+        int8_t value = static_cast<int8_t>(std::clamp(scaled, -float(SQ8_MAX_CODE), float(SQ8_MAX_CODE)));
+        codes[d] = value;
+        term += parameters.centers[d] * value;
+    }
+    std::memcpy(codes + parameters.dimension, &term, sizeof(term));
+}
+
+void SQ8Space::decode(const void* code, float* vector) const {
+    const auto* codes = static_cast<const int8_t*>(code);
+    for (size_t d = 0; d < parameters.dimension; d++) {
+        vector[d] = parameters.centers[d] + parameters.scale * codes[d];
+    }
+}
+
+void SQ8Space::save(std::ostream& out) const {
+    uint64_t dimension = parameters.dimension;
+    // 2 marks provisional parameters, files written before they existed only hold 0 or 1
+    uint8_t trainedFlag = !trained() ? 0 : provisional() ? 2 : 1;
+    out.write(reinterpret_cast<const char*>(&dimension), sizeof(dimension));
+    out.write(reinterpret_cast<const char*>(&trainedFlag), sizeof(trainedFlag));
+    out.write(reinterpret_cast<const char*>(&parameters.scale), sizeof(parameters.scale));
+    out.write(reinterpret_cast<const char*>(parameters.centers.data()), dimension * sizeof(float));
+}
+
+void SQ8Space::load(std::istream& in) {
+    uint64_t dimension = 0;
+    uint8_t trainedFlag = 0;
+    in.read(reinterpret_cast<char*>(&dimension), sizeof(dimension));
+    in.read(reinterpret_cast<char*>(&trainedFlag), sizeof(trainedFlag));
+    if (!in || dimension != parameters.dimension) {
+        throw std::runtime_error("SQ8 parameters do not match the index dimension");
+    }
+    in.read(reinterpret_cast<char*>(&parameters.scale), sizeof(parameters.scale));
+    in.read(reinterpret_cast<char*>(parameters.centers.data()), dimension * sizeof(float));
+    if (!in) {
+        throw std::runtime_error("Truncated SQ8 parameters");
+    }
+
+    parameters.centerNorm = 0.0f;
+    for (float center : parameters.centers) {
+        parameters.centerNorm += center * center;
+    }
+    isProvisional = trainedFlag == 2;
+    isTrained = trainedFlag != 0;
+}
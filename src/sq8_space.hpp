@@ -0,0 +1,66 @@
+// sq8_space.hpp
+#ifndef SQ8_SPACE_HPP
+#define SQ8_SPACE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "hnswlib/hnswlib.h"
+
+// Fraction of the trained range added on each side, so later vectors slightly outside
+// the training batch are not clamped
+#define SQ8_TRAINING_MARGIN 0.1f
+#define SQ8_MAX_CODE 127
+// Vectors a quantizer must be trained on before its range is final. An index trains again on
+// every vector it holds with each batch until it has this many.
+#define SQ8_MIN_TRAINING_VECTORS 1000
+
+// Parameters shared by every vector of an SQ8 index. Dimension d of a vector is stored as
+// the code c_d with x_d ~= centers[d] + scale * c_d.
+struct SQ8Params {
+    size_t dimension = 0;
+    bool innerProduct = false;
+    float scale = 1.0f;
+    float centerNorm = 0.0f; // sum of centers[d]^2
+    std::vector<float> centers;
+};
+
+// hnswlib space over int8 scalar quantized vectors. Each element is `dimension` int8 codes
+// followed by a float holding sum(centers[d] * c_d), which lets inner product distances be
+// computed from an integer dot product of the codes. Vectors must be encoded with encode()
+// before they are added to or searched in an index built over this space.
+class SQ8Space : public hnswlib::SpaceInterface<float> {
+public:
+    SQ8Space(size_t dimension, bool innerProduct);
+
+    size_t get_data_size() override;
+    hnswlib::DISTFUNC<float> get_dist_func() override;
+    void* get_dist_func_param() override;
+
+    // Fit the centers and scale to a batch of vectors. Every dimension shares one scale so
+    // distances reduce to integer kernels over the codes. Training on fewer than
+    // SQ8_MIN_TRAINING_VECTORS leaves the parameters provisional.
+    void train(const float* vectors, size_t count);
+    bool trained() const { return isTrained.load(); }
+    bool provisional() const { return isProvisional.load(); }
+
+    void encode(const float* vector, void* code) const;
+    void decode(const void* code, float* vector) const;
+
+    void save(std::ostream& out) const;
+    void load(std::istream& in);
+
+    const SQ8Params& params() const { return parameters; }
+
+private:
+    SQ8Params parameters;
+    std::atomic<bool> isTrained{false};
+    std::atomic<bool> isProvisional{false};
+};
+
+int32_t sq8_dot(const int8_t* a, const int8_t* b, size_t dimension);
+int32_t sq8_l2(const int8_t* a, const int8_t* b, size_t dimension);
+
+#endif // SQ8_SPACE_HPP
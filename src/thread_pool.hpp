@@ -0,0 +1,129 @@
+// thread_pool.hpp
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads used to spread a single request's work across cores
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t numThreads = std::thread::hardware_concurrency()) {
+        numThreads = std::max<size_t>(1, numThreads);
+        for (size_t i = 0; i < numThreads; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        condition.notify_one();
+    }
+
+    // Run fn(i) for every i in [0, count) using up to maxThreads threads and block until all
+    // calls have finished. The calling thread takes work too, so nested calls cannot deadlock.
+    // The first exception thrown by fn is rethrown on the calling thread.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn, size_t maxThreads = 0) {
+        if (count == 0) return;
+
+        size_t threads = maxThreads == 0 ? workers.size() + 1 : maxThreads;
+        threads = std::min(threads, count);
+        if (threads <= 1) {
+            for (size_t i = 0; i < count; i++) {
+                fn(i);
+            }
+            return;
+        }
+
+        // Workers that start after every index has been claimed return without touching fn,
+        // so the caller only waits for claimed indices to finish, never for queued tasks to start
+        struct State {
+            std::atomic<size_t> next{0};
+            std::mutex mutex;
+            std::condition_variable done;
+            size_t completed = 0;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+
+        auto work = [state, count, &fn]() {
+            size_t i;
+            while ((i = state->next.fetch_add(1)) < count) {
+                std::exception_ptr error;
+                try {
+                    fn(i);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (error && !state->error) state->error = error;
+                if (++state->completed == count) {
+                    state->done.notify_all();
+                }
+            }
+        };
+
+        for (size_t t = 0; t + 1 < threads; t++) {
+            submit(work);
+        }
+
+        work();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done.wait(lock, [&state, count] { return state->completed == count; });
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+};
+
+#endif // THREAD_POOL_HPP
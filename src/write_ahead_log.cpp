@@ -0,0 +1,398 @@
+// write_ahead_log.cpp
+#include "write_ahead_log.hpp"
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Bytes before each record body: length, sequence, body CRC, header CRC
+#define WAL_FRAME_HEADER_SIZE 20
+
+namespace {
+    std::array<uint32_t, 256> make_crc_table() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }
+
+    template <typename T>
+    void put(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    // Reads fields from a record body, throwing if the body ends early
+    class BodyReader {
+    public:
+        BodyReader(const char* body, size_t length) : position(body), end(body + length) {}
+
+        template <typename T>
+        T get() {
+            T value;
+            take(&value, sizeof(T));
+            return value;
+        }
+
+        void take(void* out, size_t length) {
+            if (static_cast<size_t>(end - position) < length) {
+                throw std::runtime_error("Truncated write-ahead log record");
+            }
+            std::memcpy(out, position, length);
+            position += length;
+        }
+
+    private:
+        const char* position;
+        const char* end;
+    };
+
+    void put_field_value(std::string& out, const FieldValue& value) {
+        put(out, static_cast<uint8_t>(value.index()));
+        if (const long* v = std::get_if<long>(&value)) {
+            put(out, static_cast<int64_t>(*v));
+        } else if (const double* v = std::get_if<double>(&value)) {
+            put(out, *v);
+        } else {
+            const std::string& str = std::get<std::string>(value);
+            put(out, static_cast<uint32_t>(str.size()));
+            out.append(str);
+        }
+    }
+
+    FieldValue get_field_value(BodyReader& reader) {
+        switch (reader.get<uint8_t>()) {
+            case 0:
+                return static_cast<long>(reader.get<int64_t>());
+            case 1:
+                return reader.get<double>();
+            case 2: {
+                std::string str(reader.get<uint32_t>(), '\0');
+                reader.take(str.data(), str.size());
+                return str;
+            }
+            default:
+                throw std::runtime_error("Unknown field type in write-ahead log record");
+        }
+    }
+
+    void put_ids(std::string& out, WalRecord::Type type, const std::vector<int>& ids) {
+        put(out, static_cast<uint8_t>(type));
+        put(out, static_cast<uint32_t>(ids.size()));
+        out.append(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(int32_t));
+    }
+
+    WalRecord decode(const char* body, size_t length, uint64_t sequence) {
+        BodyReader reader(body, length);
+        WalRecord record;
+        record.sequence = sequence;
+        record.type = static_cast<WalRecord::Type>(reader.get<uint8_t>());
+        record.ids.resize(reader.get<uint32_t>());
+        reader.take(record.ids.data(), record.ids.size() * sizeof(int32_t));
+        if (record.type == WalRecord::Type::DeleteDocuments) {
+            return record;
+        }
+        if (record.type != WalRecord::Type::AddDocuments) {
+            throw std::runtime_error("Unknown write-ahead log record type");
+        }
+
+        record.dimension = reader.get<uint32_t>();
+        record.vectors.resize(record.ids.size() * record.dimension);
+        reader.take(record.vectors.data(), record.vectors.size() * sizeof(float));
+        if (reader.get<uint8_t>() != 0) {
+            record.metadatas.resize(record.ids.size());
+            for (auto& metadata : record.metadatas) {
+                uint32_t fieldCount = reader.get<uint32_t>();
+                for (uint32_t f = 0; f < fieldCount; f++) {
+                    std::string field(reader.get<uint32_t>(), '\0');
+                    reader.take(field.data(), field.size());
+                    metadata[field] = get_field_value(reader);
+                }
+            }
+        }
+        return record;
+    }
+
+    // Fields of a frame header, false when its CRC does not match
+    bool read_frame_header(const char* header, uint32_t& length, uint64_t& sequence, uint32_t& bodyCrc) {
+        uint32_t headerCrc;
+        std::memcpy(&length, header, sizeof(length));
+        std::memcpy(&sequence, header + 4, sizeof(sequence));
+        std::memcpy(&bodyCrc, header + 12, sizeof(bodyCrc));
+        std::memcpy(&headerCrc, header + 16, sizeof(headerCrc));
+        return crc32(header, 16) == headerCrc;
+    }
+}
+
+uint32_t crc32(const char* data, size_t length) {
+    static const std::array<uint32_t, 256> table = make_crc_table();
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        c = table[(c ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& path, const WalOptions& options, uint64_t lastSequence)
+    : path(path), options(options), appendedSequence(lastSequence), durableSequence(lastSequence),
+      lastSync(std::chrono::steady_clock::now()), streamStart(lastSequence + 1) {
+    bool created = !std::filesystem::exists(path);
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open write-ahead log: " + path + ": " + std::strerror(errno));
+    }
+
+    if (created) {
+        syncDirectory();
+    }
+}
+
+// A new log file only survives a crash once its directory entry does
+void WriteAheadLog::syncDirectory() const {
+    if (options.sync == WalSyncPolicy::Never) {
+        return;
+    }
+    std::string directory = std::filesystem::path(path).parent_path().string();
+    int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (fd >= 0) {
+        if (options.sync != WalSyncPolicy::Never) {
+            ::fsync(fd);
+        }
+        ::close(fd);
+    }
+}
+
+uint64_t WriteAheadLog::appendAdd(const std::vector<int>& ids, size_t dimension, const std::vector<const float*>& vectors,
+                                  const std::vector<std::map<std::string, FieldValue>>& metadatas) {
+    std::string body;
+    body.reserve(ids.size() * (sizeof(int32_t) + dimension * sizeof(float)) + 16);
+    put_ids(body, WalRecord::Type::AddDocuments, ids);
+    put(body, static_cast<uint32_t>(dimension));
+    for (const float* vector : vectors) {
+        body.append(reinterpret_cast<const char*>(vector), dimension * sizeof(float));
+    }
+    put(body, static_cast<uint8_t>(metadatas.empty() ? 0 : 1));
+    for (const auto& metadata : metadatas) {
+        put(body, static_cast<uint32_t>(metadata.size()));
+        for (const auto& [field, value] : metadata) {
+            put(body, static_cast<uint32_t>(field.size()));
+            body.append(field);
+            put_field_value(body, value);
+        }
+    }
+    return commit(body);
+}
+
+uint64_t WriteAheadLog::appendDelete(const std::vector<int>& ids) {
+    std::string body;
+    put_ids(body, WalRecord::Type::DeleteDocuments, ids);
+    return commit(body);
+}
+
+uint64_t WriteAheadLog::lastSequence() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return appendedSequence;
+}
+
+uint64_t WriteAheadLog::commit(std::string& body) {
+    if (body.size() > UINT32_MAX) {
+        throw std::invalid_argument("Batch is too large for one write-ahead log record");
+    }
+    uint32_t bodyCrc = crc32(body.data(), body.size());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!failure.empty()) {
+        throw std::runtime_error(failure);
+    }
+
+    uint64_t sequence = ++appendedSequence;
+    std::string header;
+    put(header, static_cast<uint32_t>(body.size()));
+    put(header, sequence);
+    put(header, bodyCrc);
+    put(header, crc32(header.data(), header.size()));
+    pending.append(header);
+    pending.append(body);
+    if (options.streamBufferBytes > 0) {
+        streamBuffer.emplace_back(sequence, header + body);
+        streamBufferSize += streamBuffer.back().second.size();
+        while (streamBufferSize > options.streamBufferBytes && streamBuffer.size() > 1) {
+            streamBufferSize -= streamBuffer.front().second.size();
+            streamBuffer.pop_front();
+            streamStart = streamBuffer.front().first;
+        }
+    }
+
+    // Whoever finds no write in progress writes everything queued so far, including
+    // records appended by callers still waiting on the previous write
+    while (durableSequence < sequence) {
+        if (!failure.empty()) {
+            throw std::runtime_error(failure);
+        }
+        if (flushing) {
+            flushed.wait(lock);
+            continue;
+        }
+
+        flushing = true;
+        std::string batch;
+        batch.swap(pending);
+        uint64_t batchSequence = appendedSequence;
+        lock.unlock();
+
+        std::string error;
+        try {
+            writeAll(batch);
+            auto now = std::chrono::steady_clock::now();
+            bool sync = options.sync == WalSyncPolicy::Always
+                || (options.sync == WalSyncPolicy::Interval && now - lastSync >= options.syncInterval);
+            if (sync) {
+                if (::fsync(fd) != 0) {
+                    throw std::runtime_error(std::string("fsync failed: ") + std::strerror(errno));
+                }
+                lastSync = now;
+            }
+        } catch (const std::exception& e) {
+            error = "Write-ahead log " + path + " failed: " + e.what();
+        }
+
+        lock.lock();
+        flushing = false;
+        if (error.empty()) {
+            durableSequence = batchSequence;
+        } else {
+            failure = error;
+        }
+        flushed.notify_all();
+    }
+    return sequence;
+}
+
+void WriteAheadLog::writeAll(const std::string& bytes) {
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t result = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+        }
+        written += static_cast<size_t>(result);
+    }
+}
+
+bool WriteAheadLog::readStream(uint64_t afterSequence, size_t maxBytes, std::string& frames, uint64_t& logSequence) {
+    std::lock_guard<std::mutex> lock(mutex);
+    logSequence = durableSequence;
+    if (afterSequence + 1 < streamStart || afterSequence > appendedSequence) {
+        return false;
+    }
+
+    // Sequences in the buffer are contiguous, so the first record wanted is found by its offset
+    size_t position = streamBuffer.empty() ? 0 : afterSequence + 1 - streamBuffer.front().first;
+    size_t start = frames.size();
+    for (; position < streamBuffer.size(); position++) {
+        const auto& [sequence, frame] = streamBuffer[position];
+        if (sequence > durableSequence || (frames.size() > start && frames.size() - start + frame.size() > maxBytes)) {
+            break;
+        }
+        frames.append(frame);
+    }
+    return true;
+}
+
+bool WriteAheadLog::rotate(const std::string& retiredPath) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (::lseek(fd, 0, SEEK_END) == 0) {
+        return false;
+    }
+    if (options.sync != WalSyncPolicy::Never) {
+        ::fsync(fd);
+    }
+
+    std::filesystem::rename(path, retiredPath);
+    int replacement = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (replacement < 0) {
+        std::string error = std::strerror(errno);
+        std::filesystem::rename(retiredPath, path);
+        throw std::runtime_error("Unable to open write-ahead log: " + path + ": " + error);
+    }
+    ::close(fd);
+    fd = replacement;
+    syncDirectory();
+    return true;
+}
+
+uint64_t WriteAheadLog::replay(const std::string& path, uint64_t afterSequence,
+                               const std::function<void(const WalRecord&)>& apply) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        return afterSequence;
+    }
+
+    uint64_t lastSequence = afterSequence;
+    uint64_t validLength = 0;
+    std::string header(WAL_FRAME_HEADER_SIZE, '\0');
+    std::string body;
+    while (input.read(header.data(), header.size())) {
+        uint32_t length, bodyCrc;
+        uint64_t sequence;
+        if (!read_frame_header(header.data(), length, sequence, bodyCrc)) {
+            break;
+        }
+
+        body.resize(length);
+        if (!input.read(body.data(), length) || crc32(body.data(), length) != bodyCrc) {
+            break;
+        }
+        validLength += WAL_FRAME_HEADER_SIZE + length;
+
+        if (sequence > lastSequence) {
+            apply(decode(body.data(), length, sequence));
+            lastSequence = sequence;
+        }
+    }
+
+    // Cut off a record torn by a crash so new records are not appended after it
+    input.close();
+    if (std::filesystem::file_size(path) != validLength) {
+        std::filesystem::resize_file(path, validLength);
+    }
+    return lastSequence;
+}
+
+uint64_t WriteAheadLog::decodeStream(const std::string& frames, const std::function<void(const WalRecord&)>& apply) {
+    uint64_t lastSequence = 0;
+    size_t position = 0;
+    while (position < frames.size()) {
+        uint32_t length, bodyCrc;
+        uint64_t sequence;
+        if (frames.size() - position < WAL_FRAME_HEADER_SIZE
+            || !read_frame_header(frames.data() + position, length, sequence, bodyCrc)) {
+            throw std::runtime_error("Corrupt write-ahead log stream");
+        }
+        position += WAL_FRAME_HEADER_SIZE;
+        if (frames.size() - position < length || crc32(frames.data() + position, length) != bodyCrc) {
+            throw std::runtime_error("Corrupt write-ahead log stream");
+        }
+        apply(decode(frames.data() + position, length, sequence));
+        position += length;
+        lastSequence = sequence;
+    }
+    return lastSequence;
+}
@@ -0,0 +1,121 @@
+// write_ahead_log.hpp
+#ifndef WRITE_AHEAD_LOG_HPP
+#define WRITE_AHEAD_LOG_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "field_value.hpp"
+
+#define DEFAULT_WAL_SYNC_INTERVAL_MS 1000
+#define DEFAULT_WAL_STREAM_BUFFER_BYTES 0
+
+// When appended records are flushed to stable storage
+enum class WalSyncPolicy {
+    Always,   // fsync before an append returns
+    Interval, // fsync during a commit when the last one is older than the sync interval
+    Never     // leave it to the operating system
+};
+
+struct WalOptions {
+    bool enabled = true;
+    WalSyncPolicy sync = WalSyncPolicy::Always;
+    std::chrono::milliseconds syncInterval{DEFAULT_WAL_SYNC_INTERVAL_MS};
+    // Bytes of the latest records kept in memory for readStream, 0 keeps none
+    size_t streamBufferBytes = DEFAULT_WAL_STREAM_BUFFER_BYTES;
+};
+
+// One logged mutation. Sequence numbers increase by one per record for the life of an index,
+// across rotations, so a snapshot can record the last sequence it contains.
+struct WalRecord {
+    enum class Type : uint8_t { AddDocuments = 1, DeleteDocuments = 2 };
+
+    Type type = Type::AddDocuments;
+    uint64_t sequence = 0;
+    std::vector<int> ids;
+    size_t dimension = 0;
+    std::vector<float> vectors; // ids.size() * dimension, row major, for AddDocuments
+    std::vector<std::map<std::string, FieldValue>> metadatas; // empty or one per id
+};
+
+// Append only log of document mutations for one index. Each record is framed by its length and
+// a CRC32 so a record torn by a crash is detected and dropped on replay.
+//
+// Appends from concurrent callers are group committed: one caller writes (and syncs) every
+// record queued so far in a single write while the others wait for it, so a burst of small
+// requests costs one fsync rather than one each.
+class WriteAheadLog {
+public:
+    // Open path for appending. lastSequence is the highest sequence already used, either
+    // replayed from the log or recorded in the snapshot.
+    WriteAheadLog(const std::string& path, const WalOptions& options, uint64_t lastSequence);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Append a record and block until it is written (and synced, per the policy).
+    // Returns its sequence number.
+    uint64_t appendAdd(const std::vector<int>& ids, size_t dimension, const std::vector<const float*>& vectors,
+                       const std::vector<std::map<std::string, FieldValue>>& metadatas);
+    uint64_t appendDelete(const std::vector<int>& ids);
+
+    uint64_t lastSequence() const;
+
+    bool streams() const { return options.streamBufferBytes > 0; }
+    // Append the records after afterSequence to frames, framed as in the log file, up to about
+    // maxBytes of them (always at least one record). Only records already written to the log are
+    // returned, logSequence is set to the last of those. Returns false when the stream buffer no
+    // longer reaches back to afterSequence, or afterSequence is beyond the log, so a reader has to
+    // start again from a snapshot.
+    bool readStream(uint64_t afterSequence, size_t maxBytes, std::string& frames, uint64_t& logSequence);
+
+    // Move the records logged so far to retiredPath and continue in a new, empty file at the
+    // original path, so they can be deleted once a snapshot containing them has been written.
+    // Returns false, leaving the log as it is, when nothing has been logged since the last
+    // rotation. Callers must ensure no append is in progress.
+    bool rotate(const std::string& retiredPath);
+
+    // Call apply for each intact record with a sequence after afterSequence, in order. A torn or
+    // corrupt tail is cut off the file. Returns the last sequence in the log, or afterSequence
+    // if it is higher. A missing file is an empty log.
+    static uint64_t replay(const std::string& path, uint64_t afterSequence,
+                           const std::function<void(const WalRecord&)>& apply);
+    // Call apply for each record of frames from readStream, in order. Throws std::runtime_error if a
+    // record is incomplete or corrupt. Returns the last sequence, 0 when frames is empty.
+    static uint64_t decodeStream(const std::string& frames, const std::function<void(const WalRecord&)>& apply);
+
+private:
+    uint64_t commit(std::string& body);
+    void writeAll(const std::string& bytes);
+    void syncDirectory() const;
+
+    std::string path;
+    WalOptions options;
+    int fd = -1;
+
+    mutable std::mutex mutex;
+    std::condition_variable flushed;
+    std::string pending; // framed records not yet written
+    uint64_t appendedSequence = 0;
+    uint64_t durableSequence = 0;
+    bool flushing = false;
+    std::string failure; // set once a write fails, every later append throws
+    std::chrono::steady_clock::time_point lastSync;
+    // (sequence, framed record) of the latest records, contiguous, for readStream
+    std::deque<std::pair<uint64_t, std::string>> streamBuffer;
+    size_t streamBufferSize = 0;
+    uint64_t streamStart = 1; // first sequence the buffer can return
+};
+
+uint32_t crc32(const char* data, size_t length);
+
+#endif // WRITE_AHEAD_LOG_HPP
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include "data_store.hpp"
 #include <memory>
+#include <sstream>
 #include <string>
 
 class DataStoreTest : public ::testing::Test {
@@ -53,7 +54,7 @@ TEST_F(DataStoreTest, FilterByComparison) {
     auto filter = makeComparisonFilter("age", "=", 28L);
     auto result = dataStore.filter(filter);
 
-    std::unordered_set<int> expected = {4, 6};
+    IdSet expected = {4, 6};
     EXPECT_EQ(result, expected);
 }
 
@@ -69,7 +70,7 @@ TEST_F(DataStoreTest, FilterWithBooleanOp) {
 
     auto result = dataStore.filter(root);
 
-    std::unordered_set<int> expected = {7};
+    IdSet expected = {7};
     EXPECT_EQ(result, expected);
 }
 
@@ -104,7 +105,7 @@ TEST_F(DataStoreTest, TestEqualLongFilter) {
 
     auto result = dataStore.filter(ast);
 
-    std::unordered_set<int> expected = {12, 13};
+    IdSet expected = {12, 13};
     EXPECT_EQ(result, expected);
 }
 
@@ -119,7 +120,7 @@ TEST_F(DataStoreTest, TestEqualStringFilter) {
 
     auto result = dataStore.filter(ast);
 
-    std::unordered_set<int> expected = {16};
+    IdSet expected = {16};
     EXPECT_EQ(result, expected);
 }
 
@@ -131,7 +132,7 @@ TEST_F(DataStoreTest, TestFilterFloatRange) {
     std::string filterString = "age >= 30.0";
     auto ast = parseFilters(filterString);
     auto result = dataStore.filter(ast);
-    std::unordered_set<int> expected = {20, 21};
+    IdSet expected = {20, 21};
     EXPECT_EQ(result, expected);
 
     filterString = "age < 30.0";
@@ -148,12 +149,266 @@ TEST_F(DataStoreTest, TestCountFacets) {
     dataStore.set(24, {{"name", "Ava"}, {"age", 30L}});
     dataStore.set(25, {{"name", "Ava"}, {"age", 20L}});
 
-    std::vector<int> ids = {22, 23, 24, 25};
-    auto facets = dataStore.get_facets(ids);
+    IdSet ids = {22, 23, 24, 25};
+    auto facets = dataStore.get_facets({}, &ids);
 
     EXPECT_EQ(facets.counts["name"]["Emma"], 1);
     EXPECT_EQ(facets.counts["name"]["Oliver"], 1);
     EXPECT_EQ(facets.counts["name"]["Ava"], 2);
-    EXPECT_EQ(std::get<0>(facets.ranges["age"]), 20);
-    EXPECT_EQ(std::get<1>(facets.ranges["age"]), 30); 
-}
\ No newline at end of file
+    EXPECT_EQ(facets.ranges["age"].min, FieldValue(20L));
+    EXPECT_EQ(facets.ranges["age"].max, FieldValue(30L));
+    EXPECT_EQ(facets.ranges["age"].count, 4);
+}
+
+TEST_F(DataStoreTest, TestFacetsFromColumnsMatchFacetsFromIndex) {
+    // name and price have too many distinct values for the field index, colour does not
+    for (int i = 0; i < 200000; i++) {
+        std::map<std::string, FieldValue> record = {{"name", "doc_" + std::to_string(i % 1000)}, {"colour", i % 3 == 0 ? "red" : "blue"}};
+        if (i % 10 == 0) {
+            record["price"] = 0.5 + i;
+        } else {
+            record["price"] = static_cast<long>(i % 500) - 100;
+        }
+        dataStore.set(i, record);
+    }
+    IdSet ids = dataStore.filter(parseFilters("colour = \"red\""));
+
+    ThreadPool pool(4);
+    auto facets = dataStore.get_facets({"name", "price", "colour", "missing"}, &ids, &pool);
+    auto sequential = dataStore.get_facets({"name", "price", "colour"}, &ids);
+    EXPECT_EQ(facets.counts, sequential.counts);
+    EXPECT_EQ(facets.ranges["price"].count, sequential.ranges["price"].count);
+
+    EXPECT_EQ(facets.counts.size(), 2);
+    EXPECT_EQ(facets.counts["colour"].size(), 1);
+    EXPECT_EQ(facets.counts["colour"]["red"], ids.size());
+    EXPECT_EQ(facets.counts["name"].size(), 1000);
+    EXPECT_EQ(facets.counts["name"]["doc_3"], 67);
+    // Long and double values are combined in numeric order and keep their type
+    EXPECT_EQ(facets.ranges["price"].min, FieldValue(-99L));
+    EXPECT_EQ(facets.ranges["price"].max, FieldValue(199980.5));
+    EXPECT_EQ(facets.ranges["price"].count, ids.size());
+
+    auto all = dataStore.get_facets({"colour"});
+    EXPECT_EQ(all.counts["colour"]["blue"], 133333);
+}
+
+TEST_F(DataStoreTest, TestMergeFacets) {
+    dataStore.set(1, {{"name", "Emma"}, {"age", 22L}});
+    dataStore.set(2, {{"name", "Ava"}, {"age", 30L}});
+    DataStore other;
+    other.set(3, {{"name", "Ava"}, {"age", 19.5}});
+
+    auto facets = dataStore.get_facets({});
+    facets.merge(other.get_facets({}));
+
+    EXPECT_EQ(facets.counts["name"]["Emma"], 1);
+    EXPECT_EQ(facets.counts["name"]["Ava"], 2);
+    EXPECT_EQ(facets.ranges["age"].min, FieldValue(19.5));
+    EXPECT_EQ(facets.ranges["age"].max, FieldValue(30L));
+    EXPECT_EQ(facets.ranges["age"].count, 3);
+}
+
+TEST_F(DataStoreTest, TestNotFilter) {
+    dataStore.set(26, {{"name", "Lucas"}, {"age", 22L}});
+    dataStore.set(27, {{"name", "Mason"}, {"age", 30L}});
+    dataStore.set(28, {{"name", "Ella"}, {"age", 35L}});
+
+    auto ast = parseFilters("NOT age = 30");
+    auto result = dataStore.filter(ast);
+    IdSet expected = {26, 28};
+    EXPECT_EQ(result, expected);
+}
+
+TEST_F(DataStoreTest, TestStrictRangeExcludesBoundary) {
+    dataStore.set(29, {{"age", 20L}});
+    dataStore.set(30, {{"age", 30L}});
+    dataStore.set(31, {{"age", 40L}});
+
+    auto result = dataStore.filter(parseFilters("age > 30"));
+    IdSet expected = {31};
+    EXPECT_EQ(result, expected);
+
+    result = dataStore.filter(parseFilters("age < 30"));
+    expected = {29};
+    EXPECT_EQ(result, expected);
+
+    result = dataStore.filter(parseFilters("age <= 30"));
+    expected = {29, 30};
+    EXPECT_EQ(result, expected);
+}
+
+TEST_F(DataStoreTest, TestUpdateRecordReindexes) {
+    dataStore.set(32, {{"age", 25L}});
+    dataStore.set(32, {{"age", 26L}});
+
+    EXPECT_TRUE(dataStore.filter(parseFilters("age = 25")).empty());
+    IdSet expected = {32};
+    EXPECT_EQ(dataStore.filter(parseFilters("age = 26")), expected);
+}
+
+TEST_F(DataStoreTest, TestSetManyIndexesAllRecords) {
+    std::vector<std::pair<int, std::map<std::string, FieldValue>>> records;
+    for (int id = 33; id < 43; id++) {
+        records.emplace_back(id, std::map<std::string, FieldValue>{{"parity", id % 2 == 0 ? "even" : "odd"}});
+    }
+    dataStore.setMany(std::move(records));
+
+    EXPECT_EQ(dataStore.ids.size(), 10);
+    EXPECT_EQ(std::get<std::string>(dataStore.get(34)["parity"]), "even");
+    EXPECT_EQ(dataStore.filter(parseFilters("parity = \"odd\"")).size(), 5);
+}
+
+TEST_F(DataStoreTest, TestRemovedRowsAreReused) {
+    dataStore.set(43, {{"name", "Zoe"}, {"score", 1.5}});
+    dataStore.remove(43);
+    dataStore.set(44, {{"name", "Zoe"}});
+
+    auto retrieved = dataStore.get(44);
+    EXPECT_EQ(retrieved.size(), 1);
+    EXPECT_EQ(std::get<std::string>(retrieved["name"]), "Zoe");
+    EXPECT_FALSE(dataStore.contains(43));
+    EXPECT_TRUE(dataStore.filter(parseFilters("score >= 0.0")).empty());
+    EXPECT_EQ(dataStore.size(), 1);
+}
+
+TEST_F(DataStoreTest, TestMatchesFilterUsesComparator) {
+    dataStore.set(45, {{"name", "Yara"}, {"age", 31L}});
+
+    EXPECT_TRUE(dataStore.matchesFilter(45, parseFilters("age > 30 AND name = \"Yara\"")));
+    EXPECT_FALSE(dataStore.matchesFilter(45, parseFilters("age < 30")));
+    EXPECT_TRUE(dataStore.matchesFilter(45, parseFilters("NOT missing = 1")));
+    EXPECT_FALSE(dataStore.matchesFilter(46, parseFilters("age > 30")));
+}
+
+TEST_F(DataStoreTest, TestBoundFilterChecksManyRows) {
+    dataStore.set(1, {{"name", "Mary Ann"}, {"age", 31L}});
+    dataStore.set(2, {{"name", "Mary"}, {"age", 45L}});
+    dataStore.set(3, {{"age", 29L}});
+
+    BoundFilter bound = dataStore.bind(parseFilters("(name = \"Mary Ann\" OR age > 40) AND NOT missing = 1"));
+    ASSERT_EQ(bound.steps.size(), 6);
+    EXPECT_TRUE(dataStore.matchesFilter(1, bound));
+    EXPECT_TRUE(dataStore.matchesFilter(2, bound));
+    EXPECT_FALSE(dataStore.matchesFilter(3, bound));
+    EXPECT_FALSE(dataStore.matchesFilter(4, bound));
+    EXPECT_EQ(dataStore.matchingIds(bound.ast, {1, 2, 3, 4}), IdSet({1, 2}));
+
+    auto lock = dataStore.sharedLock();
+    EXPECT_TRUE(dataStore.matchesFilterUnlocked(2, bound));
+    EXPECT_FALSE(dataStore.matchesFilterUnlocked(3, bound));
+}
+
+TEST_F(DataStoreTest, TestRangeFiltersFollowValueOrder) {
+    dataStore.set(1, {{"price", 5L}});
+    dataStore.set(2, {{"price", 50L}});
+    dataStore.set(3, {{"price", 7.5}});
+    dataStore.set(4, {{"price", "unknown"}});
+    dataStore.set(5, {{"name", "Jack"}});
+
+    // Longs order before doubles, and doubles before strings
+    IdSet expected = {2, 3, 4};
+    EXPECT_EQ(dataStore.filter(parseFilters("price > 10")), expected);
+    expected = {3, 4};
+    EXPECT_EQ(dataStore.filter(parseFilters("price >= 1.0")), expected);
+    expected = {1, 2};
+    EXPECT_EQ(dataStore.filter(parseFilters("price < 1.0")), expected);
+    expected = {1};
+    EXPECT_EQ(dataStore.filter(parseFilters("price <= 5")), expected);
+    expected = {1, 2, 3};
+    EXPECT_EQ(dataStore.filter(parseFilters("price < \"a\"")), expected);
+}
+
+TEST_F(DataStoreTest, TestBetweenFilterMatchesBothComparisons) {
+    for (int i = 0; i < 5000; i++) {
+        dataStore.set(i, {{"price", static_cast<long>(i % 1000)}, {"weight", i / 10.0}});
+    }
+    for (int i = 0; i < 5000; i += 3) {
+        dataStore.remove(i);
+    }
+    for (int i = 0; i < 5000; i += 7) {
+        dataStore.set(i, {{"price", static_cast<long>(i % 500)}, {"weight", i / 20.0}});
+    }
+
+    for (const char* filter : {"price >= 100 AND price < 200", "price < 200 AND price >= 100",
+                                      "weight > 10.0 AND weight <= 99.5", "price > 900 AND price < 100"}) {
+        auto ast = parseFilters(filter);
+        IdSet expected;
+        for (int id : dataStore.ids) {
+            if (dataStore.matchesFilter(id, ast)) {
+                expected.add(id);
+            }
+        }
+        EXPECT_EQ(dataStore.filter(ast), expected) << filter;
+    }
+    EXPECT_FALSE(dataStore.filter(parseFilters("price >= 100 AND price < 200")).empty());
+}
+
+TEST_F(DataStoreTest, TestEstimateSelectivity) {
+    for (int i = 0; i < 100; i++) {
+        dataStore.set(i, {{"bucket", static_cast<long>(i % 4)}, {"score", static_cast<double>(i)}});
+    }
+
+    EXPECT_DOUBLE_EQ(dataStore.estimateSelectivity(parseFilters("bucket = 1")), 0.25);
+    EXPECT_DOUBLE_EQ(dataStore.estimateSelectivity(parseFilters("bucket != 1")), 0.75);
+    EXPECT_DOUBLE_EQ(dataStore.estimateSelectivity(parseFilters("bucket > 1")), 0.5);
+    EXPECT_DOUBLE_EQ(dataStore.estimateSelectivity(parseFilters("NOT bucket = 1")), 0.75);
+    EXPECT_DOUBLE_EQ(dataStore.estimateSelectivity(parseFilters("bucket = 1 AND bucket = 2")), 0.0625);
+    EXPECT_DOUBLE_EQ(dataStore.estimateSelectivity(parseFilters("missing = 1")), 0.0);
+
+    // score has more distinct values than are walked, but numeric ranges are counted by the range index
+    EXPECT_DOUBLE_EQ(dataStore.estimateSelectivity(parseFilters("score < 80.0")), 0.8);
+}
+
+TEST_F(DataStoreTest, TestDeltaAppliesChangesSinceFullCopy) {
+    dataStore.set(1, {{"name", "Jack"}});
+    dataStore.set(2, {{"name", "Karen"}});
+    std::stringstream full;
+    dataStore.serialize(full);
+    dataStore.takeChangedIds();
+
+    dataStore.set(2, {{"name", "Kate"}});
+    dataStore.set(3, {{"name", "Liam"}});
+    dataStore.remove(1);
+    IdSet changed = dataStore.takeChangedIds();
+    EXPECT_EQ(changed, IdSet({1, 2, 3}));
+    std::stringstream delta;
+    dataStore.serializeDelta(delta, changed);
+
+    DataStore restored;
+    restored.deserialize(full);
+    restored.applyDelta(delta);
+    EXPECT_THROW(restored.get(1), std::out_of_range);
+    EXPECT_EQ(std::get<std::string>(restored.get(2)["name"]), "Kate");
+    EXPECT_EQ(std::get<std::string>(restored.get(3)["name"]), "Liam");
+    EXPECT_EQ(restored.filter(parseFilters("name = \"Kate\"")), IdSet({2}));
+}
+
+TEST_F(DataStoreTest, TestSnapshotKeepsStateItWasTakenIn) {
+    dataStore.set(1, {{"name", "Jack"}, {"age", 30L}});
+    dataStore.set(2, {{"name", "Karen"}, {"score", 1.5}});
+    MetadataSnapshot full = dataStore.snapshot();
+    dataStore.takeChangedIds();
+    dataStore.set(3, {{"name", "Liam"}});
+    IdSet changed = dataStore.takeChangedIds();
+    changed.add(4);
+    MetadataSnapshot delta = dataStore.snapshotDelta(changed);
+
+    dataStore.set(1, {{"name", "John"}});
+    dataStore.remove(2);
+    dataStore.remove(3);
+    std::stringstream fullOut;
+    full.serialize(fullOut);
+    std::stringstream deltaOut;
+    delta.serialize(deltaOut);
+
+    DataStore restored;
+    restored.deserialize(fullOut);
+    EXPECT_EQ(restored.size(), 2);
+    EXPECT_EQ(std::get<std::string>(restored.get(1)["name"]), "Jack");
+    EXPECT_EQ(std::get<long>(restored.get(1)["age"]), 30);
+    EXPECT_DOUBLE_EQ(std::get<double>(restored.get(2)["score"]), 1.5);
+    restored.applyDelta(deltaOut);
+    EXPECT_EQ(restored.size(), 3);
+    EXPECT_EQ(std::get<std::string>(restored.get(3)["name"]), "Liam");
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include "filter_cache.hpp"
+#include <memory>
+#include <string>
+
+class FilterCacheTest : public ::testing::Test {
+protected:
+    DataStore dataStore;
+    FilterCache cache{4};
+
+    void SetUp() override {
+        dataStore.set(1, {{"colour", "red"}, {"size", 1L}});
+        dataStore.set(2, {{"colour", "blue"}, {"size", 2L}});
+        dataStore.set(3, {{"colour", "red"}, {"size", 3L}});
+    }
+
+    // Evaluate a filter through the cache the way IndexHandle::filterIds does
+    std::shared_ptr<const IdSet> lookup(const std::string& filter) {
+        auto ast = parseFilters(filter);
+        std::string key = normalizeFilter(ast);
+        auto cached = cache.get(key);
+        if (cached != nullptr) {
+            return cached;
+        }
+        uint64_t generation = cache.currentGeneration();
+        auto ids = std::make_shared<const IdSet>(dataStore.filter(ast));
+        cache.put(key, ast, ids, generation);
+        return ids;
+    }
+};
+
+TEST(NormalizeFilterTest, OperandOrderDoesNotMatter) {
+    EXPECT_EQ(normalizeFilter(parseFilters("a = 1 AND b = 2")), normalizeFilter(parseFilters("b = 2 AND a = 1")));
+    EXPECT_EQ(normalizeFilter(parseFilters("a = 1 OR (b = 2 OR c = 3)")), normalizeFilter(parseFilters("(c = 3 OR a = 1) OR b = 2")));
+    EXPECT_EQ(normalizeFilter(parseFilters("a = 1 AND a = 1")), normalizeFilter(parseFilters("a = 1")));
+}
+
+TEST(NormalizeFilterTest, DistinguishesOperatorsAndTypes) {
+    EXPECT_NE(normalizeFilter(parseFilters("a = 1 AND b = 2")), normalizeFilter(parseFilters("a = 1 OR b = 2")));
+    EXPECT_NE(normalizeFilter(parseFilters("a = 1")), normalizeFilter(parseFilters("a = 1.0")));
+    EXPECT_NE(normalizeFilter(parseFilters("a = 1")), normalizeFilter(parseFilters("a = \"1\"")));
+    EXPECT_NE(normalizeFilter(parseFilters("NOT a = 1")), normalizeFilter(parseFilters("a = 1")));
+}
+
+TEST_F(FilterCacheTest, HitSharesResult) {
+    auto first = lookup("colour = \"red\"");
+    auto second = lookup("colour = \"red\"");
+
+    EXPECT_EQ(first.get(), second.get());
+    IdSet expected = {1, 3};
+    EXPECT_EQ(*first, expected);
+}
+
+TEST_F(FilterCacheTest, DocumentsChangedUpdatesEntries) {
+    auto before = lookup("colour = \"red\"");
+
+    dataStore.set(2, {{"colour", "red"}, {"size", 2L}});
+    dataStore.set(3, {{"colour", "green"}, {"size", 3L}});
+    dataStore.set(4, {{"colour", "red"}, {"size", 4L}});
+    cache.documentsChanged({2, 3, 4}, dataStore);
+
+    auto after = lookup("colour = \"red\"");
+    IdSet expected = {1, 2, 4};
+    EXPECT_EQ(cache.size(), 1);
+    EXPECT_EQ(*after, expected);
+
+    // Readers holding the old result keep seeing it unchanged
+    IdSet original = {1, 3};
+    EXPECT_EQ(*before, original);
+}
+
+TEST_F(FilterCacheTest, DocumentsChangedWithoutEffectKeepsResult) {
+    auto before = lookup("colour = \"red\"");
+
+    dataStore.set(5, {{"colour", "blue"}});
+    cache.documentsChanged({5}, dataStore);
+
+    EXPECT_EQ(lookup("colour = \"red\"").get(), before.get());
+}
+
+TEST_F(FilterCacheTest, DocumentsRemovedUpdatesEntries) {
+    lookup("colour = \"red\"");
+    lookup("size > 1");
+
+    dataStore.remove(3);
+    cache.documentsRemoved({3});
+
+    IdSet red = {1};
+    IdSet large = {2};
+    EXPECT_EQ(*lookup("colour = \"red\""), red);
+    EXPECT_EQ(*lookup("size > 1"), large);
+    EXPECT_EQ(cache.size(), 2);
+}
+
+TEST_F(FilterCacheTest, StaleResultIsNotCached) {
+    auto ast = parseFilters("colour = \"red\"");
+    uint64_t generation = cache.currentGeneration();
+    auto stale = std::make_shared<const IdSet>(dataStore.filter(ast));
+
+    dataStore.set(2, {{"colour", "red"}});
+    cache.documentsChanged({2}, dataStore);
+    cache.put(normalizeFilter(ast), ast, stale, generation);
+
+    EXPECT_EQ(cache.size(), 0);
+    IdSet expected = {1, 2, 3};
+    EXPECT_EQ(*lookup("colour = \"red\""), expected);
+}
+
+TEST_F(FilterCacheTest, EvictsLeastFrequentlyUsed) {
+    lookup("size = 1");
+    lookup("size = 2");
+    lookup("size = 3");
+    lookup("size = 4");
+    lookup("size = 1");
+    lookup("size = 2");
+    lookup("size = 3");
+
+    lookup("size > 0");
+
+    EXPECT_EQ(cache.size(), 4);
+    EXPECT_EQ(cache.get(normalizeFilter(parseFilters("size = 4"))), nullptr);
+    EXPECT_NE(cache.get(normalizeFilter(parseFilters("size = 1"))), nullptr);
+}
@@ -131,4 +131,48 @@ TEST(FilterTest, TestASTConstructionWithGroup) {
     ASSERT_EQ(ast->right->filter.field, "name");
     ASSERT_EQ(ast->right->filter.type, "=");
     ASSERT_EQ(std::get<std::string>(ast->right->filter.value), "Alice");
-}
\ No newline at end of file
+}
+
+TEST(FilterTest, TestTokenizeStringsWithSpacesAndNoSeparators) {
+    auto tokens = tokenize("(name=\"Mary Ann\" OR quote = \"say \\\"hi\\\"\")AND delta>=-2.5");
+    ASSERT_EQ(tokens.size(), 13);
+    EXPECT_EQ(tokens[0].type, "LPAREN");
+    EXPECT_EQ(tokens[1].value, "name");
+    EXPECT_EQ(tokens[2].value, "=");
+    EXPECT_EQ(tokens[3].value, "Mary Ann");
+    EXPECT_EQ(tokens[3].type, "STRING");
+    EXPECT_EQ(tokens[7].value, "say \"hi\"");
+    EXPECT_EQ(tokens[8].type, "RPAREN");
+    EXPECT_EQ(tokens[9].value, "AND");
+    EXPECT_EQ(tokens[11].value, ">=");
+    EXPECT_EQ(tokens[12].value, "-2.5");
+    EXPECT_EQ(tokens[12].type, "DOUBLE");
+}
+
+TEST(FilterTest, TestNotAppliesToGroup) {
+    auto ast = parseFilters("NOT (age < 30 OR age > 40)");
+
+    ASSERT_EQ(ast->type, NodeType::Not);
+    ASSERT_EQ(ast->child->type, NodeType::BooleanOp);
+    EXPECT_EQ(ast->child->left->filter.comparator, Comparator::Less);
+    EXPECT_EQ(ast->child->right->filter.comparator, Comparator::Greater);
+}
+
+TEST(FilterTest, TestMalformedFiltersAreRejected) {
+    EXPECT_THROW(parseFilters("age = 30 AND"), std::invalid_argument);
+    EXPECT_THROW(parseFilters("(age = 30"), std::invalid_argument);
+    EXPECT_THROW(parseFilters("age ="), std::invalid_argument);
+    EXPECT_THROW(parseFilters("age = other"), std::invalid_argument);
+    EXPECT_THROW(parseFilters("name = \"unterminated"), std::invalid_argument);
+    EXPECT_THROW(parseFilters("age ! 30"), std::invalid_argument);
+    EXPECT_THROW(parseFilters("age = 99999999999999999999"), std::invalid_argument);
+    EXPECT_EQ(parseFilters("  "), nullptr);
+}
+
+TEST(FilterTest, TestParseFiltersCachedSharesAST) {
+    auto first = parseFiltersCached("cached = \"a b\"");
+    auto second = parseFiltersCached("cached = \"a b\"");
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(std::get<std::string>(first->filter.value), "a b");
+    EXPECT_NE(parseFiltersCached("cached = 1"), first);
+}
@@ -0,0 +1,261 @@
+#include <gtest/gtest.h>
+#include "http_client.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Minimal HTTP server on a loopback port. Every request is answered by the handler, after
+// sleeping for its delay. A handler returning an empty string leaves the request unanswered.
+class FakeServer {
+public:
+    struct Reply {
+        std::string response;
+        std::chrono::milliseconds delay{0};
+        bool close = false;
+    };
+
+    explicit FakeServer(std::function<Reply(const std::string&)> handler) : handler(std::move(handler)) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        socklen_t length = sizeof(address);
+        getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+        port = ntohs(address.sin_port);
+        listen(listener, 16);
+        acceptor = std::thread([this]() { acceptLoop(); });
+    }
+
+    ~FakeServer() {
+        shutdown(listener, SHUT_RDWR);
+        close(listener);
+        acceptor.join();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int fd : connections) {
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (int fd : connections) {
+            close(fd);
+        }
+    }
+
+    std::string endpoint() const { return "127.0.0.1:" + std::to_string(port); }
+
+    std::atomic<int> accepted{0};
+    std::atomic<int> requests{0};
+
+private:
+    std::function<Reply(const std::string&)> handler;
+    int listener;
+    uint16_t port;
+    std::thread acceptor;
+    std::mutex mutex;
+    std::vector<int> connections;
+    std::vector<std::thread> workers;
+
+    void acceptLoop() {
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            accepted++;
+            std::lock_guard<std::mutex> lock(mutex);
+            connections.push_back(fd);
+            workers.emplace_back([this, fd]() { serve(fd); });
+        }
+    }
+
+    void serve(int fd) {
+        std::string buffer;
+        char chunk[4096];
+        while (true) {
+            size_t headerEnd;
+            while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                if (received <= 0) {
+                    return;
+                }
+                buffer.append(chunk, received);
+            }
+            size_t length = 0;
+            size_t header = buffer.find("Content-Length: ");
+            if (header != std::string::npos && header < headerEnd) {
+                length = std::stoul(buffer.substr(header + 16));
+            }
+            while (buffer.size() < headerEnd + 4 + length) {
+                ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                if (received <= 0) {
+                    return;
+                }
+                buffer.append(chunk, received);
+            }
+            std::string request = buffer.substr(0, headerEnd + 4 + length);
+            buffer.erase(0, request.size());
+            requests++;
+
+            Reply reply = handler(request);
+            std::this_thread::sleep_for(reply.delay);
+            if (!reply.response.empty()) {
+                send(fd, reply.response.data(), reply.response.size(), MSG_NOSIGNAL);
+            }
+            if (reply.close) {
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+    }
+};
+
+std::string ok(const std::string& body) {
+    return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+HttpCall post(std::vector<size_t> endpoints, const std::string& body, bool hedge = false) {
+    HttpCall call;
+    call.endpoints = std::move(endpoints);
+    call.method = "POST";
+    call.target = "/search";
+    call.contentType = "application/json";
+    call.body = body;
+    call.hedge = hedge;
+    return call;
+}
+
+TEST(HttpResponseParserTest, ParsesResponseArrivingInPieces) {
+    std::string response = "HTTP/1.1 404 Not Found\r\ncontent-length: 9\r\nServer: Crow\r\n\r\nnot found";
+    HttpResponseParser parser;
+    for (size_t i = 0; i + 1 < response.size(); i++) {
+        EXPECT_FALSE(parser.feed(&response[i], 1));
+    }
+    EXPECT_TRUE(parser.feed(&response.back(), 1));
+    EXPECT_EQ(parser.response().status, 404);
+    EXPECT_EQ(parser.response().body, "not found");
+    EXPECT_TRUE(parser.response().keepAlive);
+}
+
+TEST(HttpResponseParserTest, HonoursConnectionClose) {
+    std::string response = "HTTP/1.1 200 OK\r\nConnection: Close\r\nContent-Length: 0\r\n\r\n";
+    HttpResponseParser parser;
+    EXPECT_TRUE(parser.feed(response.data(), response.size()));
+    EXPECT_FALSE(parser.response().keepAlive);
+}
+
+TEST(HttpResponseParserTest, RejectsResponsesWithoutLength) {
+    std::string chunked = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+    HttpResponseParser parser;
+    EXPECT_THROW(parser.feed(chunked.data(), chunked.size()), std::runtime_error);
+
+    std::string unbounded = "HTTP/1.1 200 OK\r\n\r\nbody";
+    HttpResponseParser other;
+    EXPECT_THROW(other.feed(unbounded.data(), unbounded.size()), std::runtime_error);
+}
+
+TEST(HttpClientTest, ReusesPooledConnections) {
+    FakeServer server([](const std::string& request) {
+        return FakeServer::Reply{ok(request.substr(request.find("\r\n\r\n") + 4))};
+    });
+    HttpClient client({resolve_endpoint(server.endpoint())});
+
+    for (int i = 0; i < 3; i++) {
+        std::vector<HttpCall> calls = {post({0}, "query " + std::to_string(i)), post({0}, "other")};
+        client.run(calls, std::chrono::milliseconds(2000));
+        ASSERT_TRUE(calls[0].response) << calls[0].error;
+        EXPECT_EQ(calls[0].response->body, "query " + std::to_string(i));
+        EXPECT_EQ(calls[1].response->body, "other");
+    }
+    EXPECT_EQ(server.requests.load(), 6);
+    EXPECT_EQ(server.accepted.load(), 2);
+}
+
+TEST(HttpClientTest, ReconnectsWhenPooledConnectionWasClosed) {
+    FakeServer server([](const std::string&) {
+        return FakeServer::Reply{ok("done"), std::chrono::milliseconds(0), true};
+    });
+    HttpClient client({resolve_endpoint(server.endpoint())});
+
+    for (int i = 0; i < 2; i++) {
+        std::vector<HttpCall> calls = {post({0}, "")};
+        client.run(calls, std::chrono::milliseconds(2000));
+        ASSERT_TRUE(calls[0].response) << calls[0].error;
+        EXPECT_EQ(calls[0].response->body, "done");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    EXPECT_EQ(server.accepted.load(), 2);
+}
+
+TEST(HttpClientTest, HedgesSlowEndpoint) {
+    FakeServer slow([](const std::string&) {
+        return FakeServer::Reply{ok("slow"), std::chrono::milliseconds(500)};
+    });
+    FakeServer fast([](const std::string&) {
+        return FakeServer::Reply{ok("fast")};
+    });
+    HttpClient client({resolve_endpoint(slow.endpoint()), resolve_endpoint(fast.endpoint())});
+
+    std::vector<HttpCall> calls = {post({0, 1}, "", true)};
+    auto started = std::chrono::steady_clock::now();
+    client.run(calls, std::chrono::milliseconds(2000), std::chrono::milliseconds(20));
+    auto elapsed = std::chrono::steady_clock::now() - started;
+
+    ASSERT_TRUE(calls[0].response) << calls[0].error;
+    EXPECT_EQ(calls[0].response->body, "fast");
+    EXPECT_LT(elapsed, std::chrono::milliseconds(400));
+}
+
+TEST(HttpClientTest, FailsOverToNextEndpoint) {
+    // Nothing listens on the port of a server that has shut down
+    std::string closedEndpoint;
+    {
+        FakeServer closed([](const std::string&) { return FakeServer::Reply{ok("")}; });
+        closedEndpoint = closed.endpoint();
+    }
+    FakeServer live([](const std::string&) {
+        return FakeServer::Reply{ok("live")};
+    });
+    HttpClient client({resolve_endpoint(closedEndpoint), resolve_endpoint(live.endpoint())});
+
+    std::vector<HttpCall> calls = {post({0, 1}, "")};
+    client.run(calls, std::chrono::milliseconds(2000));
+    ASSERT_TRUE(calls[0].response) << calls[0].error;
+    EXPECT_EQ(calls[0].response->body, "live");
+}
+
+TEST(HttpClientTest, DeadlineLeavesSlowCallsWithoutResponse) {
+    FakeServer slow([](const std::string&) {
+        return FakeServer::Reply{ok("late"), std::chrono::milliseconds(300)};
+    });
+    FakeServer fast([](const std::string&) {
+        return FakeServer::Reply{ok("fast")};
+    });
+    HttpClient client({resolve_endpoint(slow.endpoint()), resolve_endpoint(fast.endpoint())});
+
+    std::vector<HttpCall> calls = {post({0}, ""), post({1}, "")};
+    auto started = std::chrono::steady_clock::now();
+    client.run(calls, std::chrono::milliseconds(50));
+    EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(250));
+
+    EXPECT_FALSE(calls[0].response);
+    EXPECT_NE(calls[0].error.find("No response within 50ms"), std::string::npos);
+    ASSERT_TRUE(calls[1].response);
+    EXPECT_EQ(calls[1].response->body, "fast");
+}
+
+TEST(HttpClientTest, ResolveEndpointRejectsMalformedAddresses) {
+    EXPECT_THROW(resolve_endpoint("localhost"), std::invalid_argument);
+    EXPECT_THROW(resolve_endpoint("localhost:http"), std::invalid_argument);
+    EXPECT_THROW(resolve_endpoint("localhost:70000"), std::invalid_argument);
+    EXPECT_EQ(resolve_endpoint("127.0.0.1:8685").port, 8685);
+}
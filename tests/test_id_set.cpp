@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include "id_set.hpp"
+#include <set>
+#include <random>
+#include <algorithm>
+#include <iterator>
+
+TEST(IdSetTest, AddContainsRemove) {
+    IdSet ids;
+    ids.add(1);
+    ids.add(70000);
+    ids.add(1);
+
+    EXPECT_EQ(ids.size(), 2);
+    EXPECT_TRUE(ids.contains(1));
+    EXPECT_TRUE(ids.contains(70000));
+    EXPECT_FALSE(ids.contains(2));
+
+    ids.remove(1);
+    EXPECT_FALSE(ids.contains(1));
+    EXPECT_EQ(ids.size(), 1);
+}
+
+TEST(IdSetTest, IteratesInOrder) {
+    IdSet ids = {5, 200000, 3, 65536, 65535};
+    std::vector<int> expected = {3, 5, 65535, 65536, 200000};
+    EXPECT_EQ(ids.toVector(), expected);
+}
+
+TEST(IdSetTest, DenseContainersBecomeBitmaps) {
+    IdSet dense;
+    for (int i = 0; i < 50000; i++) {
+        dense.add(i);
+    }
+    EXPECT_EQ(dense.size(), 50000);
+    EXPECT_LT(dense.memoryUsage(), 50000 * sizeof(int));
+
+    for (int i = 0; i < 50000; i += 2) {
+        dense.remove(i);
+    }
+    EXPECT_EQ(dense.size(), 25000);
+    EXPECT_TRUE(dense.contains(1));
+    EXPECT_FALSE(dense.contains(2));
+}
+
+TEST(IdSetTest, FromIdsMatchesAddingOneByOne) {
+    std::vector<int> ids = {200000, 3, 5, 3, 65536};
+    for (int i = 70000; i < 80000; i++) {
+        ids.push_back(i);
+    }
+
+    IdSet expected;
+    for (int id : ids) {
+        expected.add(id);
+    }
+    IdSet built = IdSet::fromIds(ids);
+    EXPECT_EQ(built, expected);
+    EXPECT_EQ(built.size(), expected.size());
+    EXPECT_TRUE(IdSet::fromIds({}).empty());
+}
+
+TEST(IdSetTest, SetAlgebraMatchesStdSet) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> sparse(0, 1000000);
+    std::uniform_int_distribution<int> dense(0, 100000);
+
+    IdSet a, b;
+    std::set<int> expectedA, expectedB;
+    for (int i = 0; i < 20000; i++) {
+        int x = sparse(rng);
+        int y = dense(rng);
+        a.add(x);
+        expectedA.insert(x);
+        b.add(y);
+        expectedB.insert(y);
+    }
+
+    std::vector<int> expectedUnion, expectedIntersection, expectedDifference;
+    std::set_union(expectedA.begin(), expectedA.end(), expectedB.begin(), expectedB.end(), std::back_inserter(expectedUnion));
+    std::set_intersection(expectedA.begin(), expectedA.end(), expectedB.begin(), expectedB.end(), std::back_inserter(expectedIntersection));
+    std::set_difference(expectedA.begin(), expectedA.end(), expectedB.begin(), expectedB.end(), std::back_inserter(expectedDifference));
+
+    EXPECT_EQ((a | b).toVector(), expectedUnion);
+    EXPECT_EQ((a & b).toVector(), expectedIntersection);
+    EXPECT_EQ((a - b).toVector(), expectedDifference);
+    EXPECT_EQ((a | b).size(), expectedUnion.size());
+    EXPECT_EQ((b & a), (a & b));
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+#include "json_writer.hpp"
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+TEST(JsonWriterTest, PlacesCommasAndColons) {
+    std::string out;
+    JsonWriter writer(out);
+    writer.beginObject();
+    writer.key("hits").array(std::vector<int>{3, 1, 2});
+    writer.key("empty").beginArray().endArray();
+    writer.key("nested").beginObject().key("a").value(1).key("b").null().endObject();
+    writer.key("flags").beginArray().value(true).value(false).endArray();
+    writer.endObject();
+
+    EXPECT_EQ(out, R"({"hits":[3,1,2],"empty":[],"nested":{"a":1,"b":null},"flags":[true,false]})");
+}
+
+TEST(JsonWriterTest, EscapesStrings) {
+    std::string out;
+    JsonWriter writer(out);
+    writer.value(std::string("say \"hi\"\\\n\t\x01 Mary Ann"));
+
+    EXPECT_EQ(out, R"("say \"hi\"\\\n\t\u0001 Mary Ann")");
+}
+
+TEST(JsonWriterTest, FloatsStayFloats) {
+    std::string out;
+    JsonWriter writer(out);
+    writer.array(std::vector<double>{2.0, 0.5, -3.25, 1e21});
+    EXPECT_EQ(out, "[2.0,0.5,-3.25,1e+21]");
+
+    out.clear();
+    JsonWriter floats(out);
+    floats.array(std::vector<float>{0.1f, 0.0f, std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity()});
+    EXPECT_EQ(out, "[0.1,0.0,null,null]");
+    EXPECT_EQ(std::stof(out.substr(1, 3)), 0.1f);
+}
+
+TEST(JsonWriterTest, WritesFieldValuesWithTheirType) {
+    std::string out;
+    JsonWriter writer(out);
+    writer.beginArray();
+    writer.value(FieldValue(32L));
+    writer.value(FieldValue(4.0));
+    writer.value(FieldValue(std::string("Jack")));
+    writer.endArray();
+
+    EXPECT_EQ(out, R"([32,4.0,"Jack"])");
+}
+
+TEST(JsonWriterTest, ResponseBufferIsClearedAndReused) {
+    std::string& first = json_response_buffer();
+    first.assign(1000, 'x');
+    const char* data = first.data();
+
+    std::string& second = json_response_buffer();
+    EXPECT_TRUE(second.empty());
+    EXPECT_GE(second.capacity(), 1000);
+    EXPECT_EQ(second.data(), data);
+}
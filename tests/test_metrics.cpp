@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include "metrics.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(MetricsTest, CounterSumsConcurrentAdds) {
+    Counter counter;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&counter] {
+            for (int i = 0; i < 1000; i++) {
+                counter.add();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    counter.add(5);
+    EXPECT_EQ(counter.get(), 4005);
+}
+
+TEST(MetricsTest, HistogramBucketsAreCumulative) {
+    LatencyHistogram histogram;
+    histogram.observe(std::chrono::microseconds(40));
+    histogram.observe(std::chrono::microseconds(50));
+    histogram.observe(std::chrono::microseconds(300));
+    histogram.observe(std::chrono::seconds(10));
+
+    std::string out;
+    histogram.write(out, "latency", "route=\"/search\"");
+    EXPECT_NE(out.find("latency_bucket{route=\"/search\",le=\"0.00005\"} 2\n"), std::string::npos);
+    EXPECT_NE(out.find("latency_bucket{route=\"/search\",le=\"0.00025\"} 2\n"), std::string::npos);
+    EXPECT_NE(out.find("latency_bucket{route=\"/search\",le=\"0.0005\"} 3\n"), std::string::npos);
+    EXPECT_NE(out.find("latency_bucket{route=\"/search\",le=\"5\"} 3\n"), std::string::npos);
+    EXPECT_NE(out.find("latency_bucket{route=\"/search\",le=\"+Inf\"} 4\n"), std::string::npos);
+    size_t sum = out.find("latency_sum{route=\"/search\"} ");
+    ASSERT_NE(sum, std::string::npos);
+    EXPECT_NEAR(std::stod(out.substr(out.find(' ', sum) + 1)), 10.00039, 1e-9);
+    EXPECT_NE(out.find("latency_count{route=\"/search\"} 4\n"), std::string::npos);
+}
+
+TEST(MetricsTest, WriterFormatsSamples) {
+    MetricsWriter writer;
+    writer.header("requests_total", "counter", "Requests served.");
+    writer.sample("requests_total", metric_label("index", "a\"b\\c"), 3);
+    writer.sample("ready", "", 1);
+
+    EXPECT_EQ(writer.str(),
+              "# HELP requests_total Requests served.\n"
+              "# TYPE requests_total counter\n"
+              "requests_total{index=\"a\\\"b\\\\c\"} 3\n"
+              "ready 1\n");
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include "query_planner.hpp"
+
+class QueryPlannerTest : public ::testing::Test {
+protected:
+    SearchPlanInputs inputs;
+
+    void SetUp() override {
+        inputs.elementCount = 1000000;
+        inputs.dimension = 128;
+        inputs.maxM0 = 32;
+        inputs.k = 10;
+        inputs.ef = 64;
+        inputs.filtered = true;
+    }
+};
+
+TEST_F(QueryPlannerTest, UnfilteredUsesGraph) {
+    inputs.filtered = false;
+    SearchPlan plan = planSearch(inputs);
+
+    EXPECT_EQ(plan.type, SearchPlanType::Graph);
+    EXPECT_EQ(plan.ef, 64);
+}
+
+TEST_F(QueryPlannerTest, EfIsAtLeastK) {
+    inputs.filtered = false;
+    inputs.k = 100;
+    EXPECT_EQ(planSearch(inputs).ef, 100);
+}
+
+TEST_F(QueryPlannerTest, SelectiveFilterUsesExact) {
+    inputs.selectivity = 0.00001;
+    SearchPlan plan = planSearch(inputs);
+
+    EXPECT_EQ(plan.type, SearchPlanType::Exact);
+    EXPECT_DOUBLE_EQ(plan.selectivity, 0.00001);
+}
+
+TEST_F(QueryPlannerTest, ModerateFilterUsesFilteredGraphWithRaisedEf) {
+    inputs.selectivity = 0.1;
+    SearchPlan plan = planSearch(inputs);
+
+    EXPECT_EQ(plan.type, SearchPlanType::FilteredGraph);
+    EXPECT_EQ(plan.ef, 640);
+}
+
+TEST_F(QueryPlannerTest, BroadFilterChecksCandidatesLazily) {
+    inputs.selectivity = 0.95;
+    EXPECT_EQ(planSearch(inputs).type, SearchPlanType::PredicateGraph);
+}
+
+TEST_F(QueryPlannerTest, CachedBroadFilterUsesFilteredGraph) {
+    inputs.selectivity = 0.95;
+    inputs.filterCached = true;
+    EXPECT_EQ(planSearch(inputs).type, SearchPlanType::FilteredGraph);
+}
+
+TEST_F(QueryPlannerTest, RaisedEfIsCappedAtIndexSize) {
+    inputs.elementCount = 1000;
+    inputs.dimension = 4096;
+    inputs.selectivity = 0.01;
+    SearchPlan plan = planSearch(inputs);
+
+    EXPECT_LE(plan.ef, 1000);
+    EXPECT_GE(plan.ef, 64);
+}
+
+TEST_F(QueryPlannerTest, LargeKFavoursExact) {
+    inputs.selectivity = 0.1;
+    inputs.k = 1000;
+    EXPECT_EQ(planSearch(inputs).type, SearchPlanType::Exact);
+}
+
+TEST(SearchPlanNameTest, NamesEveryPlan) {
+    EXPECT_EQ(searchPlanName(SearchPlanType::Graph), "graph");
+    EXPECT_EQ(searchPlanName(SearchPlanType::Exact), "exact");
+    EXPECT_EQ(searchPlanName(SearchPlanType::FilteredGraph), "filtered_graph");
+    EXPECT_EQ(searchPlanName(SearchPlanType::PredicateGraph), "predicate_graph");
+}
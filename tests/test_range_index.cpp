@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include "range_index.hpp"
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+    std::vector<int> sorted(std::vector<int> ids) {
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+}
+
+TEST(RangeIndexTest, BoundsAreInclusiveOrExclusive) {
+    RangeIndex index;
+    index.insert(10L, 1);
+    index.insert(20L, 2);
+    index.insert(30L, 3);
+
+    EXPECT_EQ(sorted(index.collect(RangeBound{20L, true}, std::nullopt)), std::vector<int>({2, 3}));
+    EXPECT_EQ(sorted(index.collect(RangeBound{20L, false}, std::nullopt)), std::vector<int>({3}));
+    EXPECT_EQ(sorted(index.collect(std::nullopt, RangeBound{20L, true})), std::vector<int>({1, 2}));
+    EXPECT_EQ(sorted(index.collect(RangeBound{10L, false}, RangeBound{30L, false})), std::vector<int>({2}));
+    EXPECT_TRUE(index.collect(RangeBound{30L, false}, RangeBound{10L, false}).empty());
+    EXPECT_EQ(index.estimate(std::nullopt, std::nullopt), 3);
+}
+
+TEST(RangeIndexTest, LongsOrderBeforeDoubles) {
+    RangeIndex index;
+    index.insert(100L, 1);
+    index.insert(0.5, 2);
+
+    EXPECT_EQ(sorted(index.collect(RangeBound{1000L, true}, std::nullopt)), std::vector<int>({2}));
+    EXPECT_EQ(sorted(index.collect(std::nullopt, RangeBound{0.1, true})), std::vector<int>({1}));
+    EXPECT_EQ(sorted(index.collect(RangeBound{0L, true}, RangeBound{1.0, true})), std::vector<int>({1, 2}));
+    EXPECT_TRUE(index.collect(RangeBound{1.0, true}, RangeBound{1000L, true}).empty());
+}
+
+TEST(RangeIndexTest, BufferedChangesMatchAfterMerging) {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<long> values(0, 999);
+    std::uniform_int_distribution<int> ids(0, 4999);
+
+    RangeIndex index;
+    std::map<int, long> expected;
+    for (int i = 0; i < 20000; i++) {
+        int id = ids(rng);
+        auto it = expected.find(id);
+        if (it != expected.end()) {
+            index.remove(it->second, id);
+            expected.erase(it);
+        }
+        if (i % 4 != 0) {
+            long value = values(rng);
+            index.insert(value, id);
+            expected[id] = value;
+        }
+
+        if (i % 2500 == 0) {
+            std::vector<int> matching;
+            for (const auto& [expectedId, value] : expected) {
+                if (value >= 250 && value < 750) {
+                    matching.push_back(expectedId);
+                }
+            }
+            EXPECT_EQ(sorted(index.collect(RangeBound{250L, true}, RangeBound{750L, false})), matching);
+            EXPECT_EQ(index.size(), expected.size());
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include "request_coalescer.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+struct CountTask {
+    int input = 0;
+    int output = 0;
+    size_t groupSize = 0;
+};
+
+TEST(RequestCoalescerTest, SingleTaskRunsAfterWindow) {
+    RequestCoalescer<CountTask> coalescer;
+    CountTask task{3};
+
+    coalescer.run(task, 100us, 8, [](std::vector<CountTask*>& group) {
+        for (auto* member : group) {
+            member->output = member->input * 2;
+            member->groupSize = group.size();
+        }
+    });
+
+    EXPECT_EQ(task.output, 6);
+    EXPECT_EQ(task.groupSize, 1);
+}
+
+TEST(RequestCoalescerTest, ConcurrentTasksShareOneGroup) {
+    RequestCoalescer<CountTask> coalescer;
+    std::atomic<int> executions{0};
+    const size_t numThreads = 8;
+    std::vector<CountTask> tasks(numThreads);
+    std::vector<std::thread> threads;
+
+    // The window is far longer than the test, so the group only runs once it is full
+    for (size_t i = 0; i < numThreads; i++) {
+        tasks[i].input = static_cast<int>(i);
+        threads.emplace_back([&, i] {
+            coalescer.run(tasks[i], 60s, numThreads, [&](std::vector<CountTask*>& group) {
+                executions++;
+                for (auto* member : group) {
+                    member->output = member->input + 100;
+                    member->groupSize = group.size();
+                }
+            });
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(executions.load(), 1);
+    for (size_t i = 0; i < numThreads; i++) {
+        EXPECT_EQ(tasks[i].output, static_cast<int>(i) + 100);
+        EXPECT_EQ(tasks[i].groupSize, numThreads);
+    }
+}
+
+TEST(RequestCoalescerTest, ExceptionReachesEveryCaller) {
+    RequestCoalescer<CountTask> coalescer;
+    std::atomic<int> failures{0};
+    std::vector<CountTask> tasks(2);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+        threads.emplace_back([&, i] {
+            try {
+                coalescer.run(tasks[i], 60s, tasks.size(), [](std::vector<CountTask*>&) {
+                    throw std::runtime_error("failed");
+                });
+            } catch (const std::runtime_error&) {
+                failures++;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(failures.load(), 2);
+}
+
+TEST(RequestCoalescerTest, LaterTasksFormNewGroups) {
+    RequestCoalescer<CountTask> coalescer;
+    auto execute = [](std::vector<CountTask*>& group) {
+        for (auto* member : group) {
+            member->groupSize = group.size();
+        }
+    };
+
+    CountTask first;
+    CountTask second;
+    coalescer.run(first, 10us, 8, execute);
+    coalescer.run(second, 10us, 8, execute);
+
+    EXPECT_EQ(first.groupSize, 1);
+    EXPECT_EQ(second.groupSize, 1);
+}
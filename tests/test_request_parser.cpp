@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include "request_parser.hpp"
+#include <string>
+#include <vector>
+
+TEST(RequestParserTest, AddDocumentsPacksVectorsAndReadsMetadata) {
+    AddDocumentsRequest request;
+    parse_json_request(R"({
+        "vectors": [[1, 2.5, -3], [4, 5, 6e-1]],
+        "indexName": "docs",
+        "ignored": {"nested": [1, [2]]},
+        "ids": [7, 8],
+        "metadatas": [{"name": "Mary Ann", "age": 32, "score": 0.5}, null],
+        "numThreads": 2
+    })", request);
+
+    EXPECT_EQ(request.indexName, "docs");
+    EXPECT_EQ(request.ids, std::vector<int>({7, 8}));
+    EXPECT_EQ(request.numThreads, 2);
+    ASSERT_EQ(request.numVectors(), 2);
+    EXPECT_EQ(request.dimensionAt(1), 3);
+    EXPECT_EQ(std::vector<float>(request.vectorAt(0), request.vectorAt(0) + 6),
+              std::vector<float>({1.0f, 2.5f, -3.0f, 4.0f, 5.0f, 0.6f}));
+
+    ASSERT_EQ(request.metadatas.size(), 2);
+    EXPECT_EQ(std::get<std::string>(request.metadatas[0].at("name")), "Mary Ann");
+    EXPECT_EQ(std::get<long>(request.metadatas[0].at("age")), 32L);
+    EXPECT_EQ(std::get<double>(request.metadatas[0].at("score")), 0.5);
+    EXPECT_TRUE(request.metadatas[1].empty());
+}
+
+TEST(RequestParserTest, BinaryEncodingRoundTrips) {
+    nlohmann::json header = {{"indexName", "docs"}, {"ids", {3, 4}}, {"metadatas", {{{"name", "x"}}, nlohmann::json::object()}}};
+    std::vector<float> vectors = {1.0f, -2.0f, 0.25f, 8.0f, 9.5f, -0.5f};
+    std::string body = encode_binary_vectors(header, vectors.data(), 2, 3);
+
+    auto request = parse_request<AddDocumentsRequest>(body, BINARY_VECTORS_CONTENT_TYPE);
+    EXPECT_EQ(request.indexName, "docs");
+    EXPECT_EQ(request.ids, std::vector<int>({3, 4}));
+    ASSERT_EQ(request.numVectors(), 2);
+    EXPECT_EQ(request.dimensionAt(0), 3);
+    EXPECT_EQ(std::vector<float>(request.vectorAt(0), request.vectorAt(0) + 6), vectors);
+    EXPECT_EQ(std::get<std::string>(request.metadatas[0].at("name")), "x");
+}
+
+TEST(RequestParserTest, AddDocumentsRejectsMalformedInput) {
+    auto parse = [](const std::string& body) {
+        AddDocumentsRequest request;
+        parse_json_request(body, request);
+    };
+
+    EXPECT_THROW(parse(R"({"indexName": "docs", "ids": [1], "vectors": [[1, 2])"), std::invalid_argument);
+    EXPECT_THROW(parse(R"([1, 2])"), std::invalid_argument);
+    EXPECT_THROW(parse(R"({"indexName": "docs", "ids": [1]})"), std::invalid_argument);
+    EXPECT_THROW(parse(R"({"indexName": "docs", "ids": ["1"], "vectors": [[1]]})"), std::invalid_argument);
+    EXPECT_THROW(parse(R"({"indexName": "docs", "ids": [1, 2], "vectors": [[1, 2], [3]]})"), std::invalid_argument);
+    EXPECT_THROW(parse(R"({"indexName": "docs", "ids": [1], "vectors": [[1]], "metadatas": [{"a": [1]}]})"), std::invalid_argument);
+    EXPECT_THROW(parse(R"({"indexName": "docs", "ids": [1], "vectors": [[1]], "metadatas": [{"a": true}]})"), std::invalid_argument);
+    EXPECT_THROW(parse(R"({"indexName": 5, "ids": [1], "vectors": [[1]]})"), std::invalid_argument);
+    EXPECT_THROW(parse(R"({"indexName": "docs", "ids": [4294967296], "vectors": [[1]]})"), std::invalid_argument);
+}
+
+TEST(RequestParserTest, SearchReadsOptions) {
+    SearchRequest request;
+    parse_json_request(R"({"indexName": "docs", "queryVector": [0.5, 1], "k": 3, "filter": "name = \"Mary Ann\"", "returnMetadata": true})", request);
+
+    EXPECT_EQ(request.indexName, "docs");
+    EXPECT_EQ(request.queryVector, std::vector<float>({0.5f, 1.0f}));
+    EXPECT_EQ(request.k, 3);
+    EXPECT_EQ(request.efSearch, 512);
+    EXPECT_EQ(request.filter, "name = \"Mary Ann\"");
+    EXPECT_TRUE(request.returnMetadata);
+    EXPECT_FALSE(request.debug);
+
+    SearchRequest missingK;
+    EXPECT_THROW(parse_json_request(R"({"indexName": "docs", "queryVector": [1]})", missingK), std::invalid_argument);
+    SearchRequest badFlag;
+    EXPECT_THROW(parse_json_request(R"({"indexName": "docs", "queryVector": [1], "k": 1, "debug": 1})", badFlag), std::invalid_argument);
+
+    SearchRequest withFacets;
+    parse_json_request(R"({"indexName": "docs", "facets": ["colour", "price"], "queryVector": [1], "k": 1})", withFacets);
+    EXPECT_EQ(withFacets.facets, std::vector<std::string>({"colour", "price"}));
+    SearchRequest badFacets;
+    EXPECT_THROW(parse_json_request(R"({"indexName": "docs", "queryVector": [1], "k": 1, "facets": "colour"})", badFacets), std::invalid_argument);
+}
+
+TEST(RequestParserTest, SearchBatchQueriesFallBackToTopLevelOptions) {
+    SearchBatchRequest request;
+    // The defaults come after the queries that use them
+    parse_json_request(R"({
+        "indexName": "docs",
+        "queries": [{"queryVector": [1, 2], "k": 2}, {"filter": "a = 1", "queryVector": [3, 4]}],
+        "k": 5,
+        "filter": "b = 2"
+    })", request);
+
+    ASSERT_EQ(request.queries.size(), 2);
+    EXPECT_EQ(request.queries[0].queryVector, std::vector<float>({1.0f, 2.0f}));
+    EXPECT_EQ(request.queries[0].k, 2);
+    EXPECT_EQ(request.queries[0].filter, "b = 2");
+    EXPECT_EQ(request.queries[1].queryVector, std::vector<float>({3.0f, 4.0f}));
+    EXPECT_EQ(request.queries[1].k, 5);
+    EXPECT_EQ(request.queries[1].filter, "a = 1");
+
+    SearchBatchRequest missingVector;
+    EXPECT_THROW(parse_json_request(R"({"indexName": "docs", "queries": [{"k": 1}]})", missingVector), std::invalid_argument);
+}
+
+TEST(RequestParserTest, DeleteDocumentsReadsIds) {
+    DeleteDocumentsRequest request;
+    parse_json_request(R"({"indexName": "docs", "ids": [3, 1]})", request);
+    EXPECT_EQ(request.indexName, "docs");
+    EXPECT_EQ(request.ids, std::vector<int>({3, 1}));
+
+    DeleteDocumentsRequest truncated;
+    EXPECT_THROW(parse_json_request(R"({"indexName": "docs", "ids": [3,)", truncated), std::invalid_argument);
+}
+
+TEST(RequestParserTest, DocumentHelpersReportErrorsAsInvalidArgument) {
+    EXPECT_THROW(parse_json_body("{\"indexName\": "), std::invalid_argument);
+    auto data = parse_json_body(R"({"indexName": "docs", "async": "yes"})");
+    EXPECT_EQ(json_get<std::string>(data, "indexName"), "docs");
+    EXPECT_THROW(json_get<bool>(data, "async"), std::invalid_argument);
+    EXPECT_THROW(json_get<std::string>(data, "missing"), std::invalid_argument);
+    EXPECT_THROW(json_get<IndexRequest>(data), std::invalid_argument);
+}
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include "snapshot_writer.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+class SnapshotWriterTest : public ::testing::Test {
+protected:
+    std::string path = "snapshot_writer_test.bin";
+    SnapshotFileState state;
+    SnapshotProgress progress;
+
+    void SetUp() override {
+        std::filesystem::remove(path);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(path);
+        std::filesystem::remove(path + ".tmp");
+    }
+
+    std::string readFile() {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    void write(const std::string& head, const std::vector<char>& body, const std::string& tail) {
+        progress.reset(head.size() + body.size() + tail.size());
+        write_snapshot_file(path, head, body.data(), body.size(), tail, state, progress);
+    }
+};
+
+TEST_F(SnapshotWriterTest, FirstWriteIsFull) {
+    std::vector<char> body(3 * SNAPSHOT_BLOCK_SIZE + 100, 'b');
+    write("head", body, "tail");
+
+    EXPECT_EQ(readFile(), "head" + std::string(body.begin(), body.end()) + "tail");
+    EXPECT_EQ(progress.bytesWritten, progress.bytesTotal);
+    EXPECT_EQ(progress.bytesProcessed, progress.bytesTotal);
+    EXPECT_FALSE(std::filesystem::exists(path + ".tmp"));
+}
+
+TEST_F(SnapshotWriterTest, OnlyChangedBlocksAreRewritten) {
+    std::vector<char> body(4 * SNAPSHOT_BLOCK_SIZE, 'a');
+    write("head", body, "tail");
+
+    body[SNAPSHOT_BLOCK_SIZE + 10] = 'x';
+    body.resize(body.size() + 50, 'c');
+    write("HEAD", body, "end");
+
+    EXPECT_EQ(readFile(), "HEAD" + std::string(body.begin(), body.end()) + "end");
+    EXPECT_EQ(progress.bytesProcessed, progress.bytesTotal);
+    // The head, the changed block, the new partial block, the tail and the copy of the previous
+    // file, if it could not be cloned
+    EXPECT_EQ(progress.bytesWritten, 4 + SNAPSHOT_BLOCK_SIZE + 50 + 3 + progress.bytesCopied);
+}
+
+TEST_F(SnapshotWriterTest, ShrinkingBodyTruncatesFile) {
+    std::vector<char> body(3 * SNAPSHOT_BLOCK_SIZE, 'a');
+    write("head", body, "a long tail");
+
+    body.resize(SNAPSHOT_BLOCK_SIZE);
+    write("head", body, "");
+
+    EXPECT_EQ(readFile(), "head" + std::string(body.begin(), body.end()));
+    EXPECT_EQ(progress.bytesWritten, 4 + progress.bytesCopied);
+}
+
+TEST_F(SnapshotWriterTest, PatchOverlaysPrefixesAndDirtyRecords) {
+    const size_t recordLength = 1000;
+    std::vector<char> body(200 * recordLength, 'a');
+    write("head", body, "tail");
+
+    RecordPatch patch;
+    patch.recordCount = 201;
+    patch.recordLength = recordLength;
+    patch.prefixLength = 10;
+    patch.prefixes.assign(patch.recordCount * patch.prefixLength, 'a');
+    patch.prefixes[150 * patch.prefixLength] = 'p';
+    patch.ids = {7, 200};
+    patch.records.assign(2 * recordLength, 'r');
+
+    body.resize(patch.bodyLength(), 'a');
+    body[150 * recordLength] = 'p';
+    std::fill(body.begin() + 7 * recordLength, body.begin() + 8 * recordLength, 'r');
+    std::fill(body.begin() + 200 * recordLength, body.end(), 'r');
+
+    progress.reset(4 + patch.bodyLength() + 3);
+    patch_snapshot_file(path, "HEAD", patch, "end", state, progress);
+
+    EXPECT_EQ(readFile(), "HEAD" + std::string(body.begin(), body.end()) + "end");
+    EXPECT_EQ(progress.bytesProcessed, progress.bytesTotal);
+    // The head, the blocks holding records 7, 150 and 200 and the tail
+    EXPECT_EQ(progress.bytesWritten, 4 + 2 * SNAPSHOT_BLOCK_SIZE + (patch.bodyLength() - 3 * SNAPSHOT_BLOCK_SIZE) + 3
+                                         + progress.bytesCopied);
+}
+
+TEST_F(SnapshotWriterTest, PatchNeedsPreviousFile) {
+    RecordPatch patch;
+    EXPECT_THROW(patch_snapshot_file(path, "head", patch, "", state, progress), std::runtime_error);
+    EXPECT_FALSE(std::filesystem::exists(path));
+}
+
+TEST_F(SnapshotWriterTest, HeadLengthChangeRewritesEverything) {
+    std::vector<char> body(2 * SNAPSHOT_BLOCK_SIZE, 'a');
+    write("head", body, "");
+    write("longer head", body, "");
+
+    EXPECT_EQ(readFile(), "longer head" + std::string(body.begin(), body.end()));
+    EXPECT_EQ(progress.bytesWritten, progress.bytesTotal);
+}
+
+TEST_F(SnapshotWriterTest, WriteFileAtomicallyReplacesContents) {
+    write_file_atomically(path, "first version", progress);
+    write_file_atomically(path, "second", progress);
+
+    EXPECT_EQ(readFile(), "second");
+    EXPECT_FALSE(std::filesystem::exists(path + ".tmp"));
+}
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include "sq8_space.hpp"
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <vector>
+
+class SQ8SpaceTest : public ::testing::Test {
+protected:
+    static constexpr size_t dimension = 37; // not a multiple of the SIMD width
+    std::vector<float> vectors;
+
+    void SetUp() override {
+        std::mt19937 generator(7);
+        std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+        vectors.resize(100 * dimension);
+        for (auto& value : vectors) {
+            value = uniform(generator);
+        }
+    }
+
+    std::vector<char> encode(const SQ8Space& space, const float* vector) {
+        std::vector<char> code(dimension + sizeof(float));
+        space.encode(vector, code.data());
+        return code;
+    }
+};
+
+TEST(SQ8KernelTest, MatchesScalar) {
+    std::vector<int8_t> a(53), b(53);
+    for (size_t i = 0; i < a.size(); i++) {
+        a[i] = static_cast<int8_t>(static_cast<int>(i * 7) % 255 - 127);
+        b[i] = static_cast<int8_t>(127 - static_cast<int>(i * 13) % 255);
+    }
+
+    int32_t dot = 0, l2 = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        dot += a[i] * b[i];
+        l2 += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    EXPECT_EQ(sq8_dot(a.data(), b.data(), a.size()), dot);
+    EXPECT_EQ(sq8_l2(a.data(), b.data(), a.size()), l2);
+}
+
+TEST_F(SQ8SpaceTest, RoundTripWithinHalfAStep) {
+    SQ8Space space(dimension, false);
+    EXPECT_FALSE(space.trained());
+    space.train(vectors.data(), 100);
+    EXPECT_TRUE(space.trained());
+    EXPECT_EQ(space.get_data_size(), dimension + sizeof(float));
+
+    std::vector<float> decoded(dimension);
+    for (size_t i = 0; i < 100; i++) {
+        auto code = encode(space, &vectors[i * dimension]);
+        space.decode(code.data(), decoded.data());
+        for (size_t d = 0; d < dimension; d++) {
+            EXPECT_NEAR(decoded[d], vectors[i * dimension + d], space.params().scale / 2 + 1e-6f);
+        }
+    }
+}
+
+TEST_F(SQ8SpaceTest, L2DistanceApproximatesFloat) {
+    SQ8Space space(dimension, false);
+    space.train(vectors.data(), 100);
+    auto distance = space.get_dist_func();
+
+    for (size_t i = 1; i < 100; i++) {
+        float expected = 0.0f;
+        for (size_t d = 0; d < dimension; d++) {
+            float diff = vectors[d] - vectors[i * dimension + d];
+            expected += diff * diff;
+        }
+        auto a = encode(space, &vectors[0]);
+        auto b = encode(space, &vectors[i * dimension]);
+        EXPECT_NEAR(distance(a.data(), b.data(), space.get_dist_func_param()), expected, 0.05f * expected + 0.01f);
+    }
+}
+
+TEST_F(SQ8SpaceTest, InnerProductDistanceApproximatesFloat) {
+    // Offset every vector so the centers matter
+    for (auto& value : vectors) {
+        value += 3.0f;
+    }
+    SQ8Space space(dimension, true);
+    space.train(vectors.data(), 100);
+    auto distance = space.get_dist_func();
+
+    for (size_t i = 1; i < 100; i++) {
+        float dot = 0.0f;
+        for (size_t d = 0; d < dimension; d++) {
+            dot += vectors[d] * vectors[i * dimension + d];
+        }
+        auto a = encode(space, &vectors[0]);
+        auto b = encode(space, &vectors[i * dimension]);
+        EXPECT_NEAR(distance(a.data(), b.data(), space.get_dist_func_param()), 1.0f - dot, 0.01f * std::abs(dot) + 0.05f);
+    }
+}
+
+TEST_F(SQ8SpaceTest, ClampsOutOfRangeValues) {
+    SQ8Space space(dimension, false);
+    space.train(vectors.data(), 100);
+
+    std::vector<float> outlier(dimension, 1000.0f);
+    auto code = encode(space, outlier.data());
+    for (size_t d = 0; d < dimension; d++) {
+        EXPECT_EQ(static_cast<int8_t>(code[d]), SQ8_MAX_CODE);
+    }
+}
+
+TEST_F(SQ8SpaceTest, SaveAndLoad) {
+    SQ8Space space(dimension, true);
+    space.train(vectors.data(), 100);
+    std::stringstream stream;
+    space.save(stream);
+
+    SQ8Space loaded(dimension, true);
+    loaded.load(stream);
+    EXPECT_TRUE(loaded.trained());
+    EXPECT_EQ(encode(space, &vectors[dimension]), encode(loaded, &vectors[dimension]));
+    EXPECT_FLOAT_EQ(loaded.params().centerNorm, space.params().centerNorm);
+
+    std::stringstream again;
+    space.save(again);
+    SQ8Space wrongDimension(dimension + 1, true);
+    EXPECT_THROW(wrongDimension.load(again), std::runtime_error);
+}
+
+TEST_F(SQ8SpaceTest, FewVectorsTrainProvisionally) {
+    SQ8Space space(dimension, false);
+    EXPECT_FALSE(space.trained());
+    space.train(vectors.data(), 1);
+    EXPECT_TRUE(space.trained());
+    EXPECT_TRUE(space.provisional());
+
+    std::stringstream stream;
+    space.save(stream);
+    SQ8Space loaded(dimension, false);
+    loaded.load(stream);
+    EXPECT_TRUE(loaded.trained());
+    EXPECT_TRUE(loaded.provisional());
+
+    std::vector<float> many;
+    for (size_t i = 0; i < SQ8_MIN_TRAINING_VECTORS; i++) {
+        many.insert(many.end(), &vectors[(i % 100) * dimension], &vectors[(i % 100 + 1) * dimension]);
+    }
+    space.train(many.data(), SQ8_MIN_TRAINING_VECTORS);
+    EXPECT_FALSE(space.provisional());
+}
@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+#include "thread_pool.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+TEST(ThreadPoolTest, ParallelForVisitsEveryIndexOnce) {
+    ThreadPool pool(4);
+    std::vector<std::atomic<int>> visits(1000);
+
+    pool.parallelFor(visits.size(), [&](size_t i) {
+        visits[i]++;
+    });
+
+    for (const auto& count : visits) {
+        EXPECT_EQ(count.load(), 1);
+    }
+}
+
+TEST(ThreadPoolTest, NestedParallelForCompletes) {
+    ThreadPool pool(2);
+    std::atomic<int> total{0};
+
+    pool.parallelFor(8, [&](size_t) {
+        pool.parallelFor(8, [&](size_t) {
+            total++;
+        });
+    });
+
+    EXPECT_EQ(total.load(), 64);
+}
+
+TEST(ThreadPoolTest, ParallelForRethrowsExceptions) {
+    ThreadPool pool(4);
+    EXPECT_THROW(pool.parallelFor(100, [](size_t i) {
+        if (i == 42) throw std::runtime_error("boom");
+    }), std::runtime_error);
+}
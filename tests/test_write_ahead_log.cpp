@@ -0,0 +1,211 @@
+#include <gtest/gtest.h>
+#include "write_ahead_log.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+class WriteAheadLogTest : public ::testing::Test {
+protected:
+    std::string path = "write_ahead_log_test.wal";
+    WalOptions options;
+
+    void SetUp() override {
+        std::filesystem::remove(path);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(path);
+    }
+
+    std::vector<WalRecord> replayAll(uint64_t afterSequence = 0) {
+        std::vector<WalRecord> records;
+        WriteAheadLog::replay(path, afterSequence, [&records](const WalRecord& record) {
+            records.push_back(record);
+        });
+        return records;
+    }
+};
+
+TEST_F(WriteAheadLogTest, ReplaysAddsAndDeletesInOrder) {
+    std::vector<float> first = {1.0f, 2.0f};
+    std::vector<float> second = {3.0f, 4.0f};
+    {
+        WriteAheadLog log(path, options, 0);
+        EXPECT_EQ(log.appendAdd({7, 8}, 2, {first.data(), second.data()},
+                                {{{"name", std::string("Jack")}, {"age", 32L}}, {{"score", 0.5}}}), 1);
+        EXPECT_EQ(log.appendDelete({7}), 2);
+    }
+
+    auto records = replayAll();
+    ASSERT_EQ(records.size(), 2);
+
+    EXPECT_EQ(records[0].type, WalRecord::Type::AddDocuments);
+    EXPECT_EQ(records[0].sequence, 1);
+    EXPECT_EQ(records[0].ids, std::vector<int>({7, 8}));
+    EXPECT_EQ(records[0].dimension, 2);
+    EXPECT_EQ(records[0].vectors, std::vector<float>({1.0f, 2.0f, 3.0f, 4.0f}));
+    ASSERT_EQ(records[0].metadatas.size(), 2);
+    EXPECT_EQ(std::get<std::string>(records[0].metadatas[0].at("name")), "Jack");
+    EXPECT_EQ(std::get<long>(records[0].metadatas[0].at("age")), 32L);
+    EXPECT_EQ(std::get<double>(records[0].metadatas[1].at("score")), 0.5);
+
+    EXPECT_EQ(records[1].type, WalRecord::Type::DeleteDocuments);
+    EXPECT_EQ(records[1].sequence, 2);
+    EXPECT_EQ(records[1].ids, std::vector<int>({7}));
+}
+
+TEST_F(WriteAheadLogTest, SkipsRecordsAlreadyInSnapshot) {
+    {
+        WriteAheadLog log(path, options, 0);
+        log.appendDelete({1});
+        log.appendDelete({2});
+        log.appendDelete({3});
+    }
+
+    auto records = replayAll(2);
+    ASSERT_EQ(records.size(), 1);
+    EXPECT_EQ(records[0].ids, std::vector<int>({3}));
+    EXPECT_EQ(WriteAheadLog::replay(path, 5, [](const WalRecord&) {}), 5);
+}
+
+TEST_F(WriteAheadLogTest, TornTailIsDroppedAndCut) {
+    {
+        WriteAheadLog log(path, options, 0);
+        log.appendDelete({1});
+        log.appendDelete({2});
+    }
+    auto intactSize = std::filesystem::file_size(path);
+    {
+        WriteAheadLog log(path, options, 2);
+        log.appendDelete({3, 4, 5});
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+
+    auto records = replayAll();
+    ASSERT_EQ(records.size(), 2);
+    EXPECT_EQ(std::filesystem::file_size(path), intactSize);
+
+    // Appends after the replay land right after the last intact record
+    {
+        WriteAheadLog log(path, options, 2);
+        EXPECT_EQ(log.appendDelete({6}), 3);
+    }
+    records = replayAll();
+    ASSERT_EQ(records.size(), 3);
+    EXPECT_EQ(records[2].ids, std::vector<int>({6}));
+}
+
+TEST_F(WriteAheadLogTest, RotateRetiresRecordsAndKeepsNumbering) {
+    std::string retired = path + ".1";
+    {
+        WriteAheadLog log(path, options, 0);
+        log.appendDelete({1});
+        EXPECT_TRUE(log.rotate(retired));
+        EXPECT_EQ(std::filesystem::file_size(path), 0);
+        EXPECT_FALSE(log.rotate(path + ".2"));
+        EXPECT_EQ(log.appendDelete({2}), 2);
+    }
+
+    std::vector<WalRecord> records;
+    WriteAheadLog::replay(retired, 0, [&records](const WalRecord& record) { records.push_back(record); });
+    ASSERT_EQ(records.size(), 1);
+    EXPECT_EQ(records[0].ids, std::vector<int>({1}));
+
+    records = replayAll(1);
+    ASSERT_EQ(records.size(), 1);
+    EXPECT_EQ(records[0].sequence, 2);
+    EXPECT_FALSE(std::filesystem::exists(path + ".2"));
+    std::filesystem::remove(retired);
+}
+
+TEST_F(WriteAheadLogTest, ConcurrentAppendsAreAllLogged) {
+    const int numThreads = 8;
+    const int appendsPerThread = 50;
+    {
+        WriteAheadLog log(path, options, 0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; t++) {
+            threads.emplace_back([&log, t] {
+                for (int i = 0; i < appendsPerThread; i++) {
+                    log.appendDelete({t * appendsPerThread + i});
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_EQ(log.lastSequence(), numThreads * appendsPerThread);
+    }
+
+    auto records = replayAll();
+    ASSERT_EQ(records.size(), numThreads * appendsPerThread);
+    std::vector<bool> seen(numThreads * appendsPerThread, false);
+    for (size_t i = 0; i < records.size(); i++) {
+        EXPECT_EQ(records[i].sequence, i + 1);
+        seen[records[i].ids[0]] = true;
+    }
+    EXPECT_EQ(std::count(seen.begin(), seen.end(), true), numThreads * appendsPerThread);
+}
+
+TEST_F(WriteAheadLogTest, StreamReturnsRecordsAfterSequence) {
+    options.streamBufferBytes = 1 << 20;
+    std::vector<float> vector = {1.0f, 2.0f};
+    WriteAheadLog log(path, options, 0);
+    log.appendAdd({7}, 2, {vector.data()}, {{{"name", std::string("Jack")}}});
+    log.appendDelete({8});
+    log.appendDelete({9});
+
+    std::string frames;
+    uint64_t logSequence = 0;
+    ASSERT_TRUE(log.readStream(1, 1 << 20, frames, logSequence));
+    EXPECT_EQ(logSequence, 3);
+
+    std::vector<WalRecord> records;
+    EXPECT_EQ(WriteAheadLog::decodeStream(frames, [&records](const WalRecord& record) { records.push_back(record); }), 3);
+    ASSERT_EQ(records.size(), 2);
+    EXPECT_EQ(records[0].sequence, 2);
+    EXPECT_EQ(records[0].ids, std::vector<int>({8}));
+    EXPECT_EQ(records[1].ids, std::vector<int>({9}));
+
+    // The frames are the bytes of the log file
+    frames.clear();
+    ASSERT_TRUE(log.readStream(0, 1 << 20, frames, logSequence));
+    EXPECT_EQ(frames.size(), std::filesystem::file_size(path));
+    records.clear();
+    WriteAheadLog::decodeStream(frames, [&records](const WalRecord& record) { records.push_back(record); });
+    ASSERT_EQ(records.size(), 3);
+    EXPECT_EQ(records[0].vectors, vector);
+    EXPECT_EQ(std::get<std::string>(records[0].metadatas[0].at("name")), "Jack");
+
+    // A reader that is up to date gets nothing, one claiming to be ahead has to start over
+    frames.clear();
+    EXPECT_TRUE(log.readStream(3, 1 << 20, frames, logSequence));
+    EXPECT_TRUE(frames.empty());
+    EXPECT_FALSE(log.readStream(4, 1 << 20, frames, logSequence));
+}
+
+TEST_F(WriteAheadLogTest, StreamBufferIsBoundedAndReadInChunks) {
+    options.streamBufferBytes = 200;
+    WriteAheadLog log(path, options, 0);
+    for (int i = 0; i < 20; i++) {
+        log.appendDelete({i});
+    }
+
+    // Each record is 20 bytes of frame header and 9 of body, so the buffer keeps the last 6
+    std::string frames;
+    uint64_t logSequence = 0;
+    EXPECT_FALSE(log.readStream(10, 1 << 20, frames, logSequence));
+    EXPECT_TRUE(log.readStream(14, 1 << 20, frames, logSequence));
+    EXPECT_EQ(WriteAheadLog::decodeStream(frames, [](const WalRecord&) {}), 20);
+
+    frames.clear();
+    ASSERT_TRUE(log.readStream(14, 60, frames, logSequence));
+    EXPECT_EQ(WriteAheadLog::decodeStream(frames, [](const WalRecord&) {}), 16);
+    EXPECT_EQ(logSequence, 20);
+
+    frames[frames.size() - 1] ^= 1;
+    EXPECT_THROW(WriteAheadLog::decodeStream(frames, [](const WalRecord&) {}), std::runtime_error);
+    EXPECT_THROW(WriteAheadLog::decodeStream(frames.substr(0, 30), [](const WalRecord&) {}), std::runtime_error);
+}